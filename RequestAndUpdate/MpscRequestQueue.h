@@ -0,0 +1,365 @@
+/*
+ * Copyright (c) 2013, nilfs
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * * Neither the name of the <ORGANIZATION> nor the names of its contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __RequestAndUpdate__MpscRequestQueue__
+#define __RequestAndUpdate__MpscRequestQueue__
+
+#include <atomic>
+#include <vector>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <cstddef>
+#include <cstdint>
+
+/**
+ *  複数スレッドから追加して、1スレッドでまとめて取り出すロックフリーのキュー
+ *
+ *  要素は固定長のセグメントに詰める。追加するスレッドはスレッドごとに決まるストライプの
+ *  セグメントに fetch_add で場所を取って書き込むだけなので、ロックもメモリ確保もしない
+ *  セグメントが埋まったら予備のセグメントに差し替えて、埋まった方の次として差し替えたセグメントをつなぐ
+ *
+ *  PopAllは各ストライプの書き込み先を新しいセグメントに差し替えてから、差し替える前に読み込んだスレッドが
+ *  書き終わるのを待つ(2面のカウンタを切り替えるエポック方式)。その後、前回差し替えたセグメントから
+ *  今回外したセグメントまでを、つないだ順にたどって取り出す。同じスレッドから追加した分は追加した順に並ぶ
+ *  取り出したセグメントはPopAll側で使い回して次の予備にするので、定常状態ではメモリ確保が起きない
+ *
+ *  PopAllを同時に呼べるのは1スレッドだけ
+ */
+template< typename T >
+class MpscRequestQueue
+{
+private:
+    static const size_t SEGMENT_SIZE = 256;
+    static const size_t STRIPE_COUNT = 8;
+
+    struct Segment
+    {
+        Segment()
+        :reserved(0)
+        ,successor(nullptr)
+        ,next(nullptr)
+        {}
+
+        T* GetSlot( size_t index ){ return reinterpret_cast<T*>( &slots[index] ); }
+
+        std::atomic<size_t> reserved;   // 確保済みの数。SEGMENT_SIZE以上なら埋まっている
+        Segment* successor;             // 埋まって差し替えたときに、次に書き込み先になったセグメント
+        Segment* next;                  // 使わなかったセグメントのリストと空きリストのつなぎ
+        typename std::aligned_storage<sizeof(T), std::alignment_of<T>::value>::type slots[SEGMENT_SIZE];
+    };
+
+    // 追加するスレッドが触る部分。ストライプ同士で同じキャッシュラインに乗らないようにする
+    // キューごと new されることがあるので alignas は使わず、埋め草で離す
+    struct Stripe
+    {
+        Stripe()
+        :active(nullptr)
+        ,spare(nullptr)
+        ,first(nullptr)
+        {
+            writers[0] = 0;
+            writers[1] = 0;
+        }
+
+        std::atomic<Segment*> active;       // 書き込み中のセグメント。最初に追加されるまではない
+        std::atomic<Segment*> spare;        // 差し替え用の予備。PopAllが補充する
+        std::atomic<Segment*> first;        // 最初に書き込み先になったセグメント。PopAllがまだたどっていなければここから
+        std::atomic<unsigned int> writers[2];// エポックごとの書き込み中のスレッド数
+        char padding[64];
+    };
+
+public:
+    MpscRequestQueue()
+    :m_Unused(nullptr)
+    ,m_Epoch(0)
+    ,m_FreeList(nullptr)
+    {
+        for( Segment*& oldest : m_Oldest )
+        {
+            oldest = nullptr;
+        }
+    }
+
+    // 追加中のスレッドがいないときに破棄すること
+    ~MpscRequestQueue()
+    {
+        std::vector<T> rest;
+        PopAll( rest );
+
+        // 取り出した後は、どのストライプもPopAllが差し替えた空のセグメントだけが書き込み先に残っている
+        for( Stripe& stripe : m_Stripes )
+        {
+            delete stripe.spare.exchange( nullptr );
+            delete stripe.active.exchange( nullptr );
+        }
+        _RecycleUnused();
+        while( m_FreeList )
+        {
+            Segment* next = m_FreeList->next;
+            delete m_FreeList;
+            m_FreeList = next;
+        }
+    }
+
+private:
+    MpscRequestQueue( const MpscRequestQueue& ) = delete;
+    MpscRequestQueue& operator=( const MpscRequestQueue& ) = delete;
+
+public:
+    template< typename ...Args >
+    void Push( Args&&... args )
+    {
+        Stripe& stripe = m_Stripes[ _GetStripeIndex() ];
+        const unsigned int epoch = _Enter( stripe );
+
+        for(;;)
+        {
+            Segment* segment = stripe.active.load( std::memory_order_acquire );
+            if( segment )
+            {
+                const size_t index = segment->reserved.fetch_add( 1, std::memory_order_relaxed );
+                if( index < SEGMENT_SIZE )
+                {
+                    new (segment->GetSlot(index)) T( std::forward<Args>(args)... );
+                    break;
+                }
+            }
+
+            // 埋まっているか、まだないので差し替える
+            Segment* fresh = stripe.spare.exchange( nullptr, std::memory_order_acquire );
+            if( !fresh )
+            {
+                fresh = new Segment();
+            }
+            if( stripe.active.compare_exchange_strong( segment, fresh, std::memory_order_acq_rel ) )
+            {
+                // 埋まった方の次としてつなぐ。PopAllは差し替える前に入ったスレッドを待ってからたどる
+                if( segment )
+                {
+                    segment->successor = fresh;
+                }
+                else
+                {
+                    stripe.first.store( fresh, std::memory_order_release );
+                }
+            }
+            else
+            {
+                // 他のスレッドかPopAllが先に差し替えた。使わなかったので空きに戻す
+                _PushUnused( fresh );
+            }
+        }
+
+        _Leave( stripe, epoch );
+    }
+
+    // 追加された要素を全てoutの後ろにムーブする
+    void PopAll( std::vector<T>& out )
+    {
+        // 書き込み先を空のセグメントに差し替えてから、差し替える前に読み込んだスレッドが抜けるのを待つ
+        // まだ1度も追加されていないストライプと、前回から何も追加されていないストライプはそのままにする
+        Segment* detached[STRIPE_COUNT];
+        Segment* replaced[STRIPE_COUNT];
+        for( size_t i=0; i<STRIPE_COUNT; ++i )
+        {
+            detached[i] = nullptr;
+            replaced[i] = nullptr;
+            const Segment* current = m_Stripes[i].active.load( std::memory_order_acquire );
+            if( current && ( current != m_Oldest[i] || current->reserved.load( std::memory_order_relaxed ) != 0 ) )
+            {
+                replaced[i] = _AcquireSegment();
+                detached[i] = m_Stripes[i].active.exchange( replaced[i], std::memory_order_seq_cst );
+            }
+        }
+
+        const unsigned int epoch = m_Epoch.load( std::memory_order_relaxed );
+        m_Epoch.store( epoch ^ 1, std::memory_order_seq_cst );
+        for( Stripe& stripe : m_Stripes )
+        {
+            while( stripe.writers[epoch].load( std::memory_order_acquire ) != 0 )
+            {
+                std::this_thread::yield();
+            }
+        }
+
+        // 同じスレッドから追加した分は追加した順番に並ぶように、書き込み先になった順にたどる
+        // 外したセグメントまでのつなぎは、待ったスレッドが全て書き終えている
+        for( size_t i=0; i<STRIPE_COUNT; ++i )
+        {
+            if( !detached[i] )
+            {
+                continue;
+            }
+            if( !m_Oldest[i] )
+            {
+                // 最初のセグメントを入れたスレッドも待ったので、覚えた先頭が読める
+                m_Oldest[i] = m_Stripes[i].first.load( std::memory_order_acquire );
+            }
+            Segment* segment = m_Oldest[i];
+            for(;;)
+            {
+                Segment* successor = segment->successor;
+                const bool last = segment == detached[i];
+                _Drain( segment, out );
+                if( last )
+                {
+                    break;
+                }
+                segment = successor;
+            }
+            // 次のPopAllは差し替えたセグメントからたどる
+            m_Oldest[i] = replaced[i];
+        }
+        _RecycleUnused();
+
+        // 予備がなくなったストライプに補充する。予備を入れるのはPopAllだけなので、読んでから入れてよい
+        for( Stripe& stripe : m_Stripes )
+        {
+            if( m_FreeList && !stripe.spare.load( std::memory_order_relaxed ) )
+            {
+                Segment* segment = m_FreeList;
+                m_FreeList = segment->next;
+                segment->next = nullptr;
+                stripe.spare.store( segment, std::memory_order_release );
+            }
+        }
+    }
+
+    // 取り出す側から呼ぶ。書き込み中の要素があれば空ではないとみなす
+    bool IsEmpty() const
+    {
+        for( size_t i=0; i<STRIPE_COUNT; ++i )
+        {
+            const Segment* segment = m_Stripes[i].active.load( std::memory_order_acquire );
+            if( !segment )
+            {
+                continue;
+            }
+            // 前回のPopAllから差し替わっていれば、埋まったセグメントがある。まだたどったことがなければ空ではないとみなす
+            if( m_Oldest[i] != segment || segment->reserved.load( std::memory_order_relaxed ) != 0 )
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+private:
+    // スレッドごとにストライプを割り振る
+    static size_t _GetStripeIndex()
+    {
+        static std::atomic<size_t> s_NextStripe( 0 );
+        static thread_local size_t s_Stripe = s_NextStripe.fetch_add( 1, std::memory_order_relaxed ) % STRIPE_COUNT;
+        return s_Stripe;
+    }
+
+    unsigned int _Enter( Stripe& stripe )
+    {
+        for(;;)
+        {
+            const unsigned int epoch = m_Epoch.load( std::memory_order_seq_cst );
+            stripe.writers[epoch].fetch_add( 1, std::memory_order_seq_cst );
+            if( m_Epoch.load( std::memory_order_seq_cst ) == epoch )
+            {
+                return epoch;
+            }
+            // 数える前にPopAllが切り替えたので、新しいエポックで数え直す
+            stripe.writers[epoch].fetch_sub( 1, std::memory_order_release );
+        }
+    }
+
+    void _Leave( Stripe& stripe, unsigned int epoch )
+    {
+        stripe.writers[epoch].fetch_sub( 1, std::memory_order_release );
+    }
+
+    void _PushUnused( Segment* segment )
+    {
+        Segment* head = m_Unused.load( std::memory_order_relaxed );
+        do
+        {
+            segment->next = head;
+        } while( !m_Unused.compare_exchange_weak( head, segment, std::memory_order_release, std::memory_order_relaxed ) );
+    }
+
+    // 書き込み先にならなかったセグメントは誰も書いていないので、いつでも空きに戻せる
+    void _RecycleUnused()
+    {
+        Segment* segment = m_Unused.exchange( nullptr, std::memory_order_acquire );
+        while( segment )
+        {
+            Segment* next = segment->next;
+            segment->next = m_FreeList;
+            m_FreeList = segment;
+            segment = next;
+        }
+    }
+
+    Segment* _AcquireSegment()
+    {
+        if( !m_FreeList )
+        {
+            return new Segment();
+        }
+        Segment* segment = m_FreeList;
+        m_FreeList = segment->next;
+        segment->next = nullptr;
+        return segment;
+    }
+
+    void _Drain( Segment* segment, std::vector<T>& out )
+    {
+        size_t count = segment->reserved.load( std::memory_order_relaxed );
+        if( SEGMENT_SIZE < count )
+        {
+            count = SEGMENT_SIZE;
+        }
+        for( size_t i=0; i<count; ++i )
+        {
+            T* item = segment->GetSlot(i);
+            out.emplace_back( std::move(*item) );
+            item->~T();
+        }
+
+        segment->reserved.store( 0, std::memory_order_relaxed );
+        segment->successor = nullptr;
+        segment->next = m_FreeList;
+        m_FreeList = segment;
+    }
+
+private:
+    Stripe m_Stripes[STRIPE_COUNT];
+    std::atomic<Segment*> m_Unused;                  // 差し替えに負けて使わなかったセグメントのリスト
+    std::atomic<unsigned int> m_Epoch;
+    Segment* m_FreeList;                             // PopAllだけが触る空きセグメント
+    Segment* m_Oldest[STRIPE_COUNT];                 // PopAllだけが触る。次に取り出すときにたどり始めるセグメント
+};
+
+#endif /* defined(__RequestAndUpdate__MpscRequestQueue__) */
@@ -0,0 +1,227 @@
+/*
+ * Copyright (c) 2013, nilfs
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * * Neither the name of the <ORGANIZATION> nor the names of its contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __RequestAndUpdate__RequestArena__
+#define __RequestAndUpdate__RequestArena__
+
+#include <vector>
+#include <cstring>
+#include <cstddef>
+#include <type_traits>
+
+/**
+ *  アリーナにコピーした文字列。解放はアリーナのResetでまとめて行う
+ */
+struct RequestArenaString
+{
+    const char* data;
+    size_t size;
+};
+
+/**
+ *  リクエストの中身を置く領域
+ *  確保は先頭から切り出すだけで、個別には解放しない。ResetはO(1)で先頭に戻すだけ
+ *  一時的に大きく使ったときのために、一定回数のResetの間に使った最大量を超える分のブロックは解放する
+ *  スレッドセーフではない
+ */
+class RequestArena
+{
+public:
+    explicit RequestArena( size_t blockSize=64*1024 )
+    :m_BlockSize(blockSize)
+    ,m_BlockIndex(0)
+    ,m_Offset(0)
+    ,m_Used(0)
+    ,m_HighWater(0)
+    ,m_WindowPeak(0)
+    ,m_ShrinkInterval(0)
+    ,m_ResetCount(0)
+    {}
+
+    ~RequestArena()
+    {
+        for( Block& block : m_Blocks )
+        {
+            delete [] block.data;
+        }
+    }
+
+private:
+    RequestArena( const RequestArena& ) = delete;
+    RequestArena& operator=( const RequestArena& ) = delete;
+
+public:
+    void* Allocate( size_t size, size_t alignment=alignof(std::max_align_t) )
+    {
+        if( !m_Blocks.empty() )
+        {
+            const size_t offset = _AlignUp( m_Blocks[m_BlockIndex].data, m_Offset, alignment );
+            if( offset + size <= m_Blocks[m_BlockIndex].size )
+            {
+                m_Used += offset + size - m_Offset;
+                m_Offset = offset + size;
+                return m_Blocks[m_BlockIndex].data + offset;
+            }
+        }
+
+        _NextBlock( size + alignment );
+        const size_t offset = _AlignUp( m_Blocks[m_BlockIndex].data, 0, alignment );
+        m_Used += offset + size;
+        m_Offset = offset + size;
+        return m_Blocks[m_BlockIndex].data + offset;
+    }
+
+    // デストラクタを呼ばないので、後始末のいらない型だけ置ける
+    template< typename T >
+    T* AllocateArray( size_t count )
+    {
+        static_assert( std::is_trivially_destructible<T>::value, "arena objects are never destroyed" );
+        return static_cast<T*>( Allocate( sizeof(T) * count, alignof(T) ) );
+    }
+
+    RequestArenaString CopyString( const char* str, size_t size )
+    {
+        char* data = AllocateArray<char>( size + 1 );
+        std::memcpy( data, str, size );
+        data[size] = '\0';
+        RequestArenaString result = { data, size };
+        return result;
+    }
+
+    RequestArenaString CopyString( const char* str )
+    {
+        return CopyString( str, std::strlen(str) );
+    }
+
+    // 確保したものを全て捨てて先頭に戻す
+    void Reset()
+    {
+        if( m_HighWater < m_Used )
+        {
+            m_HighWater = m_Used;
+        }
+        if( m_WindowPeak < m_Used )
+        {
+            m_WindowPeak = m_Used;
+        }
+        m_BlockIndex = 0;
+        m_Offset = 0;
+        m_Used = 0;
+
+        if( m_ShrinkInterval != 0 && m_ShrinkInterval <= ++m_ResetCount )
+        {
+            _Shrink( m_WindowPeak );
+            m_WindowPeak = 0;
+            m_ResetCount = 0;
+        }
+    }
+
+    /**
+     *  resetCount回のResetごとに、その間の最大使用量を残して余ったブロックを解放する。0なら解放しない
+     */
+    void SetShrinkInterval( size_t resetCount )
+    {
+        m_ShrinkInterval = resetCount;
+        m_ResetCount = 0;
+    }
+
+    size_t GetUsed() const { return m_Used; }
+    size_t GetHighWater() const { return m_Used < m_HighWater ? m_HighWater : m_Used; }
+    size_t GetCapacity() const
+    {
+        size_t capacity = 0;
+        for( const Block& block : m_Blocks )
+        {
+            capacity += block.size;
+        }
+        return capacity;
+    }
+
+private:
+    struct Block
+    {
+        char* data;
+        size_t size;
+    };
+
+private:
+    static size_t _AlignUp( const char* base, size_t offset, size_t alignment )
+    {
+        const size_t address = reinterpret_cast<size_t>( base ) + offset;
+        return offset + ( alignment - address % alignment ) % alignment;
+    }
+
+    // 次のブロックに進む。足りなければ確保して差し込む
+    void _NextBlock( size_t size )
+    {
+        if( m_HighWater < m_Used )
+        {
+            m_HighWater = m_Used;
+        }
+
+        const size_t next = m_Blocks.empty() ? 0 : m_BlockIndex + 1;
+        if( next < m_Blocks.size() && size <= m_Blocks[next].size )
+        {
+            m_BlockIndex = next;
+            m_Offset = 0;
+            return;
+        }
+
+        Block block;
+        block.size = size < m_BlockSize ? m_BlockSize : size;
+        block.data = new char[block.size];
+        m_Blocks.insert( m_Blocks.begin() + next, block );
+        m_BlockIndex = next;
+        m_Offset = 0;
+    }
+
+    void _Shrink( size_t keep )
+    {
+        size_t capacity = GetCapacity();
+        while( !m_Blocks.empty() && keep + m_Blocks.back().size <= capacity )
+        {
+            capacity -= m_Blocks.back().size;
+            delete [] m_Blocks.back().data;
+            m_Blocks.pop_back();
+        }
+    }
+
+private:
+    std::vector<Block> m_Blocks;
+    size_t m_BlockSize;
+    size_t m_BlockIndex;
+    size_t m_Offset;
+    size_t m_Used;              // 今使っている量(揃えの分も含む)
+    size_t m_HighWater;         // 今までの最大使用量
+    size_t m_WindowPeak;        // 前回縮めてからの最大使用量
+    size_t m_ShrinkInterval;
+    size_t m_ResetCount;
+};
+
+#endif /* defined(__RequestAndUpdate__RequestArena__) */
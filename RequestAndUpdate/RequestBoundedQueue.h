@@ -0,0 +1,324 @@
+/*
+ * Copyright (c) 2013, nilfs
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * * Neither the name of the <ORGANIZATION> nor the names of its contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __RequestAndUpdate__RequestBoundedQueue__
+#define __RequestAndUpdate__RequestBoundedQueue__
+
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <cstdint>
+#include <cstddef>
+
+/**
+ *  大きさの決まった、複数スレッドから追加も取り出しもできるキュー
+ *
+ *  要素ごとの通し番号で、書き込み済みか読み出し済みかを判断する(Dmitry Vyukovのbounded MPMC queue)
+ *  TryPush/TryPopはロックしない。Push/Popは少し回ってから、空き・要素ができるまで眠る
+ *  眠っているスレッドがいるときだけロックを取って起こすので、流れている間はロックしない
+ */
+template< typename T >
+class RequestBoundedQueue
+{
+public:
+    // capacityは2のべき乗に切り上げる
+    explicit RequestBoundedQueue( size_t capacity )
+    :m_EnqueuePos(0)
+    ,m_DequeuePos(0)
+    ,m_Waiters(0)
+    ,m_Closed(false)
+    ,m_FullWaits(0)
+    {
+        size_t size = 2;
+        while( size < capacity )
+        {
+            size *= 2;
+        }
+        m_Mask = size - 1;
+        m_Cells = new Cell[size];
+        for( size_t i=0; i<size; ++i )
+        {
+            m_Cells[i].sequence.store( i, std::memory_order_relaxed );
+        }
+    }
+
+    ~RequestBoundedQueue()
+    {
+        const size_t enqueue = m_EnqueuePos.load( std::memory_order_relaxed );
+        for( size_t pos=m_DequeuePos.load( std::memory_order_relaxed ); pos<enqueue; ++pos )
+        {
+            reinterpret_cast<T*>( &m_Cells[pos & m_Mask].storage )->~T();
+        }
+        delete [] m_Cells;
+    }
+
+private:
+    RequestBoundedQueue( const RequestBoundedQueue& ) = delete;
+    RequestBoundedQueue& operator=( const RequestBoundedQueue& ) = delete;
+
+public:
+    // 埋まっているか閉じられていたらfalseを返す。そのときitemはムーブしない
+    bool TryPush( T&& item )
+    {
+        if( m_Closed.load( std::memory_order_acquire ) || !_TryPush( item ) )
+        {
+            return false;
+        }
+        _WakeWaiters();
+        return true;
+    }
+
+    bool TryPop( T& item )
+    {
+        if( !_TryPop( item ) )
+        {
+            return false;
+        }
+        _WakeWaiters();
+        return true;
+    }
+
+    // 空きができるまで待つ。閉じられていたらfalse
+    bool Push( T&& item )
+    {
+        if( TryPush( std::move(item) ) )
+        {
+            return true;
+        }
+        if( m_Closed.load( std::memory_order_acquire ) )
+        {
+            return false;
+        }
+        m_FullWaits.fetch_add( 1, std::memory_order_relaxed );
+        if( _Spin( [this, &item]{ return TryPush( std::move(item) ); } ) )
+        {
+            return true;
+        }
+
+        std::unique_lock<std::mutex> lock( m_Mutex );
+        m_Waiters.fetch_add( 1, std::memory_order_relaxed );
+        std::atomic_thread_fence( std::memory_order_seq_cst );
+        bool pushed = false;
+        while( !m_Closed.load( std::memory_order_acquire ) && !( pushed = _TryPush( item ) ) )
+        {
+            m_Condition.wait( lock );
+        }
+        m_Waiters.fetch_sub( 1, std::memory_order_relaxed );
+        if( pushed )
+        {
+            // ロックを持っているので、他に待っているスレッドはそのまま起こす
+            m_Condition.notify_all();
+        }
+        return pushed;
+    }
+
+    // 要素が来るまで待つ。閉じられて空になったらfalse
+    bool Pop( T& item )
+    {
+        if( _Spin( [this, &item]{ return TryPop( item ); } ) )
+        {
+            return true;
+        }
+
+        std::unique_lock<std::mutex> lock( m_Mutex );
+        m_Waiters.fetch_add( 1, std::memory_order_relaxed );
+        std::atomic_thread_fence( std::memory_order_seq_cst );
+        bool popped = false;
+        for(;;)
+        {
+            // 閉じた後に残っている分は取り出せるように、閉じたかどうかは先に見る
+            const bool closed = m_Closed.load( std::memory_order_acquire );
+            if( ( popped = _TryPop( item ) ) || closed )
+            {
+                break;
+            }
+            m_Condition.wait( lock );
+        }
+        m_Waiters.fetch_sub( 1, std::memory_order_relaxed );
+        if( popped )
+        {
+            m_Condition.notify_all();
+        }
+        return popped;
+    }
+
+    /**
+     *  これ以上追加しない。待っているスレッドを全て起こす
+     *  Closeと同時に追加していたものは、閉じた後に入ることがある。残りはPop/TryPopで取り出せる
+     */
+    void Close()
+    {
+        m_Closed.store( true, std::memory_order_release );
+        std::lock_guard<std::mutex> lock( m_Mutex );
+        m_Condition.notify_all();
+    }
+
+    // 閉じたキューをもう一度使う。残っている要素はそのまま。待っているスレッドがいないときに呼ぶこと
+    void Reopen()
+    {
+        m_Closed.store( false, std::memory_order_release );
+    }
+
+    bool IsClosed() const { return m_Closed.load( std::memory_order_acquire ); }
+
+    // おおよその要素数
+    size_t size() const
+    {
+        const size_t enqueue = m_EnqueuePos.load( std::memory_order_relaxed );
+        const size_t dequeue = m_DequeuePos.load( std::memory_order_relaxed );
+        return dequeue < enqueue ? enqueue - dequeue : 0;
+    }
+
+    size_t capacity() const { return m_Mask + 1; }
+
+    // Pushが埋まっていて待った回数
+    uint64_t GetFullWaitCount() const { return m_FullWaits.load( std::memory_order_relaxed ); }
+
+private:
+    static const int SPIN_COUNT = 64;
+
+    struct Cell
+    {
+        std::atomic<size_t> sequence;
+        typename std::aligned_storage<sizeof(T), std::alignment_of<T>::value>::type storage;
+    };
+
+private:
+    bool _TryPush( T& item )
+    {
+        size_t pos = m_EnqueuePos.load( std::memory_order_relaxed );
+        Cell* cell = nullptr;
+        for(;;)
+        {
+            cell = &m_Cells[pos & m_Mask];
+            const size_t sequence = cell->sequence.load( std::memory_order_acquire );
+            const intptr_t diff = static_cast<intptr_t>( sequence ) - static_cast<intptr_t>( pos );
+            if( diff == 0 )
+            {
+                if( m_EnqueuePos.compare_exchange_weak( pos, pos + 1, std::memory_order_relaxed ) )
+                {
+                    break;
+                }
+            }
+            else if( diff < 0 )
+            {
+                return false;
+            }
+            else
+            {
+                pos = m_EnqueuePos.load( std::memory_order_relaxed );
+            }
+        }
+
+        new (&cell->storage) T( std::move(item) );
+        cell->sequence.store( pos + 1, std::memory_order_release );
+        return true;
+    }
+
+    bool _TryPop( T& item )
+    {
+        size_t pos = m_DequeuePos.load( std::memory_order_relaxed );
+        Cell* cell = nullptr;
+        for(;;)
+        {
+            cell = &m_Cells[pos & m_Mask];
+            const size_t sequence = cell->sequence.load( std::memory_order_acquire );
+            const intptr_t diff = static_cast<intptr_t>( sequence ) - static_cast<intptr_t>( pos + 1 );
+            if( diff == 0 )
+            {
+                if( m_DequeuePos.compare_exchange_weak( pos, pos + 1, std::memory_order_relaxed ) )
+                {
+                    break;
+                }
+            }
+            else if( diff < 0 )
+            {
+                return false;
+            }
+            else
+            {
+                pos = m_DequeuePos.load( std::memory_order_relaxed );
+            }
+        }
+
+        T* slot = reinterpret_cast<T*>( &cell->storage );
+        item = std::move( *slot );
+        slot->~T();
+        cell->sequence.store( pos + m_Mask + 1, std::memory_order_release );
+        return true;
+    }
+
+private:
+    template< typename Try >
+    static bool _Spin( Try tryOnce )
+    {
+        for( int i=0; i<SPIN_COUNT; ++i )
+        {
+            if( tryOnce() )
+            {
+                return true;
+            }
+            if( SPIN_COUNT / 2 <= i )
+            {
+                std::this_thread::yield();
+            }
+        }
+        return false;
+    }
+
+    void _WakeWaiters()
+    {
+        // 待つ側は数を増やしてから確かめ直すので、ここで0に見えたら待つ側が変化に気づく
+        std::atomic_thread_fence( std::memory_order_seq_cst );
+        if( m_Waiters.load( std::memory_order_relaxed ) != 0 )
+        {
+            std::lock_guard<std::mutex> lock( m_Mutex );
+            m_Condition.notify_all();
+        }
+    }
+
+private:
+    Cell* m_Cells;
+    size_t m_Mask;
+    char m_Padding0[64];
+    std::atomic<size_t> m_EnqueuePos;
+    char m_Padding1[64];
+    std::atomic<size_t> m_DequeuePos;
+    char m_Padding2[64];
+    std::atomic<int> m_Waiters;
+    std::atomic<bool> m_Closed;
+    std::atomic<uint64_t> m_FullWaits;
+    std::mutex m_Mutex;
+    std::condition_variable m_Condition;
+};
+
+#endif /* defined(__RequestAndUpdate__RequestBoundedQueue__) */
@@ -0,0 +1,279 @@
+/*
+ * Copyright (c) 2013, nilfs
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * * Neither the name of the <ORGANIZATION> nor the names of its contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __RequestAndUpdate__RequestColumnUpdate__
+#define __RequestAndUpdate__RequestColumnUpdate__
+
+#include <vector>
+#include <tuple>
+#include <functional>
+#include <utility>
+#include <new>
+#include <initializer_list>
+#include <type_traits>
+#include <cstdint>
+#include <cstddef>
+
+#include "RequestUpdate.h"
+
+/**
+ *  先頭をAlignmentバイトに揃えて確保するアロケータ
+ */
+template< typename T, size_t Alignment=64 >
+class RequestAlignedAllocator
+{
+public:
+    typedef T value_type;
+
+    template< typename U >
+    struct rebind
+    {
+        typedef RequestAlignedAllocator<U, Alignment> other;
+    };
+
+    RequestAlignedAllocator() {}
+
+    template< typename U >
+    RequestAlignedAllocator( const RequestAlignedAllocator<U, Alignment>& ) {}
+
+    T* allocate( size_t count )
+    {
+        // 揃えた位置の直前に、元のポインタを置いておく
+        char* raw = static_cast<char*>( ::operator new( count * sizeof(T) + Alignment + sizeof(void*) ) );
+        const uintptr_t start = reinterpret_cast<uintptr_t>( raw + sizeof(void*) );
+        char* aligned = raw + sizeof(void*) + ( ( Alignment - start % Alignment ) % Alignment );
+        reinterpret_cast<void**>( aligned )[-1] = raw;
+        return reinterpret_cast<T*>( aligned );
+    }
+
+    void deallocate( T* ptr, size_t )
+    {
+        ::operator delete( reinterpret_cast<void**>( ptr )[-1] );
+    }
+
+    template< typename U >
+    bool operator==( const RequestAlignedAllocator<U, Alignment>& ) const { return true; }
+    template< typename U >
+    bool operator!=( const RequestAlignedAllocator<U, Alignment>& ) const { return false; }
+};
+
+/**
+ *  型の並びにboolが含まれるか
+ */
+template< typename ...Types >
+struct RequestColumnHasBool : std::false_type {};
+
+template< typename First, typename ...Rest >
+struct RequestColumnHasBool< First, Rest... >
+: std::integral_constant< bool, std::is_same< typename std::remove_cv<First>::type, bool >::value || RequestColumnHasBool< Rest... >::value > {};
+
+/**
+ *  リクエストの引数を、引数ごとの連続した列(Structure of Arrays)で持つRequestUpdate
+ *  エグゼキュータは列ごとの範囲をまとめて受け取るので、1つの引数だけを読む処理やSIMDで列を処理するときにキャッシュを無駄にしない
+ *  例: SetRequestExecuter( []( RequestSpan<const int> ids, RequestSpan<const float> values ){ ... } );
+ *  boolの列はstd::vector<bool>になって連続した範囲を渡せないので、bool引数はuint8_tなどで受け取る
+ */
+template< typename ThreadingPolicy, typename ArgFirst, typename ...ArgTypes >
+class BasicRequestColumnUpdate
+{
+public:
+    static_assert( !RequestColumnHasBool< ArgFirst, ArgTypes... >::value, "bool columns are not supported, use uint8_t instead" );
+
+    typedef std::tuple< ArgFirst, ArgTypes... > Parameter;
+    typedef std::function< void(RequestSpan<const ArgFirst>, RequestSpan<const ArgTypes>...)> ColumnExecuter;
+
+    template< typename T >
+    using Column = std::vector< T, RequestAlignedAllocator<T> >;
+
+public:
+    BasicRequestColumnUpdate()
+    :m_SortColumn(nullptr)
+    ,m_SortEngine(REQUEST_SORT_AUTO)
+    ,m_ChunkSize(0)
+    {}
+
+private:
+    BasicRequestColumnUpdate( const BasicRequestColumnUpdate& ) = delete;
+    BasicRequestColumnUpdate& operator=( const BasicRequestColumnUpdate& ) = delete;
+
+public:
+    /**
+     *  列ごとの範囲を受け取る関数。chunkSize件ずつに区切って呼ぶ。0なら1回のUpdateで1度だけ呼ぶ
+     */
+    void SetRequestExecuter( const ColumnExecuter& executer, size_t chunkSize=0 )
+    {
+        m_Executer = executer;
+        m_ChunkSize = chunkSize;
+    }
+
+    /**
+     *  Index番目の引数の値の小さい順に処理する。値は整数か浮動小数点数
+     *  並べるのは添字だけで、列は並んだ順に1度だけ詰める
+     */
+    template< size_t Index >
+    void SetRequestSortColumn( RequestSortEngine engine=REQUEST_SORT_AUTO )
+    {
+        typedef typename std::tuple_element< Index, Parameter >::type Key;
+        static_assert( std::is_arithmetic<Key>::value || std::is_enum<Key>::value, "sort column must be an integral, floating point or enum type" );
+
+        m_SortColumn = &BasicRequestColumnUpdate::_MakeSortEntries<Index>;
+        m_SortEngine = engine;
+    }
+
+    void ClearRequestSort()
+    {
+        m_SortColumn = nullptr;
+    }
+
+    /**
+     *  呼べるスレッドはThreadingPolicyで決まる
+     */
+    void AddRequest( ArgFirst argFirst, ArgTypes... args )
+    {
+        m_Requests.Push( std::move(argFirst), std::move(args)... );
+    }
+
+    /**
+     *  引数から直接リクエストを作る。右辺値はムーブされるので、ムーブしかできない型も渡せる
+     *  呼べるスレッドはThreadingPolicyで決まる
+     */
+    template< typename ...Args >
+    void EmplaceRequest( Args&&... args )
+    {
+        static_assert( sizeof...(Args) == 1 + sizeof...(ArgTypes), "argument count does not match the request" );
+        m_Requests.Push( std::forward<Args>(args)... );
+    }
+
+    /**
+     *  溜まったリクエストを列に並べ替えて処理する。処理した数を返す
+     */
+    size_t Update()
+    {
+        m_Requests.PopAll( m_UpdatingRequests );
+        const size_t size = m_UpdatingRequests.size();
+
+        Indices indices;
+        _ClearColumns( indices );
+        _ReserveColumns( size, indices );
+        if( m_SortColumn )
+        {
+            (this->*m_SortColumn)();
+            m_Sorter.Sort( m_SortEntries, m_SortEngine );
+            for( const RequestSortEntry& entry : m_SortEntries )
+            {
+                _AppendRow( m_UpdatingRequests[entry.index], indices );
+            }
+            m_SortEntries.clear();
+        }
+        else
+        {
+            for( Parameter& param : m_UpdatingRequests )
+            {
+                _AppendRow( param, indices );
+            }
+        }
+        m_UpdatingRequests.clear();
+
+        const size_t chunkSize = m_ChunkSize == 0 ? size : m_ChunkSize;
+        for( size_t offset=0; offset<size; offset+=chunkSize )
+        {
+            const size_t count = size - offset < chunkSize ? size - offset : chunkSize;
+            _Execute( offset, count, indices );
+        }
+        return size;
+    }
+
+    // 前回のUpdateで処理した列。次のUpdateまで有効
+    template< size_t Index >
+    const Column< typename std::tuple_element< Index, Parameter >::type >& GetColumn() const
+    {
+        return std::get<Index>( m_Columns );
+    }
+
+private:
+    typedef typename RequestMakeIndexSequence< 1 + sizeof...(ArgTypes) >::type Indices;
+
+    template< size_t Index >
+    void _MakeSortEntries()
+    {
+        typedef typename std::tuple_element< Index, Parameter >::type Key;
+        const size_t size = m_UpdatingRequests.size();
+        m_SortEntries.resize( size );
+        for( size_t i=0; i<size; ++i )
+        {
+            m_SortEntries[i].key = RequestSortKeyTraits<Key>::Encode( std::get<Index>( m_UpdatingRequests[i] ) );
+            m_SortEntries[i].index = static_cast<uint32_t>(i);
+        }
+    }
+
+    // パック展開のために使う
+    static void _Expand( std::initializer_list<int> ) {}
+
+    template< size_t... Is >
+    void _ClearColumns( RequestIndexSequence<Is...> )
+    {
+        _Expand( { ( std::get<Is>( m_Columns ).clear(), 0 )... } );
+    }
+
+    template< size_t... Is >
+    void _ReserveColumns( size_t size, RequestIndexSequence<Is...> )
+    {
+        _Expand( { ( std::get<Is>( m_Columns ).reserve( size ), 0 )... } );
+    }
+
+    template< size_t... Is >
+    void _AppendRow( Parameter& param, RequestIndexSequence<Is...> )
+    {
+        _Expand( { ( std::get<Is>( m_Columns ).push_back( std::move( std::get<Is>( param ) ) ), 0 )... } );
+    }
+
+    template< size_t... Is >
+    void _Execute( size_t offset, size_t count, RequestIndexSequence<Is...> )
+    {
+        m_Executer( RequestSpan< const typename std::tuple_element< Is, Parameter >::type >( std::get<Is>( m_Columns ).data() + offset, count )... );
+    }
+
+private:
+    typename ThreadingPolicy::template Queue< Parameter > m_Requests;   //リクエスト追加用
+    std::vector< Parameter > m_UpdatingRequests;
+    std::tuple< Column<ArgFirst>, Column<ArgTypes>... > m_Columns;     // 引数ごとの列
+    ColumnExecuter m_Executer;
+
+    void (BasicRequestColumnUpdate::*m_SortColumn)();
+    RequestSortEngine m_SortEngine;
+    RequestSorter m_Sorter;
+    std::vector< RequestSortEntry > m_SortEntries;
+
+    size_t m_ChunkSize;
+};
+
+template< typename ArgFirst, typename ...ArgTypes >
+using RequestColumnUpdate = BasicRequestColumnUpdate< RequestUpdateMpsc, ArgFirst, ArgTypes... >;
+
+#endif /* defined(__RequestAndUpdate__RequestColumnUpdate__) */
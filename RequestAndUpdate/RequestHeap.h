@@ -0,0 +1,176 @@
+/*
+ * Copyright (c) 2013, nilfs
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * * Neither the name of the <ORGANIZATION> nor the names of its contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __RequestAndUpdate__RequestHeap__
+#define __RequestAndUpdate__RequestHeap__
+
+#include <vector>
+#include <algorithm>
+#include <utility>
+#include <cstddef>
+
+/**
+ *  d分木のヒープ。先頭が最も優先度の高い要素になる
+ *  2分木より木が浅く、子の比較が連続した領域で済むので、要素が多いときの取り出しが速い
+ *  比較関数は呼び出しごとに渡す。lessが「左を先に処理する」を返す
+ */
+template< typename Entry, size_t Arity=4 >
+class RequestDaryHeap
+{
+public:
+    bool empty() const { return m_Entries.empty(); }
+    size_t size() const { return m_Entries.size(); }
+    const Entry& Top() const { return m_Entries.front(); }
+    typename std::vector<Entry>::const_iterator begin() const { return m_Entries.begin(); }
+    typename std::vector<Entry>::const_iterator end() const { return m_Entries.end(); }
+    void clear(){ m_Entries.clear(); }
+
+    // 1つ追加する。O(log n)
+    template< typename Less >
+    void Push( const Entry& entry, Less less )
+    {
+        m_Entries.push_back( entry );
+        _SiftUp( m_Entries.size() - 1, less );
+    }
+
+    // 並び順を気にせず後ろに追加する。追加し終わったらBuildを呼ぶこと
+    void Append( const Entry& entry )
+    {
+        m_Entries.push_back( entry );
+    }
+
+    // 全体をヒープにし直す。O(n)
+    template< typename Less >
+    void Build( Less less )
+    {
+        const size_t size = m_Entries.size();
+        if( size < 2 )
+        {
+            return;
+        }
+        for( size_t i = ( size - 2 ) / Arity + 1; 0 < i; --i )
+        {
+            _SiftDown( i - 1, less );
+        }
+    }
+
+    // 先頭を取り出す。O(d log n)
+    template< typename Less >
+    Entry Pop( Less less )
+    {
+        Entry top = m_Entries.front();
+        m_Entries.front() = m_Entries.back();
+        m_Entries.pop_back();
+        if( !m_Entries.empty() )
+        {
+            _SiftDown( 0, less );
+        }
+        return top;
+    }
+
+    // 全ての要素をmodifyで書き換える。modifyが1つでもtrueを返したら(並び順が変わったら)ヒープを作り直す。O(n)
+    template< typename Modify, typename Less >
+    void ModifyAll( Modify modify, Less less )
+    {
+        bool modified = false;
+        for( Entry& entry : m_Entries )
+        {
+            modified = modify( entry ) || modified;
+        }
+        if( modified )
+        {
+            Build( less );
+        }
+    }
+
+    // predがtrueを返した要素を取り除いて、ヒープを作り直す。取り除いた数を返す。O(n)
+    template< typename Predicate, typename Less >
+    size_t RemoveIf( Predicate pred, Less less )
+    {
+        const size_t size = m_Entries.size();
+        m_Entries.erase( std::remove_if( m_Entries.begin(), m_Entries.end(), pred ), m_Entries.end() );
+        Build( less );
+        return size - m_Entries.size();
+    }
+
+private:
+    template< typename Less >
+    void _SiftUp( size_t index, Less& less )
+    {
+        const Entry entry = m_Entries[index];
+        while( 0 < index )
+        {
+            const size_t parent = ( index - 1 ) / Arity;
+            if( !less( entry, m_Entries[parent] ) )
+            {
+                break;
+            }
+            m_Entries[index] = m_Entries[parent];
+            index = parent;
+        }
+        m_Entries[index] = entry;
+    }
+
+    template< typename Less >
+    void _SiftDown( size_t index, Less& less )
+    {
+        const size_t size = m_Entries.size();
+        const Entry entry = m_Entries[index];
+        for(;;)
+        {
+            const size_t first = index * Arity + 1;
+            if( size <= first )
+            {
+                break;
+            }
+            const size_t last = first + Arity < size ? first + Arity : size;
+
+            size_t best = first;
+            for( size_t child = first + 1; child < last; ++child )
+            {
+                if( less( m_Entries[child], m_Entries[best] ) )
+                {
+                    best = child;
+                }
+            }
+            if( !less( m_Entries[best], entry ) )
+            {
+                break;
+            }
+            m_Entries[index] = m_Entries[best];
+            index = best;
+        }
+        m_Entries[index] = entry;
+    }
+
+private:
+    std::vector<Entry> m_Entries;
+};
+
+#endif /* defined(__RequestAndUpdate__RequestHeap__) */
@@ -0,0 +1,374 @@
+/*
+ * Copyright (c) 2013, nilfs
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * * Neither the name of the <ORGANIZATION> nor the names of its contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __RequestAndUpdate__RequestInstrument__
+#define __RequestAndUpdate__RequestInstrument__
+
+#include <atomic>
+#include <chrono>
+#include <ostream>
+#include <cstdint>
+#include <cstddef>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+/**
+ *  計測用の安いタイムスタンプ。x86ではTSC、それ以外ではsteady_clockのナノ秒
+ *  単位はCPUによって違うので、ナノ秒にするときはRequestUpdateInstrumentで較正した値を使う
+ */
+struct RequestTsc
+{
+    static uint64_t Now()
+    {
+#if defined(__x86_64__) || defined(__i386__)
+        return __rdtsc();
+#else
+        return static_cast<uint64_t>( std::chrono::duration_cast<std::chrono::nanoseconds>( std::chrono::steady_clock::now().time_since_epoch() ).count() );
+#endif
+    }
+};
+
+/**
+ *  ヒストグラムの要約。時間の単位はナノ秒
+ */
+struct RequestHistogramSummary
+{
+    uint64_t count;
+    double mean;
+    double p50;
+    double p90;
+    double p99;
+    double max;
+};
+
+/**
+ *  値の対数で区切ったヒストグラム。2の累乗の区間をさらに8つに分けるので、誤差は1/8まで
+ *  どのスレッドから記録してもよい
+ */
+class RequestHistogram
+{
+public:
+    static const size_t SUB_BUCKET_BITS = 3;
+    static const size_t SUB_BUCKET_COUNT = size_t(1) << SUB_BUCKET_BITS;
+    static const size_t BUCKET_COUNT = ( 64 - SUB_BUCKET_BITS + 1 ) * SUB_BUCKET_COUNT;
+
+public:
+    RequestHistogram()
+    {
+        Reset();
+    }
+
+private:
+    RequestHistogram( const RequestHistogram& ) = delete;
+    RequestHistogram& operator=( const RequestHistogram& ) = delete;
+
+public:
+    void Record( uint64_t value )
+    {
+        m_Buckets[ GetBucketIndex( value ) ].fetch_add( 1, std::memory_order_relaxed );
+        m_Sum.fetch_add( value, std::memory_order_relaxed );
+        uint64_t max = m_Max.load( std::memory_order_relaxed );
+        while( max < value && !m_Max.compare_exchange_weak( max, value, std::memory_order_relaxed ) )
+        {
+        }
+    }
+
+    // 手元で数えたバケツをまとめて足す。1回のUpdateで大量に記録するときに使う
+    void Merge( const uint64_t* buckets, uint64_t sum, uint64_t max )
+    {
+        for( size_t i=0; i<BUCKET_COUNT; ++i )
+        {
+            if( buckets[i] != 0 )
+            {
+                m_Buckets[i].fetch_add( buckets[i], std::memory_order_relaxed );
+            }
+        }
+        m_Sum.fetch_add( sum, std::memory_order_relaxed );
+        uint64_t current = m_Max.load( std::memory_order_relaxed );
+        while( current < max && !m_Max.compare_exchange_weak( current, max, std::memory_order_relaxed ) )
+        {
+        }
+    }
+
+    void Reset()
+    {
+        for( std::atomic<uint64_t>& bucket : m_Buckets )
+        {
+            bucket.store( 0, std::memory_order_relaxed );
+        }
+        m_Sum.store( 0, std::memory_order_relaxed );
+        m_Max.store( 0, std::memory_order_relaxed );
+    }
+
+    // scaleを掛けた単位で要約する
+    RequestHistogramSummary Summarize( double scale ) const
+    {
+        uint64_t buckets[BUCKET_COUNT];
+        uint64_t count = 0;
+        for( size_t i=0; i<BUCKET_COUNT; ++i )
+        {
+            buckets[i] = m_Buckets[i].load( std::memory_order_relaxed );
+            count += buckets[i];
+        }
+        const uint64_t max = m_Max.load( std::memory_order_relaxed );
+
+        RequestHistogramSummary summary;
+        summary.count = count;
+        summary.mean = count == 0 ? 0.0 : m_Sum.load( std::memory_order_relaxed ) * scale / count;
+        summary.p50 = _GetPercentile( buckets, count, max, 0.50 ) * scale;
+        summary.p90 = _GetPercentile( buckets, count, max, 0.90 ) * scale;
+        summary.p99 = _GetPercentile( buckets, count, max, 0.99 ) * scale;
+        summary.max = max * scale;
+        return summary;
+    }
+
+    static size_t GetBucketIndex( uint64_t value )
+    {
+        if( value < SUB_BUCKET_COUNT )
+        {
+            return static_cast<size_t>( value );
+        }
+        const size_t exponent = 63 - __builtin_clzll( value );
+        const size_t sub = static_cast<size_t>( value >> ( exponent - SUB_BUCKET_BITS ) ) & ( SUB_BUCKET_COUNT - 1 );
+        return ( exponent - SUB_BUCKET_BITS + 1 ) * SUB_BUCKET_COUNT + sub;
+    }
+
+    // バケツに入る最小の値
+    static uint64_t GetBucketLowerBound( size_t index )
+    {
+        if( index < SUB_BUCKET_COUNT )
+        {
+            return index;
+        }
+        const size_t exponent = index / SUB_BUCKET_COUNT + SUB_BUCKET_BITS - 1;
+        const uint64_t sub = index % SUB_BUCKET_COUNT;
+        return ( SUB_BUCKET_COUNT + sub ) << ( exponent - SUB_BUCKET_BITS );
+    }
+
+private:
+    // 該当するバケツの真ん中の値。最大値は超えない
+    static double _GetPercentile( const uint64_t* buckets, uint64_t count, uint64_t max, double ratio )
+    {
+        if( count == 0 )
+        {
+            return 0.0;
+        }
+        uint64_t rank = static_cast<uint64_t>( ratio * count + 0.5 );
+        rank = rank < 1 ? 1 : rank;
+        uint64_t seen = 0;
+        for( size_t i=0; i<BUCKET_COUNT; ++i )
+        {
+            seen += buckets[i];
+            if( rank <= seen )
+            {
+                const double lower = static_cast<double>( GetBucketLowerBound( i ) );
+                const double upper = i + 1 < BUCKET_COUNT ? static_cast<double>( GetBucketLowerBound( i + 1 ) ) : lower;
+                const double middle = ( lower + upper ) / 2;
+                return middle < max ? middle : static_cast<double>( max );
+            }
+        }
+        return static_cast<double>( max );
+    }
+
+private:
+    std::atomic<uint64_t> m_Buckets[BUCKET_COUNT];
+    std::atomic<uint64_t> m_Sum;
+    std::atomic<uint64_t> m_Max;
+};
+
+/**
+ *  RequestUpdateの計測結果
+ *  queueDepthは1回のUpdateで取り出した件数、それ以外はナノ秒
+ */
+struct RequestInstrumentSnapshot
+{
+    bool enabled;                       // REQUEST_UPDATE_INSTRUMENTを定義せずにビルドしたらfalseで、他は全て0
+    uint64_t updateCount;
+    uint64_t requestCount;              // AddRequestした数
+    RequestHistogramSummary queueDepth;
+    RequestHistogramSummary sortTime;   // 取り出してから並べ終わるまで
+    RequestHistogramSummary executeTime;// 並べてから全て処理し終わるまで
+    RequestHistogramSummary updateTime; // Update全体
+    RequestHistogramSummary latency;    // AddRequestしてから、取り出したUpdateが処理を始めるまで
+    RequestHistogramSummary enqueueTime;// AddRequestがキューに入れるのにかかった時間。追加するスレッド同士の競合で伸びる
+
+    RequestInstrumentSnapshot()
+    :enabled(false)
+    ,updateCount(0)
+    ,requestCount(0)
+    ,queueDepth()
+    ,sortTime()
+    ,executeTime()
+    ,updateTime()
+    ,latency()
+    ,enqueueTime()
+    {}
+
+    // タブ区切りのテキストで書き出す
+    void Print( std::ostream& out ) const
+    {
+        if( !enabled )
+        {
+            out << "instrumentation disabled (define REQUEST_UPDATE_INSTRUMENT)" << std::endl;
+            return;
+        }
+        out << "updates\t" << updateCount << "\trequests\t" << requestCount << std::endl;
+        out << "metric\tcount\tmean\tp50\tp90\tp99\tmax" << std::endl;
+        _PrintRow( out, "queueDepth", queueDepth );
+        _PrintRow( out, "sortTime(ns)", sortTime );
+        _PrintRow( out, "executeTime(ns)", executeTime );
+        _PrintRow( out, "updateTime(ns)", updateTime );
+        _PrintRow( out, "latency(ns)", latency );
+        _PrintRow( out, "enqueueTime(ns)", enqueueTime );
+    }
+
+private:
+    static void _PrintRow( std::ostream& out, const char* name, const RequestHistogramSummary& summary )
+    {
+        out << name << "\t" << summary.count << "\t" << summary.mean << "\t" << summary.p50 << "\t"
+            << summary.p90 << "\t" << summary.p99 << "\t" << summary.max << std::endl;
+    }
+};
+
+/**
+ *  RequestUpdateが記録する計測値。時間はRequestTscの単位で持ち、取り出すときにナノ秒にする
+ */
+class RequestUpdateInstrument
+{
+public:
+    RequestUpdateInstrument()
+    :m_StartTsc(RequestTsc::Now())
+    ,m_StartTime(std::chrono::steady_clock::now())
+    ,m_UpdateCount(0)
+    ,m_RequestCount(0)
+    {}
+
+private:
+    RequestUpdateInstrument( const RequestUpdateInstrument& ) = delete;
+    RequestUpdateInstrument& operator=( const RequestUpdateInstrument& ) = delete;
+
+public:
+    // 追加するスレッドから呼ぶ
+    void RecordEnqueue( uint64_t ticks )
+    {
+        m_RequestCount.fetch_add( 1, std::memory_order_relaxed );
+        m_EnqueueTime.Record( ticks );
+    }
+
+    // 以下はUpdateを呼ぶスレッドから呼ぶ
+    void RecordUpdate( size_t depth, uint64_t sortTicks, uint64_t executeTicks, uint64_t updateTicks )
+    {
+        m_UpdateCount.fetch_add( 1, std::memory_order_relaxed );
+        m_QueueDepth.Record( depth );
+        m_SortTime.Record( sortTicks );
+        m_ExecuteTime.Record( executeTicks );
+        m_UpdateTime.Record( updateTicks );
+    }
+
+    // 追加した時刻の並びからnowまでの待ち時間をまとめて記録する
+    void RecordLatency( const uint64_t* enqueued, size_t count, uint64_t now )
+    {
+        if( count == 0 )
+        {
+            return;
+        }
+        uint64_t buckets[RequestHistogram::BUCKET_COUNT] = {};
+        uint64_t sum = 0;
+        uint64_t max = 0;
+        for( size_t i=0; i<count; ++i )
+        {
+            // 別のコアで取ったTSCが少し先に進んでいることがある
+            const uint64_t wait = enqueued[i] < now ? now - enqueued[i] : 0;
+            ++buckets[ RequestHistogram::GetBucketIndex( wait ) ];
+            sum += wait;
+            max = max < wait ? wait : max;
+        }
+        m_Latency.Merge( buckets, sum, max );
+    }
+
+    // どのスレッドから呼んでもよい
+    RequestInstrumentSnapshot Snapshot() const
+    {
+        const double nanosecondsPerTick = 1.0 / _GetTicksPerNanosecond();
+        RequestInstrumentSnapshot snapshot;
+        snapshot.enabled = true;
+        snapshot.updateCount = m_UpdateCount.load( std::memory_order_relaxed );
+        snapshot.requestCount = m_RequestCount.load( std::memory_order_relaxed );
+        snapshot.queueDepth = m_QueueDepth.Summarize( 1.0 );
+        snapshot.sortTime = m_SortTime.Summarize( nanosecondsPerTick );
+        snapshot.executeTime = m_ExecuteTime.Summarize( nanosecondsPerTick );
+        snapshot.updateTime = m_UpdateTime.Summarize( nanosecondsPerTick );
+        snapshot.latency = m_Latency.Summarize( nanosecondsPerTick );
+        snapshot.enqueueTime = m_EnqueueTime.Summarize( nanosecondsPerTick );
+        return snapshot;
+    }
+
+    // 記録を捨てる。較正はそのまま続ける
+    void Reset()
+    {
+        m_UpdateCount.store( 0, std::memory_order_relaxed );
+        m_RequestCount.store( 0, std::memory_order_relaxed );
+        m_QueueDepth.Reset();
+        m_SortTime.Reset();
+        m_ExecuteTime.Reset();
+        m_UpdateTime.Reset();
+        m_Latency.Reset();
+        m_EnqueueTime.Reset();
+    }
+
+private:
+    // 作ってからの経過時間でTSCを較正する。短すぎると誤差が大きいので、1ミリ秒は待つ
+    double _GetTicksPerNanosecond() const
+    {
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        while( now - m_StartTime < std::chrono::milliseconds(1) )
+        {
+            now = std::chrono::steady_clock::now();
+        }
+        const uint64_t ticks = RequestTsc::Now() - m_StartTsc;
+        const double nanoseconds = std::chrono::duration<double, std::nano>( now - m_StartTime ).count();
+        return ticks / nanoseconds;
+    }
+
+private:
+    uint64_t m_StartTsc;
+    std::chrono::steady_clock::time_point m_StartTime;
+    std::atomic<uint64_t> m_UpdateCount;
+    std::atomic<uint64_t> m_RequestCount;
+    RequestHistogram m_QueueDepth;
+    RequestHistogram m_SortTime;
+    RequestHistogram m_ExecuteTime;
+    RequestHistogram m_UpdateTime;
+    RequestHistogram m_Latency;
+    RequestHistogram m_EnqueueTime;
+};
+
+#endif /* defined(__RequestAndUpdate__RequestInstrument__) */
@@ -0,0 +1,133 @@
+/*
+ * Copyright (c) 2013, nilfs
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * * Neither the name of the <ORGANIZATION> nor the names of its contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __RequestAndUpdate__RequestKeyTable__
+#define __RequestAndUpdate__RequestKeyTable__
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+/**
+ *  64bitのキーから添字を引くオープンアドレス法のハッシュ表
+ *  Clearは世代を進めるだけなので、毎フレーム使い回しても表を消して回らない
+ */
+class RequestKeyTable
+{
+public:
+    RequestKeyTable()
+    :m_Mask(0)
+    ,m_Stamp(1)
+    {}
+
+    // count個入れても埋まりすぎないようにする。中身は消える
+    void Reserve( size_t count )
+    {
+        size_t capacity = 16;
+        while( capacity < count * 2 )
+        {
+            capacity *= 2;
+        }
+        if( m_Slots.size() < capacity )
+        {
+            m_Slots.assign( capacity, Slot() );
+            m_Mask = capacity - 1;
+            m_Stamp = 1;
+        }
+        else
+        {
+            Clear();
+        }
+    }
+
+    void Clear()
+    {
+        if( ++m_Stamp == 0 )
+        {
+            // 世代が一周したら本当に消す
+            for( Slot& slot : m_Slots )
+            {
+                slot.stamp = 0;
+            }
+            m_Stamp = 1;
+        }
+    }
+
+    /**
+     *  keyの値を返す。なければvalueを入れてinsertedをtrueにする
+     *  Reserveした数より多く入れないこと
+     */
+    uint32_t& FindOrInsert( uint64_t key, uint32_t value, bool& inserted )
+    {
+        size_t index = _Hash( key ) & m_Mask;
+        for(;;)
+        {
+            Slot& slot = m_Slots[index];
+            if( slot.stamp != m_Stamp )
+            {
+                slot.key = key;
+                slot.value = value;
+                slot.stamp = m_Stamp;
+                inserted = true;
+                return slot.value;
+            }
+            if( slot.key == key )
+            {
+                inserted = false;
+                return slot.value;
+            }
+            index = ( index + 1 ) & m_Mask;
+        }
+    }
+
+private:
+    struct Slot
+    {
+        Slot() : key(0), value(0), stamp(0) {}
+
+        uint64_t key;
+        uint32_t value;
+        uint32_t stamp;     // m_Stampと同じなら使用中
+    };
+
+    static size_t _Hash( uint64_t key )
+    {
+        key ^= key >> 33;
+        key *= 0xff51afd7ed558ccdull;
+        key ^= key >> 33;
+        return static_cast<size_t>( key );
+    }
+
+private:
+    std::vector<Slot> m_Slots;
+    size_t m_Mask;
+    uint32_t m_Stamp;
+};
+
+#endif /* defined(__RequestAndUpdate__RequestKeyTable__) */
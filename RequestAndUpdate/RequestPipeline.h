@@ -0,0 +1,431 @@
+/*
+ * Copyright (c) 2013, nilfs
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * * Neither the name of the <ORGANIZATION> nor the names of its contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __RequestAndUpdate__RequestPipeline__
+#define __RequestAndUpdate__RequestPipeline__
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <functional>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <ostream>
+#include <cstdint>
+#include <cstddef>
+
+#include "RequestBoundedQueue.h"
+
+/**
+ *  段ごとの統計
+ */
+struct RequestPipelineStageStats
+{
+    std::string name;
+    uint64_t processed;         // 処理した数
+    double throughput;          // Startからの1秒あたりの処理数
+    size_t queueDepth;          // 入力キューに溜まっている数
+    size_t maxQueueDepth;       // 取り出すときに見た入力キューの最大の深さ
+    size_t queueCapacity;
+    uint64_t backpressureWaits; // 入力キューが埋まっていて、前の段(またはPush)が待った回数
+};
+
+/**
+ *  段の出力先。次の段の入力キューが埋まっていれば空くまで待つ
+ */
+template< typename Out >
+class RequestPipelineOutput
+{
+public:
+    RequestPipelineOutput()
+    :m_Queue(nullptr)
+    {}
+
+    void Push( Out&& item )
+    {
+        m_Queue->Push( std::move(item) );
+    }
+
+    void Push( const Out& item )
+    {
+        Out copy( item );
+        m_Queue->Push( std::move(copy) );
+    }
+
+private:
+    template< typename, typename > friend class RequestPipelineStage;
+
+    RequestBoundedQueue<Out>* m_Queue;
+};
+
+/**
+ *  入力キューとスレッドを持つ段。処理の中身は派生クラスで決める
+ */
+class RequestPipelineStageBase
+{
+public:
+    RequestPipelineStageBase( const std::string& name, size_t threadCount )
+    :m_Name(name)
+    ,m_ThreadCount(threadCount < 1 ? 1 : threadCount)
+    ,m_Running(0)
+    ,m_Processed(0)
+    ,m_MaxQueueDepth(0)
+    {}
+
+    virtual ~RequestPipelineStageBase() {}
+
+private:
+    RequestPipelineStageBase( const RequestPipelineStageBase& ) = delete;
+    RequestPipelineStageBase& operator=( const RequestPipelineStageBase& ) = delete;
+
+public:
+    // Stopで閉じた入力キューは開き直す
+    void Start()
+    {
+        _Open();
+        m_Running.store( m_ThreadCount, std::memory_order_relaxed );
+        for( size_t i=0; i<m_ThreadCount; ++i )
+        {
+            m_Threads.push_back( std::thread( &RequestPipelineStageBase::_WorkerMain, this ) );
+        }
+    }
+
+    void Join()
+    {
+        for( std::thread& thread : m_Threads )
+        {
+            thread.join();
+        }
+        m_Threads.clear();
+    }
+
+    RequestPipelineStageStats GetStats( double seconds ) const
+    {
+        RequestPipelineStageStats stats;
+        stats.name = m_Name;
+        stats.processed = m_Processed.load( std::memory_order_relaxed );
+        stats.throughput = 0.0 < seconds ? stats.processed / seconds : 0.0;
+        stats.queueDepth = _GetQueueDepth();
+        stats.maxQueueDepth = m_MaxQueueDepth.load( std::memory_order_relaxed );
+        stats.queueCapacity = _GetQueueCapacity();
+        stats.backpressureWaits = _GetFullWaitCount();
+        return stats;
+    }
+
+protected:
+    // スレッドを起こす前に呼ぶ。入力キューを開く
+    virtual void _Open() = 0;
+    // 入力がなくなるまで処理する
+    virtual void _Run() = 0;
+    // 全てのスレッドが終わったら呼ぶ。次の段の入力を閉じる
+    virtual void _Finish() = 0;
+    virtual size_t _GetQueueDepth() const = 0;
+    virtual size_t _GetQueueCapacity() const = 0;
+    virtual uint64_t _GetFullWaitCount() const = 0;
+
+    void _OnProcessed( size_t queueDepth )
+    {
+        m_Processed.fetch_add( 1, std::memory_order_relaxed );
+        size_t maxDepth = m_MaxQueueDepth.load( std::memory_order_relaxed );
+        while( maxDepth < queueDepth && !m_MaxQueueDepth.compare_exchange_weak( maxDepth, queueDepth, std::memory_order_relaxed ) )
+        {
+        }
+    }
+
+private:
+    void _WorkerMain()
+    {
+        _Run();
+        if( m_Running.fetch_sub( 1, std::memory_order_acq_rel ) == 1 )
+        {
+            _Finish();
+        }
+    }
+
+private:
+    std::string m_Name;
+    size_t m_ThreadCount;
+    std::vector<std::thread> m_Threads;
+    std::atomic<size_t> m_Running;
+    std::atomic<uint64_t> m_Processed;
+    std::atomic<size_t> m_MaxQueueDepth;
+};
+
+/**
+ *  Inを受け取ってOutを0個以上次の段に渡す段。Outがvoidなら最後の段
+ */
+template< typename In, typename Out >
+class RequestPipelineStage : public RequestPipelineStageBase
+{
+public:
+    typedef std::function< void(In&&, RequestPipelineOutput<Out>&)> Function;
+
+    RequestPipelineStage( const std::string& name, const Function& function, size_t threadCount, size_t capacity )
+    :RequestPipelineStageBase(name, threadCount)
+    ,m_Input(capacity)
+    ,m_Function(function)
+    {}
+
+    RequestBoundedQueue<In>& GetInput() { return m_Input; }
+    RequestBoundedQueue<Out>*& GetOutputQueue() { return m_Output.m_Queue; }
+
+protected:
+    virtual void _Open()
+    {
+        m_Input.Reopen();
+    }
+
+    virtual void _Run()
+    {
+        RequestPipelineOutput<Out> output = m_Output;
+        In item;
+        while( m_Input.Pop( item ) )
+        {
+            const size_t depth = m_Input.size();
+            m_Function( std::move(item), output );
+            _OnProcessed( depth );
+        }
+    }
+
+    virtual void _Finish()
+    {
+        m_Output.m_Queue->Close();
+    }
+
+    virtual size_t _GetQueueDepth() const { return m_Input.size(); }
+    virtual size_t _GetQueueCapacity() const { return m_Input.capacity(); }
+    virtual uint64_t _GetFullWaitCount() const { return m_Input.GetFullWaitCount(); }
+
+private:
+    RequestBoundedQueue<In> m_Input;
+    Function m_Function;
+    RequestPipelineOutput<Out> m_Output;
+};
+
+template< typename In >
+class RequestPipelineStage< In, void > : public RequestPipelineStageBase
+{
+public:
+    typedef std::function< void(In&&)> Function;
+
+    RequestPipelineStage( const std::string& name, const Function& function, size_t threadCount, size_t capacity )
+    :RequestPipelineStageBase(name, threadCount)
+    ,m_Input(capacity)
+    ,m_Function(function)
+    {}
+
+    RequestBoundedQueue<In>& GetInput() { return m_Input; }
+
+protected:
+    virtual void _Open()
+    {
+        m_Input.Reopen();
+    }
+
+    virtual void _Run()
+    {
+        In item;
+        while( m_Input.Pop( item ) )
+        {
+            const size_t depth = m_Input.size();
+            m_Function( std::move(item) );
+            _OnProcessed( depth );
+        }
+    }
+
+    virtual void _Finish() {}
+    virtual size_t _GetQueueDepth() const { return m_Input.size(); }
+    virtual size_t _GetQueueCapacity() const { return m_Input.capacity(); }
+    virtual uint64_t _GetFullWaitCount() const { return m_Input.GetFullWaitCount(); }
+
+private:
+    RequestBoundedQueue<In> m_Input;
+    Function m_Function;
+};
+
+/**
+ *  段ごとに別のスレッドで処理を進めるパイプライン
+ *  段の間は大きさの決まったキューでつなぎ、次の段が詰まっていれば前の段が待つ
+ *  段を流れる型はデフォルトコンストラクトとムーブができること
+ *
+ *  例: RequestPipeline<Packet> pipeline;
+ *      pipeline.Begin()
+ *          .Then<Command>( "decode", []( Packet&& packet, RequestPipelineOutput<Command>& out ){ out.Push( Decode(packet) ); } )
+ *          .Then<Command>( "validate", []( Command&& command, RequestPipelineOutput<Command>& out ){ if( IsValid(command) ) out.Push( std::move(command) ); }, 2 )
+ *          .Finally( "apply", []( Command&& command ){ Apply(command); } );
+ *      pipeline.Start();
+ *      pipeline.Push( std::move(packet) );
+ *      pipeline.Stop();
+ */
+template< typename Input >
+class RequestPipeline
+{
+public:
+    static const size_t DEFAULT_CAPACITY = 1024;
+
+    template< typename Current >
+    class Builder
+    {
+    public:
+        Builder( RequestPipeline* pipeline, RequestBoundedQueue<Current>** connect )
+        :m_Pipeline(pipeline)
+        ,m_Connect(connect)
+        {}
+
+        // threadCount個のスレッドで処理する段を足す。capacityはこの段の入力キューの大きさ
+        template< typename Out >
+        Builder<Out> Then( const std::string& name, const typename RequestPipelineStage<Current, Out>::Function& function, size_t threadCount=1, size_t capacity=DEFAULT_CAPACITY )
+        {
+            RequestPipelineStage<Current, Out>* stage = new RequestPipelineStage<Current, Out>( name, function, threadCount, capacity );
+            m_Pipeline->m_Stages.push_back( std::unique_ptr<RequestPipelineStageBase>( stage ) );
+            *m_Connect = &stage->GetInput();
+            return Builder<Out>( m_Pipeline, &stage->GetOutputQueue() );
+        }
+
+        // 最後の段を足す
+        void Finally( const std::string& name, const typename RequestPipelineStage<Current, void>::Function& function, size_t threadCount=1, size_t capacity=DEFAULT_CAPACITY )
+        {
+            RequestPipelineStage<Current, void>* stage = new RequestPipelineStage<Current, void>( name, function, threadCount, capacity );
+            m_Pipeline->m_Stages.push_back( std::unique_ptr<RequestPipelineStageBase>( stage ) );
+            *m_Connect = &stage->GetInput();
+            m_Pipeline->m_Complete = true;
+        }
+
+    private:
+        RequestPipeline* m_Pipeline;
+        RequestBoundedQueue<Current>** m_Connect;   // 次に足す段の入力キューをつなぐ先
+    };
+
+public:
+    RequestPipeline()
+    :m_Head(nullptr)
+    ,m_Complete(false)
+    ,m_Started(false)
+    {}
+
+    ~RequestPipeline()
+    {
+        Stop();
+    }
+
+private:
+    RequestPipeline( const RequestPipeline& ) = delete;
+    RequestPipeline& operator=( const RequestPipeline& ) = delete;
+
+public:
+    Builder<Input> Begin()
+    {
+        return Builder<Input>( this, &m_Head );
+    }
+
+    // Finallyまでつないでいなければfalse。Stopした後は入力を開き直してもう一度動かす
+    bool Start()
+    {
+        if( !m_Complete || m_Started )
+        {
+            return false;
+        }
+        m_StartTime = std::chrono::steady_clock::now();
+        for( std::unique_ptr<RequestPipelineStageBase>& stage : m_Stages )
+        {
+            stage->Start();
+        }
+        m_Started = true;
+        return true;
+    }
+
+    /**
+     *  最初の段の入力キューが空くまで待つ。Finallyまでつないでいないか、Stopした後はfalse
+     *  Stopと同時に呼んだときは、追加できても次のStartまで処理されないことがある
+     */
+    bool Push( Input&& item )
+    {
+        if( !m_Complete )
+        {
+            return false;
+        }
+        return m_Head->Push( std::move(item) );
+    }
+
+    // 最初の段の入力キューが埋まっているか、Finallyまでつないでいないか、Stopした後ならfalse
+    bool TryPush( Input&& item )
+    {
+        if( !m_Complete )
+        {
+            return false;
+        }
+        return m_Head->TryPush( std::move(item) );
+    }
+
+    // 入力を閉じて、流れている分を全ての段が処理し終えるまで待つ
+    void Stop()
+    {
+        if( !m_Started )
+        {
+            return;
+        }
+        m_Head->Close();
+        for( std::unique_ptr<RequestPipelineStageBase>& stage : m_Stages )
+        {
+            stage->Join();
+        }
+        m_Started = false;
+    }
+
+    std::vector<RequestPipelineStageStats> GetStats() const
+    {
+        const double seconds = std::chrono::duration<double>( std::chrono::steady_clock::now() - m_StartTime ).count();
+        std::vector<RequestPipelineStageStats> stats;
+        for( const std::unique_ptr<RequestPipelineStageBase>& stage : m_Stages )
+        {
+            stats.push_back( stage->GetStats( seconds ) );
+        }
+        return stats;
+    }
+
+    void PrintStats( std::ostream& out ) const
+    {
+        out << "stage\tprocessed\tthroughput\tdepth\tmaxDepth\tcapacity\tbackpressure" << std::endl;
+        for( const RequestPipelineStageStats& stats : GetStats() )
+        {
+            out << stats.name << "\t" << stats.processed << "\t" << stats.throughput << "\t" << stats.queueDepth << "\t"
+                << stats.maxQueueDepth << "\t" << stats.queueCapacity << "\t" << stats.backpressureWaits << std::endl;
+        }
+    }
+
+private:
+    std::vector< std::unique_ptr<RequestPipelineStageBase> > m_Stages;
+    RequestBoundedQueue<Input>* m_Head;     // 最初の段の入力キュー
+    bool m_Complete;
+    bool m_Started;
+    std::chrono::steady_clock::time_point m_StartTime;
+};
+
+#endif /* defined(__RequestAndUpdate__RequestPipeline__) */
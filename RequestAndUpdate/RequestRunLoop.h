@@ -0,0 +1,194 @@
+/*
+ * Copyright (c) 2013, nilfs
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * * Neither the name of the <ORGANIZATION> nor the names of its contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __RequestAndUpdate__RequestRunLoop__
+#define __RequestAndUpdate__RequestRunLoop__
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <cstdint>
+
+/**
+ *  止める側が持つ。GetTokenで渡したトークンに止めるように伝える
+ */
+class RequestStopToken;
+
+class RequestStopSource
+{
+public:
+    RequestStopSource()
+    :m_Stopped(std::make_shared< std::atomic<bool> >(false))
+    {}
+
+    void RequestStop()
+    {
+        m_Stopped->store( true, std::memory_order_release );
+    }
+
+    bool StopRequested() const
+    {
+        return m_Stopped->load( std::memory_order_acquire );
+    }
+
+    RequestStopToken GetToken() const;
+
+private:
+    std::shared_ptr< std::atomic<bool> > m_Stopped;
+};
+
+/**
+ *  止めるように言われたかを見るだけの側。コピーして渡してよい
+ */
+class RequestStopToken
+{
+public:
+    bool StopRequested() const
+    {
+        return m_Stopped->load( std::memory_order_acquire );
+    }
+
+private:
+    friend class RequestStopSource;
+
+    explicit RequestStopToken( const std::shared_ptr< std::atomic<bool> >& stopped )
+    :m_Stopped(stopped)
+    {}
+
+private:
+    std::shared_ptr< std::atomic<bool> > m_Stopped;
+};
+
+inline RequestStopToken RequestStopSource::GetToken() const
+{
+    return RequestStopToken( m_Stopped );
+}
+
+/**
+ *  Runの待ち方
+ *  spinDuration: 空になってから寝るまで、スレッドを譲りながら待つ時間。短い間隔で来るリクエストの遅延を減らす
+ *  parkTimeout  : 1回寝る最大の時間。起こされなくても、この間隔で止めるように言われていないか確かめる
+ *                 Duration::max()のように今の時刻に足すと溢れるほど長ければ、起こされるまで寝る
+ */
+struct RequestRunOptions
+{
+    typedef std::chrono::steady_clock::duration Duration;
+
+    RequestRunOptions( Duration spin=std::chrono::microseconds(50), Duration park=std::chrono::milliseconds(100) )
+    :spinDuration(spin)
+    ,parkTimeout(park)
+    {}
+
+    Duration spinDuration;
+    Duration parkTimeout;
+};
+
+/**
+ *  消費する1スレッドを寝かせておき、追加した側から起こす
+ *  寝る側はPrepareの後にもう一度キューが空か確かめてからParkする。追加した側はキューに入れた後にNotifyする
+ *  どちらも順序の揃うフェンスを挟むので、確かめた後に入ったリクエストを見落として寝続けることはない
+ *  続けて何度Notifyしても、寝ている1回につき起こすのは1回だけ
+ */
+class RequestWakeup
+{
+public:
+    RequestWakeup()
+    :m_Parked(false)
+    ,m_WakeCount(0)
+    {}
+
+private:
+    RequestWakeup( const RequestWakeup& ) = delete;
+    RequestWakeup& operator=( const RequestWakeup& ) = delete;
+
+public:
+    // 追加した側から呼ぶ
+    void Notify()
+    {
+        std::atomic_thread_fence( std::memory_order_seq_cst );
+        if( m_Parked.load( std::memory_order_relaxed ) && m_Parked.exchange( false, std::memory_order_relaxed ) )
+        {
+            std::lock_guard<std::mutex> lock( m_Mutex );
+            m_WakeCount.fetch_add( 1, std::memory_order_relaxed );
+            m_Condition.notify_one();
+        }
+    }
+
+    // 以下は寝る側から呼ぶ
+    void Prepare()
+    {
+        m_Parked.store( true, std::memory_order_relaxed );
+        std::atomic_thread_fence( std::memory_order_seq_cst );
+    }
+
+    // Prepareの後で、やることが見つかったので寝るのをやめる
+    void Cancel()
+    {
+        m_Parked.store( false, std::memory_order_relaxed );
+    }
+
+    // Notifyされるかtimeoutが過ぎるまで寝る。今の時刻に足すと溢れるほど長いtimeoutは、Notifyされるまで寝る
+    template< typename Rep, typename Period >
+    void Park( const std::chrono::duration<Rep, Period>& timeout )
+    {
+        typedef std::chrono::steady_clock Clock;
+
+        std::unique_lock<std::mutex> lock( m_Mutex );
+        auto woken = [this]{ return !m_Parked.load( std::memory_order_relaxed ); };
+
+        // wait_forは今の時刻に足してから待つので、Duration::max()などは溢れて、すぐに戻ってしまう
+        // 型ごとの範囲を気にせず比べられるように、残りの時間はdoubleの秒で比べる
+        const Clock::time_point now = Clock::now();
+        const std::chrono::duration<double> limit = Clock::time_point::max() - now;
+        if( std::chrono::duration<double>( timeout ) < limit )
+        {
+            m_Condition.wait_until( lock, now + std::chrono::duration_cast<Clock::duration>( timeout ), woken );
+        }
+        else
+        {
+            m_Condition.wait( lock, woken );
+        }
+        m_Parked.store( false, std::memory_order_relaxed );
+    }
+
+    uint64_t GetWakeCount() const
+    {
+        return m_WakeCount.load( std::memory_order_relaxed );
+    }
+
+private:
+    std::atomic<bool> m_Parked;
+    std::mutex m_Mutex;
+    std::condition_variable m_Condition;
+    std::atomic<uint64_t> m_WakeCount;
+};
+
+#endif /* defined(__RequestAndUpdate__RequestRunLoop__) */
@@ -0,0 +1,444 @@
+/*
+ * Copyright (c) 2013, nilfs
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * * Neither the name of the <ORGANIZATION> nor the names of its contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __RequestAndUpdate__RequestSort__
+#define __RequestAndUpdate__RequestSort__
+
+#include <vector>
+#include <algorithm>
+#include <type_traits>
+#include <limits>
+#include <cstdint>
+#include <cstring>
+#include <cstddef>
+
+/**
+ *  キーで並べるときの並べ方
+ *  REQUEST_SORT_AUTO  : 数が多ければ基数ソート、少なければpdqsort
+ *  REQUEST_SORT_RADIX : 常にLSD基数ソート
+ *  REQUEST_SORT_PDQ   : 常にpdqsort。同じキーの順番は保証しない
+ *  REQUEST_SORT_STABLE: 同じキーは追加された順番のまま並べる
+ */
+enum RequestSortEngine
+{
+    REQUEST_SORT_AUTO,
+    REQUEST_SORT_RADIX,
+    REQUEST_SORT_PDQ,
+    REQUEST_SORT_STABLE,
+};
+
+// 並べ替えの単位。リクエスト本体は動かさず、キーと添字だけを並べる
+struct RequestSortEntry
+{
+    uint64_t key;
+    uint32_t index;
+};
+
+/**
+ *  キーを大小関係を保ったまま符号なし64bitに変換する
+ *  整数と浮動小数点数はどちらも基数ソートで並べられるようになる
+ */
+template< typename Key, typename Enable=void >
+struct RequestSortKeyTraits;
+
+template< typename Key >
+struct RequestSortKeyTraits< Key, typename std::enable_if< std::is_integral<Key>::value && std::is_unsigned<Key>::value >::type >
+{
+    static uint64_t Encode( Key key ){ return static_cast<uint64_t>(key); }
+};
+
+template< typename Key >
+struct RequestSortKeyTraits< Key, typename std::enable_if< std::is_integral<Key>::value && std::is_signed<Key>::value >::type >
+{
+    // 符号ビットを反転すると負の数が前に来る
+    static uint64_t Encode( Key key ){ return static_cast<uint64_t>( static_cast<int64_t>(key) ) ^ ( 1ULL << 63 ); }
+};
+
+template< typename Key >
+struct RequestSortKeyTraits< Key, typename std::enable_if< std::is_floating_point<Key>::value >::type >
+{
+    // 正の数は符号ビットを立て、負の数は全ビットを反転する
+    // 符号ビットの立ったNaNは先頭に来てしまうので、NaNは正のquiet NaNにそろえて最後に並べる
+    static uint64_t Encode( Key key )
+    {
+        double value = static_cast<double>(key);
+        if( value != value )
+        {
+            value = std::numeric_limits<double>::quiet_NaN();
+        }
+        else if( value == 0.0 )
+        {
+            value = 0.0;    // -0を0にそろえる
+        }
+        uint64_t bits = 0;
+        std::memcpy( &bits, &value, sizeof(bits) );
+        return ( bits & ( 1ULL << 63 ) ) ? ~bits : ( bits | ( 1ULL << 63 ) );
+    }
+};
+
+template< typename Key >
+struct RequestSortKeyTraits< Key, typename std::enable_if< std::is_enum<Key>::value >::type >
+{
+    static uint64_t Encode( Key key )
+    {
+        typedef typename std::underlying_type<Key>::type Underlying;
+        return RequestSortKeyTraits<Underlying>::Encode( static_cast<Underlying>(key) );
+    }
+};
+
+/**
+ *  キーと添字の組を並べる
+ *  基数ソート用の作業領域を持っているので、同じオブジェクトを使い回せばメモリ確保しない
+ */
+class RequestSorter
+{
+public:
+    // これより少なければ基数ソートより比較ソートの方が速い
+    static const size_t RADIX_THRESHOLD = 256;
+
+public:
+    void Sort( std::vector<RequestSortEntry>& entries, RequestSortEngine engine )
+    {
+        const size_t size = entries.size();
+        if( size < 2 )
+        {
+            return;
+        }
+
+        switch( engine )
+        {
+            case REQUEST_SORT_RADIX:
+                _RadixSort( entries );
+                break;
+
+            case REQUEST_SORT_PDQ:
+                _PdqSort( entries.data(), entries.data() + size, _Log2(size), true );
+                break;
+
+            case REQUEST_SORT_STABLE:
+                // 基数ソートは安定している
+                if( RADIX_THRESHOLD <= size )
+                {
+                    _RadixSort( entries );
+                }
+                else
+                {
+                    _InsertionSort( entries.data(), entries.data() + size );
+                }
+                break;
+
+            case REQUEST_SORT_AUTO:
+            default:
+                if( RADIX_THRESHOLD <= size )
+                {
+                    _RadixSort( entries );
+                }
+                else
+                {
+                    _PdqSort( entries.data(), entries.data() + size, _Log2(size), true );
+                }
+                break;
+        }
+    }
+
+private:
+    static const size_t INSERTION_SORT_THRESHOLD = 24;
+    static const size_t NINTHER_THRESHOLD = 128;
+    static const size_t PARTIAL_INSERTION_SORT_LIMIT = 8;
+
+    static bool _Less( const RequestSortEntry& lhs, const RequestSortEntry& rhs ){ return lhs.key < rhs.key; }
+
+    static int _Log2( size_t size )
+    {
+        int log = 0;
+        while( size >>= 1 )
+        {
+            ++log;
+        }
+        return log;
+    }
+
+    /**
+     *  8bitずつ下の桁から並べる
+     *  最初に全桁の度数を1度に数えて、全要素が同じ値になる桁は飛ばす
+     */
+    void _RadixSort( std::vector<RequestSortEntry>& entries )
+    {
+        const size_t size = entries.size();
+        m_Scratch.resize( size );
+
+        size_t counts[8][256];
+        std::memset( counts, 0, sizeof(counts) );
+        for( const RequestSortEntry& entry : entries )
+        {
+            const uint64_t key = entry.key;
+            for( int digit=0; digit<8; ++digit )
+            {
+                ++counts[digit][ ( key >> ( digit * 8 ) ) & 0xff ];
+            }
+        }
+
+        RequestSortEntry* source = entries.data();
+        RequestSortEntry* destination = m_Scratch.data();
+        for( int digit=0; digit<8; ++digit )
+        {
+            size_t* count = counts[digit];
+            if( count[ ( source[0].key >> ( digit * 8 ) ) & 0xff ] == size )
+            {
+                continue;
+            }
+
+            size_t offset = 0;
+            for( int bucket=0; bucket<256; ++bucket )
+            {
+                const size_t n = count[bucket];
+                count[bucket] = offset;
+                offset += n;
+            }
+            for( size_t i=0; i<size; ++i )
+            {
+                destination[ count[ ( source[i].key >> ( digit * 8 ) ) & 0xff ]++ ] = source[i];
+            }
+            std::swap( source, destination );
+        }
+
+        if( source != entries.data() )
+        {
+            std::memcpy( entries.data(), source, size * sizeof(RequestSortEntry) );
+        }
+    }
+
+    static void _InsertionSort( RequestSortEntry* begin, RequestSortEntry* end )
+    {
+        for( RequestSortEntry* current = begin + 1; current < end; ++current )
+        {
+            RequestSortEntry* sift = current;
+            if( _Less( *sift, *( sift - 1 ) ) )
+            {
+                const RequestSortEntry entry = *sift;
+                do
+                {
+                    *sift = *( sift - 1 );
+                    --sift;
+                } while( begin < sift && _Less( entry, *( sift - 1 ) ) );
+                *sift = entry;
+            }
+        }
+    }
+
+    // ほぼ並んでいるときだけ挿入ソートで仕上げる。動かす量が多すぎたらやめてfalseを返す
+    static bool _PartialInsertionSort( RequestSortEntry* begin, RequestSortEntry* end )
+    {
+        size_t moved = 0;
+        for( RequestSortEntry* current = begin + 1; current < end; ++current )
+        {
+            RequestSortEntry* sift = current;
+            if( _Less( *sift, *( sift - 1 ) ) )
+            {
+                const RequestSortEntry entry = *sift;
+                do
+                {
+                    *sift = *( sift - 1 );
+                    --sift;
+                } while( begin < sift && _Less( entry, *( sift - 1 ) ) );
+                *sift = entry;
+                moved += current - sift;
+            }
+            if( PARTIAL_INSERTION_SORT_LIMIT < moved )
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    static void _Sort2( RequestSortEntry* a, RequestSortEntry* b )
+    {
+        if( _Less( *b, *a ) )
+        {
+            std::swap( *a, *b );
+        }
+    }
+
+    static void _Sort3( RequestSortEntry* a, RequestSortEntry* b, RequestSortEntry* c )
+    {
+        _Sort2( a, b );
+        _Sort2( b, c );
+        _Sort2( a, b );
+    }
+
+    // 先頭をピボットにして、ピボット未満と以上に分ける。分ける前から分かれていたかも返す
+    static RequestSortEntry* _PartitionRight( RequestSortEntry* begin, RequestSortEntry* end, bool& alreadyPartitioned )
+    {
+        const RequestSortEntry pivot = *begin;
+        RequestSortEntry* first = begin;
+        RequestSortEntry* last = end;
+
+        while( _Less( *++first, pivot ) );
+        if( first - 1 == begin )
+        {
+            while( first < last && !_Less( *--last, pivot ) );
+        }
+        else
+        {
+            while( !_Less( *--last, pivot ) );
+        }
+
+        alreadyPartitioned = last <= first;
+        while( first < last )
+        {
+            std::swap( *first, *last );
+            while( _Less( *++first, pivot ) );
+            while( !_Less( *--last, pivot ) );
+        }
+
+        RequestSortEntry* pivotPosition = first - 1;
+        *begin = *pivotPosition;
+        *pivotPosition = pivot;
+        return pivotPosition;
+    }
+
+    // ピボットと同じキーが多いときに、同じキーを左にまとめる
+    static RequestSortEntry* _PartitionLeft( RequestSortEntry* begin, RequestSortEntry* end )
+    {
+        const RequestSortEntry pivot = *begin;
+        RequestSortEntry* first = begin;
+        RequestSortEntry* last = end;
+
+        while( _Less( pivot, *--last ) );
+        if( last + 1 == end )
+        {
+            while( first < last && !_Less( pivot, *++first ) );
+        }
+        else
+        {
+            while( !_Less( pivot, *++first ) );
+        }
+
+        while( first < last )
+        {
+            std::swap( *first, *last );
+            while( _Less( pivot, *--last ) );
+            while( !_Less( pivot, *++first ) );
+        }
+
+        *begin = *last;
+        *last = pivot;
+        return last;
+    }
+
+    /**
+     *  pattern-defeating quicksort
+     *  偏った分割が続いたら要素を入れ替えてパターンを崩し、それでも駄目ならヒープソートに切り替える
+     */
+    static void _PdqSort( RequestSortEntry* begin, RequestSortEntry* end, int badAllowed, bool leftmost )
+    {
+        for(;;)
+        {
+            const size_t size = end - begin;
+            if( size < INSERTION_SORT_THRESHOLD )
+            {
+                _InsertionSort( begin, end );
+                return;
+            }
+
+            // ピボットは3点か9点の中央値
+            const size_t half = size / 2;
+            if( NINTHER_THRESHOLD < size )
+            {
+                _Sort3( begin, begin + half, end - 1 );
+                _Sort3( begin + 1, begin + ( half - 1 ), end - 2 );
+                _Sort3( begin + 2, begin + ( half + 1 ), end - 3 );
+                _Sort3( begin + ( half - 1 ), begin + half, begin + ( half + 1 ) );
+                std::swap( *begin, *( begin + half ) );
+            }
+            else
+            {
+                _Sort3( begin + half, begin, end - 1 );
+            }
+
+            // 左隣がピボットと同じなら、ピボットと同じキーは全てここより左には来ない
+            if( !leftmost && !_Less( *( begin - 1 ), *begin ) )
+            {
+                begin = _PartitionLeft( begin, end ) + 1;
+                continue;
+            }
+
+            bool alreadyPartitioned = false;
+            RequestSortEntry* pivotPosition = _PartitionRight( begin, end, alreadyPartitioned );
+
+            const size_t leftSize = pivotPosition - begin;
+            const size_t rightSize = end - ( pivotPosition + 1 );
+            if( leftSize < size / 8 || rightSize < size / 8 )
+            {
+                if( --badAllowed == 0 )
+                {
+                    std::make_heap( begin, end, _Less );
+                    std::sort_heap( begin, end, _Less );
+                    return;
+                }
+
+                if( INSERTION_SORT_THRESHOLD <= leftSize )
+                {
+                    std::swap( *begin, *( begin + leftSize / 4 ) );
+                    std::swap( *( pivotPosition - 1 ), *( pivotPosition - leftSize / 4 ) );
+                }
+                if( INSERTION_SORT_THRESHOLD <= rightSize )
+                {
+                    std::swap( *( pivotPosition + 1 ), *( pivotPosition + ( 1 + rightSize / 4 ) ) );
+                    std::swap( *( end - 1 ), *( end - rightSize / 4 ) );
+                }
+            }
+            else if( alreadyPartitioned
+                    && _PartialInsertionSort( begin, pivotPosition )
+                    && _PartialInsertionSort( pivotPosition + 1, end ) )
+            {
+                return;
+            }
+
+            // 小さい方を再帰して、大きい方はループで続ける
+            if( leftSize < rightSize )
+            {
+                _PdqSort( begin, pivotPosition, badAllowed, leftmost );
+                begin = pivotPosition + 1;
+                leftmost = false;
+            }
+            else
+            {
+                _PdqSort( pivotPosition + 1, end, badAllowed, false );
+                end = pivotPosition;
+            }
+        }
+    }
+
+private:
+    std::vector<RequestSortEntry> m_Scratch;
+};
+
+#endif /* defined(__RequestAndUpdate__RequestSort__) */
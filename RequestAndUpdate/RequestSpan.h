@@ -0,0 +1,69 @@
+/*
+ * Copyright (c) 2013, nilfs
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * * Neither the name of the <ORGANIZATION> nor the names of its contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __RequestAndUpdate__RequestSpan__
+#define __RequestAndUpdate__RequestSpan__
+
+#include <cstddef>
+
+/**
+ *  連続した領域への参照。領域は持たないので、渡された関数の中でだけ使うこと
+ */
+template< typename T >
+class RequestSpan
+{
+public:
+    RequestSpan()
+    :m_Data(nullptr)
+    ,m_Size(0)
+    {}
+
+    RequestSpan( T* data, size_t size )
+    :m_Data(data)
+    ,m_Size(size)
+    {}
+
+    T* data() const { return m_Data; }
+    size_t size() const { return m_Size; }
+    bool empty() const { return m_Size == 0; }
+    T* begin() const { return m_Data; }
+    T* end() const { return m_Data + m_Size; }
+    T& operator[]( size_t index ) const { return m_Data[index]; }
+
+    RequestSpan subspan( size_t offset, size_t count ) const
+    {
+        return RequestSpan( m_Data + offset, count );
+    }
+
+private:
+    T* m_Data;
+    size_t m_Size;
+};
+
+#endif /* defined(__RequestAndUpdate__RequestSpan__) */
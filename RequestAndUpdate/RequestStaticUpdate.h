@@ -0,0 +1,152 @@
+/*
+ * Copyright (c) 2013, nilfs
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * * Neither the name of the <ORGANIZATION> nor the names of its contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __RequestAndUpdate__RequestStaticUpdate__
+#define __RequestAndUpdate__RequestStaticUpdate__
+
+#include <vector>
+#include <tuple>
+#include <memory>
+#include <algorithm>
+#include <utility>
+
+#include "RequestUpdate.h"
+
+/**
+ *  並べ替えない場合のComparator
+ */
+struct RequestNoSort {};
+
+/**
+ *  エグゼキュータと比較関数を型として持つRequestUpdate
+ *  std::functionを経由しないので、Updateのループとstd::sortの中に直接展開される
+ *  並べ替えと実行だけの最小限の機能で、持ち越しや優先度などはBasicRequestUpdateを使う
+ *  MakeRequestUpdateで作ると型を書かずに済む
+ */
+template< typename ThreadingPolicy, typename Executer, typename Comparator, typename ArgFirst, typename ...ArgTypes >
+class BasicStaticRequestUpdate
+{
+public:
+    typedef std::tuple< ArgFirst, ArgTypes... > Parameter;
+
+public:
+    BasicStaticRequestUpdate( const Executer& executer, const Comparator& comparator=Comparator() )
+    :m_Executer(executer)
+    ,m_Comparator(comparator)
+    {}
+
+private:
+    BasicStaticRequestUpdate( const BasicStaticRequestUpdate& ) = delete;
+    BasicStaticRequestUpdate& operator=( const BasicStaticRequestUpdate& ) = delete;
+
+public:
+    /**
+     *  呼べるスレッドはThreadingPolicyで決まる
+     */
+    void AddRequest( ArgFirst argFirst, ArgTypes... args )
+    {
+        m_Requests.Push( std::move(argFirst), std::move(args)... );
+    }
+
+    /**
+     *  引数から直接リクエストを作る。右辺値はムーブされるので、ムーブしかできない型も渡せる
+     *  呼べるスレッドはThreadingPolicyで決まる
+     */
+    template< typename ...Args >
+    void EmplaceRequest( Args&&... args )
+    {
+        static_assert( sizeof...(Args) == 1 + sizeof...(ArgTypes), "argument count does not match the request" );
+        m_Requests.Push( std::forward<Args>(args)... );
+    }
+
+    size_t Update()
+    {
+        m_Requests.PopAll( m_UpdatingRequests );
+        _Sort( m_Comparator );
+
+        Indices indices;
+        for( Parameter& param : m_UpdatingRequests )
+        {
+            _Execute( param, indices );
+        }
+
+        const size_t size = m_UpdatingRequests.size();
+        m_UpdatingRequests.clear();
+        return size;
+    }
+
+private:
+    typedef typename RequestMakeIndexSequence< 1 + sizeof...(ArgTypes) >::type Indices;
+
+    template< typename Compare >
+    void _Sort( Compare& comparator )
+    {
+        std::sort( m_UpdatingRequests.begin(), m_UpdatingRequests.end(), comparator );
+    }
+
+    void _Sort( RequestNoSort& )
+    {
+    }
+
+    template< size_t... Is >
+    void _Execute( Parameter& param, RequestIndexSequence<Is...> )
+    {
+        m_Executer( std::move( std::get<Is>( param ) )... );
+    }
+
+private:
+    typename ThreadingPolicy::template Queue< Parameter > m_Requests;   //リクエスト追加用
+    std::vector< Parameter > m_UpdatingRequests;
+    Executer m_Executer;
+    Comparator m_Comparator;
+};
+
+/**
+ *  例: auto requestUpdate = MakeRequestUpdate<int, float>(
+ *          []( int id, float value ){ ... },
+ *          []( const std::tuple<int, float>& lhs, const std::tuple<int, float>& rhs ){ return std::get<0>(lhs) < std::get<0>(rhs); } );
+ */
+template< typename ArgFirst, typename ...ArgTypes, typename Executer, typename Comparator >
+std::unique_ptr< BasicStaticRequestUpdate<RequestUpdateMpsc, Executer, Comparator, ArgFirst, ArgTypes...> >
+MakeRequestUpdate( const Executer& executer, const Comparator& comparator )
+{
+    return std::unique_ptr< BasicStaticRequestUpdate<RequestUpdateMpsc, Executer, Comparator, ArgFirst, ArgTypes...> >(
+        new BasicStaticRequestUpdate<RequestUpdateMpsc, Executer, Comparator, ArgFirst, ArgTypes...>( executer, comparator ) );
+}
+
+// 並べ替えない
+template< typename ArgFirst, typename ...ArgTypes, typename Executer >
+std::unique_ptr< BasicStaticRequestUpdate<RequestUpdateMpsc, Executer, RequestNoSort, ArgFirst, ArgTypes...> >
+MakeRequestUpdate( const Executer& executer )
+{
+    return std::unique_ptr< BasicStaticRequestUpdate<RequestUpdateMpsc, Executer, RequestNoSort, ArgFirst, ArgTypes...> >(
+        new BasicStaticRequestUpdate<RequestUpdateMpsc, Executer, RequestNoSort, ArgFirst, ArgTypes...>( executer ) );
+}
+
+#endif /* defined(__RequestAndUpdate__RequestStaticUpdate__) */
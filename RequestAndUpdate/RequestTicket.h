@@ -0,0 +1,256 @@
+/*
+ * Copyright (c) 2013, nilfs
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * * Neither the name of the <ORGANIZATION> nor the names of its contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __RequestAndUpdate__RequestTicket__
+#define __RequestAndUpdate__RequestTicket__
+
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+
+/**
+ *  取り消せるリクエストの引換券。世代が合わない券(処理済み、取り消し済み)では何もできない
+ *  世代が0なら無効な券
+ */
+struct RequestTicket
+{
+    RequestTicket()
+    :index(0)
+    ,generation(0)
+    {}
+
+    RequestTicket( uint32_t index, uint32_t generation )
+    :index(index)
+    ,generation(generation)
+    {}
+
+    bool IsValid() const { return generation != 0; }
+
+    uint32_t index;
+    uint32_t generation;
+};
+
+/**
+ *  券の状態を持つ表。取り消しは世代を確かめて印を付けるだけなのでO(1)
+ *  空いた番号はロックなしのスタックで使い回す。表は固定の大きさのかたまりで伸ばし、確保した後は動かさない
+ *
+ *  Acquire, Cancel: どのスレッドから呼んでもよい
+ *  IsCancelled, Claim: 取り出す1スレッドから呼ぶ
+ */
+class RequestTicketTable
+{
+private:
+    static const uint32_t CHUNK_BITS = 14;
+    static const uint32_t CHUNK_SIZE = uint32_t(1) << CHUNK_BITS;
+    static const uint32_t MAX_CHUNKS = 1024;   // 同時に持てる券は1600万ほど
+
+    // stateは 世代 << 1 | 取り消したか
+    struct Slot
+    {
+        std::atomic<uint32_t> state;
+        std::atomic<uint32_t> next;     // 空きスタックでの次の番号+1
+    };
+
+public:
+    RequestTicketTable()
+    :m_Chunks(nullptr)
+    ,m_FreeHead(0)
+    ,m_Count(0)
+    ,m_CancelCount(0)
+    {}
+
+    ~RequestTicketTable()
+    {
+        std::atomic<Slot*>* chunks = m_Chunks.load( std::memory_order_acquire );
+        if( chunks )
+        {
+            for( uint32_t i=0; i<MAX_CHUNKS; ++i )
+            {
+                delete [] chunks[i].load( std::memory_order_relaxed );
+            }
+            delete [] chunks;
+        }
+    }
+
+private:
+    RequestTicketTable( const RequestTicketTable& ) = delete;
+    RequestTicketTable& operator=( const RequestTicketTable& ) = delete;
+
+public:
+    // 新しい券を出す。表が埋まっていれば無効な券を返す
+    RequestTicket Acquire()
+    {
+        uint32_t index = 0;
+        if( !_PopFree( index ) )
+        {
+            index = m_Count.fetch_add( 1, std::memory_order_relaxed );
+            if( CHUNK_SIZE * MAX_CHUNKS <= index )
+            {
+                m_Count.fetch_sub( 1, std::memory_order_relaxed );
+                return RequestTicket();
+            }
+            _EnsureChunk( index >> CHUNK_BITS );
+        }
+        const uint32_t state = _GetSlot( index ).state.load( std::memory_order_relaxed );
+        return RequestTicket( index, state >> 1 );
+    }
+
+    // まだ処理されていなければ取り消してtrueを返す
+    bool Cancel( const RequestTicket& ticket )
+    {
+        if( !ticket.IsValid() || m_Count.load( std::memory_order_acquire ) <= ticket.index )
+        {
+            return false;
+        }
+        uint32_t expected = ticket.generation << 1;
+        if( _GetSlot( ticket.index ).state.compare_exchange_strong( expected, expected | 1, std::memory_order_acq_rel ) )
+        {
+            m_CancelCount.fetch_add( 1, std::memory_order_relaxed );
+            return true;
+        }
+        return false;
+    }
+
+    bool IsCancelled( const RequestTicket& ticket ) const
+    {
+        return ticket.IsValid() && ( _GetSlot( ticket.index ).state.load( std::memory_order_acquire ) & 1 ) != 0;
+    }
+
+    /**
+     *  処理すると決めて券を使い切る。取り消されていたらfalse
+     *  どちらでも世代を進めて番号を返すので、その後のCancelは失敗する。無効な券ならtrue
+     */
+    bool Claim( const RequestTicket& ticket )
+    {
+        if( !ticket.IsValid() )
+        {
+            return true;
+        }
+        Slot& slot = _GetSlot( ticket.index );
+        uint32_t generation = ticket.generation + 1;
+        if( ( generation & 0x7fffffff ) == 0 )
+        {
+            generation = 1;
+        }
+        uint32_t state = slot.state.load( std::memory_order_relaxed );
+        while( !slot.state.compare_exchange_weak( state, generation << 1, std::memory_order_acq_rel ) )
+        {
+        }
+        _PushFree( ticket.index );
+        return ( state & 1 ) == 0;
+    }
+
+    // 今までに取り消した数
+    uint64_t GetCancelCount() const
+    {
+        return m_CancelCount.load( std::memory_order_relaxed );
+    }
+
+private:
+    Slot& _GetSlot( uint32_t index ) const
+    {
+        return m_Chunks.load( std::memory_order_acquire )[ index >> CHUNK_BITS ].load( std::memory_order_acquire )[ index & ( CHUNK_SIZE - 1 ) ];
+    }
+
+    // 先頭は 番号+1 | 書き換えた回数 << 32。回数で、取り出している間に入れ替わったことに気付く
+    bool _PopFree( uint32_t& index )
+    {
+        uint64_t head = m_FreeHead.load( std::memory_order_acquire );
+        while( static_cast<uint32_t>( head ) != 0 )
+        {
+            const uint32_t top = static_cast<uint32_t>( head ) - 1;
+            const uint32_t next = _GetSlot( top ).next.load( std::memory_order_relaxed );
+            const uint64_t newHead = ( ( ( head >> 32 ) + 1 ) << 32 ) | next;
+            if( m_FreeHead.compare_exchange_weak( head, newHead, std::memory_order_acquire, std::memory_order_acquire ) )
+            {
+                index = top;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void _PushFree( uint32_t index )
+    {
+        Slot& slot = _GetSlot( index );
+        uint64_t head = m_FreeHead.load( std::memory_order_relaxed );
+        uint64_t newHead = 0;
+        do
+        {
+            slot.next.store( static_cast<uint32_t>( head ), std::memory_order_relaxed );
+            newHead = ( ( ( head >> 32 ) + 1 ) << 32 ) | ( index + 1 );
+        } while( !m_FreeHead.compare_exchange_weak( head, newHead, std::memory_order_release, std::memory_order_relaxed ) );
+    }
+
+    // かたまりがなければ作る。同時に作ったら負けた方が捨てる
+    void _EnsureChunk( uint32_t chunkIndex )
+    {
+        std::atomic<Slot*>* chunks = m_Chunks.load( std::memory_order_acquire );
+        if( !chunks )
+        {
+            std::atomic<Slot*>* created = new std::atomic<Slot*>[MAX_CHUNKS];
+            for( uint32_t i=0; i<MAX_CHUNKS; ++i )
+            {
+                created[i].store( nullptr, std::memory_order_relaxed );
+            }
+            if( m_Chunks.compare_exchange_strong( chunks, created, std::memory_order_acq_rel ) )
+            {
+                chunks = created;
+            }
+            else
+            {
+                delete [] created;
+            }
+        }
+
+        if( chunks[chunkIndex].load( std::memory_order_acquire ) )
+        {
+            return;
+        }
+        Slot* chunk = new Slot[CHUNK_SIZE];
+        for( uint32_t i=0; i<CHUNK_SIZE; ++i )
+        {
+            chunk[i].state.store( 1 << 1, std::memory_order_relaxed );
+            chunk[i].next.store( 0, std::memory_order_relaxed );
+        }
+        Slot* expected = nullptr;
+        if( !chunks[chunkIndex].compare_exchange_strong( expected, chunk, std::memory_order_acq_rel ) )
+        {
+            delete [] chunk;
+        }
+    }
+
+private:
+    std::atomic< std::atomic<Slot*>* > m_Chunks;    // 使うまで確保しない
+    std::atomic<uint64_t> m_FreeHead;
+    std::atomic<uint32_t> m_Count;                  // 出したことのある番号の数
+    std::atomic<uint64_t> m_CancelCount;
+};
+
+#endif /* defined(__RequestAndUpdate__RequestTicket__) */
@@ -0,0 +1,305 @@
+/*
+ * Copyright (c) 2013, nilfs
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * * Neither the name of the <ORGANIZATION> nor the names of its contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __RequestAndUpdate__RequestTimerWheel__
+#define __RequestAndUpdate__RequestTimerWheel__
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+/**
+ *  階層タイマーホイール。時刻は呼び出し側が決めたtick単位の整数
+ *  256スロットの輪を4段重ね、近いものほど下の段に入れる。登録と取り出しはO(1)
+ *  上の段のスロットは、下の段が一周したときにまとめて下の段へ入れ直す
+ *  タイマーにはpayloadとして32bitの値だけを持たせる
+ */
+class RequestTimerWheel
+{
+public:
+    RequestTimerWheel()
+    :m_Current(0)
+    ,m_Due(NONE)
+    ,m_FreeList(NONE)
+    ,m_Count(0)
+    {
+        for( size_t level=0; level<LEVEL_COUNT; ++level )
+        {
+            for( size_t slot=0; slot<SLOT_COUNT; ++slot )
+            {
+                m_Heads[level][slot] = NONE;
+            }
+        }
+    }
+
+public:
+    /**
+     *  expireのtickで取り出す。periodが0でなければ、その後もperiodごとに取り出す
+     *  過ぎた時刻なら次のAdvanceで取り出す
+     */
+    void Schedule( uint64_t expire, uint64_t period, uint32_t payload )
+    {
+        uint32_t index = m_FreeList;
+        if( index == NONE )
+        {
+            index = static_cast<uint32_t>( m_Nodes.size() );
+            m_Nodes.push_back( Node() );
+        }
+        else
+        {
+            m_FreeList = m_Nodes[index].next;
+        }
+
+        Node& node = m_Nodes[index];
+        node.expire = expire;
+        node.period = period;
+        node.payload = payload;
+        _Insert( index );
+        ++m_Count;
+    }
+
+    /**
+     *  nowのtickまで進めて、時刻になったタイマーのpayloadでonExpire(payload, periodic)を呼ぶ
+     *  繰り返しのタイマーは遅れた分をまとめて1回にして、nowより後の次の時刻に入れ直す。onExpireがfalseを返したら止める
+     *  同じtickのタイマーの順番は決まらない
+     *  次のタイマーまで間が空いていたら、1tickずつ進めずに入れ直して一度に進む
+     */
+    template< typename Callback >
+    void Advance( uint64_t now, Callback& onExpire )
+    {
+        _Fire( m_Due, now, onExpire );
+        m_Due = NONE;
+
+        // この時刻までは一番早いタイマーを探し直さない
+        uint64_t nextSearch = m_Current;
+        while( m_Current < now )
+        {
+            if( m_Count == 0 )
+            {
+                m_Current = now;
+                break;
+            }
+
+            // 探す手間はタイマーの数に比例するので、それより長く空いているときだけ探す
+            const uint64_t skipThreshold = SLOT_COUNT < m_Count ? m_Count : SLOT_COUNT;
+            if( nextSearch <= m_Current && skipThreshold < now - m_Current )
+            {
+                const uint64_t earliest = _GetEarliestExpire();
+                if( skipThreshold < earliest - m_Current )
+                {
+                    _Rebuild( earliest - 1 < now ? earliest - 1 : now );
+                    continue;
+                }
+                nextSearch = earliest;
+            }
+
+            ++m_Current;
+            // 上の段から順に、このtickで始まる範囲を下の段へ移す
+            for( size_t level=LEVEL_COUNT-1; 0<level; --level )
+            {
+                if( ( m_Current & ( ( uint64_t(1) << ( LEVEL_BITS * level ) ) - 1 ) ) == 0 )
+                {
+                    uint32_t& head = m_Heads[level][ ( m_Current >> ( LEVEL_BITS * level ) ) & SLOT_MASK ];
+                    uint32_t index = head;
+                    head = NONE;
+                    while( index != NONE )
+                    {
+                        const uint32_t next = m_Nodes[index].next;
+                        _Insert( index );
+                        index = next;
+                    }
+                }
+            }
+
+            uint32_t& head = m_Heads[0][ m_Current & SLOT_MASK ];
+            const uint32_t list = head;
+            head = NONE;
+            _Fire( list, now, onExpire );
+            _Fire( m_Due, now, onExpire );
+            m_Due = NONE;
+        }
+    }
+
+    // 登録中の全てのタイマーのpayloadでf(payload)を呼ぶ
+    template< typename Function >
+    void ForEach( Function f ) const
+    {
+        _ForEachList( m_Due, f );
+        for( size_t level=0; level<LEVEL_COUNT; ++level )
+        {
+            for( size_t slot=0; slot<SLOT_COUNT; ++slot )
+            {
+                _ForEachList( m_Heads[level][slot], f );
+            }
+        }
+    }
+
+    size_t size() const { return m_Count; }
+    bool empty() const { return m_Count == 0; }
+    uint64_t GetCurrent() const { return m_Current; }
+
+private:
+    static const uint32_t NONE = 0xffffffffu;
+    static const size_t LEVEL_BITS = 8;
+    static const size_t LEVEL_COUNT = 4;
+    static const size_t SLOT_COUNT = size_t(1) << LEVEL_BITS;
+    static const uint64_t SLOT_MASK = SLOT_COUNT - 1;
+
+    struct Node
+    {
+        uint64_t expire;
+        uint64_t period;
+        uint32_t payload;
+        uint32_t next;
+    };
+
+private:
+    // 今の時刻からの距離で入れる段を決める
+    void _Insert( uint32_t index )
+    {
+        Node& node = m_Nodes[index];
+        if( node.expire <= m_Current )
+        {
+            node.next = m_Due;
+            m_Due = index;
+            return;
+        }
+
+        uint64_t expire = node.expire;
+        const uint64_t maxDelta = ( uint64_t(1) << ( LEVEL_BITS * LEVEL_COUNT ) ) - 1;
+        if( maxDelta < expire - m_Current )
+        {
+            // 一番上の段にも収まらなければ、届く範囲の最後に入れておいて、降りてきたときに入れ直す
+            expire = m_Current + maxDelta;
+        }
+
+        size_t level = 0;
+        while( level + 1 < LEVEL_COUNT && ( uint64_t(1) << ( LEVEL_BITS * ( level + 1 ) ) ) <= expire - m_Current )
+        {
+            ++level;
+        }
+        uint32_t& head = m_Heads[level][ ( expire >> ( LEVEL_BITS * level ) ) & SLOT_MASK ];
+        node.next = head;
+        head = index;
+    }
+
+    // 登録中のタイマーで一番早い時刻。時刻を過ぎたものは取り出し済みで、全て今より後
+    uint64_t _GetEarliestExpire() const
+    {
+        uint64_t earliest = UINT64_MAX;
+        for( size_t level=0; level<LEVEL_COUNT; ++level )
+        {
+            for( size_t slot=0; slot<SLOT_COUNT; ++slot )
+            {
+                for( uint32_t index = m_Heads[level][slot]; index != NONE; index = m_Nodes[index].next )
+                {
+                    if( m_Nodes[index].expire < earliest )
+                    {
+                        earliest = m_Nodes[index].expire;
+                    }
+                }
+            }
+        }
+        return earliest;
+    }
+
+    // 全てのタイマーを外して、currentの時刻から入れ直す。currentは一番早いタイマーより前であること
+    void _Rebuild( uint64_t current )
+    {
+        uint32_t all = NONE;
+        for( size_t level=0; level<LEVEL_COUNT; ++level )
+        {
+            for( size_t slot=0; slot<SLOT_COUNT; ++slot )
+            {
+                uint32_t index = m_Heads[level][slot];
+                m_Heads[level][slot] = NONE;
+                while( index != NONE )
+                {
+                    const uint32_t next = m_Nodes[index].next;
+                    m_Nodes[index].next = all;
+                    all = index;
+                    index = next;
+                }
+            }
+        }
+
+        m_Current = current;
+        while( all != NONE )
+        {
+            const uint32_t next = m_Nodes[all].next;
+            _Insert( all );
+            all = next;
+        }
+    }
+
+    template< typename Callback >
+    void _Fire( uint32_t index, uint64_t now, Callback& onExpire )
+    {
+        while( index != NONE )
+        {
+            const uint32_t next = m_Nodes[index].next;
+            const bool keep = onExpire( m_Nodes[index].payload, m_Nodes[index].period != 0 );
+
+            Node& node = m_Nodes[index];
+            if( node.period != 0 && keep )
+            {
+                // 過ぎた回はまとめて飛ばして、nowより後の最初の時刻にする
+                const uint64_t last = now < m_Current ? m_Current : now;
+                node.expire += ( ( last - node.expire ) / node.period + 1 ) * node.period;
+                _Insert( index );
+            }
+            else
+            {
+                node.next = m_FreeList;
+                m_FreeList = index;
+                --m_Count;
+            }
+            index = next;
+        }
+    }
+
+    template< typename Function >
+    void _ForEachList( uint32_t index, Function& f ) const
+    {
+        for( ; index != NONE; index = m_Nodes[index].next )
+        {
+            f( m_Nodes[index].payload );
+        }
+    }
+
+private:
+    std::vector<Node> m_Nodes;
+    uint32_t m_Heads[LEVEL_COUNT][SLOT_COUNT];  // スロットごとのタイマーの単方向リスト
+    uint64_t m_Current;     // 処理済みのtick
+    uint32_t m_Due;         // 時刻を過ぎてから登録されたタイマー
+    uint32_t m_FreeList;
+    size_t m_Count;
+};
+
+#endif /* defined(__RequestAndUpdate__RequestTimerWheel__) */
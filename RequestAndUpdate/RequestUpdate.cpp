@@ -7,3 +7,6 @@
 //
 
 #include "RequestUpdate.h"
+
+// よく使う型を実体化しておく。使う側はREQUEST_UPDATE_EXTERN_TEMPLATEを定義すると実体化を省ける
+template class BasicRequestUpdate<RequestUpdateMpsc, int>;
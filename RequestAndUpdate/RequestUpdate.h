@@ -9,6 +9,2135 @@
 #ifndef __RequestAndUpdate__RequestUpdate__
 #define __RequestAndUpdate__RequestUpdate__
 
-#include <iostream>
+#include <functional>
+#include <vector>
+#include <tuple>
+#include <algorithm>
+#include <iterator>
+#include <utility>
+#include <deque>
+#include <limits>
+#include <chrono>
+#include <atomic>
+#include <type_traits>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstdint>
+
+#include "MpscRequestQueue.h"
+#include "SpscRequestQueue.h"
+#include "RequestSort.h"
+#include "RequestHeap.h"
+#include "RequestWorkerPool.h"
+#include "RequestKeyTable.h"
+#include "RequestSpan.h"
+#include "RequestArena.h"
+#include "RequestTimerWheel.h"
+#include "RequestInstrument.h"
+#include "RequestRunLoop.h"
+#include "RequestTicket.h"
+
+/**
+ * std::tupleを関数の引数にする実装をここから持ってきた http://d.hatena.ne.jp/redboltz/20110811/1313024577
+ * std::functionに対応するために少し変更してある
+ * 実行した後のパラメータは使わないので、要素は右辺値で渡す
+ */
+template <class F, class... Ts, class... Us>
+typename std::enable_if<
+sizeof...(Us) == sizeof...(Ts),
+typename F::result_type>::type
+apply_impl(F& fun, std::tuple<Ts...>& args, Us*... us)
+{
+    return fun(std::move(*us)...);
+}
+
+template <class F, class... Ts, class... Us>
+typename std::enable_if<
+sizeof...(Us) < sizeof...(Ts),
+typename F::result_type>::type
+apply_impl(F& fun, std::tuple<Ts...>& args, Us*... us)
+{
+    return apply_impl(fun, args, us..., &std::get<sizeof...(Us)>(args));
+}
+
+template <class F, class... Ts>
+typename F::result_type
+apply(F& fun, std::tuple<Ts...>& args)
+{
+    return apply_impl(fun, args);
+}
+
+// 0からN-1までの添字の並び
+template< size_t... Indices >
+struct RequestIndexSequence {};
+
+template< size_t N, size_t... Indices >
+struct RequestMakeIndexSequence : RequestMakeIndexSequence< N-1, N-1, Indices... > {};
+
+template< size_t... Indices >
+struct RequestMakeIndexSequence< 0, Indices... >
+{
+    typedef RequestIndexSequence< Indices... > type;
+};
+
+/**
+ *  スレッドの扱い
+ *  RequestUpdateSingleThread          : AddRequestとUpdateを同じ1スレッドから呼ぶ。同期を一切しない
+ *  RequestUpdateSpsc                  : AddRequestを呼ぶスレッドとUpdateを呼ぶスレッドがそれぞれ1つだけ。ロックしないが、
+ *                                       キューが埋まるとAddRequestの中でメモリ確保する
+ *  RequestUpdateSpscFixed<Capacity>   : RequestUpdateSpscのキューをCapacity件に固定する。AddRequestはメモリ確保せず、
+ *                                       埋まっていたらUpdateが取り出すまで待つ
+ *  RequestUpdateMpsc                  : AddRequestはどのスレッドから呼んでもよい(今までの動作)
+ */
+struct RequestUpdateSingleThread
+{
+    template< typename T >
+    class Queue
+    {
+    public:
+        template< typename ...Args >
+        void Push( Args&&... args )
+        {
+            m_Items.emplace_back( std::forward<Args>(args)... );
+        }
+
+        void PopAll( std::vector<T>& out )
+        {
+            if( out.empty() )
+            {
+                // 入れ替えれば両方のバッファの領域を使い回せる
+                out.swap( m_Items );
+                return;
+            }
+            std::move( m_Items.begin(), m_Items.end(), std::back_inserter(out) );
+            m_Items.clear();
+        }
+
+        bool IsEmpty() const
+        {
+            return m_Items.empty();
+        }
+
+    private:
+        std::vector<T> m_Items;
+    };
+};
+
+struct RequestUpdateSpsc
+{
+    template< typename T >
+    class Queue : public SpscRequestQueue<T> {};
+};
+
+template< size_t Capacity >
+struct RequestUpdateSpscFixed
+{
+    template< typename T >
+    class Queue : public SpscRequestQueue<T>
+    {
+    public:
+        Queue() : SpscRequestQueue<T>( Capacity, false ) {}
+    };
+};
+
+struct RequestUpdateMpsc
+{
+    template< typename T >
+    class Queue : public MpscRequestQueue<T> {};
+};
+
+/**
+ *  1回のUpdateで使ってよい時間と件数。どちらかを使い切ったら残りは次のUpdateに持ち越す
+ *  時間は1件処理するごとに確認するので、最後の1件の分だけ超えることがある
+ */
+struct RequestUpdateBudget
+{
+    typedef std::chrono::steady_clock::duration Duration;
+
+    RequestUpdateBudget( size_t count=std::numeric_limits<size_t>::max() )
+    :maxDuration(Duration::max())
+    ,maxCount(count)
+    {}
+
+    RequestUpdateBudget( Duration duration, size_t count=std::numeric_limits<size_t>::max() )
+    :maxDuration(duration)
+    ,maxCount(count)
+    {}
+
+    bool HasTimeLimit() const { return maxDuration != Duration::max(); }
+
+    Duration maxDuration;
+    size_t maxCount;
+};
+
+/**
+ *  Updateの統計
+ */
+struct RequestUpdateStats
+{
+    uint64_t updateCount;           // Updateを呼んだ回数
+    uint64_t executedCount;         // 処理したリクエストの総数
+    uint64_t timeBudgetExhausted;   // 時間を使い切って打ち切った回数
+    uint64_t countBudgetExhausted;  // 件数を使い切って打ち切った回数
+    size_t lastExecuted;            // 前回のUpdateで処理した数
+    size_t carryOver;               // 次のUpdateに持ち越している数
+    size_t maxCarryOver;            // 持ち越しの最大値
+    uint64_t coalescedCount;        // 同じキーのリクエストとまとめて減った数
+    uint64_t parkCount;             // Runで寝た回数
+    uint64_t wakeupCount;           // Runで寝ているところをAddRequestで起こした回数
+    uint64_t cancelledCount;        // 取り消されていたので処理せずに捨てた数
+};
+
+/**
+ *  SetRequestCapacityで決めた数を超えたときの扱い
+ */
+enum RequestOverloadPolicy
+{
+    REQUEST_OVERLOAD_REJECT,        // 追加しない。AddRequestがfalseを返す
+    REQUEST_OVERLOAD_BLOCK,         // 空くまで待つ。時間切れならfalseを返す
+    REQUEST_OVERLOAD_DROP_OLDEST,   // 追加して、Updateで古いものから捨てる。上限の2倍に達したら追加しない
+    REQUEST_OVERLOAD_DROP_LOWEST,   // 追加して、Updateで処理する順の最後から捨てる。キーなら大きいもの、比較関数なら後に並ぶもの、同じなら新しいもの。上限の2倍に達したら追加しない
+};
+
+/**
+ *  上限を超えたときの統計。どのスレッドから読んでもよい
+ */
+struct RequestOverloadStats
+{
+    uint64_t rejectedCount;     // 追加しなかった数
+    uint64_t droppedCount;      // 追加した後で捨てた数
+    uint64_t blockedCount;      // 空きを待った数
+    uint64_t fullCount;         // 追加しようとしたときに上限に達していた回数
+    size_t waitingCount;        // 処理を待っている数の目安
+    size_t capacity;            // 0なら上限なし
+    bool full;                  // 今上限に達しているか
+};
+
+/**
+ *  優先度ごとのバケツの中で処理する順番
+ */
+enum RequestBucketOrder
+{
+    REQUEST_BUCKET_FIFO,    // 追加した順
+    REQUEST_BUCKET_LIFO,    // 後から追加したものから
+};
+
+/**
+ *  同じキーのリクエストをまとめるときに残す方
+ */
+enum RequestCoalesceMode
+{
+    REQUEST_COALESCE_LAST,  // 最後に追加したもの
+    REQUEST_COALESCE_FIRST, // 最初に追加したもの
+};
+
+template< typename ThreadingPolicy, typename ArgFirst, typename ...ArgTypes >
+class BasicRequestUpdate
+{
+private:
+    typedef std::function< void(ArgFirst, ArgTypes...)> RequestExecuter;
+    typedef std::tuple< ArgFirst, ArgTypes... > Parameter;
+    
+    typedef std::function< bool(const Parameter&, const Parameter&)> SortPredicator;
+    typedef std::function< uint64_t(const Parameter&)> SortKeyProjection;
+    typedef std::function< size_t(const Parameter&)> PriorityProjection;
+    typedef std::function< uint64_t(const Parameter&)> LaneKeyProjection;
+    typedef std::function< uint64_t(const Parameter&)> CoalesceKeyProjection;
+    typedef std::function< void(RequestSpan<const Parameter>)> BatchExecuter;
+    typedef std::function< void(Parameter& merged, Parameter&& incoming)> CoalesceReducer;
+
+public:
+    typedef RequestUpdateBudget Budget;
+    typedef std::chrono::steady_clock::time_point TimePoint;
+    typedef std::chrono::steady_clock::duration Duration;
+    typedef std::function< TimePoint() > TimerClock;
+
+public:
+    BasicRequestUpdate()
+    :m_SortEngine(REQUEST_SORT_AUTO)
+    ,m_BucketOrder(REQUEST_BUCKET_FIFO)
+    ,m_Sequence(0)
+    ,m_Generation(0)
+    ,m_AgingUpdates(0)
+    ,m_OldestPendingGeneration(0)
+    ,m_WorkerPool(nullptr)
+    ,m_LaneBits(0)
+    ,m_BatchChunkSize(0)
+    ,m_ArenaIndex(0)
+    ,m_UpdatingArena(NO_ARENA)
+    ,m_ArenaShrinkInterval(0)
+    ,m_HasTimerRequests(false)
+    ,m_TimerClock(&std::chrono::steady_clock::now)
+    ,m_TimerResolution(std::chrono::milliseconds(1))
+    ,m_TimerStarted(false)
+    ,m_CancelCheckpoint(0)
+    ,m_Capacity(0)
+    ,m_OverloadPolicy(REQUEST_OVERLOAD_REJECT)
+    ,m_BlockTimeout(Duration::max())
+    ,m_QueuedCount(0)
+    ,m_InFlightCount(0)
+    ,m_TrimCount(0)
+    ,m_RejectedCount(0)
+    ,m_DroppedCount(0)
+    ,m_BlockedCount(0)
+    ,m_FullCount(0)
+    ,m_SpaceWaiters(0)
+    {
+        m_ArenaIndex = _AcquireArena();
+        ResetStats();
+    }
+
+    ~BasicRequestUpdate()
+    {
+        for( const PendingEntry& entry : m_Pending )
+        {
+            _FreeSlot( entry.slot );
+        }
+        m_TimerWheel.ForEach( [this]( uint32_t slot ){ _FreeSlot( slot ); } );
+    }
+
+private:
+    BasicRequestUpdate( const BasicRequestUpdate& ) = delete;
+    BasicRequestUpdate& operator=( const BasicRequestUpdate& ) = delete;
+
+public:
+    /**
+     *  リクエストを処理する関数
+     */
+    void SetRequestExecuter( const RequestExecuter& executer )
+    {
+        m_Executer = executer;
+        m_BatchExecuter = nullptr;
+    }
+
+    /**
+     *  並んだ順のリクエストをまとめて受け取る関数。SetRequestExecuterの代わりに使う
+     *  chunkSize件ずつに区切って呼ぶ。0なら1回のUpdateで1度だけ呼ぶ
+     *  並べ替えや持ち越しがなければ、溜まったリクエストをコピーせずにそのまま渡す
+     *  時間の予算はchunkSize件を渡し終えたときにしか確かめられない
+     *  並列実行(SetRequestParallel)とは併用しない
+     */
+    void SetBatchExecuter( const BatchExecuter& executer, size_t chunkSize=0 )
+    {
+        m_BatchExecuter = executer;
+        m_BatchChunkSize = chunkSize;
+    }
+    
+    
+    /**
+     *  リクエストパラメータの処理順番を決定するソート関数
+     *  並べ方の指定(SetRequestSortPredicator, SetRequestSortKey, SetRequestPriority)は持ち越しがないときに変えること
+     */
+    void SetRequestSortPredicator( const SortPredicator& func )
+    {
+        m_SortPred = func;
+        m_SortKey = nullptr;
+        m_Priority = nullptr;
+    }
+
+    /**
+     *  リクエストパラメータから並べるキーを取り出す関数
+     *  キーは整数か浮動小数点数。比較関数と違って1リクエストにつき1度しか呼ばれず、並べ替えでパラメータも動かさない
+     *  例: SetRequestSortKey( []( const std::tuple<int>& v ){ return std::get<0>(v); } );
+     */
+    template< typename Projection >
+    void SetRequestSortKey( Projection projection, RequestSortEngine engine=REQUEST_SORT_AUTO )
+    {
+        typedef typename std::decay< decltype( projection( std::declval<const Parameter&>() ) ) >::type Key;
+        static_assert( std::is_arithmetic<Key>::value || std::is_enum<Key>::value, "sort key must be an integral, floating point or enum type" );
+
+        m_SortKey = [projection]( const Parameter& param ){
+            return RequestSortKeyTraits<Key>::Encode( projection( param ) );
+        };
+        m_SortEngine = engine;
+        m_SortPred = nullptr;
+        m_Priority = nullptr;
+    }
+
+    /**
+     *  優先度が0からbucketCount-1の小さな整数で決まる場合に使う。比較による並べ替えをしない
+     *  優先度の小さいバケツから順に処理する。範囲外の優先度は最後のバケツに入れる
+     *  例: SetRequestPriority( []( const std::tuple<int>& v ){ return std::get<0>(v); }, 16 );
+     */
+    template< typename Projection >
+    void SetRequestPriority( Projection projection, size_t bucketCount, RequestBucketOrder order=REQUEST_BUCKET_FIFO )
+    {
+        m_Priority = [projection]( const Parameter& param ){
+            return static_cast<size_t>( projection( param ) );
+        };
+        _ClearBucketArenas();
+        m_Buckets.clear();
+        m_Buckets.resize( bucketCount < 1 ? 1 : bucketCount );
+        m_BucketArenas.resize( m_Buckets.size() );
+        m_BucketGenerations.clear();
+        m_BucketGenerations.resize( m_Buckets.size() );
+        m_BucketHeads.assign( m_Buckets.size(), 0 );
+        m_BucketOrder = order;
+        m_SortPred = nullptr;
+        m_SortKey = nullptr;
+    }
+    
+    /**
+     *  同じキーのリクエストは並んだ順に1つのレーンで、違うキーのリクエストはpoolで並列に処理する
+     *  エグゼキュータは複数のスレッドから同時に呼ばれるようになる
+     *  時間の予算を指定したUpdateと、優先度のバケツ(SetRequestPriority)では並列にしない
+     *  例: SetRequestParallel( &pool, []( const std::tuple<int, float>& v ){ return std::get<0>(v); } );
+     */
+    template< typename Projection >
+    void SetRequestParallel( RequestWorkerPool* pool, Projection projection )
+    {
+        m_WorkerPool = pool;
+        m_LaneKey = [projection]( const Parameter& param ){
+            return static_cast<uint64_t>( projection( param ) );
+        };
+
+        // スレッド数より多めにレーンを切って、偏りは盗み合いでならす
+        const size_t threadCount = pool ? pool->GetWorkerCount() + 1 : 1;
+        m_LaneBits = 2;
+        while( ( size_t(1) << m_LaneBits ) < threadCount * 4 )
+        {
+            ++m_LaneBits;
+        }
+        m_Lanes.clear();
+        m_Lanes.resize( size_t(1) << m_LaneBits );
+    }
+
+    void ClearRequestParallel()
+    {
+        m_WorkerPool = nullptr;
+        m_LaneKey = nullptr;
+        m_Lanes.clear();
+    }
+
+    /**
+     *  whenの時刻を過ぎた最初のUpdateで、その回のリクエストと一緒に並べて処理する
+     *  時刻はSetRequestTimerResolutionの単位に切り上げる。呼べるスレッドはThreadingPolicyで決まる
+     */
+    template< typename ...Args >
+    void AddRequestAt( TimePoint when, Args&&... args )
+    {
+        static_assert( sizeof...(Args) == 1 + sizeof...(ArgTypes), "argument count does not match the request" );
+        m_TimerRequests.Push( when, Duration::zero(), Parameter( std::forward<Args>(args)... ), RequestTicket() );
+        m_HasTimerRequests.store( true, std::memory_order_release );
+        _NotifyConsumer();
+    }
+
+    /**
+     *  今からperiodごとに処理する。Updateが遅れて何回分か過ぎていても1回だけ処理する
+     *  毎回パラメータをコピーして渡すので、コピーできる型だけ
+     *  返した券をCancelに渡すと止まる。止めた後に処理するのは、既に取り出した回の分だけ
+     *  タイマーは次の時刻になったときに取り除く。券の表が埋まっていたら無効な券を返し、止められないまま登録する
+     */
+    template< typename ...Args >
+    RequestTicket AddRequestEvery( Duration period, Args&&... args )
+    {
+        static_assert( sizeof...(Args) == 1 + sizeof...(ArgTypes), "argument count does not match the request" );
+        static_assert( std::is_copy_constructible<Parameter>::value, "periodic requests must be copyable" );
+        const RequestTicket ticket = m_Tickets.Acquire();
+        m_TimerRequests.Push( m_TimerClock() + period, period, Parameter( std::forward<Args>(args)... ), ticket );
+        m_HasTimerRequests.store( true, std::memory_order_release );
+        _NotifyConsumer();
+        return ticket;
+    }
+
+    /**
+     *  タイマーの時刻の細かさ。初期値は1ミリ秒。タイマーを登録する前に変えること
+     */
+    void SetRequestTimerResolution( Duration resolution )
+    {
+        m_TimerResolution = resolution < Duration(1) ? Duration(1) : resolution;
+    }
+
+    /**
+     *  タイマーが使う時計。ゲーム内の時間で動かしたいときなどに変える。初期値はsteady_clock
+     *  AddRequestEveryを呼ぶスレッドからも呼ばれる
+     */
+    void SetRequestTimerClock( const TimerClock& clock )
+    {
+        m_TimerClock = clock;
+    }
+
+    // 登録中のタイマーの数
+    size_t GetTimerCount() const
+    {
+        return m_TimerWheel.size();
+    }
+
+    /**
+     *  1回のUpdateに届いた同じキーのリクエストを1つにまとめてから処理する
+     *  まとめたリクエストは最初に届いたリクエストの位置に置く。前のUpdateから持ち越した分とはまとめない
+     *  例: SetRequestCoalesce( []( const std::tuple<int, float>& v ){ return std::get<0>(v); } );
+     */
+    template< typename Projection >
+    void SetRequestCoalesce( Projection projection, RequestCoalesceMode mode=REQUEST_COALESCE_LAST )
+    {
+        if( mode == REQUEST_COALESCE_LAST )
+        {
+            SetRequestCoalesce( projection, []( Parameter& merged, Parameter&& incoming ){ merged = std::move(incoming); } );
+        }
+        else
+        {
+            SetRequestCoalesce( projection, []( Parameter&, Parameter&& ){} );
+        }
+    }
+
+    /**
+     *  まとめ方を指定する。reducerは届いた順に、まとめた結果と次のリクエストを受け取る
+     */
+    template< typename Projection >
+    void SetRequestCoalesce( Projection projection, const CoalesceReducer& reducer )
+    {
+        m_CoalesceKey = [projection]( const Parameter& param ){
+            return static_cast<uint64_t>( projection( param ) );
+        };
+        m_CoalesceReducer = reducer;
+    }
+
+    void ClearRequestCoalesce()
+    {
+        m_CoalesceKey = nullptr;
+        m_CoalesceReducer = nullptr;
+    }
+
+    /**
+     *  リクエストの中身(文字列など)を置く領域。そのリクエストを処理したUpdateの最後にまとめて捨てる
+     *  スレッドセーフではないので、Updateを呼ぶスレッドからだけ使える(エグゼキュータの中で次のリクエストを作る場合も含む)
+     *  RequestUpdateMpscで他のスレッドから追加するリクエストには使えない。そのスレッドで持つ領域か、値で持つ型を使う
+     *  Updateごとに領域を分けて、持ち越したリクエストが残っている領域は、全て処理されるまで捨てない
+     *  持ち越しが続いても、処理し終わったUpdateの分から捨てるので、領域が際限なく伸びることはない
+     *  タイマーで後から処理するリクエスト(AddRequestAt, AddRequestEvery)には使えない
+     *  例: AddRequest( id, GetRequestArena().CopyString( name ) );
+     */
+    RequestArena& GetRequestArena()
+    {
+        return m_Arenas[m_ArenaIndex];
+    }
+
+    // 一時的に増えた領域を、resetCount回のUpdateごとに縮める
+    void SetRequestArenaShrinkInterval( size_t resetCount )
+    {
+        m_ArenaShrinkInterval = resetCount;
+        for( RequestArena& arena : m_Arenas )
+        {
+            arena.SetShrinkInterval( resetCount );
+        }
+    }
+
+    // 全ての領域で確保しているバイト数
+    size_t GetRequestArenaCapacity() const
+    {
+        size_t capacity = 0;
+        for( const RequestArena& arena : m_Arenas )
+        {
+            capacity += arena.GetCapacity();
+        }
+        return capacity;
+    }
+
+    /**
+     *  処理を待つリクエスト(キューに積まれた分と持ち越した分)の上限。0なら上限なし
+     *  上限に達したときの扱いはpolicyで決める。REQUEST_OVERLOAD_BLOCKはblockTimeoutまで待つ
+     *  捨てるのはUpdateの中で、取り出した分と持ち越した分を合わせて上限に収まるようにする
+     *  キューに積んだものは追加する側から取り除けないので、捨てる方式でもUpdateが呼ばれないまま上限の2倍に達したら、
+     *  古いものと入れ替えずにREQUEST_OVERLOAD_REJECTと同じく追加しないでfalseを返す(GetOverloadStatsのrejectedCountに数える)
+     *  Updateが長く止まることがあって新しいリクエストを優先したいなら、Updateを呼ぶ間隔に対して上限に余裕を持たせること
+     *  優先度のバケツ(SetRequestPriority)では、優先度の低いバケツから捨てる
+     *  数えるのは上限があるときだけなので、リクエストを追加し始める前に呼ぶこと
+     *  タイマーのリクエストは登録するときには上限を確かめないが、時刻になって取り出した後は処理を待つ数に入り、捨てる方式では捨てることもある
+     */
+    void SetRequestCapacity( size_t capacity, RequestOverloadPolicy policy=REQUEST_OVERLOAD_REJECT, Duration blockTimeout=Duration::max() )
+    {
+        m_Capacity = capacity;
+        m_OverloadPolicy = policy;
+        m_BlockTimeout = blockTimeout;
+    }
+
+    // どのスレッドから呼んでもよい
+    RequestOverloadStats GetOverloadStats() const
+    {
+        RequestOverloadStats stats;
+        stats.rejectedCount = m_RejectedCount.load( std::memory_order_relaxed );
+        stats.droppedCount = m_DroppedCount.load( std::memory_order_relaxed );
+        stats.blockedCount = m_BlockedCount.load( std::memory_order_relaxed );
+        stats.fullCount = m_FullCount.load( std::memory_order_relaxed );
+        const int64_t waiting = _GetWaitingCount();
+        stats.waitingCount = 0 < waiting ? static_cast<size_t>( waiting ) : 0;
+        stats.capacity = m_Capacity;
+        stats.full = m_Capacity != 0 && m_Capacity <= stats.waitingCount;
+        return stats;
+    }
+
+    /**
+     *  呼べるスレッドはThreadingPolicyで決まる
+     *  上限(SetRequestCapacity)に達していて追加しなかったらfalse
+     */
+    bool AddRequest( ArgFirst argFirst, ArgTypes... args )
+    {
+        return _PushRequest( std::move(argFirst), std::move(args)... );
+    }
+
+    /**
+     *  引数から直接リクエストを作る。右辺値はムーブされるので、ムーブしかできない型も渡せる
+     *  呼べるスレッドはThreadingPolicyで決まる
+     */
+    template< typename ...Args >
+    bool EmplaceRequest( Args&&... args )
+    {
+        static_assert( sizeof...(Args) == 1 + sizeof...(ArgTypes), "argument count does not match the request" );
+        return _PushRequest( std::forward<Args>(args)... );
+    }
+
+    /**
+     *  取り消せるリクエストを追加して、引換券を返す。券をCancelに渡せば、処理する前なら捨てられる
+     *  券の表が埋まっていたら無効な券を返し、リクエストは取り消せないまま追加する
+     *  上限(SetRequestCapacity)に達していて追加しなかったときも無効な券を返す
+     *  券のないリクエストと同じキューに積むので、並べ替えないときは追加した順に処理する
+     *  呼べるスレッドはThreadingPolicyで決まる
+     */
+    template< typename ...Args >
+    RequestTicket AddCancellableRequest( Args&&... args )
+    {
+        static_assert( sizeof...(Args) == 1 + sizeof...(ArgTypes), "argument count does not match the request" );
+        if( !_Admit() )
+        {
+            return RequestTicket();
+        }
+        const RequestTicket ticket = m_Tickets.Acquire();
+        _PushAdmitted( ticket, std::forward<Args>(args)... );
+        return ticket;
+    }
+
+    /**
+     *  まだ処理していないリクエストを取り消す。取り消せたらtrue、処理中か処理済みならfalse
+     *  どのスレッドから呼んでもよい。O(1)で印を付けるだけで、次に取り出したときに並べ替えの前に捨てる
+     *  持ち越しの中に取り消しが溜まったら、まとめて取り除く
+     *  並べ替えの比較関数、優先度のバケツ、同じキーをまとめる指定、まとめて処理する関数のどれかを使っているときは、
+     *  Updateが取り出した時点で取り消せなくなる
+     *  AddRequestEveryの券なら繰り返しを止める。止めた後の券ではfalse
+     */
+    bool Cancel( const RequestTicket& ticket )
+    {
+        return m_Tickets.Cancel( ticket );
+    }
+    
+    /**
+     *  積まれたリクエストをまとめて処理する。同時に呼べるのは1スレッドだけ
+     */
+    void Update()
+    {
+        Update( std::numeric_limits<size_t>::max() );
+    }
+
+    /**
+     *  優先度の高い順に最大maxCount件だけ処理する。処理した数を返す
+     *  残りは順番を保ったまま次のUpdateに持ち越す。持ち越しはヒープに入れておくので、k件の取り出しはO(k log n)
+     */
+    size_t Update( size_t maxCount )
+    {
+        return Update( Budget( maxCount ) );
+    }
+
+    /**
+     *  時間か件数を使い切るまで優先度の高い順に処理する。処理した数を返す
+     *  例: Update( RequestUpdateBudget( std::chrono::milliseconds(2) ) );
+     */
+    size_t Update( const Budget& budget )
+    {
+#ifdef REQUEST_UPDATE_INSTRUMENT
+        const uint64_t startTsc = RequestTsc::Now();
+#endif
+        const size_t picked = _TakeQueued();
+        if( m_HasTimerRequests.exchange( false, std::memory_order_acquire ) || !m_TimerWheel.empty() )
+        {
+            _UpdateTimers();
+        }
+        if( m_Capacity != 0 )
+        {
+            _AccountPicked( picked );
+        }
+        if( !m_Pending.empty() && std::max<uint64_t>( 64, m_Pending.size() / 2 ) <= m_Tickets.GetCancelCount() - m_CancelCheckpoint )
+        {
+            _CompactPending();
+        }
+        ++m_Generation;
+        if( m_AgingUpdates && !m_Pending.empty() )
+        {
+            _AgePending();
+        }
+        _SealArena();
+        if( m_Capacity != 0 )
+        {
+            _TrimToCapacity();
+        }
+        if( m_CoalesceKey )
+        {
+            _Coalesce();
+        }
+#ifdef REQUEST_UPDATE_INSTRUMENT
+        m_PickedTsc = RequestTsc::Now();
+        m_SortedTsc = m_PickedTsc;
+#endif
+
+        BudgetTracker tracker( budget );
+        if( m_Priority )
+        {
+            _UpdateByPriority( tracker );
+        }
+        else if( m_Pending.empty() && m_UpdatingRequests.size() <= budget.maxCount )
+        {
+            // 持ち越しがなく件数が足りるなら、まとめて並べた方が速い。時間切れになった分だけ持ち越す
+            _UpdateAll( tracker );
+        }
+        else
+        {
+            _PushPending();
+            _MarkSorted();
+            _PopPending( tracker );
+        }
+        
+        _FlushBatch();
+#ifdef REQUEST_UPDATE_INSTRUMENT
+        _RecordInstrument( startTsc );
+#endif
+
+        // 確保した領域は次のUpdateで使い回す
+        m_UpdatingRequests.clear();
+        m_UpdatingTickets.clear();
+        _RecycleArenas();
+        if( m_Capacity != 0 )
+        {
+            _ReleaseCapacity();
+        }
+
+        _UpdateStats( tracker );
+        return tracker.executed;
+    }
+
+    /**
+     *  stopで止めるように言われるまで、呼んだスレッドでUpdateし続ける。処理した数を返す
+     *  やることがなくなったらoptions.spinDurationの間待ってから寝て、次のAddRequestで起きる
+     *  寝ている間に続けて追加されても、起こすのは1回だけ
+     *  止めるときはRequestStopの後にWakeConsumerを呼ぶとすぐに戻る。呼ばなければparkTimeoutのうちに戻る
+     *  止めたときに積まれている分は処理しないので、必要ならその後でUpdateを呼ぶ
+     *  Runを始めた瞬間に追加されたものも見落とさないように、AddRequestはRunしていなくても毎回フェンスを1つ挟んで寝ているスレッドを確かめる
+     *  例: RequestStopSource stop;
+     *      std::thread consumer( [&]{ requestUpdate.Run( stop.GetToken() ); } );
+     *      ...
+     *      stop.RequestStop();
+     *      requestUpdate.WakeConsumer();
+     *      consumer.join();
+     */
+    size_t Run( const RequestStopToken& stop, const RequestRunOptions& options=RequestRunOptions() )
+    {
+        static_assert( !std::is_same<ThreadingPolicy, RequestUpdateSingleThread>::value, "Run needs a threading policy that accepts requests from other threads" );
+
+        size_t executed = 0;
+        while( !stop.StopRequested() )
+        {
+            executed += Update( Budget() );
+            if( _HasWork() || _SpinForWork( stop, options.spinDuration ) )
+            {
+                continue;
+            }
+
+            // 寝ると決めた後にもう一度確かめる。ここから後の追加はNotifyで起こされる
+            m_Wakeup.Prepare();
+            if( _HasWork() || stop.StopRequested() )
+            {
+                m_Wakeup.Cancel();
+                continue;
+            }
+
+            // タイマーがあれば、次の刻みで時刻を確かめる
+            Duration timeout = options.parkTimeout;
+            if( !m_TimerWheel.empty() && m_TimerResolution < timeout )
+            {
+                timeout = m_TimerResolution;
+            }
+            ++m_Stats.parkCount;
+            m_Wakeup.Park( timeout );
+        }
+        return executed;
+    }
+
+    // Runで寝ているスレッドを起こす
+    void WakeConsumer()
+    {
+        m_Wakeup.Notify();
+    }
+
+    /**
+     *  持ち越されたリクエストが後から来たリクエストに抜かれ続けないようにする
+     *  agingUpdates回以上のUpdateの間持ち越されたリクエストは、優先度に関わらず、それより後に来たリクエストより先に処理する。0なら無効
+     *  持ち越されすぎたものどうしは、いつもの並び順で処理する。優先度のバケツ(SetRequestPriority)でも同じ数え方
+     */
+    void SetRequestAging( size_t agingUpdates )
+    {
+        m_AgingUpdates = agingUpdates;
+    }
+
+    RequestUpdateStats GetStats() const
+    {
+        RequestUpdateStats stats = m_Stats;
+        stats.wakeupCount = m_Wakeup.GetWakeCount() - m_WakeupBase;
+        return stats;
+    }
+
+    void ResetStats()
+    {
+        m_Stats = RequestUpdateStats();
+        m_Stats.carryOver = GetPendingCount();
+        m_WakeupBase = m_Wakeup.GetWakeCount();
+    }
+
+    /**
+     *  REQUEST_UPDATE_INSTRUMENTを定義してビルドしたときの計測値。定義していなければenabledがfalseで中身は空
+     *  どのスレッドから呼んでもよい
+     *  例: GetInstrumentSnapshot().Print( std::cout );
+     */
+    RequestInstrumentSnapshot GetInstrumentSnapshot() const
+    {
+#ifdef REQUEST_UPDATE_INSTRUMENT
+        return m_Instrument.Snapshot();
+#else
+        return RequestInstrumentSnapshot();
+#endif
+    }
+
+    void ResetInstrument()
+    {
+#ifdef REQUEST_UPDATE_INSTRUMENT
+        m_Instrument.Reset();
+#endif
+    }
+
+    // 次のUpdateに持ち越しているリクエストの数
+    size_t GetPendingCount() const
+    {
+        size_t count = m_Pending.size();
+        for( size_t i=0; i<m_Buckets.size(); ++i )
+        {
+            count += m_Buckets[i].size() - m_BucketHeads[i];
+        }
+        return count;
+    }
+
+private:
+    // 持ち越されすぎて先に処理すると決めた持ち越しの世代
+    static const uint32_t AGED_GENERATION = 0;
+    // 領域を使っていないリクエスト
+    static const uint32_t NO_ARENA = UINT32_MAX;
+
+    // バケツの中で、同じ領域を使う続いたリクエストの数
+    struct ArenaRun
+    {
+        uint32_t arena;
+        size_t count;
+    };
+
+    // 持ち越したリクエスト。パラメータ本体はm_Slotsに置いて、ヒープでは添字だけを動かす
+    struct PendingEntry
+    {
+        uint64_t key;
+        uint64_t sequence;  // 同じ優先度なら追加した順
+        uint32_t slot;
+        uint32_t generation;    // 持ち越したUpdateの世代。AGED_GENERATIONなら持ち越されすぎたので先に処理する
+        RequestTicket ticket;
+    };
+
+    // 予算の使い具合
+    struct BudgetTracker
+    {
+        explicit BudgetTracker( const Budget& budget )
+        :budget(budget)
+        ,executed(0)
+        ,timeExhausted(false)
+        {
+            if( budget.HasTimeLimit() )
+            {
+                start = std::chrono::steady_clock::now();
+            }
+        }
+
+        // もう1件処理してよいか。少なくとも1件は処理する
+        bool CanExecute()
+        {
+            if( budget.maxCount <= executed )
+            {
+                return false;
+            }
+            if( budget.HasTimeLimit() && 0 < executed && budget.maxDuration <= std::chrono::steady_clock::now() - start )
+            {
+                timeExhausted = true;
+                return false;
+            }
+            return true;
+        }
+
+        Budget budget;
+        std::chrono::steady_clock::time_point start;
+        size_t executed;
+        bool timeExhausted;
+    };
+
+    typedef typename std::aligned_storage< sizeof(Parameter), std::alignment_of<Parameter>::value >::type ParameterStorage;
+
+    // ヒープの並び順。比較関数がなければキー、どちらもなければ追加した順
+    struct PendingLess
+    {
+        const BasicRequestUpdate* owner;
+
+        bool operator()( const PendingEntry& lhs, const PendingEntry& rhs ) const
+        {
+            const bool lhsAged = lhs.generation == AGED_GENERATION;
+            if( lhsAged != ( rhs.generation == AGED_GENERATION ) )
+            {
+                return lhsAged;
+            }
+            if( owner->m_SortPred )
+            {
+                const Parameter& l = owner->_GetSlot( lhs.slot );
+                const Parameter& r = owner->_GetSlot( rhs.slot );
+                if( owner->m_SortPred( l, r ) )
+                {
+                    return true;
+                }
+                if( owner->m_SortPred( r, l ) )
+                {
+                    return false;
+                }
+                return lhs.sequence < rhs.sequence;
+            }
+            return lhs.key < rhs.key || ( lhs.key == rhs.key && lhs.sequence < rhs.sequence );
+        }
+    };
+
+    // 持ち越しがないときに、全部を並べて処理する
+    void _UpdateAll( BudgetTracker& tracker )
+    {
+        if( m_SortKey )
+        {
+            _SortByKey();
+        }
+        else if( m_SortPred )
+        {
+            std::sort(m_UpdatingRequests.begin(), m_UpdatingRequests.end(), m_SortPred);
+        }
+        _MarkSorted();
+
+        const size_t size = m_UpdatingRequests.size();
+        if( m_BatchExecuter && !m_SortKey && !tracker.budget.HasTimeLimit() )
+        {
+            // 並んでいる領域をそのまま渡す
+            _ExecuteBatch( RequestSpan<const Parameter>( m_UpdatingRequests.data(), size ) );
+            tracker.executed = size;
+        }
+        else if( _IsParallel( tracker ) )
+        {
+            m_ParallelOrder.clear();
+            for( size_t i=0; i<size; ++i )
+            {
+                if( _ClaimTicket( _GetSortedTicket( i ) ) )
+                {
+                    m_ParallelOrder.push_back( &_GetSorted( i ) );
+                }
+            }
+            _ExecuteParallel();
+            tracker.executed = m_ParallelOrder.size();
+        }
+        else
+        {
+            for( size_t i=0; i<size; ++i )
+            {
+                if( !tracker.CanExecute() )
+                {
+                    // 並んだ順に入れればそのままヒープになっている
+                    for( ; i<size; ++i )
+                    {
+                        _AppendPending( _GetSorted( i ), m_SortKey ? m_SortEntries[i].key : 0, _GetSortedTicket( i ) );
+                    }
+                    m_Pending.Build( PendingLess{ this } );
+                    break;
+                }
+                if( !_ClaimTicket( _GetSortedTicket( i ) ) )
+                {
+                    continue;
+                }
+                _Execute( _GetSorted( i ) );
+                ++tracker.executed;
+            }
+        }
+        m_SortEntries.clear();
+    }
+
+    // 新しいタイマーをホイールに入れて、時刻になったものを今回のリクエストに加える
+    void _UpdateTimers()
+    {
+        m_TimerRequests.PopAll( m_NewTimers );
+        if( !m_TimerStarted && !m_NewTimers.empty() )
+        {
+            m_TimerEpoch = m_TimerClock();
+            m_TimerStarted = true;
+        }
+        for( TimerRequest& timer : m_NewTimers )
+        {
+            if( m_Tickets.IsCancelled( timer.ticket ) )
+            {
+                // 登録する前に止められた
+                m_Tickets.Claim( timer.ticket );
+                ++m_Stats.cancelledCount;
+                continue;
+            }
+            uint64_t period = 0;
+            if( timer.period != Duration::zero() )
+            {
+                period = ( timer.period + m_TimerResolution - Duration(1) ) / m_TimerResolution;
+                period = period < 1 ? 1 : period;
+            }
+            const uint32_t slot = _AllocateSlot( std::move(timer.param), NO_ARENA );
+            if( m_TimerTickets.size() <= slot )
+            {
+                m_TimerTickets.resize( slot + 1 );
+            }
+            m_TimerTickets[slot] = timer.ticket;
+            m_TimerWheel.Schedule( _ToTick( timer.when, true ), period, slot );
+        }
+        m_NewTimers.clear();
+
+        if( !m_TimerWheel.empty() )
+        {
+            TimerExpire expire = { this };
+            m_TimerWheel.Advance( _ToTick( m_TimerClock(), false ), expire );
+        }
+    }
+
+    struct TimerExpire
+    {
+        BasicRequestUpdate* owner;
+
+        // 繰り返しを続けるならtrue
+        bool operator()( uint32_t slot, bool periodic ) const
+        {
+            if( periodic )
+            {
+                const RequestTicket ticket = owner->m_TimerTickets[slot];
+                if( owner->m_Tickets.IsCancelled( ticket ) )
+                {
+                    owner->m_Tickets.Claim( ticket );
+                    owner->_FreeSlot( slot );
+                    ++owner->m_Stats.cancelledCount;
+                    return false;
+                }
+                owner->_PushTimerCopy( owner->_GetSlot( slot ), typename std::is_copy_constructible<Parameter>::type() );
+                return true;
+            }
+            owner->m_UpdatingRequests.push_back( std::move( owner->_GetSlot( slot ) ) );
+            owner->_FreeSlot( slot );
+            return false;
+        }
+    };
+
+    void _PushTimerCopy( const Parameter& param, std::true_type )
+    {
+        m_UpdatingRequests.push_back( param );
+    }
+
+    // コピーできない型はAddRequestEveryで弾いているので呼ばれない
+    void _PushTimerCopy( const Parameter&, std::false_type )
+    {
+    }
+
+    uint64_t _ToTick( TimePoint time, bool roundUp ) const
+    {
+        if( time <= m_TimerEpoch )
+        {
+            return 0;
+        }
+        const Duration elapsed = time - m_TimerEpoch;
+        uint64_t tick = static_cast<uint64_t>( elapsed / m_TimerResolution );
+        if( roundUp && m_TimerResolution * tick < elapsed )
+        {
+            ++tick;
+        }
+        return tick;
+    }
+
+    // 同じキーのリクエストを最初に届いた位置にまとめて、前に詰める
+    void _Coalesce()
+    {
+        const size_t size = m_UpdatingRequests.size();
+        m_CoalesceTable.Reserve( size );
+        size_t count = 0;
+        for( size_t i=0; i<size; ++i )
+        {
+            bool inserted = false;
+            const uint32_t index = m_CoalesceTable.FindOrInsert( m_CoalesceKey( m_UpdatingRequests[i] ), static_cast<uint32_t>(count), inserted );
+            if( inserted )
+            {
+                if( count != i )
+                {
+                    m_UpdatingRequests[count] = std::move( m_UpdatingRequests[i] );
+                }
+                ++count;
+            }
+            else
+            {
+                m_CoalesceReducer( m_UpdatingRequests[index], std::move( m_UpdatingRequests[i] ) );
+            }
+        }
+        m_Stats.coalescedCount += size - count;
+        m_UpdatingRequests.erase( m_UpdatingRequests.begin() + count, m_UpdatingRequests.end() );
+    }
+
+    // 1件処理する。まとめて処理するときは並んだ順に溜めておく
+    void _Execute( Parameter& param )
+    {
+        if( m_BatchExecuter )
+        {
+            m_BatchBuffer.push_back( std::move(param) );
+            if( m_BatchBuffer.size() == m_BatchChunkSize )
+            {
+                _FlushBatch();
+            }
+        }
+        else
+        {
+            ::apply(m_Executer, param);
+        }
+    }
+
+    void _FlushBatch()
+    {
+        if( !m_BatchBuffer.empty() )
+        {
+            m_BatchExecuter( RequestSpan<const Parameter>( m_BatchBuffer.data(), m_BatchBuffer.size() ) );
+            m_BatchBuffer.clear();
+        }
+    }
+
+    // chunkSize件ずつに区切って渡す
+    void _ExecuteBatch( RequestSpan<const Parameter> span )
+    {
+        const size_t chunkSize = m_BatchChunkSize == 0 ? span.size() : m_BatchChunkSize;
+        for( size_t offset=0; offset<span.size(); offset+=chunkSize )
+        {
+            const size_t count = span.size() - offset < chunkSize ? span.size() - offset : chunkSize;
+            m_BatchExecuter( span.subspan( offset, count ) );
+        }
+    }
+
+    // 並べ替えた後のi番目
+    Parameter& _GetSorted( size_t i )
+    {
+        return m_SortKey ? m_UpdatingRequests[ m_SortEntries[i].index ] : m_UpdatingRequests[i];
+    }
+
+    bool _IsParallel( const BudgetTracker& tracker ) const
+    {
+        return m_WorkerPool != nullptr && !m_BatchExecuter && !tracker.budget.HasTimeLimit();
+    }
+
+    // m_ParallelOrderをキーごとのレーンに分けて、レーン単位で並列に処理する
+    void _ExecuteParallel()
+    {
+        for( std::vector< Parameter* >& lane : m_Lanes )
+        {
+            lane.clear();
+        }
+        for( Parameter* param : m_ParallelOrder )
+        {
+            const uint64_t hash = m_LaneKey( *param ) * 0x9E3779B97F4A7C15ull;
+            m_Lanes[ hash >> ( 64 - m_LaneBits ) ].push_back( param );
+        }
+
+        m_ActiveLanes.clear();
+        for( size_t i=0; i<m_Lanes.size(); ++i )
+        {
+            if( !m_Lanes[i].empty() )
+            {
+                m_ActiveLanes.push_back( i );
+            }
+        }
+        m_WorkerPool->Run( &BasicRequestUpdate::_ExecuteLane, this, m_ActiveLanes.size() );
+    }
+
+    static void _ExecuteLane( void* context, size_t index )
+    {
+        BasicRequestUpdate* self = static_cast<BasicRequestUpdate*>( context );
+        for( Parameter* param : self->m_Lanes[ self->m_ActiveLanes[index] ] )
+        {
+            ::apply(self->m_Executer, *param);
+        }
+    }
+
+    void _AppendPending( Parameter& param, uint64_t key, const RequestTicket& ticket )
+    {
+        PendingEntry entry;
+        entry.key = key;
+        entry.sequence = m_Sequence++;
+        entry.slot = _AllocateSlot( std::move(param), m_UpdatingArena );
+        entry.generation = _GetPendingGeneration();
+        entry.ticket = ticket;
+        m_Pending.Append( entry );
+    }
+
+    // 持ち越すリクエストに付ける世代。0はAGED_GENERATIONと区別できないので1にずらす
+    uint32_t _GetPendingGeneration()
+    {
+        const uint32_t generation = static_cast<uint32_t>( m_Generation );
+        if( m_Pending.empty() )
+        {
+            m_OldestPendingGeneration = generation;
+        }
+        return generation == AGED_GENERATION ? 1 : generation;
+    }
+
+    /**
+     *  持ち越されてm_AgingUpdates回以上経ったものを、後から来たものより先に処理する側へ移す(優先度のバケツと同じ数え方)
+     *  全体を見てヒープを作り直すので、一番古い世代が経過したときだけ呼ぶ
+     */
+    void _AgePending()
+    {
+        const uint32_t generation = static_cast<uint32_t>( m_Generation );
+        if( static_cast<uint32_t>( generation - m_OldestPendingGeneration ) < m_AgingUpdates )
+        {
+            return;
+        }
+
+        // 移さなかった中で一番古い世代を数え直す
+        uint32_t oldestAge = 0;
+        m_Pending.ModifyAll( [this, generation, &oldestAge]( PendingEntry& entry ){
+            if( entry.generation == AGED_GENERATION )
+            {
+                return false;
+            }
+            const uint32_t age = generation - entry.generation;
+            if( age < m_AgingUpdates )
+            {
+                oldestAge = oldestAge < age ? age : oldestAge;
+                return false;
+            }
+            entry.generation = AGED_GENERATION;
+            return true;
+        }, PendingLess{ this } );
+        m_OldestPendingGeneration = generation - oldestAge;
+    }
+
+    // 今回のリクエストをヒープに入れる。今あるヒープより多ければ、まとめて入れてから作り直す
+    void _PushPending()
+    {
+        const PendingLess less = { this };
+        const bool rebuild = m_Pending.size() <= m_UpdatingRequests.size();
+        for( size_t i=0; i<m_UpdatingRequests.size(); ++i )
+        {
+            Parameter& param = m_UpdatingRequests[i];
+            PendingEntry entry;
+            entry.key = m_SortKey ? m_SortKey( param ) : 0;
+            entry.sequence = m_Sequence++;
+            entry.slot = _AllocateSlot( std::move(param), m_UpdatingArena );
+            entry.generation = _GetPendingGeneration();
+            entry.ticket = _GetTicket( i );
+            if( rebuild )
+            {
+                m_Pending.Append( entry );
+            }
+            else
+            {
+                m_Pending.Push( entry, less );
+            }
+        }
+        if( rebuild )
+        {
+            m_Pending.Build( less );
+        }
+    }
+
+    void _PopPending( BudgetTracker& tracker )
+    {
+        const PendingLess less = { this };
+        if( _IsParallel( tracker ) )
+        {
+            // 取り出す順に並べてから並列に処理する。スロットは全部終わってから解放する
+            m_ParallelSlots.clear();
+            m_ParallelOrder.clear();
+            while( !m_Pending.empty() && tracker.CanExecute() )
+            {
+                const PendingEntry entry = m_Pending.Pop( less );
+                m_ParallelSlots.push_back( entry.slot );
+                if( !_ClaimTicket( entry.ticket ) )
+                {
+                    continue;
+                }
+                m_ParallelOrder.push_back( &_GetSlot( entry.slot ) );
+                ++tracker.executed;
+            }
+            _ExecuteParallel();
+            for( uint32_t slot : m_ParallelSlots )
+            {
+                _FreeSlot( slot );
+            }
+            return;
+        }
+
+        while( !m_Pending.empty() && tracker.CanExecute() )
+        {
+            const PendingEntry entry = m_Pending.Pop( less );
+            if( !_ClaimTicket( entry.ticket ) )
+            {
+                _FreeSlot( entry.slot );
+                continue;
+            }
+            _Execute( _GetSlot( entry.slot ) );
+            _FreeSlot( entry.slot );
+            ++tracker.executed;
+        }
+    }
+
+    // arenaはパラメータが中身を置いた領域。スロットを解放するまでその領域を捨てない
+    uint32_t _AllocateSlot( Parameter&& param, uint32_t arena )
+    {
+        uint32_t slot = 0;
+        if( m_FreeSlots.empty() )
+        {
+            slot = static_cast<uint32_t>( m_Slots.size() );
+            m_Slots.emplace_back();
+            m_SlotArenas.push_back( NO_ARENA );
+        }
+        else
+        {
+            slot = m_FreeSlots.back();
+            m_FreeSlots.pop_back();
+        }
+        new (&m_Slots[slot]) Parameter( std::move(param) );
+        m_SlotArenas[slot] = arena;
+        _RetainArena( arena );
+        return slot;
+    }
+
+    void _FreeSlot( uint32_t slot )
+    {
+        _GetSlot( slot ).~Parameter();
+        _ReleaseArena( m_SlotArenas[slot] );
+        m_FreeSlots.push_back( slot );
+    }
+
+    Parameter& _GetSlot( uint32_t slot ){ return *reinterpret_cast<Parameter*>( &m_Slots[slot] ); }
+    const Parameter& _GetSlot( uint32_t slot ) const { return *reinterpret_cast<const Parameter*>( &m_Slots[slot] ); }
+
+    // 優先度ごとのバケツに振り分けて、バケツの順に処理する。処理しきれなかった分はバケツに残す
+    void _UpdateByPriority( BudgetTracker& tracker )
+    {
+        const size_t lastBucket = m_Buckets.size() - 1;
+        const uint32_t generation = static_cast<uint32_t>( m_Generation );
+        for( Parameter& param : m_UpdatingRequests )
+        {
+            size_t priority = m_Priority( param );
+            if( lastBucket < priority )
+            {
+                priority = lastBucket;
+            }
+            m_Buckets[priority].push_back( std::move(param) );
+            _PushBucketArena( priority );
+            if( m_AgingUpdates )
+            {
+                m_BucketGenerations[priority].push_back( generation );
+            }
+        }
+        if( m_TrimCount != 0 )
+        {
+            _TrimBuckets();
+        }
+        _MarkSorted();
+
+        // バケツの中は古い順に並んでいるので、持ち越されすぎた分は先頭からまとめて先に処理する
+        if( m_AgingUpdates )
+        {
+            for( size_t i=0; i<m_Buckets.size(); ++i )
+            {
+                std::vector< Parameter >& bucket = m_Buckets[i];
+                const std::vector< uint32_t >& generations = m_BucketGenerations[i];
+                size_t& head = m_BucketHeads[i];
+                for( ; head < bucket.size() && m_AgingUpdates <= static_cast<uint32_t>( generation - generations[head] ) && tracker.CanExecute(); ++head )
+                {
+                    _Execute( bucket[head] );
+                    _PopBucketArena( i, true );
+                    ++tracker.executed;
+                }
+            }
+        }
+
+        for( size_t i=0; i<m_Buckets.size(); ++i )
+        {
+            std::vector< Parameter >& bucket = m_Buckets[i];
+            size_t& head = m_BucketHeads[i];
+            if( m_BucketOrder == REQUEST_BUCKET_FIFO )
+            {
+                for( ; head < bucket.size() && tracker.CanExecute(); ++head )
+                {
+                    _Execute( bucket[head] );
+                    _PopBucketArena( i, true );
+                    ++tracker.executed;
+                }
+            }
+            else
+            {
+                while( head < bucket.size() && tracker.CanExecute() )
+                {
+                    _Execute( bucket.back() );
+                    ++tracker.executed;
+                    bucket.pop_back();
+                    _PopBucketArena( i, false );
+                    if( m_AgingUpdates )
+                    {
+                        m_BucketGenerations[i].pop_back();
+                    }
+                }
+            }
+            _CompactBucket( i );
+        }
+    }
+
+    // バケツに入れたリクエストが使った領域を、続けて同じ領域なら1つにまとめて数えておく
+    void _PushBucketArena( size_t index )
+    {
+        std::deque< ArenaRun >& runs = m_BucketArenas[index];
+        if( runs.empty() || runs.back().arena != m_UpdatingArena )
+        {
+            const ArenaRun run = { m_UpdatingArena, 0 };
+            runs.push_back( run );
+        }
+        ++runs.back().count;
+        _RetainArena( m_UpdatingArena );
+    }
+
+    // バケツの先頭か末尾の1件を処理したか捨てた
+    void _PopBucketArena( size_t index, bool front )
+    {
+        std::deque< ArenaRun >& runs = m_BucketArenas[index];
+        ArenaRun& run = front ? runs.front() : runs.back();
+        _ReleaseArena( run.arena );
+        if( --run.count == 0 )
+        {
+            if( front )
+            {
+                runs.pop_front();
+            }
+            else
+            {
+                runs.pop_back();
+            }
+        }
+    }
+
+    void _ClearBucketArenas()
+    {
+        for( std::deque< ArenaRun >& runs : m_BucketArenas )
+        {
+            for( const ArenaRun& run : runs )
+            {
+                if( run.arena != NO_ARENA )
+                {
+                    m_ArenaPending[run.arena] -= run.count;
+                }
+            }
+        }
+        m_BucketArenas.clear();
+    }
+
+    // 今回処理するリクエストが使った領域を閉じて、この後に追加するリクエストには別の領域を使う
+    // 何も置いていなければ閉じずにそのまま使い続ける
+    void _SealArena()
+    {
+        if( m_Arenas[m_ArenaIndex].GetUsed() == 0 )
+        {
+            m_UpdatingArena = NO_ARENA;
+            return;
+        }
+        m_UpdatingArena = m_ArenaIndex;
+        m_ArenaIndex = _AcquireArena();
+    }
+
+    // 閉じた領域のうち、持ち越しから参照されなくなったものを捨てて使い回す
+    void _RecycleArenas()
+    {
+        if( m_UpdatingArena != NO_ARENA )
+        {
+            m_SealedArenas.push_back( m_UpdatingArena );
+            m_UpdatingArena = NO_ARENA;
+        }
+        for( size_t i=0; i<m_SealedArenas.size(); )
+        {
+            const uint32_t arena = m_SealedArenas[i];
+            if( m_ArenaPending[arena] != 0 )
+            {
+                ++i;
+                continue;
+            }
+            m_Arenas[arena].Reset();
+            m_FreeArenas.push_back( arena );
+            m_SealedArenas[i] = m_SealedArenas.back();
+            m_SealedArenas.pop_back();
+        }
+    }
+
+    uint32_t _AcquireArena()
+    {
+        if( !m_FreeArenas.empty() )
+        {
+            const uint32_t arena = m_FreeArenas.back();
+            m_FreeArenas.pop_back();
+            return arena;
+        }
+        m_Arenas.emplace_back();
+        m_Arenas.back().SetShrinkInterval( m_ArenaShrinkInterval );
+        m_ArenaPending.push_back( 0 );
+        return static_cast<uint32_t>( m_Arenas.size() - 1 );
+    }
+
+    void _RetainArena( uint32_t arena )
+    {
+        if( arena != NO_ARENA )
+        {
+            ++m_ArenaPending[arena];
+        }
+    }
+
+    void _ReleaseArena( uint32_t arena )
+    {
+        if( arena != NO_ARENA )
+        {
+            --m_ArenaPending[arena];
+        }
+    }
+
+    // 処理済みの分を取り除く。先頭から消すのは処理済みが半分を超えてから
+    void _CompactBucket( size_t index )
+    {
+        std::vector< Parameter >& bucket = m_Buckets[index];
+        std::vector< uint32_t >& generations = m_BucketGenerations[index];
+        size_t& head = m_BucketHeads[index];
+        if( head == bucket.size() )
+        {
+            bucket.clear();
+            generations.clear();
+            head = 0;
+        }
+        else if( bucket.size() < head * 2 )
+        {
+            bucket.erase( bucket.begin(), bucket.begin() + head );
+            if( !generations.empty() )
+            {
+                generations.erase( generations.begin(), generations.begin() + head );
+            }
+            head = 0;
+        }
+    }
+
+    void _UpdateStats( const BudgetTracker& tracker )
+    {
+        const size_t carryOver = GetPendingCount();
+        ++m_Stats.updateCount;
+        m_Stats.executedCount += tracker.executed;
+        m_Stats.lastExecuted = tracker.executed;
+        m_Stats.carryOver = carryOver;
+        if( m_Stats.maxCarryOver < carryOver )
+        {
+            m_Stats.maxCarryOver = carryOver;
+        }
+        if( tracker.timeExhausted )
+        {
+            ++m_Stats.timeBudgetExhausted;
+        }
+        else if( 0 < carryOver && tracker.budget.maxCount <= tracker.executed )
+        {
+            ++m_Stats.countBudgetExhausted;
+        }
+    }
+
+    template< typename ...Args >
+    bool _PushRequest( Args&&... args )
+    {
+        if( !_Admit() )
+        {
+            return false;
+        }
+        _PushAdmitted( RequestTicket(), std::forward<Args>(args)... );
+        return true;
+    }
+
+    // 券のないリクエストには無効な券を付けて、同じキューに追加した順に積む
+    template< typename ...Args >
+    void _PushAdmitted( const RequestTicket& ticket, Args&&... args )
+    {
+#ifdef REQUEST_UPDATE_INSTRUMENT
+        const uint64_t enqueued = RequestTsc::Now();
+        m_Requests.Push( ticket, enqueued, std::forward<Args>(args)... );
+        m_Instrument.RecordEnqueue( RequestTsc::Now() - enqueued );
+#else
+        m_Requests.Push( ticket, std::forward<Args>(args)... );
+#endif
+        _NotifyConsumer();
+    }
+
+    /**
+     *  Runで寝ているスレッドがいれば起こす
+     *  Runしているかを先に見ると、フェンスのないその読み込みがキューへの追加より前に済んでしまい、
+     *  Runを始めたばかりのスレッドが追加を見落として寝続けることがある。Notifyは寝ていなければフェンス1つで済むので、いつも呼ぶ
+     */
+    void _NotifyConsumer()
+    {
+        if( !std::is_same<ThreadingPolicy, RequestUpdateSingleThread>::value )
+        {
+            m_Wakeup.Notify();
+        }
+    }
+
+    // 次のUpdateでやることがあるか
+    bool _HasWork() const
+    {
+        return !m_Requests.IsEmpty() || m_HasTimerRequests.load( std::memory_order_relaxed ) || 0 < GetPendingCount();
+    }
+
+    /**
+     *  キューから取り出して、追加した順に今回のリクエストに並べる。取り出した数を返す
+     *  取り消された券のものはここで捨てるので並べ替えにも回らない
+     *  並べ替えやまとめる処理で位置が動く場合と、まとめて渡す場合はここで券を使い切る
+     *  それ以外は券をm_UpdatingTicketsに今回のリクエストと同じ添字で並べておき、処理する直前まで取り消せるようにする
+     */
+    size_t _TakeQueued()
+    {
+        m_Requests.PopAll( m_QueuedRequests );
+        const size_t count = m_QueuedRequests.size();
+        const bool claimNow = m_SortPred || m_Priority || m_CoalesceKey || m_BatchExecuter;
+#ifdef REQUEST_UPDATE_INSTRUMENT
+        m_EnqueueTimes.clear();
+#endif
+        for( QueuedRequest& queued : m_QueuedRequests )
+        {
+            if( queued.ticket.IsValid() )
+            {
+                if( claimNow || m_Tickets.IsCancelled( queued.ticket ) )
+                {
+                    if( !_ClaimTicket( queued.ticket ) )
+                    {
+                        continue;
+                    }
+                }
+                else
+                {
+                    // 券のないものが続いた分は無効な券で埋める
+                    m_UpdatingTickets.resize( m_UpdatingRequests.size() );
+                    m_UpdatingTickets.push_back( queued.ticket );
+                }
+            }
+#ifdef REQUEST_UPDATE_INSTRUMENT
+            m_EnqueueTimes.push_back( queued.enqueued );
+#endif
+            m_UpdatingRequests.push_back( std::move(queued.param) );
+        }
+        m_QueuedRequests.clear();
+        return count;
+    }
+
+    // m_UpdatingRequestsのindex番目の券。券がなければ無効な券
+    RequestTicket _GetTicket( size_t index ) const
+    {
+        if( m_UpdatingTickets.size() <= index )
+        {
+            return RequestTicket();
+        }
+        return m_UpdatingTickets[index];
+    }
+
+    RequestTicket _GetSortedTicket( size_t i ) const
+    {
+        if( m_UpdatingTickets.empty() )
+        {
+            return RequestTicket();
+        }
+        return _GetTicket( m_SortKey ? m_SortEntries[i].index : i );
+    }
+
+    // 処理すると決めて券を使い切る。取り消されていたらfalse
+    bool _ClaimTicket( const RequestTicket& ticket )
+    {
+        if( m_Tickets.Claim( ticket ) )
+        {
+            return true;
+        }
+        ++m_Stats.cancelledCount;
+        return false;
+    }
+
+    // 持ち越しに溜まった取り消し済みをまとめて取り除く。前回から持ち越しの半分以上取り消されたときだけ呼ぶので、ならせばO(1)
+    void _CompactPending()
+    {
+        m_CancelCheckpoint = m_Tickets.GetCancelCount();
+        m_Stats.cancelledCount += m_Pending.RemoveIf( [this]( const PendingEntry& entry ){
+            if( !m_Tickets.IsCancelled( entry.ticket ) )
+            {
+                return false;
+            }
+            m_Tickets.Claim( entry.ticket );
+            _FreeSlot( entry.slot );
+            return true;
+        }, PendingLess{ this } );
+    }
+
+    // キューに積まれた分と、Updateが取り出して持っている分の合計
+    int64_t _GetWaitingCount() const
+    {
+        return m_QueuedCount.load( std::memory_order_seq_cst ) + m_InFlightCount.load( std::memory_order_seq_cst );
+    }
+
+    // 上限を確かめて、追加してよければ数に入れる
+    bool _Admit()
+    {
+        if( m_Capacity == 0 )
+        {
+            return true;
+        }
+        const int64_t capacity = static_cast<int64_t>( m_Capacity );
+        const bool dropLater = m_OverloadPolicy == REQUEST_OVERLOAD_DROP_OLDEST || m_OverloadPolicy == REQUEST_OVERLOAD_DROP_LOWEST;
+        bool blocked = false;
+        bool hasDeadline = false;
+        TimePoint deadline;
+        for(;;)
+        {
+            const int64_t waiting = m_QueuedCount.fetch_add( 1, std::memory_order_seq_cst ) + m_InFlightCount.load( std::memory_order_seq_cst );
+            if( waiting < capacity )
+            {
+                return true;
+            }
+            m_FullCount.fetch_add( 1, std::memory_order_relaxed );
+            if( dropLater && waiting < capacity * 2 )
+            {
+                return true;
+            }
+            m_QueuedCount.fetch_sub( 1, std::memory_order_seq_cst );
+
+            if( m_OverloadPolicy != REQUEST_OVERLOAD_BLOCK )
+            {
+                m_RejectedCount.fetch_add( 1, std::memory_order_relaxed );
+                return false;
+            }
+            if( !blocked )
+            {
+                // 待つ時間は呼び出し1回分で数える。起きた後で他のスレッドに先を越されても延ばさない
+                blocked = true;
+                m_BlockedCount.fetch_add( 1, std::memory_order_relaxed );
+                const TimePoint now = std::chrono::steady_clock::now();
+                hasDeadline = m_BlockTimeout < TimePoint::max() - now;
+                deadline = hasDeadline ? now + m_BlockTimeout : TimePoint::max();
+            }
+            if( !_WaitForSpace( hasDeadline, deadline ) )
+            {
+                m_RejectedCount.fetch_add( 1, std::memory_order_relaxed );
+                return false;
+            }
+        }
+    }
+
+    // 上限を下回るまで待つ。deadlineを過ぎたらfalse
+    bool _WaitForSpace( bool hasDeadline, TimePoint deadline )
+    {
+        const int64_t capacity = static_cast<int64_t>( m_Capacity );
+        std::unique_lock<std::mutex> lock( m_SpaceMutex );
+        m_SpaceWaiters.fetch_add( 1, std::memory_order_seq_cst );
+        bool hasSpace = true;
+        if( !hasDeadline )
+        {
+            m_SpaceCondition.wait( lock, [this, capacity]{ return _GetWaitingCount() < capacity; } );
+        }
+        else
+        {
+            hasSpace = m_SpaceCondition.wait_until( lock, deadline, [this, capacity]{ return _GetWaitingCount() < capacity; } );
+        }
+        m_SpaceWaiters.fetch_sub( 1, std::memory_order_relaxed );
+        return hasSpace;
+    }
+
+    /**
+     *  キューから取り出したpicked件を、キューの数から手元の数に移す。先に手元に足すので、合計が一時的に実際より少なくなることはない
+     *  手元の数には時刻になったタイマーのリクエストも入れる
+     */
+    void _AccountPicked( size_t picked )
+    {
+        m_InFlightCount.store( static_cast<int64_t>( GetPendingCount() + m_UpdatingRequests.size() ), std::memory_order_seq_cst );
+        m_QueuedCount.fetch_sub( static_cast<int64_t>( picked ), std::memory_order_seq_cst );
+    }
+
+    // 処理し終わって残った数を知らせて、空きを待っているスレッドを起こす
+    void _ReleaseCapacity()
+    {
+        m_InFlightCount.store( static_cast<int64_t>( GetPendingCount() ), std::memory_order_seq_cst );
+        if( m_SpaceWaiters.load( std::memory_order_seq_cst ) != 0 )
+        {
+            std::lock_guard<std::mutex> lock( m_SpaceMutex );
+            m_SpaceCondition.notify_all();
+        }
+    }
+
+    // 取り出した分と持ち越した分を合わせて上限に収まるように捨てる
+    void _TrimToCapacity()
+    {
+        if( m_OverloadPolicy != REQUEST_OVERLOAD_DROP_OLDEST && m_OverloadPolicy != REQUEST_OVERLOAD_DROP_LOWEST )
+        {
+            return;
+        }
+        const size_t total = m_UpdatingRequests.size() + GetPendingCount();
+        if( total <= m_Capacity )
+        {
+            return;
+        }
+        const size_t excess = total - m_Capacity;
+        if( m_Priority )
+        {
+            // バケツに分けてから捨てる
+            m_TrimCount = excess;
+            return;
+        }
+        _TrimPending( excess );
+        m_InFlightCount.store( static_cast<int64_t>( m_UpdatingRequests.size() + GetPendingCount() ), std::memory_order_seq_cst );
+    }
+
+    // 捨てる候補。持ち越しならindexはスロットの番号、今回の分ならm_UpdatingRequestsの添字
+    struct DropCandidate
+    {
+        uint64_t key;
+        uint64_t sequence;
+        const Parameter* param;
+        size_t index;
+        bool pending;
+    };
+
+    // 捨てる順。並べ方がなければ追加した順に処理するので、古い順と新しい順になる
+    struct DropOrder
+    {
+        const BasicRequestUpdate* owner;
+        bool oldest;
+
+        // lhsを先に捨てるか
+        bool operator()( const DropCandidate& lhs, const DropCandidate& rhs ) const
+        {
+            if( oldest )
+            {
+                return lhs.sequence < rhs.sequence;
+            }
+            if( owner->m_SortPred )
+            {
+                // 後で処理するものから捨てる
+                if( owner->m_SortPred( *rhs.param, *lhs.param ) )
+                {
+                    return true;
+                }
+                if( owner->m_SortPred( *lhs.param, *rhs.param ) )
+                {
+                    return false;
+                }
+                return rhs.sequence < lhs.sequence;
+            }
+            return rhs.key < lhs.key || ( lhs.key == rhs.key && rhs.sequence < lhs.sequence );
+        }
+    };
+
+    // 持ち越しと今回の分から、捨てる順にexcess件捨てる。今回の分は持ち越しより新しい
+    void _TrimPending( size_t excess )
+    {
+        const DropOrder order = { this, m_OverloadPolicy == REQUEST_OVERLOAD_DROP_OLDEST };
+        const size_t size = m_UpdatingRequests.size();
+        m_DropCandidates.clear();
+        for( const PendingEntry& entry : m_Pending )
+        {
+            const DropCandidate candidate = { entry.key, entry.sequence, &_GetSlot( entry.slot ), entry.slot, true };
+            m_DropCandidates.push_back( candidate );
+        }
+        for( size_t i=0; i<size; ++i )
+        {
+            const DropCandidate candidate = { m_SortKey ? m_SortKey( m_UpdatingRequests[i] ) : 0, m_Sequence + i, &m_UpdatingRequests[i], i, false };
+            m_DropCandidates.push_back( candidate );
+        }
+
+        // 先頭のexcess件を捨てる。比較でリクエストを見るので、捨てるものを全部決めてから取り除く
+        std::nth_element( m_DropCandidates.begin(), m_DropCandidates.begin() + ( excess - 1 ), m_DropCandidates.end(), order );
+        m_DropSlots.assign( m_Slots.size(), 0 );
+        m_DropUpdating.assign( size, 0 );
+        for( size_t i=0; i<excess; ++i )
+        {
+            const DropCandidate& candidate = m_DropCandidates[i];
+            ( candidate.pending ? m_DropSlots : m_DropUpdating )[candidate.index] = 1;
+        }
+
+        uint64_t dropped = m_Pending.RemoveIf( [this]( const PendingEntry& entry ){
+            if( !m_DropSlots[entry.slot] )
+            {
+                return false;
+            }
+            m_Tickets.Claim( entry.ticket );
+            _FreeSlot( entry.slot );
+            return true;
+        }, PendingLess{ this } );
+
+        // 今回の分は並びを保ったまま詰める。券も同じ添字で一緒に詰める
+        size_t kept = 0;
+        for( size_t i=0; i<size; ++i )
+        {
+            const RequestTicket ticket = _GetTicket( i );
+            if( m_DropUpdating[i] )
+            {
+                m_Tickets.Claim( ticket );
+                ++dropped;
+                continue;
+            }
+            if( kept != i )
+            {
+                m_UpdatingRequests[kept] = std::move( m_UpdatingRequests[i] );
+            }
+            if( kept < m_UpdatingTickets.size() )
+            {
+                m_UpdatingTickets[kept] = ticket;
+            }
+            ++kept;
+        }
+        m_UpdatingRequests.erase( m_UpdatingRequests.begin() + kept, m_UpdatingRequests.end() );
+        if( kept < m_UpdatingTickets.size() )
+        {
+            m_UpdatingTickets.resize( kept );
+        }
+        m_DroppedCount.fetch_add( dropped, std::memory_order_relaxed );
+    }
+
+    // 優先度の低いバケツから捨てる。古いものから捨てるなら先頭から、そうでなければ後ろから
+    void _TrimBuckets()
+    {
+        uint64_t dropped = 0;
+        for( size_t i=m_Buckets.size(); 0 < i && dropped < m_TrimCount; --i )
+        {
+            std::vector< Parameter >& bucket = m_Buckets[i - 1];
+            size_t& head = m_BucketHeads[i - 1];
+            while( head < bucket.size() && dropped < m_TrimCount )
+            {
+                if( m_OverloadPolicy == REQUEST_OVERLOAD_DROP_OLDEST )
+                {
+                    ++head;
+                    _PopBucketArena( i - 1, true );
+                }
+                else
+                {
+                    bucket.pop_back();
+                    _PopBucketArena( i - 1, false );
+                    if( m_AgingUpdates )
+                    {
+                        m_BucketGenerations[i - 1].pop_back();
+                    }
+                }
+                ++dropped;
+            }
+            _CompactBucket( i - 1 );
+        }
+        m_TrimCount = 0;
+        m_DroppedCount.fetch_add( dropped, std::memory_order_relaxed );
+    }
+
+    // durationの間やることが来ないか見ている。来たらtrue
+    bool _SpinForWork( const RequestStopToken& stop, Duration duration ) const
+    {
+        if( duration <= Duration::zero() )
+        {
+            return false;
+        }
+        // Duration::max()などは今の時刻に足すと溢れるので、時刻の最大で止める
+        const TimePoint now = std::chrono::steady_clock::now();
+        const TimePoint end = duration < TimePoint::max() - now ? now + duration : TimePoint::max();
+        do
+        {
+            if( _HasWork() )
+            {
+                return true;
+            }
+            std::this_thread::yield();
+        } while( !stop.StopRequested() && std::chrono::steady_clock::now() < end );
+        return false;
+    }
+
+    // 並べ終わって処理を始める時刻を記録する
+    void _MarkSorted()
+    {
+#ifdef REQUEST_UPDATE_INSTRUMENT
+        m_SortedTsc = RequestTsc::Now();
+#endif
+    }
+
+#ifdef REQUEST_UPDATE_INSTRUMENT
+    void _RecordInstrument( uint64_t startTsc )
+    {
+        const uint64_t endTsc = RequestTsc::Now();
+        m_Instrument.RecordUpdate( m_EnqueueTimes.size(), m_SortedTsc - m_PickedTsc, endTsc - m_SortedTsc, endTsc - startTsc );
+        m_Instrument.RecordLatency( m_EnqueueTimes.data(), m_EnqueueTimes.size(), m_SortedTsc );
+    }
+#endif
+
+    // キーと添字だけを並べる。パラメータは動かさない
+    void _SortByKey()
+    {
+        const size_t size = m_UpdatingRequests.size();
+        m_SortEntries.resize( size );
+        for( size_t i=0; i<size; ++i )
+        {
+            m_SortEntries[i].key = m_SortKey( m_UpdatingRequests[i] );
+            m_SortEntries[i].index = static_cast<uint32_t>(i);
+        }
+
+        m_Sorter.Sort( m_SortEntries, m_SortEngine );
+    }
+
+private:
+    // キューに積むリクエスト。取り消せないものは無効な券を持つ。計測するときは追加した時刻も一緒に積む
+    struct QueuedRequest
+    {
+#ifdef REQUEST_UPDATE_INSTRUMENT
+        template< typename ...Args >
+        QueuedRequest( const RequestTicket& ticket, uint64_t enqueued, Args&&... args )
+        :ticket(ticket)
+        ,enqueued(enqueued)
+        ,param(std::forward<Args>(args)...)
+        {}
+#else
+        template< typename ...Args >
+        QueuedRequest( const RequestTicket& ticket, Args&&... args )
+        :ticket(ticket)
+        ,param(std::forward<Args>(args)...)
+        {}
+#endif
+
+        RequestTicket ticket;
+#ifdef REQUEST_UPDATE_INSTRUMENT
+        uint64_t enqueued;
+#endif
+        Parameter param;
+    };
+
+    typename ThreadingPolicy::template Queue< QueuedRequest > m_Requests;   //リクエスト追加用
+    std::vector< QueuedRequest > m_QueuedRequests;
+    std::vector< Parameter > m_UpdatingRequests;//処理中のリクエスト
+    RequestExecuter m_Executer;
+    SortPredicator m_SortPred;
+
+    SortKeyProjection m_SortKey;
+    RequestSortEngine m_SortEngine;
+    RequestSorter m_Sorter;
+    std::vector< RequestSortEntry > m_SortEntries;  // 並べ替え用のキーと添字
+
+    PriorityProjection m_Priority;
+    RequestBucketOrder m_BucketOrder;
+    std::vector< std::vector< Parameter > > m_Buckets;  // 優先度ごとのバケツ。領域は使い回す
+    std::vector< size_t > m_BucketHeads;                // バケツごとの処理済みの位置
+    std::vector< std::vector< uint32_t > > m_BucketGenerations; // エージングするときの、追加したUpdateの世代
+    std::vector< std::deque< ArenaRun > > m_BucketArenas;       // バケツの処理していない分が使っている領域
+
+    RequestDaryHeap< PendingEntry > m_Pending;          // 持ち越したリクエスト
+    std::deque< ParameterStorage > m_Slots;             // 持ち越したパラメータ。伸ばしても既存の要素は動かない
+    std::vector< uint32_t > m_FreeSlots;
+    std::vector< uint32_t > m_SlotArenas;               // スロットのパラメータが使っている領域
+    uint64_t m_Sequence;
+
+    uint64_t m_Generation;      // Updateを呼んだ回数
+    size_t m_AgingUpdates;
+    uint32_t m_OldestPendingGeneration; // 持ち越しで、まだ先に処理する側へ移していない中で一番古い世代(古すぎることはある)
+    RequestUpdateStats m_Stats;
+
+    RequestWorkerPool* m_WorkerPool;
+    LaneKeyProjection m_LaneKey;
+    size_t m_LaneBits;                              // レーン数は2のm_LaneBits乗
+    std::vector< std::vector< Parameter* > > m_Lanes;
+    std::vector< size_t > m_ActiveLanes;            // 空でないレーン
+    std::vector< Parameter* > m_ParallelOrder;      // 並列に処理するリクエストを並んだ順に
+    std::vector< uint32_t > m_ParallelSlots;
+
+    CoalesceKeyProjection m_CoalesceKey;
+    CoalesceReducer m_CoalesceReducer;
+    RequestKeyTable m_CoalesceTable;
+
+    BatchExecuter m_BatchExecuter;
+    size_t m_BatchChunkSize;
+    std::vector< Parameter > m_BatchBuffer;     // 並べ替えた順に詰め直したリクエスト
+
+    std::deque< RequestArena > m_Arenas;    // Updateごとの領域。伸ばしても既存の要素は動かない
+    std::vector< size_t > m_ArenaPending;   // 領域ごとの、持ち越したリクエストの数
+    std::vector< uint32_t > m_FreeArenas;   // 捨てて使い回せる領域
+    std::vector< uint32_t > m_SealedArenas; // 閉じた後、持ち越しが残っている領域
+    uint32_t m_ArenaIndex;                  // 追加中のリクエスト用
+    uint32_t m_UpdatingArena;               // 今回処理するリクエスト用。何も置いていなければNO_ARENA
+    size_t m_ArenaShrinkInterval;
+
+    struct TimerRequest
+    {
+        TimerRequest( TimePoint when, Duration period, Parameter&& param, const RequestTicket& ticket )
+        :when(when)
+        ,period(period)
+        ,param(std::move(param))
+        ,ticket(ticket)
+        {}
+
+        TimePoint when;
+        Duration period;    // 繰り返さないなら0
+        Parameter param;
+        RequestTicket ticket;   // 繰り返しを止める券
+    };
+    typename ThreadingPolicy::template Queue< TimerRequest > m_TimerRequests;  // タイマー追加用
+    std::atomic<bool> m_HasTimerRequests;
+    std::vector< TimerRequest > m_NewTimers;
+    RequestTimerWheel m_TimerWheel;     // 中身はm_Slotsの番号
+    std::vector< RequestTicket > m_TimerTickets;    // 繰り返しのタイマーの券。スロットの番号が添字
+    TimerClock m_TimerClock;
+    Duration m_TimerResolution;
+    TimePoint m_TimerEpoch;             // tickの0
+    bool m_TimerStarted;
+
+#ifdef REQUEST_UPDATE_INSTRUMENT
+    RequestUpdateInstrument m_Instrument;
+    std::vector< uint64_t > m_EnqueueTimes;     // 今回取り出したリクエストを追加した時刻
+    uint64_t m_PickedTsc;                       // 取り出し終わった時刻
+    uint64_t m_SortedTsc;                       // 並べ終わった時刻
+#endif
+
+    RequestWakeup m_Wakeup;
+    uint64_t m_WakeupBase;          // ResetStatsしたときの起こした回数
+
+    RequestTicketTable m_Tickets;
+    std::vector< RequestTicket > m_UpdatingTickets; // m_UpdatingRequestsと同じ添字の券。最後の券より後ろは券がない
+    uint64_t m_CancelCheckpoint;    // 前回持ち越しを掃除したときの取り消し数
+
+    size_t m_Capacity;                      // 0なら上限なし
+    RequestOverloadPolicy m_OverloadPolicy;
+    Duration m_BlockTimeout;
+    std::atomic<int64_t> m_QueuedCount;     // 追加してまだ取り出していない数
+    char m_CountPadding[64];                // 追加するスレッドが書く数と、Updateが書く数を別のキャッシュラインに置く
+    std::atomic<int64_t> m_InFlightCount;   // Updateが取り出して持っている数(持ち越しを含む)
+    size_t m_TrimCount;                     // バケツに分けた後で捨てる数
+    std::vector< DropCandidate > m_DropCandidates;
+    std::vector< char > m_DropSlots;        // 捨てる持ち越し。スロットの番号が添字
+    std::vector< char > m_DropUpdating;     // 捨てる今回の分。m_UpdatingRequestsの添字
+    std::atomic<uint64_t> m_RejectedCount;
+    std::atomic<uint64_t> m_DroppedCount;
+    std::atomic<uint64_t> m_BlockedCount;
+    std::atomic<uint64_t> m_FullCount;
+    std::mutex m_SpaceMutex;                // 空きを待つ
+    std::condition_variable m_SpaceCondition;
+    std::atomic<unsigned int> m_SpaceWaiters;
+};
+
+template< typename ThreadingPolicy, typename ArgFirst, typename ...ArgTypes >
+const uint32_t BasicRequestUpdate<ThreadingPolicy, ArgFirst, ArgTypes...>::NO_ARENA;
+
+// 今までと同じ動作のRequestUpdate
+template< typename ArgFirst, typename ...ArgTypes >
+using RequestUpdate = BasicRequestUpdate< RequestUpdateMpsc, ArgFirst, ArgTypes... >;
+
+#ifdef REQUEST_UPDATE_EXTERN_TEMPLATE
+// よく使う型はライブラリ側で実体化してある(RequestUpdate.cpp)
+extern template class BasicRequestUpdate<RequestUpdateMpsc, int>;
+#endif
 
 #endif /* defined(__RequestAndUpdate__RequestUpdate__) */
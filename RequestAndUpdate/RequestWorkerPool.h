@@ -0,0 +1,236 @@
+/*
+ * Copyright (c) 2013, nilfs
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * * Neither the name of the <ORGANIZATION> nor the names of its contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __RequestAndUpdate__RequestWorkerPool__
+#define __RequestAndUpdate__RequestWorkerPool__
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <cstddef>
+
+/**
+ *  仕事を盗み合うスレッドプール
+ *  ワーカーごとにキューを持ち、自分のキューは後ろから、他のキューは前から取る
+ *  Runを呼んだスレッドも終わるまで一緒に処理するので、ワーカーが0人でも動く
+ */
+class RequestWorkerPool
+{
+public:
+    typedef void (*TaskFunction)( void* context, size_t index );
+
+public:
+    explicit RequestWorkerPool( size_t threadCount=std::thread::hardware_concurrency() )
+    :m_Queues( threadCount < 1 ? 1 : threadCount )
+    ,m_QueuedCount(0)
+    ,m_NextQueue(0)
+    ,m_Stop(false)
+    {
+        for( size_t i=0; i<threadCount; ++i )
+        {
+            m_Threads.push_back( std::thread( &RequestWorkerPool::_WorkerMain, this, i ) );
+        }
+    }
+
+    ~RequestWorkerPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock( m_Mutex );
+            m_Stop = true;
+        }
+        m_Condition.notify_all();
+        for( std::thread& thread : m_Threads )
+        {
+            thread.join();
+        }
+    }
+
+private:
+    RequestWorkerPool( const RequestWorkerPool& ) = delete;
+    RequestWorkerPool& operator=( const RequestWorkerPool& ) = delete;
+
+public:
+    size_t GetWorkerCount() const { return m_Threads.size(); }
+
+    /**
+     *  function(context, 0) から function(context, count-1) までを並列に呼び、全部終わるまで待つ
+     *  複数のスレッドから同時に呼んでもよい
+     */
+    void Run( TaskFunction function, void* context, size_t count )
+    {
+        if( count == 0 )
+        {
+            return;
+        }
+
+        Batch batch;
+        batch.remaining.store( count, std::memory_order_relaxed );
+        batch.done = false;
+
+        // 取り出したワーカーが先に減らして数が巻き戻らないように、配る前に数えておく
+        {
+            std::lock_guard<std::mutex> lock( m_Mutex );
+            m_QueuedCount.fetch_add( count, std::memory_order_relaxed );
+        }
+
+        // ワーカーのキューに順番に配る
+        const size_t queueCount = m_Queues.size();
+        const size_t first = m_NextQueue.fetch_add( 1, std::memory_order_relaxed );
+        for( size_t q=0; q<queueCount && q<count; ++q )
+        {
+            TaskQueue& queue = m_Queues[ ( first + q ) % queueCount ];
+            std::lock_guard<std::mutex> lock( queue.mutex );
+            for( size_t i=q; i<count; i+=queueCount )
+            {
+                Task task = { function, context, i, &batch };
+                queue.tasks.push_back( task );
+            }
+        }
+        m_Condition.notify_all();
+
+        // 待っている間も手伝う。キューが空なら残りは他のスレッドが実行中
+        while( batch.remaining.load( std::memory_order_acquire ) != 0 && _RunOne( first % queueCount ) )
+        {
+        }
+
+        // 最後のタスクが通知を終えるまではbatchを破棄できない
+        std::unique_lock<std::mutex> lock( batch.mutex );
+        batch.condition.wait( lock, [&batch]{ return batch.done; } );
+    }
+
+private:
+    struct Batch
+    {
+        std::atomic<size_t> remaining;
+        bool done;
+        std::mutex mutex;
+        std::condition_variable condition;
+    };
+
+    struct Task
+    {
+        TaskFunction function;
+        void* context;
+        size_t index;
+        Batch* batch;
+    };
+
+    struct TaskQueue
+    {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+private:
+    void _WorkerMain( size_t index )
+    {
+        for(;;)
+        {
+            if( _RunOne( index ) )
+            {
+                continue;
+            }
+
+            std::unique_lock<std::mutex> lock( m_Mutex );
+            m_Condition.wait( lock, [this]{ return m_Stop || m_QueuedCount.load( std::memory_order_relaxed ) != 0; } );
+            if( m_Stop )
+            {
+                return;
+            }
+        }
+    }
+
+    // 自分のキューの後ろから、なければ他のキューの前から1つ取って実行する
+    bool _RunOne( size_t self )
+    {
+        Task task;
+        if( !_PopBack( m_Queues[self], task ) )
+        {
+            bool stolen = false;
+            for( size_t i=1; i<m_Queues.size() && !stolen; ++i )
+            {
+                stolen = _PopFront( m_Queues[ ( self + i ) % m_Queues.size() ], task );
+            }
+            if( !stolen )
+            {
+                return false;
+            }
+        }
+        m_QueuedCount.fetch_sub( 1, std::memory_order_relaxed );
+
+        task.function( task.context, task.index );
+
+        Batch* batch = task.batch;
+        if( batch->remaining.fetch_sub( 1, std::memory_order_acq_rel ) == 1 )
+        {
+            std::lock_guard<std::mutex> lock( batch->mutex );
+            batch->done = true;
+            batch->condition.notify_all();
+        }
+        return true;
+    }
+
+    static bool _PopBack( TaskQueue& queue, Task& task )
+    {
+        std::lock_guard<std::mutex> lock( queue.mutex );
+        if( queue.tasks.empty() )
+        {
+            return false;
+        }
+        task = queue.tasks.back();
+        queue.tasks.pop_back();
+        return true;
+    }
+
+    static bool _PopFront( TaskQueue& queue, Task& task )
+    {
+        std::lock_guard<std::mutex> lock( queue.mutex );
+        if( queue.tasks.empty() )
+        {
+            return false;
+        }
+        task = queue.tasks.front();
+        queue.tasks.pop_front();
+        return true;
+    }
+
+private:
+    std::vector<std::thread> m_Threads;
+    std::vector<TaskQueue> m_Queues;
+    std::atomic<size_t> m_QueuedCount;  // キューに入れる途中か、入っていてまだ誰も取っていない数
+    std::atomic<size_t> m_NextQueue;
+    std::mutex m_Mutex;
+    std::condition_variable m_Condition;
+    bool m_Stop;
+};
+
+#endif /* defined(__RequestAndUpdate__RequestWorkerPool__) */
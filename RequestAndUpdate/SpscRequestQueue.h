@@ -0,0 +1,212 @@
+/*
+ * Copyright (c) 2013, nilfs
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * * Neither the name of the <ORGANIZATION> nor the names of its contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __RequestAndUpdate__SpscRequestQueue__
+#define __RequestAndUpdate__SpscRequestQueue__
+
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <type_traits>
+#include <utility>
+#include <cstddef>
+
+/**
+ *  1スレッドから追加して、別の1スレッドで取り出すキュー
+ *
+ *  リングバッファの先頭と末尾をそれぞれのスレッドだけが書き換えるので、ロックしない
+ *  リングが埋まると、追加側がPushの中で倍の大きさのリングを確保して後ろにつなぐ
+ *  (確保の回数は大きさの対数で、ならせば1件あたりO(1))。取り出し側は古いリングを読み終えたら捨てる
+ *  そのためPushはメモリ確保することがあり、確保も待ちもしないのはTryPushとPopAllだけ
+ *  growableをfalseにすると大きさを固定して、Pushは確保せずに取り出し側が空けるまで待つ
+ */
+template< typename T >
+class SpscRequestQueue
+{
+private:
+    static const size_t INITIAL_CAPACITY = 1024;
+
+    struct Ring
+    {
+        explicit Ring( size_t capacity )
+        :head(0)
+        ,tail(0)
+        ,next(nullptr)
+        ,mask(capacity - 1)
+        ,slots(new Slot[capacity])
+        {}
+
+        ~Ring()
+        {
+            delete [] slots;
+        }
+
+        T* GetSlot( size_t index ){ return reinterpret_cast<T*>( &slots[index & mask] ); }
+
+        typedef typename std::aligned_storage<sizeof(T), std::alignment_of<T>::value>::type Slot;
+
+        // new で確保するので alignas は使わず、埋め草で別のキャッシュラインに分ける
+        std::atomic<size_t> head;   // 取り出し側だけが書き換える
+        char padding[64];
+        std::atomic<size_t> tail;   // 追加側だけが書き換える
+        std::atomic<Ring*> next;                // 追加側が次のリングに移ったらつなぐ
+        const size_t mask;
+        Slot* slots;
+    };
+
+public:
+    // initialCapacityは2のべき乗に切り上げる
+    explicit SpscRequestQueue( size_t initialCapacity=INITIAL_CAPACITY, bool growable=true )
+    :m_Growable(growable)
+    {
+        size_t capacity = 2;
+        while( capacity < initialCapacity )
+        {
+            capacity *= 2;
+        }
+        m_ProducerRing = m_ConsumerRing = new Ring( capacity );
+    }
+
+    ~SpscRequestQueue()
+    {
+        std::vector<T> rest;
+        PopAll( rest );
+        delete m_ConsumerRing;
+    }
+
+private:
+    SpscRequestQueue( const SpscRequestQueue& ) = delete;
+    SpscRequestQueue& operator=( const SpscRequestQueue& ) = delete;
+
+public:
+    /**
+     *  埋まっていたら、育てられるなら大きいリングを確保し、固定なら取り出し側が空けるまで待つ
+     *  固定の大きさで待つので、取り出すスレッドから呼んではいけない
+     */
+    template< typename ...Args >
+    void Push( Args&&... args )
+    {
+        Ring* ring = m_ProducerRing;
+        if( _IsFull( ring ) )
+        {
+            if( m_Growable )
+            {
+                // 埋まったので大きいリングに移る。古いリングにはもう書かない
+                Ring* next = new Ring( ( ring->mask + 1 ) * 2 );
+                ring->next.store( next, std::memory_order_release );
+                m_ProducerRing = ring = next;
+            }
+            else
+            {
+                while( _IsFull( ring ) )
+                {
+                    std::this_thread::yield();
+                }
+            }
+        }
+        _Write( ring, std::forward<Args>(args)... );
+    }
+
+    // 埋まっていたら確保も待ちもせずにfalseを返す
+    template< typename ...Args >
+    bool TryPush( Args&&... args )
+    {
+        Ring* ring = m_ProducerRing;
+        if( _IsFull( ring ) )
+        {
+            return false;
+        }
+        _Write( ring, std::forward<Args>(args)... );
+        return true;
+    }
+
+    // 追加された要素を全てoutの後ろにムーブする
+    void PopAll( std::vector<T>& out )
+    {
+        for(;;)
+        {
+            Ring* ring = m_ConsumerRing;
+            // nextを先に読む。nextがあれば、その時点で古いリングへの書き込みは終わっている
+            Ring* next = ring->next.load( std::memory_order_acquire );
+            _Drain( ring, out );
+            if( !next )
+            {
+                return;
+            }
+            m_ConsumerRing = next;
+            delete ring;
+        }
+    }
+
+    // 取り出す側から呼ぶ
+    bool IsEmpty() const
+    {
+        const Ring* ring = m_ConsumerRing;
+        if( ring->next.load( std::memory_order_acquire ) )
+        {
+            return false;
+        }
+        return ring->head.load( std::memory_order_relaxed ) == ring->tail.load( std::memory_order_acquire );
+    }
+
+private:
+    static bool _IsFull( Ring* ring )
+    {
+        return ring->mask < ring->tail.load( std::memory_order_relaxed ) - ring->head.load( std::memory_order_acquire );
+    }
+
+    template< typename ...Args >
+    static void _Write( Ring* ring, Args&&... args )
+    {
+        const size_t index = ring->tail.load( std::memory_order_relaxed );
+        new (ring->GetSlot(index)) T( std::forward<Args>(args)... );
+        ring->tail.store( index + 1, std::memory_order_release );
+    }
+
+    void _Drain( Ring* ring, std::vector<T>& out )
+    {
+        size_t head = ring->head.load( std::memory_order_relaxed );
+        const size_t tail = ring->tail.load( std::memory_order_acquire );
+        for( ; head != tail; ++head )
+        {
+            T* item = ring->GetSlot(head);
+            out.emplace_back( std::move(*item) );
+            item->~T();
+        }
+        ring->head.store( head, std::memory_order_release );
+    }
+
+private:
+    Ring* m_ProducerRing;
+    bool m_Growable;
+    char m_Padding[64];
+    Ring* m_ConsumerRing;
+};
+
+#endif /* defined(__RequestAndUpdate__SpscRequestQueue__) */
@@ -0,0 +1,70 @@
+/*
+ * Copyright (c) 2013, nilfs
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * * Neither the name of the <ORGANIZATION> nor the names of its contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __benchmark__Benchmark__
+#define __benchmark__Benchmark__
+
+#include <iostream>
+#include <chrono>
+#include <string>
+#include <cstdlib>
+
+/**
+ *  ベンチマークの共通処理
+ *  結果は "名前 値 単位" の1行で出力する。scripts/pgo_build.sh がこの形式を読んで比較する
+ */
+class BenchmarkTimer
+{
+public:
+    BenchmarkTimer()
+    :m_Start(std::chrono::steady_clock::now())
+    {}
+
+public:
+    double GetSeconds() const
+    {
+        return std::chrono::duration<double>( std::chrono::steady_clock::now() - m_Start ).count();
+    }
+
+private:
+    std::chrono::steady_clock::time_point m_Start;
+};
+
+inline void BenchmarkReport( const std::string& name, double value, const char* unit )
+{
+    std::cout << name << " " << value << " " << unit << std::endl;
+}
+
+// 引数がなければ既定値を使う
+inline long BenchmarkArgument( int argc, const char* argv[], int index, long defaultValue )
+{
+    return index < argc ? std::atol( argv[index] ) : defaultValue;
+}
+
+#endif /* defined(__benchmark__Benchmark__) */
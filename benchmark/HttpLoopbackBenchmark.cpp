@@ -0,0 +1,125 @@
+/*
+ * Copyright (c) 2013, nilfs
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * * Neither the name of the <ORGANIZATION> nor the names of its contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <iostream>
+#include <string>
+
+#include "HttpClient.h"
+#include "Benchmark.h"
+#include "LoopbackHttpServer.h"
+
+namespace
+{
+    // concurrency件を処理中に保ちながら、count件のGETを処理し終わるまでの時間を測る
+    template< class MakeRequest >
+    double RunLoopback( HttpClient& client, long count, long concurrency, MakeRequest makeRequest )
+    {
+        long started = 0;
+        long completed = 0;
+        long failed = 0;
+        auto onComplete = [&]( const HttpTransaction& transaction, const char*, size_t ){
+            // ストリーミングなので本文の断片ごとに来る。完了したときだけ数える
+            if( !transaction.IsOk() )
+            {
+                ++failed;
+            }
+        };
+
+        std::vector<HttpTransactionHandle> handles;
+        BenchmarkTimer timer;
+        while( completed < count )
+        {
+            while( started < count && static_cast<long>(handles.size()) < concurrency )
+            {
+                handles.push_back( client.CreateRequest( makeRequest(), onComplete, false ) );
+                ++started;
+            }
+
+            client.Update();
+
+            for( size_t i=0; i<handles.size(); )
+            {
+                if( client.IsCompleted( handles[i] ) )
+                {
+                    client.ReleaseTransaction( handles[i] );
+                    handles[i] = handles.back();
+                    handles.pop_back();
+                    ++completed;
+                }
+                else
+                {
+                    ++i;
+                }
+            }
+        }
+        const double seconds = timer.GetSeconds();
+
+        if( 0 < failed )
+        {
+            std::cerr << failed << "件失敗した" << std::endl;
+        }
+        return count / seconds;
+    }
+}
+
+int main(int argc, const char * argv[])
+{
+    // 引数: リクエスト数 同時に処理する数 本文のバイト数
+    const long count = BenchmarkArgument( argc, argv, 1, 20000 );
+    const long concurrency = BenchmarkArgument( argc, argv, 2, 32 );
+    const long bodySize = BenchmarkArgument( argc, argv, 3, 1024 );
+
+    LoopbackHttpServer server( bodySize );
+    if( !server.Start() )
+    {
+        std::cerr << "サーバーを起動できなかった" << std::endl;
+        return 1;
+    }
+
+    curl_global_init( CURL_GLOBAL_DEFAULT );
+    {
+        HttpClient client;
+        const std::string url = server.GetUrl( "/index.html" );
+        BenchmarkReport( "loopback_get", RunLoopback( client, count, concurrency, [&]{
+            return HttpRequest( url.c_str(), HttpRequest::GET );
+        } ), "req/s" );
+
+        // ベースURLは1度だけ解析して、パスだけ差し替える
+        const HttpUrl base( server.GetUrl().c_str() );
+        BenchmarkReport( "loopback_get_parsed", RunLoopback( client, count, concurrency, [&]{
+            HttpUrl url( base );
+            url.SetPath( "/index.html" );
+            url.AppendQuery( "q", "bench" );
+            return HttpRequest( std::move(url), HttpRequest::GET );
+        } ), "req/s" );
+    }
+    curl_global_cleanup();
+
+    return 0;
+}
@@ -0,0 +1,226 @@
+/*
+ * Copyright (c) 2013, nilfs
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * * Neither the name of the <ORGANIZATION> nor the names of its contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __benchmark__LoopbackHttpServer__
+#define __benchmark__LoopbackHttpServer__
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <cstring>
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <unistd.h>
+
+#ifndef MSG_NOSIGNAL
+// SIGPIPEを止めるフラグがない環境(macOS)
+#define MSG_NOSIGNAL 0
+#endif
+
+/**
+ *  ベンチマーク用の最小限のHTTPサーバー
+ *  127.0.0.1の空いているポートで待ち受けて、どのリクエストにも同じ本文を返す。keep-aliveのみ対応
+ *  ネットワークの影響を除いて、クライアント側の処理にかかる時間だけを測るために使う
+ */
+class LoopbackHttpServer
+{
+public:
+    explicit LoopbackHttpServer( size_t bodySize )
+    :m_ListenSocket(-1)
+    ,m_Port(0)
+    ,m_Running(false)
+    {
+        const std::string body( bodySize, 'x' );
+        m_Response = "HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\nContent-Length: " + std::to_string(bodySize) + "\r\n\r\n" + body;
+    }
+
+    ~LoopbackHttpServer()
+    {
+        Stop();
+    }
+
+public:
+    bool Start()
+    {
+        m_ListenSocket = socket( AF_INET, SOCK_STREAM, 0 );
+        if( m_ListenSocket < 0 )
+        {
+            return false;
+        }
+        const int reuse = 1;
+        setsockopt( m_ListenSocket, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse) );
+
+        sockaddr_in address;
+        std::memset( &address, 0, sizeof(address) );
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl( INADDR_LOOPBACK );
+        address.sin_port = 0;
+        socklen_t length = sizeof(address);
+        if( bind( m_ListenSocket, reinterpret_cast<sockaddr*>(&address), sizeof(address) ) < 0
+           || listen( m_ListenSocket, 128 ) < 0
+           || getsockname( m_ListenSocket, reinterpret_cast<sockaddr*>(&address), &length ) < 0 )
+        {
+            close( m_ListenSocket );
+            m_ListenSocket = -1;
+            return false;
+        }
+        m_Port = ntohs( address.sin_port );
+
+        m_Running = true;
+        m_Thread = std::thread( [this]{ _Run(); } );
+        return true;
+    }
+
+    void Stop()
+    {
+        if( m_Running.exchange( false ) )
+        {
+            m_Thread.join();
+        }
+        if( 0 <= m_ListenSocket )
+        {
+            close( m_ListenSocket );
+            m_ListenSocket = -1;
+        }
+    }
+
+    std::string GetUrl( const char* path="/" ) const
+    {
+        return "http://127.0.0.1:" + std::to_string(m_Port) + path;
+    }
+
+private:
+    struct Connection
+    {
+        int socket;
+        std::string received;
+    };
+
+    void _Run()
+    {
+        std::vector<Connection> connections;
+        std::vector<pollfd> fds;
+        char buffer[16 * 1024];
+
+        while( m_Running )
+        {
+            fds.clear();
+            pollfd listen = { m_ListenSocket, POLLIN, 0 };
+            fds.push_back( listen );
+            for( const Connection& connection : connections )
+            {
+                pollfd fd = { connection.socket, POLLIN, 0 };
+                fds.push_back( fd );
+            }
+
+            // 止めるときに気付けるように短い間隔で起きる
+            if( poll( fds.data(), fds.size(), 50 ) <= 0 )
+            {
+                continue;
+            }
+
+            if( fds[0].revents & POLLIN )
+            {
+                const int socket = accept( m_ListenSocket, nullptr, nullptr );
+                if( 0 <= socket )
+                {
+                    Connection connection = { socket, std::string() };
+                    connections.push_back( connection );
+                }
+            }
+
+            for( size_t i=1; i<fds.size(); ++i )
+            {
+                if( !( fds[i].revents & ( POLLIN | POLLHUP | POLLERR ) ) )
+                {
+                    continue;
+                }
+
+                Connection& connection = connections[i - 1];
+                const ssize_t size = recv( connection.socket, buffer, sizeof(buffer), 0 );
+                if( size <= 0 )
+                {
+                    close( connection.socket );
+                    connection.socket = -1;
+                    continue;
+                }
+
+                // ヘッダの終わりごとに1つ応答する。本文付きのリクエストは扱わない
+                connection.received.append( buffer, size );
+                size_t end = 0;
+                while( ( end = connection.received.find( "\r\n\r\n" ) ) != std::string::npos )
+                {
+                    connection.received.erase( 0, end + 4 );
+                    if( !_SendAll( connection.socket ) )
+                    {
+                        close( connection.socket );
+                        connection.socket = -1;
+                        break;
+                    }
+                }
+            }
+
+            connections.erase( std::remove_if( connections.begin(), connections.end(), []( const Connection& connection ){ return connection.socket < 0; } ), connections.end() );
+        }
+
+        for( const Connection& connection : connections )
+        {
+            close( connection.socket );
+        }
+    }
+
+    bool _SendAll( int socket ) const
+    {
+        size_t sent = 0;
+        while( sent < m_Response.size() )
+        {
+            const ssize_t size = send( socket, m_Response.data() + sent, m_Response.size() - sent, MSG_NOSIGNAL );
+            if( size <= 0 )
+            {
+                return false;
+            }
+            sent += size;
+        }
+        return true;
+    }
+
+private:
+    int m_ListenSocket;
+    unsigned short m_Port;
+    std::atomic<bool> m_Running;
+    std::thread m_Thread;
+    std::string m_Response;
+};
+
+#endif /* defined(__benchmark__LoopbackHttpServer__) */
@@ -0,0 +1,581 @@
+/*
+ * Copyright (c) 2013, nilfs
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * * Neither the name of the <ORGANIZATION> nor the names of its contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <iostream>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <string>
+#include <chrono>
+
+#include "RequestUpdate.h"
+#include "RequestColumnUpdate.h"
+#include "RequestStaticUpdate.h"
+#include "RequestPipeline.h"
+#include "Benchmark.h"
+
+namespace
+{
+    // 1スレッドで追加してUpdateする。ソートと実行の速さを見る
+    template< typename ThreadingPolicy >
+    double RunSingleThread( long count, long batch )
+    {
+        BasicRequestUpdate<ThreadingPolicy, int> requestUpdate;
+        long long sum = 0;
+        requestUpdate.SetRequestExecuter( [&sum]( int v ){ sum += v; } );
+        requestUpdate.SetRequestSortPredicator( []( std::tuple<int> v1, std::tuple<int> v2 ){
+            return std::get<0>(v1) < std::get<0>(v2);
+        } );
+
+        unsigned int seed = 1;
+        BenchmarkTimer timer;
+        for( long i=0; i<count; )
+        {
+            for( long j=0; j<batch && i<count; ++j, ++i )
+            {
+                seed = seed * 1103515245u + 12345u;
+                requestUpdate.AddRequest( static_cast<int>( seed >> 16 ) );
+            }
+            requestUpdate.Update();
+        }
+        const double seconds = timer.GetSeconds();
+
+        // 最適化で消されないように使う
+        if( sum == 0 )
+        {
+            std::cerr << "sum=0" << std::endl;
+        }
+        return count / seconds;
+    }
+
+    // 1回のUpdateでcount件を並べて処理する。比較関数とキーの取り出しを比べる
+    double RunSort( long count, bool useKey, RequestSortEngine engine )
+    {
+        BasicRequestUpdate<RequestUpdateSingleThread, int, std::string> requestUpdate;
+        long long sum = 0;
+        requestUpdate.SetRequestExecuter( [&sum]( int v, std::string ){ sum += v; } );
+        if( useKey )
+        {
+            requestUpdate.SetRequestSortKey( []( const std::tuple<int, std::string>& v ){ return std::get<0>(v); }, engine );
+        }
+        else
+        {
+            requestUpdate.SetRequestSortPredicator( []( std::tuple<int, std::string> v1, std::tuple<int, std::string> v2 ){
+                return std::get<0>(v1) < std::get<0>(v2);
+            } );
+        }
+
+        unsigned int seed = 1;
+        for( long i=0; i<count; ++i )
+        {
+            seed = seed * 1103515245u + 12345u;
+            requestUpdate.AddRequest( static_cast<int>( seed >> 8 ), "request" );
+        }
+
+        BenchmarkTimer timer;
+        requestUpdate.Update();
+        const double seconds = timer.GetSeconds();
+
+        if( sum == 0 )
+        {
+            std::cerr << "sum=0" << std::endl;
+        }
+        return count / seconds;
+    }
+
+    // 16段階の優先度で処理する。キーでの並べ替えとバケツを比べる
+    double RunPriority( long count, bool useBuckets )
+    {
+        BasicRequestUpdate<RequestUpdateSingleThread, int, int> requestUpdate;
+        long long sum = 0;
+        requestUpdate.SetRequestExecuter( [&sum]( int priority, int v ){ sum += priority + v; } );
+        if( useBuckets )
+        {
+            requestUpdate.SetRequestPriority( []( const std::tuple<int, int>& v ){ return std::get<0>(v); }, 16 );
+        }
+        else
+        {
+            requestUpdate.SetRequestSortKey( []( const std::tuple<int, int>& v ){ return std::get<0>(v); }, REQUEST_SORT_STABLE );
+        }
+
+        unsigned int seed = 1;
+        for( long i=0; i<count; ++i )
+        {
+            seed = seed * 1103515245u + 12345u;
+            requestUpdate.AddRequest( static_cast<int>( ( seed >> 16 ) & 15 ), static_cast<int>(i) );
+        }
+
+        BenchmarkTimer timer;
+        requestUpdate.Update();
+        const double seconds = timer.GetSeconds();
+
+        if( sum == 0 )
+        {
+            std::cerr << "sum=0" << std::endl;
+        }
+        return count / seconds;
+    }
+
+    // 1フレームにbatch件ずつ追加して、perFrame件ずつ処理する。持ち越しが多いときの取り出しの速さを見る
+    double RunPartialDrain( long count, long batch, const RequestUpdateBudget& budget )
+    {
+        BasicRequestUpdate<RequestUpdateSingleThread, int> requestUpdate;
+        long long sum = 0;
+        requestUpdate.SetRequestExecuter( [&sum]( int v ){ sum += v; } );
+        requestUpdate.SetRequestSortKey( []( const std::tuple<int>& v ){ return std::get<0>(v); } );
+
+        // 最初に溜まっている分
+        unsigned int seed = 1;
+        for( long i=0; i<count; ++i )
+        {
+            seed = seed * 1103515245u + 12345u;
+            requestUpdate.AddRequest( static_cast<int>( seed >> 8 ) );
+        }
+
+        long executed = 0;
+        BenchmarkTimer timer;
+        while( executed < count )
+        {
+            for( long i=0; i<batch; ++i )
+            {
+                seed = seed * 1103515245u + 12345u;
+                requestUpdate.AddRequest( static_cast<int>( seed >> 8 ) );
+            }
+            executed += requestUpdate.Update( budget );
+        }
+        const double seconds = timer.GetSeconds();
+
+        if( sum == 0 )
+        {
+            std::cerr << "sum=0" << std::endl;
+        }
+        return executed / seconds;
+    }
+
+    // 1件ずつ呼ぶのとまとめて受け取るのを比べる。chunkが負なら1件ずつ
+    double RunBatchExecuter( long count, long chunk )
+    {
+        BasicRequestUpdate<RequestUpdateSingleThread, int> requestUpdate;
+        long long sum = 0;
+        if( chunk < 0 )
+        {
+            requestUpdate.SetRequestExecuter( [&sum]( int v ){ sum += v; } );
+        }
+        else
+        {
+            requestUpdate.SetBatchExecuter( [&sum]( RequestSpan<const std::tuple<int>> requests ){
+                for( const std::tuple<int>& request : requests )
+                {
+                    sum += std::get<0>(request);
+                }
+            }, static_cast<size_t>( chunk ) );
+        }
+
+        BenchmarkTimer timer;
+        for( long i=0; i<count; ++i )
+        {
+            requestUpdate.AddRequest( static_cast<int>( i ) );
+        }
+        requestUpdate.Update();
+        const double seconds = timer.GetSeconds();
+
+        if( sum == 0 )
+        {
+            std::cerr << "sum=0" << std::endl;
+        }
+        return count / seconds;
+    }
+
+    // 文字列を持つリクエストをフレームごとに作って処理する。arenaならアリーナにコピーする
+    double RunStringPayload( long count, long batch, bool arena )
+    {
+        static const char* names[] = { "short", "a name longer than the small string buffer", "another fairly long entity name" };
+        size_t total = 0;
+        BasicRequestUpdate<RequestUpdateSingleThread, int, std::string> stringUpdate;
+        stringUpdate.SetRequestExecuter( [&total]( int, const std::string& name ){ total += name.size(); } );
+        BasicRequestUpdate<RequestUpdateSingleThread, int, RequestArenaString> arenaUpdate;
+        arenaUpdate.SetRequestExecuter( [&total]( int, RequestArenaString name ){ total += name.size; } );
+
+        BenchmarkTimer timer;
+        for( long done=0; done<count; done+=batch )
+        {
+            for( long i=0; i<batch; ++i )
+            {
+                const char* name = names[i % 3];
+                if( arena )
+                {
+                    arenaUpdate.AddRequest( static_cast<int>( i ), arenaUpdate.GetRequestArena().CopyString( name ) );
+                }
+                else
+                {
+                    stringUpdate.AddRequest( static_cast<int>( i ), name );
+                }
+            }
+            if( arena )
+            {
+                arenaUpdate.Update();
+            }
+            else
+            {
+                stringUpdate.Update();
+            }
+        }
+        const double seconds = timer.GetSeconds();
+
+        if( total == 0 )
+        {
+            std::cerr << "total=0" << std::endl;
+        }
+        return count / seconds;
+    }
+
+    // 1分間に散らばったタイマーを登録して、16ミリ秒ごとのUpdateで全部処理する。時計はゲーム内の時間として進める
+    double RunTimers( long count )
+    {
+        typedef std::chrono::steady_clock::time_point TimePoint;
+        const TimePoint start = std::chrono::steady_clock::now();
+        TimePoint now = start;
+        BasicRequestUpdate<RequestUpdateSingleThread, int> requestUpdate;
+        long executed = 0;
+        requestUpdate.SetRequestExecuter( [&executed]( int ){ ++executed; } );
+        requestUpdate.SetRequestTimerClock( [&now]{ return now; } );
+
+        BenchmarkTimer timer;
+        unsigned int seed = 1;
+        for( long i=0; i<count; ++i )
+        {
+            seed = seed * 1103515245u + 12345u;
+            requestUpdate.AddRequestAt( start + std::chrono::milliseconds( ( seed >> 8 ) % 60000 ), static_cast<int>( i ) );
+        }
+        for( long ms=0; ms<=60000; ms+=16 )
+        {
+            now = start + std::chrono::milliseconds( ms );
+            requestUpdate.Update();
+        }
+        const double seconds = timer.GetSeconds();
+
+        if( executed != count )
+        {
+            std::cerr << "executed=" << executed << std::endl;
+        }
+        return count / seconds;
+    }
+
+    // decode → validate → applyの3段を別スレッドで流す
+    double RunPipeline( long count )
+    {
+        RequestPipeline<long> pipeline;
+        std::atomic<long long> sum( 0 );
+        pipeline.Begin()
+            .Then<long>( "decode", []( long&& v, RequestPipelineOutput<long>& out ){ out.Push( v * 3 ); } )
+            .Then<long>( "validate", []( long&& v, RequestPipelineOutput<long>& out ){ if( v % 2 == 0 ){ out.Push( v ); } } )
+            .Finally( "apply", [&sum]( long&& v ){ sum.fetch_add( v, std::memory_order_relaxed ); } );
+
+        BenchmarkTimer timer;
+        pipeline.Start();
+        for( long i=0; i<count; ++i )
+        {
+            long value = i;
+            pipeline.Push( std::move(value) );
+        }
+        pipeline.Stop();
+        const double seconds = timer.GetSeconds();
+
+        if( sum.load() == 0 )
+        {
+            std::cerr << "sum=0" << std::endl;
+        }
+        return count / seconds;
+    }
+
+    struct SumExecuter
+    {
+        long long* sum;
+        void operator()( int v ) const { *sum += v; }
+    };
+
+    struct LessComparator
+    {
+        bool operator()( const std::tuple<int>& lhs, const std::tuple<int>& rhs ) const { return std::get<0>(lhs) < std::get<0>(rhs); }
+    };
+
+    // 並べ替えて実行する。staticDispatchならstd::functionを経由しない
+    double RunDispatch( long count, bool staticDispatch )
+    {
+        long long sum = 0;
+        SumExecuter executer = { &sum };
+        BasicStaticRequestUpdate<RequestUpdateSingleThread, SumExecuter, LessComparator, int> staticUpdate( executer );
+        BasicRequestUpdate<RequestUpdateSingleThread, int> requestUpdate;
+        requestUpdate.SetRequestExecuter( executer );
+        requestUpdate.SetRequestSortPredicator( LessComparator() );
+
+        unsigned int seed = 1;
+        BenchmarkTimer timer;
+        for( long i=0; i<count; ++i )
+        {
+            seed = seed * 1103515245u + 12345u;
+            if( staticDispatch )
+            {
+                staticUpdate.AddRequest( static_cast<int>( seed >> 8 ) );
+            }
+            else
+            {
+                requestUpdate.AddRequest( static_cast<int>( seed >> 8 ) );
+            }
+        }
+        if( staticDispatch )
+        {
+            staticUpdate.Update();
+        }
+        else
+        {
+            requestUpdate.Update();
+        }
+        const double seconds = timer.GetSeconds();
+
+        if( sum == 0 )
+        {
+            std::cerr << "sum=0" << std::endl;
+        }
+        return count / seconds;
+    }
+
+    // 3つの引数のうち1つだけを合計する。columnsなら引数ごとの列で受け取る
+    double RunColumns( long count, bool columns )
+    {
+        float sum = 0.f;
+        BenchmarkTimer timer;
+        if( columns )
+        {
+            BasicRequestColumnUpdate<RequestUpdateSingleThread, int, float, double> requestUpdate;
+            requestUpdate.SetRequestExecuter( [&sum]( RequestSpan<const int>, RequestSpan<const float> values, RequestSpan<const double> ){
+                for( float value : values )
+                {
+                    sum += value;
+                }
+            } );
+            for( long i=0; i<count; ++i )
+            {
+                requestUpdate.AddRequest( static_cast<int>( i ), 1.f, 0.0 );
+            }
+            requestUpdate.Update();
+        }
+        else
+        {
+            BasicRequestUpdate<RequestUpdateSingleThread, int, float, double> requestUpdate;
+            requestUpdate.SetBatchExecuter( [&sum]( RequestSpan<const std::tuple<int, float, double>> requests ){
+                for( const std::tuple<int, float, double>& request : requests )
+                {
+                    sum += std::get<1>(request);
+                }
+            } );
+            for( long i=0; i<count; ++i )
+            {
+                requestUpdate.AddRequest( static_cast<int>( i ), 1.f, 0.0 );
+            }
+            requestUpdate.Update();
+        }
+        const double seconds = timer.GetSeconds();
+
+        if( sum == 0.f )
+        {
+            std::cerr << "sum=0" << std::endl;
+        }
+        return count / seconds;
+    }
+
+    // 同じエンティティへの更新がフレーム内に何度も届く。coalesceなら最後の1つだけ処理する
+    double RunCoalesce( long count, bool coalesce )
+    {
+        BasicRequestUpdate<RequestUpdateSingleThread, int, int> requestUpdate;
+        std::vector<int> states( 4096, 0 );
+        requestUpdate.SetRequestExecuter( [&states]( int entity, int value ){ states[entity] = value; } );
+        requestUpdate.SetRequestSortKey( []( const std::tuple<int, int>& v ){ return std::get<0>(v); } );
+        if( coalesce )
+        {
+            requestUpdate.SetRequestCoalesce( []( const std::tuple<int, int>& v ){ return std::get<0>(v); } );
+        }
+
+        BenchmarkTimer timer;
+        for( long i=0; i<count; ++i )
+        {
+            requestUpdate.AddRequest( static_cast<int>( ( i * 7919 ) & 4095 ), static_cast<int>( i ) );
+        }
+        requestUpdate.Update();
+        const double seconds = timer.GetSeconds();
+
+        if( states[0] < 0 )
+        {
+            std::cerr << "state<0" << std::endl;
+        }
+        return count / seconds;
+    }
+
+    // エンティティごとに少し重い処理をする。workersが0なら直列
+    double RunParallelLanes( long count, long workers )
+    {
+        RequestWorkerPool pool( static_cast<size_t>( workers ) );
+        BasicRequestUpdate<RequestUpdateSingleThread, int, int> requestUpdate;
+        std::vector<unsigned int> states( 4096, 1 );
+        requestUpdate.SetRequestExecuter( [&states]( int entity, int value ){
+            unsigned int state = states[entity];
+            for( int i=0; i<64; ++i )
+            {
+                state = state * 1103515245u + static_cast<unsigned int>( value );
+            }
+            states[entity] = state;
+        } );
+        if( 0 < workers )
+        {
+            requestUpdate.SetRequestParallel( &pool, []( const std::tuple<int, int>& v ){ return std::get<0>(v); } );
+        }
+
+        BenchmarkTimer timer;
+        for( long i=0; i<count; ++i )
+        {
+            requestUpdate.AddRequest( static_cast<int>( ( i * 7919 ) & 4095 ), static_cast<int>( i ) );
+        }
+        requestUpdate.Update();
+        const double seconds = timer.GetSeconds();
+
+        if( states[0] == 0 )
+        {
+            std::cerr << "state=0" << std::endl;
+        }
+        return count / seconds;
+    }
+
+    // Runで寝ている消費スレッドに1件ずつ渡して、処理されるまでの時間を測る。平均のマイクロ秒
+    double RunWakeLatency( long count, const RequestRunOptions& options )
+    {
+        RequestUpdate<int> requestUpdate;
+        std::atomic<long> executed( 0 );
+        std::atomic<long long> totalNanoseconds( 0 );
+        std::chrono::steady_clock::time_point sent;
+        requestUpdate.SetRequestExecuter( [&]( int ){
+            totalNanoseconds.fetch_add( std::chrono::duration_cast<std::chrono::nanoseconds>( std::chrono::steady_clock::now() - sent ).count() );
+            executed.fetch_add( 1, std::memory_order_release );
+        } );
+
+        RequestStopSource stop;
+        std::thread consumer( [&]{ requestUpdate.Run( stop.GetToken(), options ); } );
+        for( long i=0; i<count; ++i )
+        {
+            // 寝るまで待ってから送る
+            std::this_thread::sleep_for( std::chrono::microseconds(200) );
+            sent = std::chrono::steady_clock::now();
+            requestUpdate.AddRequest( 0 );
+            while( executed.load( std::memory_order_acquire ) <= i )
+            {
+                std::this_thread::yield();
+            }
+        }
+        stop.RequestStop();
+        requestUpdate.WakeConsumer();
+        consumer.join();
+        return totalNanoseconds.load() / 1000.0 / count;
+    }
+
+    // 複数スレッドから追加しながら、1スレッドでUpdateし続ける
+    template< typename ThreadingPolicy >
+    double RunMultiProducer( long count, long producers )
+    {
+        BasicRequestUpdate<ThreadingPolicy, int> requestUpdate;
+        std::atomic<long> executed( 0 );
+        requestUpdate.SetRequestExecuter( [&executed]( int ){ executed.fetch_add( 1, std::memory_order_relaxed ); } );
+        requestUpdate.SetRequestSortPredicator( []( std::tuple<int> v1, std::tuple<int> v2 ){
+            return std::get<0>(v1) < std::get<0>(v2);
+        } );
+
+        const long perProducer = count / producers;
+        const long total = perProducer * producers;
+
+        BenchmarkTimer timer;
+        std::vector<std::thread> threads;
+        for( long p=0; p<producers; ++p )
+        {
+            threads.push_back( std::thread( [&requestUpdate, perProducer, p]{
+                for( long i=0; i<perProducer; ++i )
+                {
+                    requestUpdate.AddRequest( static_cast<int>( ( i * 7919 + p ) & 0xffff ) );
+                }
+            } ) );
+        }
+        while( executed.load( std::memory_order_relaxed ) < total )
+        {
+            requestUpdate.Update();
+        }
+        const double seconds = timer.GetSeconds();
+
+        for( std::thread& thread : threads )
+        {
+            thread.join();
+        }
+        return total / seconds;
+    }
+}
+
+int main(int argc, const char * argv[])
+{
+    // 引数: リクエスト数 1回のUpdateで処理する数 追加するスレッド数 並べ替えの件数
+    const long count = BenchmarkArgument( argc, argv, 1, 2000000 );
+    const long batch = BenchmarkArgument( argc, argv, 2, 1024 );
+    const long producers = BenchmarkArgument( argc, argv, 3, 4 );
+    const long sortCount = BenchmarkArgument( argc, argv, 4, 1000000 );
+
+    BenchmarkReport( "queue_single_thread", RunSingleThread<RequestUpdateMpsc>( count, batch ), "req/s" );
+    BenchmarkReport( "queue_single_thread_policy", RunSingleThread<RequestUpdateSingleThread>( count, batch ), "req/s" );
+    BenchmarkReport( "queue_spsc", RunMultiProducer<RequestUpdateSpsc>( count, 1 ), "req/s" );
+    BenchmarkReport( "sort_predicator", RunSort( sortCount, false, REQUEST_SORT_AUTO ), "req/s" );
+    BenchmarkReport( "sort_key_radix", RunSort( sortCount, true, REQUEST_SORT_RADIX ), "req/s" );
+    BenchmarkReport( "sort_key_pdq", RunSort( sortCount, true, REQUEST_SORT_PDQ ), "req/s" );
+    BenchmarkReport( "priority_sort_key", RunPriority( sortCount, false ), "req/s" );
+    BenchmarkReport( "priority_buckets", RunPriority( sortCount, true ), "req/s" );
+    BenchmarkReport( "partial_drain_heap", RunPartialDrain( sortCount, 500, RequestUpdateBudget( 1000 ) ), "req/s" );
+    BenchmarkReport( "partial_drain_time", RunPartialDrain( sortCount, 500, RequestUpdateBudget( std::chrono::microseconds(100) ) ), "req/s" );
+    BenchmarkReport( "executer_per_request", RunBatchExecuter( sortCount, -1 ), "req/s" );
+    BenchmarkReport( "executer_batch_" + std::to_string(batch), RunBatchExecuter( sortCount, batch ), "req/s" );
+    BenchmarkReport( "payload_std_string", RunStringPayload( sortCount, batch, false ), "req/s" );
+    BenchmarkReport( "payload_arena_string", RunStringPayload( sortCount, batch, true ), "req/s" );
+    BenchmarkReport( "pipeline_3stage", RunPipeline( sortCount ), "req/s" );
+    BenchmarkReport( "timer_wheel", RunTimers( sortCount ), "req/s" );
+    BenchmarkReport( "dispatch_function", RunDispatch( sortCount, false ), "req/s" );
+    BenchmarkReport( "dispatch_static", RunDispatch( sortCount, true ), "req/s" );
+    BenchmarkReport( "columns_tuple_batch", RunColumns( sortCount, false ), "req/s" );
+    BenchmarkReport( "columns_soa", RunColumns( sortCount, true ), "req/s" );
+    BenchmarkReport( "coalesce_none", RunCoalesce( sortCount, false ), "req/s" );
+    BenchmarkReport( "coalesce_last", RunCoalesce( sortCount, true ), "req/s" );
+    BenchmarkReport( "lanes_serial", RunParallelLanes( sortCount, 0 ), "req/s" );
+    BenchmarkReport( "lanes_parallel_" + std::to_string(producers), RunParallelLanes( sortCount, producers ), "req/s" );
+    BenchmarkReport( "run_wake_park", RunWakeLatency( 1000, RequestRunOptions( std::chrono::microseconds(0) ) ), "us" );
+    BenchmarkReport( "run_wake_spin", RunWakeLatency( 1000, RequestRunOptions( std::chrono::microseconds(500) ) ), "us" );
+    BenchmarkReport( "queue_producers_" + std::to_string(producers), RunMultiProducer<RequestUpdateMpsc>( count, producers ), "req/s" );
+
+    return 0;
+}
@@ -0,0 +1,371 @@
+/*
+ * Copyright (c) 2013, nilfs
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * * Neither the name of the <ORGANIZATION> nor the names of its contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <iostream>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <string>
+#include <tuple>
+#include <algorithm>
+#include <cstring>
+#include <cstdint>
+
+#include "RequestUpdate.h"
+#include "Benchmark.h"
+
+/**
+ *  RequestUpdateの設定を比べるためのベンチマーク
+ *  追加するスレッド数、1回のUpdateに溜まる数、並べ方、パラメータの大きさを変えて計測し、結果をJSONで標準出力に書く
+ *  どの記録も同じキーを持つので、別の環境やビルドの結果と並べて比べられる。経過は標準エラーに出す
+ *
+ *  引数: 最大のバッチ数 追加スレッド数を変えるときのリクエスト数 繰り返し回数 パラメータに使ってよいバイト数
+ */
+namespace
+{
+    // 256バイトのパラメータ
+    struct LargePayload
+    {
+        char data[256 - sizeof(int)];
+        int value;
+    };
+
+    // パラメータごとの作り方
+    struct IntPayload
+    {
+        typedef RequestUpdate<int> Update;
+        static const char* GetName() { return "int"; }
+        static size_t GetSize() { return sizeof(int); }
+        static void Add( Update& update, int key ) { update.AddRequest( key ); }
+        static void SetExecuter( Update& update, uint64_t& sink )
+        {
+            update.SetRequestExecuter( [&sink]( int key ){ sink += key; } );
+        }
+    };
+
+    struct StringPayload
+    {
+        typedef RequestUpdate<int, std::string> Update;
+        static const char* GetName() { return "string"; }
+        static size_t GetSize() { return sizeof(int) + sizeof(std::string) + 32; }
+        // 短い文字列の最適化に収まらない長さにする
+        static void Add( Update& update, int key ) { update.AddRequest( key, std::string( 32, static_cast<char>( 'a' + ( key & 15 ) ) ) ); }
+        static void SetExecuter( Update& update, uint64_t& sink )
+        {
+            update.SetRequestExecuter( [&sink]( int key, std::string value ){ sink += key + value[0]; } );
+        }
+    };
+
+    struct StructPayload
+    {
+        typedef RequestUpdate<int, LargePayload> Update;
+        static const char* GetName() { return "struct256"; }
+        static size_t GetSize() { return sizeof(int) + sizeof(LargePayload); }
+        static void Add( Update& update, int key )
+        {
+            LargePayload payload;
+            std::memset( payload.data, key & 0xff, sizeof(payload.data) );
+            payload.value = key;
+            update.AddRequest( key, payload );
+        }
+        static void SetExecuter( Update& update, uint64_t& sink )
+        {
+            update.SetRequestExecuter( [&sink]( int key, LargePayload payload ){ sink += key + payload.data[0]; } );
+        }
+    };
+
+    // 先頭の要素で並べる
+    struct FirstKey
+    {
+        template< typename Tuple >
+        int operator()( const Tuple& value ) const { return std::get<0>( value ); }
+    };
+
+    struct FirstLess
+    {
+        template< typename Tuple >
+        bool operator()( const Tuple& lhs, const Tuple& rhs ) const { return std::get<0>( lhs ) < std::get<0>( rhs ); }
+    };
+
+    enum SuiteOrder
+    {
+        SUITE_ORDER_NONE,       // 並べ替えない
+        SUITE_ORDER_KEY,        // SetRequestSortKey
+        SUITE_ORDER_PREDICATOR, // SetRequestSortPredicator
+    };
+
+    const char* GetOrderName( SuiteOrder order )
+    {
+        switch( order )
+        {
+        case SUITE_ORDER_KEY:
+            return "sort_key";
+        case SUITE_ORDER_PREDICATOR:
+            return "sort_predicator";
+        default:
+            return "none";
+        }
+    }
+
+    template< typename Update >
+    void SetOrder( Update& update, SuiteOrder order )
+    {
+        if( order == SUITE_ORDER_KEY )
+        {
+            update.SetRequestSortKey( FirstKey() );
+        }
+        else if( order == SUITE_ORDER_PREDICATOR )
+        {
+            update.SetRequestSortPredicator( FirstLess() );
+        }
+    }
+
+    // 再現できるように固定の種で作る乱数
+    struct SuiteRandom
+    {
+        explicit SuiteRandom( uint64_t seed ) : state(seed * 0x9E3779B97F4A7C15ull + 1) {}
+
+        int Next()
+        {
+            state ^= state << 13;
+            state ^= state >> 7;
+            state ^= state << 17;
+            return static_cast<int>( state & 0x7fffffff );
+        }
+
+        uint64_t state;
+    };
+
+    struct SuiteResult
+    {
+        std::string benchmark;
+        std::string payload;
+        std::string order;
+        long producers;
+        long batch;
+        long requests;
+        double seconds;         // 繰り返した中の中央値
+    };
+
+    double GetMedian( std::vector<double> values )
+    {
+        std::sort( values.begin(), values.end() );
+        return values[ values.size() / 2 ];
+    }
+
+    // producers個のスレッドから合わせてcount件追加する間、1スレッドでUpdateし続ける。追加し終わるまでの時間
+    template< typename Payload >
+    double MeasureAddRequest( long count, long producers )
+    {
+        typename Payload::Update update;
+        uint64_t sink = 0;
+        Payload::SetExecuter( update, sink );
+
+        const long perProducer = count / producers;
+        std::atomic<long> ready( 0 );
+        std::atomic<bool> start( false );
+        std::atomic<long> finished( 0 );
+        std::vector<std::thread> threads;
+        for( long p=0; p<producers; ++p )
+        {
+            threads.push_back( std::thread( [&, p]{
+                SuiteRandom random( p + 1 );
+                ready.fetch_add( 1 );
+                while( !start.load( std::memory_order_acquire ) )
+                {
+                    std::this_thread::yield();
+                }
+                for( long i=0; i<perProducer; ++i )
+                {
+                    Payload::Add( update, random.Next() );
+                }
+                finished.fetch_add( 1, std::memory_order_release );
+            } ) );
+        }
+        while( ready.load() < producers )
+        {
+            std::this_thread::yield();
+        }
+
+        BenchmarkTimer timer;
+        start.store( true, std::memory_order_release );
+        while( finished.load( std::memory_order_acquire ) < producers )
+        {
+            update.Update();
+        }
+        const double seconds = timer.GetSeconds();
+
+        for( std::thread& thread : threads )
+        {
+            thread.join();
+        }
+        update.Update();
+        return seconds;
+    }
+
+    // batch件溜めてから1回のUpdateにかかる時間。溜める時間は含まない
+    template< typename Payload >
+    double MeasureUpdate( long batch, SuiteOrder order, uint64_t seed )
+    {
+        typename Payload::Update update;
+        uint64_t sink = 0;
+        Payload::SetExecuter( update, sink );
+        SetOrder( update, order );
+
+        SuiteRandom random( seed );
+        for( long i=0; i<batch; ++i )
+        {
+            Payload::Add( update, random.Next() );
+        }
+
+        BenchmarkTimer timer;
+        update.Update();
+        return timer.GetSeconds();
+    }
+
+    class Suite
+    {
+    public:
+        Suite( long maxBatch, long producerRequests, long repeat, long memoryLimit )
+        :m_MaxBatch(maxBatch)
+        ,m_ProducerRequests(producerRequests)
+        ,m_Repeat(repeat < 1 ? 1 : repeat)
+        ,m_MemoryLimit(memoryLimit)
+        {}
+
+        template< typename Payload >
+        void RunProducers()
+        {
+            for( long producers=1; producers<=64; producers*=2 )
+            {
+                std::vector<double> samples;
+                for( long r=0; r<m_Repeat; ++r )
+                {
+                    samples.push_back( MeasureAddRequest<Payload>( m_ProducerRequests, producers ) );
+                }
+                _Add( "add_request", Payload::GetName(), SUITE_ORDER_NONE, producers, 0, m_ProducerRequests / producers * producers, GetMedian( samples ) );
+            }
+        }
+
+        template< typename Payload >
+        void RunUpdate( SuiteOrder order )
+        {
+            for( long batch=1000; batch<=m_MaxBatch; batch*=10 )
+            {
+                // キューと処理中の配列で2倍近く使う
+                if( m_MemoryLimit < static_cast<double>( batch ) * Payload::GetSize() * 2 )
+                {
+                    std::cerr << "skip update " << Payload::GetName() << " " << batch << ": exceeds memory limit" << std::endl;
+                    break;
+                }
+                std::vector<double> samples;
+                for( long r=0; r<m_Repeat; ++r )
+                {
+                    samples.push_back( MeasureUpdate<Payload>( batch, order, r + 1 ) );
+                }
+                _Add( "update", Payload::GetName(), order, 1, batch, batch, GetMedian( samples ) );
+            }
+        }
+
+        // 結果をまとめてJSONで書き出す
+        void Print( std::ostream& out ) const
+        {
+            out << "{\n";
+            out << "  \"suite\": \"RequestUpdate\",\n";
+            out << "  \"hardware_concurrency\": " << std::thread::hardware_concurrency() << ",\n";
+            out << "  \"repeat\": " << m_Repeat << ",\n";
+            out << "  \"results\": [\n";
+            for( size_t i=0; i<m_Results.size(); ++i )
+            {
+                const SuiteResult& result = m_Results[i];
+                const double perSecond = 0.0 < result.seconds ? result.requests / result.seconds : 0.0;
+                const double nanoseconds = 0 < result.requests ? result.seconds * 1e9 / result.requests : 0.0;
+                out << "    {\"benchmark\": \"" << result.benchmark << "\""
+                    << ", \"payload\": \"" << result.payload << "\""
+                    << ", \"order\": \"" << result.order << "\""
+                    << ", \"producers\": " << result.producers
+                    << ", \"batch\": " << result.batch
+                    << ", \"requests\": " << result.requests
+                    << ", \"seconds\": " << result.seconds
+                    << ", \"requests_per_second\": " << perSecond
+                    << ", \"ns_per_request\": " << nanoseconds
+                    << "}" << ( i + 1 < m_Results.size() ? "," : "" ) << "\n";
+            }
+            out << "  ]\n";
+            out << "}" << std::endl;
+        }
+
+    private:
+        void _Add( const char* benchmark, const char* payload, SuiteOrder order, long producers, long batch, long requests, double seconds )
+        {
+            SuiteResult result;
+            result.benchmark = benchmark;
+            result.payload = payload;
+            result.order = GetOrderName( order );
+            result.producers = producers;
+            result.batch = batch;
+            result.requests = requests;
+            result.seconds = seconds;
+            m_Results.push_back( result );
+            std::cerr << benchmark << " " << payload << " " << result.order << " producers=" << producers << " batch=" << batch << " " << seconds << "s" << std::endl;
+        }
+
+    private:
+        long m_MaxBatch;
+        long m_ProducerRequests;
+        long m_Repeat;
+        double m_MemoryLimit;
+        std::vector<SuiteResult> m_Results;
+    };
+
+    template< typename Payload >
+    void RunPayload( Suite& suite )
+    {
+        suite.RunProducers<Payload>();
+        suite.RunUpdate<Payload>( SUITE_ORDER_NONE );
+        suite.RunUpdate<Payload>( SUITE_ORDER_KEY );
+        suite.RunUpdate<Payload>( SUITE_ORDER_PREDICATOR );
+    }
+}
+
+int main(int argc, const char * argv[])
+{
+    const long maxBatch = BenchmarkArgument( argc, argv, 1, 10000000 );
+    const long producerRequests = BenchmarkArgument( argc, argv, 2, 1000000 );
+    const long repeat = BenchmarkArgument( argc, argv, 3, 3 );
+    const long memoryLimit = BenchmarkArgument( argc, argv, 4, 2048L * 1024 * 1024 );
+
+    Suite suite( maxBatch, producerRequests, repeat, memoryLimit );
+    RunPayload<IntPayload>( suite );
+    RunPayload<StringPayload>( suite );
+    RunPayload<StructPayload>( suite );
+    suite.Print( std::cout );
+
+    return 0;
+}
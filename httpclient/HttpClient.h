@@ -0,0 +1,1161 @@
+/*
+ * Copyright (c) 2013, nilfs
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * * Neither the name of the <ORGANIZATION> nor the names of its contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __httpclient__HttpClient__
+#define __httpclient__HttpClient__
+
+#include <curl/curl.h>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <map>
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <algorithm>
+#include <memory>
+#include <cstdint>
+#include <cstring>
+#include <new>
+
+#include "HttpClientPolicy.h"
+#include "HttpUrl.h"
+#include "HttpRequest.h"
+
+/**
+ *  スレッドの扱い
+ *  HttpMultiThreadPolicy : 複数スレッドからリクエストを作れる。全クライアントで1つのmutexを共有する(今までの動作)
+ *  HttpSingleThreadPolicy: 1スレッドからしか使わない。ロックは全てコンパイル時に消える
+ */
+struct HttpMultiThreadPolicy
+{
+    typedef std::mutex Mutex;
+
+    template< typename T >
+    struct Counter
+    {
+        typedef std::atomic<T> Type;
+        static T Increment( Type& counter ){ return std::atomic_fetch_add( &counter, static_cast<T>(1) ) + 1; }
+    };
+};
+
+struct HttpSingleThreadPolicy
+{
+    // 何もしないmutex。std::lock_guardにそのまま渡せる
+    struct Mutex
+    {
+        void lock(){}
+        void unlock(){}
+    };
+
+    template< typename T >
+    struct Counter
+    {
+        typedef T Type;
+        static T Increment( Type& counter ){ return ++counter; }
+    };
+};
+
+/**
+ *  完了コールバックの呼び方
+ *  HttpFunctionCompletion        : std::functionで受け取り、自動解放するかはリクエストごとに指定する(今までの動作)
+ *  HttpStaticCompletion<F, Auto> : 関数オブジェクトFを直接呼ぶのでインライン展開できる。自動解放もコンパイル時に決める
+ *                                  Fは (const Transaction&, const char*, size_t) で呼べる型にする
+ */
+struct HttpFunctionCompletion
+{
+    template< class Transaction >
+    class Holder
+    {
+    public:
+        typedef std::function<void(const Transaction&, const char*, size_t)> Callback;
+
+    public:
+        Holder( const Callback& callback, bool autoRelease )
+        :m_Callback(callback)
+        ,m_AutoRelease(autoRelease)
+        {}
+
+    public:
+        void Reset( const Callback& callback, bool autoRelease )
+        {
+            m_Callback = callback;
+            m_AutoRelease = autoRelease;
+        }
+        void Invoke( const Transaction& transaction, const char* data, size_t dataSize ){ m_Callback( transaction, data, dataSize ); }
+        bool IsAutoRelease() const { return m_AutoRelease; }
+
+    private:
+        Callback m_Callback;
+        bool m_AutoRelease;
+    };
+};
+
+template< class Func, bool AutoRelease=true >
+struct HttpStaticCompletion
+{
+    template< class Transaction >
+    class Holder
+    {
+    public:
+        typedef Func Callback;
+
+    public:
+        Holder( const Callback& callback, bool )
+        :m_Callback(callback)
+        {}
+
+    public:
+        void Reset( const Callback& callback, bool )
+        {
+            // ラムダは代入できないので作り直す
+            m_Callback.~Callback();
+            new (&m_Callback) Callback( callback );
+        }
+        void Invoke( const Transaction& transaction, const char* data, size_t dataSize ){ m_Callback( transaction, data, dataSize ); }
+        bool IsAutoRelease() const { return AutoRelease; }
+
+    private:
+        Callback m_Callback;
+    };
+};
+
+/**
+ *  受信データの渡し方
+ *  HttpStreamingBuffer : 受信した分からコールバックに渡す。バッファを持たない(今までの動作)
+ *  HttpAccumulateBuffer: 受信し終わるまで貯めて、完了時に1度だけコールバックに全体を渡す
+ */
+struct HttpStreamingBuffer
+{
+    struct Storage {};
+
+    static void Clear( Storage& ){}
+
+    template< class Transaction >
+    static void OnData( Transaction& transaction, Storage&, const char* data, size_t dataSize )
+    {
+        transaction._Notify( data, dataSize, CURLE_OK );
+    }
+
+    template< class Transaction >
+    static void OnDone( Transaction& transaction, Storage&, CURLcode result )
+    {
+        if( result != CURLE_OK )
+        {
+            transaction._Notify( nullptr, 0, result );
+        }
+    }
+};
+
+struct HttpAccumulateBuffer
+{
+    struct Storage
+    {
+        std::string body;
+    };
+
+    // 使い回すときに確保済みの領域は残す
+    static void Clear( Storage& storage ){ storage.body.clear(); }
+
+    template< class Transaction >
+    static void OnData( Transaction&, Storage& storage, const char* data, size_t dataSize )
+    {
+        storage.body.append( data, dataSize );
+    }
+
+    template< class Transaction >
+    static void OnDone( Transaction& transaction, Storage& storage, CURLcode result )
+    {
+        if( result == CURLE_OK )
+        {
+            transaction._Notify( storage.body.data(), storage.body.size(), result );
+        }
+        else
+        {
+            transaction._Notify( nullptr, 0, result );
+        }
+        storage.body.clear();
+    }
+};
+
+/**
+ *  1回分のHTTP通信の状態とコールバック
+ *  リクエストはここにムーブして持つ。クライアントが使い回すので、curlのハンドルや受信バッファも再利用される
+ */
+template< class CompletionPolicy, class BufferPolicy >
+class BasicHttpTransaction : private BufferPolicy::Storage
+{
+    friend BufferPolicy;
+
+private:
+    typedef typename CompletionPolicy::template Holder<BasicHttpTransaction> CompletionHolder;
+
+public:
+    // 通信完了時のコールバック。エラーでも来る
+    typedef typename CompletionHolder::Callback RequestCompleteCallback;
+
+public:
+    BasicHttpTransaction( const RequestCompleteCallback& callback, bool autoRelase, HttpRequest&& request )
+    :m_Curl(nullptr)
+    ,m_Headers(nullptr)
+    ,m_Completion(callback, autoRelase)
+    ,m_Request(std::move(request))
+    ,m_Completed(false)
+    ,m_RequestResult(CURL_LAST) // 無効値がなかったのでとりあえずCURL_LAST
+    {
+    }
+
+    ~BasicHttpTransaction()
+    {
+        curl_slist_free_all(m_Headers);
+        curl_easy_cleanup(m_Curl);
+        m_Curl = nullptr;
+    }
+
+public:
+    // 使い回すために別のリクエストで初期化し直す
+    void Reset( const RequestCompleteCallback& callback, bool autoRelase, HttpRequest&& request )
+    {
+        if( m_Curl )
+        {
+            curl_easy_reset( m_Curl );
+        }
+        curl_slist_free_all( m_Headers );
+        m_Headers = nullptr;
+        BufferPolicy::Clear( _GetStorage() );
+
+        m_Completion.Reset( callback, autoRelase );
+        m_Request = std::move(request);
+        m_Completed = false;
+        m_RequestResult = CURL_LAST;
+    }
+
+    // ポリシーを使う場合は試行ごとにハンドルを作るので、直接通信するときだけ作る
+    CURL* InitCurl()
+    {
+        if( !m_Curl )
+        {
+            m_Curl = curl_easy_init();
+        }
+        return m_Curl;
+    }
+    CURL* GetCurl() const { return m_Curl; }
+
+    const HttpRequest& GetRequest() const { return m_Request; }
+    HttpOriginId GetOriginId() const { return m_Request.GetOriginId(); }
+
+    // リクエストのヘッダをcurlに渡す形にする。ヘッジした試行でも共有する
+    curl_slist* GetHeaderList()
+    {
+        if( !m_Headers && 0 < m_Request.GetHeaderCount() )
+        {
+            const char* header = m_Request.GetHeaders();
+            for( size_t i=0; i<m_Request.GetHeaderCount(); ++i )
+            {
+                m_Headers = curl_slist_append( m_Headers, header );
+                header += std::strlen(header) + 1;
+            }
+        }
+        return m_Headers;
+    }
+
+    // データを受信した
+    void OnData( const char* data, size_t dataSize )
+    {
+        BufferPolicy::OnData( *this, _GetStorage(), data, dataSize );
+    }
+
+    // 通信が終わった
+    void OnDone( CURLcode result )
+    {
+        BufferPolicy::OnDone( *this, _GetStorage(), result );
+        m_RequestResult = result;
+        m_Completed = true;
+    }
+
+    // 成功、失敗に関わらず処理が終わった
+    bool IsCompleted()   const { return m_Completed; }
+    // 成功した
+    bool IsOk()          const { return m_RequestResult == CURLE_OK; }
+    // タイムアウトした
+    bool IsTimeout()     const { return m_RequestResult == CURLE_OPERATION_TIMEDOUT; }
+    // 自動解放するか
+    bool IsAutoRelease() const { return m_Completion.IsAutoRelease(); }
+
+private:
+    BasicHttpTransaction( const BasicHttpTransaction& ) = delete;
+    BasicHttpTransaction& operator=( const BasicHttpTransaction& ) = delete;
+
+    void _Notify( const char* data, size_t dataSize, CURLcode result )
+    {
+        m_RequestResult = result;
+
+        m_Completion.Invoke( *this, data, dataSize );
+    }
+
+    typename BufferPolicy::Storage& _GetStorage(){ return *this; }
+
+private:
+    CURL* m_Curl;
+    curl_slist* m_Headers;
+    CompletionHolder m_Completion;
+    HttpRequest m_Request;
+    bool m_Completed;
+
+    CURLcode m_RequestResult;
+};
+
+/**
+ *  1回分のHTTP通信処理オブジェクト
+ */
+class HttpTransactionHandle
+{
+public:
+    typedef unsigned int HandleId;
+
+public:
+    // 不正なハンドルID
+    static const HandleId INVALID_HANDLE_ID = UINT32_MAX;
+
+public:
+    // 不要なハンドルを返す
+    static const HttpTransactionHandle& Invalid()
+    {
+        static HttpTransactionHandle s_Invalid;
+        return s_Invalid;
+    }
+
+public:
+    HttpTransactionHandle( const HandleId handle=INVALID_HANDLE_ID )
+    :m_Handle(handle)
+    {
+    }
+
+    HttpTransactionHandle( const HttpTransactionHandle&& handle )
+    :m_Handle(handle.m_Handle)
+    {
+    }
+
+public:
+    HttpTransactionHandle& operator=( const HttpTransactionHandle& handle )
+    {
+        m_Handle = handle.m_Handle;
+
+        return *this;
+    }
+
+public:
+    HandleId GetHandleId() const{ return m_Handle; }
+
+    bool IsInvalid()     const { return m_Handle == INVALID_HANDLE_ID; }
+    bool IsValid()       const { return m_Handle != INVALID_HANDLE_ID; }
+
+private:
+    HandleId m_Handle;
+};
+
+/**
+ *  ハンドルからトランザクションを引く表
+ *  HttpMapHandleTable : 通し番号のハンドルをstd::mapで引く。ハンドルは同じ型のクライアント全体で重ならない(今までの動作)
+ *  HttpSlotHandleTable: 配列の添字をハンドルにして直接引く。空いた添字は使い回すので、上位ビットの世代で古いハンドルを見分ける
+ *                       同時に持てるのは2^20-1個まで。超えるとCreateRequestが無効なハンドルを返す
+ */
+struct HttpMapHandleTable
+{
+    template< class Transaction, class ThreadingPolicy >
+    class Table
+    {
+    public:
+        typedef HttpTransactionHandle::HandleId HandleId;
+
+    private:
+        typedef typename ThreadingPolicy::template Counter<HandleId> Counter;
+
+    public:
+        HandleId Add( Transaction* transaction )
+        {
+            const HandleId handle = Counter::Increment( s_TopHandleId );
+            m_Handles[handle] = transaction;
+            return handle;
+        }
+
+        Transaction* Find( HandleId handle ) const
+        {
+            auto it = m_Handles.find( handle );
+            return it != m_Handles.end() ? it->second : nullptr;
+        }
+
+        // 表から外したトランザクションを返す。なければnullptr
+        Transaction* Remove( HandleId handle )
+        {
+            auto it = m_Handles.find( handle );
+            if( it == m_Handles.end() )
+            {
+                return nullptr;
+            }
+            Transaction* transaction = it->second;
+            m_Handles.erase( it );
+            return transaction;
+        }
+
+        template< class Func >
+        void ForEach( Func func ) const
+        {
+            for( auto& handle : m_Handles )
+            {
+                func( handle.second );
+            }
+        }
+
+    private:
+        static typename Counter::Type s_TopHandleId;
+
+        std::map<HandleId, Transaction*> m_Handles;
+    };
+};
+
+template< class Transaction, class ThreadingPolicy >
+typename HttpMapHandleTable::Table<Transaction, ThreadingPolicy>::Counter::Type HttpMapHandleTable::Table<Transaction, ThreadingPolicy>::s_TopHandleId(0U);
+
+struct HttpSlotHandleTable
+{
+    template< class Transaction, class ThreadingPolicy >
+    class Table
+    {
+    public:
+        typedef HttpTransactionHandle::HandleId HandleId;
+
+    private:
+        static const unsigned int INDEX_BITS = 20;
+        static const HandleId INDEX_MASK = ( 1U << INDEX_BITS ) - 1;
+        static const HandleId GENERATION_MASK = UINT32_MAX >> INDEX_BITS;
+
+        struct Slot
+        {
+            Transaction* transaction;
+            HandleId generation;
+        };
+
+    public:
+        HandleId Add( Transaction* transaction )
+        {
+            size_t index = 0;
+            if( !m_FreeSlots.empty() )
+            {
+                index = m_FreeSlots.back();
+                m_FreeSlots.pop_back();
+            }
+            else
+            {
+                // 添字がINDEX_MASKまで届くと無効なハンドルと区別できないので、その手前で止める
+                if( INDEX_MASK <= m_Slots.size() )
+                {
+                    return HttpTransactionHandle::INVALID_HANDLE_ID;
+                }
+                index = m_Slots.size();
+                Slot slot = { nullptr, 0 };
+                m_Slots.push_back( slot );
+            }
+
+            // 世代は0を飛ばして回す。0番目の最初のハンドルが0にならないようにする
+            Slot& slot = m_Slots[index];
+            slot.generation = ( slot.generation + 1 ) & GENERATION_MASK;
+            if( slot.generation == 0 )
+            {
+                slot.generation = 1;
+            }
+            slot.transaction = transaction;
+            return ( slot.generation << INDEX_BITS ) | static_cast<HandleId>(index);
+        }
+
+        Transaction* Find( HandleId handle ) const
+        {
+            const Slot* slot = _FindSlot( handle );
+            return slot ? slot->transaction : nullptr;
+        }
+
+        // 表から外したトランザクションを返す。なければnullptr
+        Transaction* Remove( HandleId handle )
+        {
+            Slot* slot = const_cast<Slot*>( _FindSlot( handle ) );
+            if( !slot )
+            {
+                return nullptr;
+            }
+            Transaction* transaction = slot->transaction;
+            slot->transaction = nullptr;
+            m_FreeSlots.push_back( handle & INDEX_MASK );
+            return transaction;
+        }
+
+        template< class Func >
+        void ForEach( Func func ) const
+        {
+            for( const Slot& slot : m_Slots )
+            {
+                if( slot.transaction )
+                {
+                    func( slot.transaction );
+                }
+            }
+        }
+
+    private:
+        const Slot* _FindSlot( HandleId handle ) const
+        {
+            const size_t index = handle & INDEX_MASK;
+            if( m_Slots.size() <= index )
+            {
+                return nullptr;
+            }
+            const Slot& slot = m_Slots[index];
+            return slot.transaction && slot.generation == ( handle >> INDEX_BITS ) ? &slot : nullptr;
+        }
+
+    private:
+        std::vector<Slot> m_Slots;
+        std::vector<size_t> m_FreeSlots;
+    };
+};
+
+/**
+ * Http通信をするクライアントクラス
+ * 使わない機能の分のコストを払わなくていいように、スレッド、コールバック、受信バッファ、ハンドルの表の扱いをテンプレート引数で選ぶ
+ * リトライなどのポリシー(SetPolicy)を設定したときだけは、処理中のリクエストをstd::mapで持つ
+ */
+template< class ThreadingPolicy, class CompletionPolicy, class BufferPolicy, class HandleTablePolicy=HttpMapHandleTable >
+class BasicHttpClient
+{
+    friend class HttpPolicyController<BasicHttpClient>;
+
+public:
+    typedef BasicHttpTransaction<CompletionPolicy, BufferPolicy> Transaction;
+    typedef typename Transaction::RequestCompleteCallback RequestCompleteCallback;
+    typedef typename ThreadingPolicy::Mutex Mutex;
+    typedef typename HandleTablePolicy::template Table<Transaction, ThreadingPolicy> HandleTable;
+
+private:
+    typedef std::lock_guard<Mutex> Lock;
+
+public:
+    BasicHttpClient()
+    :m_MultiHandle(nullptr)
+    ,m_HandleCount(0)
+    ,m_StartTime(std::chrono::steady_clock::now())
+    {
+        m_MultiHandle = curl_multi_init();
+    }
+
+    ~BasicHttpClient()
+    {
+        for( auto& attempt : m_Attempts )
+        {
+            curl_multi_remove_handle( m_MultiHandle, attempt.second->curl );
+            curl_easy_cleanup( attempt.second->curl );
+            delete attempt.second;
+        }
+        m_Handles.ForEach( [this]( Transaction* transaction ){
+            if( transaction->GetCurl() )
+            {
+                curl_multi_remove_handle( m_MultiHandle, transaction->GetCurl() );
+            }
+            delete transaction;
+        } );
+        // 解放済みで完了待ちのものはm_Handlesにはないので、ここで消す
+        for( auto& request : m_PolicyRequests )
+        {
+            if( request.second.released )
+            {
+                delete request.second.transaction;
+            }
+        }
+        for( Completion& completion : m_Completions )
+        {
+            if( completion.released )
+            {
+                delete completion.transaction;
+            }
+        }
+        for( Transaction* transaction : m_TransactionPool )
+        {
+            delete transaction;
+        }
+        curl_multi_cleanup( m_MultiHandle );
+    }
+
+public:
+    /**
+     *  リトライ、ヘッジ、流量制御、負荷分散のポリシーを設定する
+     *  endpointsを指定した場合は、選ばれた接続先の後ろにリクエストのURLをつなげて通信する
+     *  処理中のリクエストがないときに呼ぶこと
+     */
+    void SetPolicy( const HttpPolicyConfig& config, const std::vector<std::string>& endpoints=std::vector<std::string>() )
+    {
+        Lock lock( s_mutex );
+
+        m_Endpoints = endpoints;
+        m_Policy.reset( new HttpPolicyController<BasicHttpClient>( *this, config, endpoints.size() ) );
+    }
+
+    void Update()
+    {
+        curl_multi_perform(m_MultiHandle, &m_HandleCount);
+
+        CURLMsg *msg = nullptr;
+        int msgs_left = 0;
+        while ((msg = curl_multi_info_read(m_MultiHandle, &msgs_left))) {
+            if( msg->msg != CURLMSG_DONE )
+            {
+                continue;
+            }
+
+            char* privatePtr = nullptr;
+            curl_easy_getinfo( msg->easy_handle, CURLINFO_PRIVATE, &privatePtr );
+
+            Lock lock( s_mutex );
+            if( m_Policy )
+            {
+                // ポリシー経由の試行は、試行ごとの結果をポリシーに渡す
+                _OnAttemptDone( reinterpret_cast<HttpAttempt*>(privatePtr), msg->data.result );
+                continue;
+            }
+
+            const HttpTransactionHandle::HandleId handle = static_cast<HttpTransactionHandle::HandleId>( reinterpret_cast<uintptr_t>(privatePtr) );
+            if( Transaction* transaction = m_Handles.Find( handle ) )
+            {
+                curl_multi_remove_handle( m_MultiHandle, transaction->GetCurl() );
+                _ReleaseOrigin( transaction->GetOriginId() );
+
+                // 受信データは届いたときに渡してあるので、終わったことだけを後で通知する
+                Completion completion;
+                completion.handle = handle;
+                completion.transaction = transaction;
+                completion.result = msg->data.result;
+                completion.released = false;
+                completion.buffered = false;
+                m_Completions.push_back( std::move(completion) );
+            }
+            else
+            {
+                // @todo エラー処理。想定しない状態なのでエラーログとか出しておくべき
+            }
+        }
+
+        {
+            Lock lock( s_mutex );
+            if( m_Policy )
+            {
+                m_Policy->Update( _Now() );
+            }
+            // 通知している間もReleaseTransactionから見えるようにメンバーに移しておく
+            m_Notifying.swap( m_Completions );
+        }
+
+        // コールバックの中からCreateRequestやReleaseTransactionを呼べるように、ロックを外してから通知する
+        // m_Notifyingの大きさを変えるのはUpdateだけなので、通知している間はロックなしで参照できる
+        for( size_t i=0; i<m_Notifying.size(); ++i )
+        {
+            Completion& completion = m_Notifying[i];
+            bool released = false;
+            {
+                Lock lock( s_mutex );
+                released = completion.released;
+            }
+            if( !released )
+            {
+                if( completion.buffered && completion.result == CURLE_OK )
+                {
+                    completion.transaction->OnData( completion.body.data(), completion.body.size() );
+                }
+                completion.transaction->OnDone( completion.result );
+            }
+
+            // 通知の前後に解放されたものも、ここで回収する
+            Lock lock( s_mutex );
+            if( completion.released )
+            {
+                _RecycleTransaction( completion.transaction );
+            }
+            else if( completion.transaction->IsAutoRelease() )
+            {
+                m_Handles.Remove( completion.handle );
+                _RecycleTransaction( completion.transaction );
+            }
+            // ここから後のReleaseTransactionは、完了したトランザクションとしてその場で回収する
+            completion.transaction = nullptr;
+        }
+
+        Lock lock( s_mutex );
+        m_Notifying.clear();
+    }
+
+    /**
+     *  リクエストを開始する
+     *  リクエストはトランザクションにムーブされ、URLやPOSTの内容はコピーしない
+     */
+    HttpTransactionHandle CreateRequest( HttpRequest&& request, const RequestCompleteCallback& callback, bool autoRelease=true )
+    {
+        Lock lock(s_mutex);
+
+        Transaction* transaction = _AcquireTransaction( callback, autoRelease, std::move(request) );
+        const HttpTransactionHandle::HandleId handle = m_Handles.Add( transaction );
+        if( handle == HttpTransactionHandle::INVALID_HANDLE_ID )
+        {
+            // 表が埋まっている
+            _RecycleTransaction( transaction );
+            return HttpTransactionHandle();
+        }
+
+        _AcquireOrigin( transaction->GetOriginId() );
+
+        if( m_Policy )
+        {
+            // 試行し直すときはトランザクションが持っているリクエストを使う
+            PolicyRequest& policyRequest = m_PolicyRequests[handle];
+            policyRequest.transaction = transaction;
+            policyRequest.lastCode = CURLE_OK;
+            policyRequest.released = false;
+
+            m_Policy->Submit( handle, _Now() );
+            return HttpTransactionHandle( handle );
+        }
+
+        const HttpRequest& owned = transaction->GetRequest();
+        CURL* curl = transaction->InitCurl();
+        if( owned.GetParsedUrl() )
+        {
+            curl_easy_setopt(curl, CURLOPT_CURLU, owned.GetParsedUrl()->GetHandle() );
+        }
+        else
+        {
+            curl_easy_setopt(curl, CURLOPT_URL, owned.GetUrl() );
+        }
+        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, &BasicHttpClient::_OnResponse );
+        curl_easy_setopt(curl, CURLOPT_WRITEDATA, transaction );
+        curl_easy_setopt(curl, CURLOPT_PRIVATE, reinterpret_cast<void*>( static_cast<uintptr_t>(handle) ) );
+
+        if( 0 < owned.GetTimeout() )
+        {
+            curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, static_cast<long>(owned.GetTimeout() * 1000) );
+        }
+
+        switch( owned.GetMethodType() )
+        {
+            case HttpRequest::POST:
+                curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, static_cast<long>(owned.GetPostFieldSize()) );
+                curl_easy_setopt(curl, CURLOPT_POSTFIELDS, owned.GetPostField());
+                break;
+
+            case HttpRequest::GET:
+            default:
+                break;
+        }
+
+        if( curl_slist* headers = transaction->GetHeaderList() )
+        {
+            curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers );
+        }
+
+        curl_multi_add_handle(m_MultiHandle, curl);
+
+        return HttpTransactionHandle( handle );
+    }
+
+public:
+    bool IsCompleted( const HttpTransactionHandle& handle )
+    {
+        Transaction* transaction = _GetCurlHandle( handle.GetHandleId() );
+        if( transaction )
+        {
+            return transaction->IsCompleted();
+        }
+        else
+        {
+            // 存在しないハンドルなので、既に終了して削除されている可能性がある
+            return true;
+        }
+    }
+
+    /**
+     *  トランザクションを解放する。完了のコールバックの中から自分のハンドルを解放してもよい
+     *  通知待ちや通知中のものは、通知が終わってからUpdateで回収する
+     */
+    bool ReleaseTransaction( const HttpTransactionHandle& handle )
+    {
+        // 探してから消すまでロックしたままにして、同じハンドルを2回回収しないようにする
+        Lock lock(s_mutex);
+        if( Transaction* transaction = m_Handles.Remove( handle.GetHandleId() ) )
+        {
+            if( transaction->GetCurl() )
+            {
+                curl_multi_remove_handle( m_MultiHandle, transaction->GetCurl() );
+            }
+
+            // ポリシー経由で処理中なら、試行がリクエストを参照しているので終わってから回収する
+            auto policyIt = m_PolicyRequests.find( handle.GetHandleId() );
+            if( policyIt != m_PolicyRequests.end() )
+            {
+                policyIt->second.released = true;
+                return true;
+            }
+            // 完了の通知待ちか通知中なので、オリジンの数は既に減らしてある。Updateで回収する
+            if( _MarkReleased( m_Completions, transaction ) || _MarkReleased( m_Notifying, transaction ) )
+            {
+                return true;
+            }
+            if( !transaction->IsCompleted() )
+            {
+                _ReleaseOrigin( transaction->GetOriginId() );
+            }
+            _RecycleTransaction( transaction );
+            return true;
+        }
+        else
+        {
+            return false;
+        }
+    }
+
+    // オリジンごとの処理中のリクエスト数。解析済みのURLで作ったリクエストだけを数える
+    int GetInFlightCount( HttpOriginId originId ) const
+    {
+        Lock lock(s_mutex);
+        return originId < m_OriginInFlight.size() ? m_OriginInFlight[originId] : 0;
+    }
+
+    // ポリシーの統計。ポリシーを設定していなければ空
+    HttpPolicyStats GetPolicyStats() const
+    {
+        Lock lock(s_mutex);
+        return m_Policy ? m_Policy->GetStats() : HttpPolicyStats();
+    }
+
+private:
+    // ポリシーを通すリクエストの内容
+    struct PolicyRequest
+    {
+        Transaction* transaction;
+        CURLcode lastCode;  // 最後に終わった試行の結果
+        bool released;      // 完了前に解放された
+    };
+
+    // 1回分の試行。ヘッジすると1リクエストに複数できる
+    struct HttpAttempt
+    {
+        CURL* curl;
+        HttpPolicyRequestId requestId;
+        HttpPolicyAttemptId attemptId;
+        std::string body;
+    };
+
+    // 通知待ちの完了したリクエスト
+    struct Completion
+    {
+        HttpTransactionHandle::HandleId handle;
+        Transaction* transaction;
+        std::string body;
+        CURLcode result;
+        bool released;
+        bool buffered;  // ポリシー経由で、受信データをbodyに貯めてある
+    };
+
+private:
+    // 受信完了したときのコールバック関数
+    static size_t _OnResponse(void *ptr, size_t size, size_t count, void *transaction) {
+
+        const size_t dataSize = size*count;
+        Transaction* _trancation = reinterpret_cast<Transaction*>(transaction);
+        _trancation->OnData((char*)ptr, dataSize);
+
+        return dataSize;
+    }
+
+    // 試行の受信データ。ヘッジで勝った試行の分だけを返すので、終わるまで貯めておく
+    static size_t _OnAttemptData(void *ptr, size_t size, size_t count, void *attempt) {
+
+        const size_t dataSize = size*count;
+        reinterpret_cast<HttpAttempt*>(attempt)->body.append( (char*)ptr, dataSize );
+
+        return dataSize;
+    }
+
+private:
+    // 以下はHttpPolicyControllerから呼ばれる。s_mutexを取った状態で呼ばれる
+    void StartAttempt( HttpPolicyRequestId requestId, HttpPolicyAttemptId attemptId, size_t endpoint )
+    {
+        Transaction* transaction = m_PolicyRequests[requestId].transaction;
+        const HttpRequest& request = transaction->GetRequest();
+        const HttpUrl* parsedUrl = request.GetParsedUrl();
+
+        HttpAttempt* attempt = new HttpAttempt();
+        attempt->curl = curl_easy_init();
+        attempt->requestId = requestId;
+        attempt->attemptId = attemptId;
+        m_Attempts[attemptId] = attempt;
+
+        CURL* curl = attempt->curl;
+        if( endpoint < m_Endpoints.size() )
+        {
+            const std::string url = m_Endpoints[endpoint] + ( parsedUrl ? parsedUrl->GetPathAndQuery() : std::string(request.GetUrl()) );
+            curl_easy_setopt(curl, CURLOPT_URL, url.c_str() );
+        }
+        else if( parsedUrl )
+        {
+            curl_easy_setopt(curl, CURLOPT_CURLU, parsedUrl->GetHandle() );
+        }
+        else
+        {
+            curl_easy_setopt(curl, CURLOPT_URL, request.GetUrl() );
+        }
+        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, &BasicHttpClient::_OnAttemptData );
+        curl_easy_setopt(curl, CURLOPT_WRITEDATA, attempt );
+        curl_easy_setopt(curl, CURLOPT_PRIVATE, attempt );
+
+        long timeoutMs = static_cast<long>(request.GetTimeout() * 1000);
+        const long policyTimeoutMs = static_cast<long>(std::chrono::duration_cast<std::chrono::milliseconds>( m_Policy->GetConfig().GetAttemptTimeout() ).count());
+        if( 0 < policyTimeoutMs && ( timeoutMs <= 0 || policyTimeoutMs < timeoutMs ) )
+        {
+            timeoutMs = policyTimeoutMs;
+        }
+        if( 0 < timeoutMs )
+        {
+            curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, timeoutMs );
+        }
+
+        if( request.GetMethodType() == HttpRequest::POST )
+        {
+            curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, static_cast<long>(request.GetPostFieldSize()) );
+            curl_easy_setopt(curl, CURLOPT_POSTFIELDS, request.GetPostField());
+        }
+        if( curl_slist* headers = transaction->GetHeaderList() )
+        {
+            curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers );
+        }
+
+        curl_multi_add_handle(m_MultiHandle, curl);
+    }
+
+    void CancelAttempt( HttpPolicyAttemptId attemptId )
+    {
+        auto it = m_Attempts.find( attemptId );
+        if( it != m_Attempts.end() )
+        {
+            _DestroyAttempt( it->second );
+            m_Attempts.erase( it );
+        }
+    }
+
+    void CompleteRequest( HttpPolicyRequestId requestId, HttpPolicyAttemptId winner, HttpAttemptResult result )
+    {
+        auto requestIt = m_PolicyRequests.find( requestId );
+        if( requestIt == m_PolicyRequests.end() )
+        {
+            return;
+        }
+
+        Completion completion;
+        completion.handle = static_cast<HttpTransactionHandle::HandleId>(requestId);
+        completion.transaction = requestIt->second.transaction;
+        completion.released = requestIt->second.released;
+        completion.buffered = true;
+        _ReleaseOrigin( completion.transaction->GetOriginId() );
+        switch( result )
+        {
+            case HTTP_ATTEMPT_OK:       completion.result = CURLE_OK; break;
+            case HTTP_ATTEMPT_TIMEOUT:  completion.result = CURLE_OPERATION_TIMEDOUT; break;
+            case HTTP_ATTEMPT_REJECTED: completion.result = CURLE_AGAIN; break;
+            default:                    completion.result = requestIt->second.lastCode; break;
+        }
+
+        auto attemptIt = m_Attempts.find( winner );
+        if( attemptIt != m_Attempts.end() )
+        {
+            completion.body.swap( attemptIt->second->body );
+            _DestroyAttempt( attemptIt->second );
+            m_Attempts.erase( attemptIt );
+        }
+
+        m_PolicyRequests.erase( requestIt );
+        if( completion.released )
+        {
+            // 試行は全部終わったので、もう誰も参照していない
+            _RecycleTransaction( completion.transaction );
+            return;
+        }
+        m_Completions.push_back( std::move(completion) );
+    }
+
+private:
+    void _OnAttemptDone( HttpAttempt* attempt, CURLcode code )
+    {
+        long status = 0;
+        curl_easy_getinfo( attempt->curl, CURLINFO_RESPONSE_CODE, &status );
+
+        HttpAttemptResult result = HTTP_ATTEMPT_OK;
+        if( code == CURLE_OPERATION_TIMEDOUT )
+        {
+            result = HTTP_ATTEMPT_TIMEOUT;
+        }
+        else if( code != CURLE_OK )
+        {
+            result = HTTP_ATTEMPT_ERROR;
+        }
+        else if( 500 <= status )
+        {
+            // サーバー側の問題なので別の接続先で試す価値がある
+            result = HTTP_ATTEMPT_ERROR;
+            code = CURLE_HTTP_RETURNED_ERROR;
+        }
+
+        auto requestIt = m_PolicyRequests.find( attempt->requestId );
+        if( requestIt != m_PolicyRequests.end() )
+        {
+            requestIt->second.lastCode = code;
+        }
+
+        // 勝った試行はCompleteRequestの中で受信データを取り出して消される。残っていたらここで消す
+        const HttpPolicyAttemptId attemptId = attempt->attemptId;
+        m_Policy->OnAttemptFinished( attemptId, result, _Now() );
+        CancelAttempt( attemptId );
+    }
+
+    static bool _MarkReleased( std::vector<Completion>& completions, const Transaction* transaction )
+    {
+        for( Completion& completion : completions )
+        {
+            if( completion.transaction == transaction )
+            {
+                completion.released = true;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void _AcquireOrigin( HttpOriginId originId )
+    {
+        if( originId == HttpOriginTable::INVALID_ORIGIN_ID )
+        {
+            return;
+        }
+        if( m_OriginInFlight.size() <= originId )
+        {
+            m_OriginInFlight.resize( originId + 1, 0 );
+        }
+        ++m_OriginInFlight[originId];
+    }
+
+    void _ReleaseOrigin( HttpOriginId originId )
+    {
+        if( originId < m_OriginInFlight.size() )
+        {
+            --m_OriginInFlight[originId];
+        }
+    }
+
+    void _DestroyAttempt( HttpAttempt* attempt )
+    {
+        curl_multi_remove_handle( m_MultiHandle, attempt->curl );
+        curl_easy_cleanup( attempt->curl );
+        delete attempt;
+    }
+
+    // 使い終わったトランザクションがあれば使い回す。s_mutexを取った状態で呼ぶ
+    Transaction* _AcquireTransaction( const RequestCompleteCallback& callback, bool autoRelease, HttpRequest&& request )
+    {
+        if( m_TransactionPool.empty() )
+        {
+            return new Transaction( callback, autoRelease, std::move(request) );
+        }
+
+        Transaction* transaction = m_TransactionPool.back();
+        m_TransactionPool.pop_back();
+        transaction->Reset( callback, autoRelease, std::move(request) );
+        return transaction;
+    }
+
+    void _RecycleTransaction( Transaction* transaction )
+    {
+        if( MAX_POOLED_TRANSACTIONS <= m_TransactionPool.size() )
+        {
+            delete transaction;
+            return;
+        }
+        m_TransactionPool.push_back( transaction );
+    }
+
+    HttpPolicyDuration _Now() const
+    {
+        return std::chrono::duration_cast<HttpPolicyDuration>( std::chrono::steady_clock::now() - m_StartTime );
+    }
+
+private:
+    Transaction* _GetCurlHandle( const HttpTransactionHandle::HandleId& handle )
+    {
+        Lock lock(s_mutex);
+
+        return m_Handles.Find( handle );
+    }
+
+private:
+    // 使い回すために残しておくトランザクションの上限
+    static const size_t MAX_POOLED_TRANSACTIONS = 64;
+
+    static Mutex s_mutex;
+
+private:
+    CURLM* m_MultiHandle;
+    HandleTable m_Handles;
+    std::vector<Transaction*> m_TransactionPool;
+    int m_HandleCount; // 接続中のハンドル数
+
+    std::chrono::steady_clock::time_point m_StartTime;  // ポリシーに渡す時刻の基準
+    std::unique_ptr< HttpPolicyController<BasicHttpClient> > m_Policy;
+    std::vector<std::string> m_Endpoints;
+    std::map<HttpTransactionHandle::HandleId, PolicyRequest> m_PolicyRequests;
+    std::map<HttpPolicyAttemptId, HttpAttempt*> m_Attempts;
+    std::vector<Completion> m_Completions;
+    std::vector<Completion> m_Notifying;    // Updateが通知している最中の完了
+    std::vector<int> m_OriginInFlight;  // オリジンIDを添字にした処理中の数
+};
+
+template< class ThreadingPolicy, class CompletionPolicy, class BufferPolicy, class HandleTablePolicy >
+typename BasicHttpClient<ThreadingPolicy, CompletionPolicy, BufferPolicy, HandleTablePolicy>::Mutex BasicHttpClient<ThreadingPolicy, CompletionPolicy, BufferPolicy, HandleTablePolicy>::s_mutex;
+
+// 今までと同じ動作のクライアント
+typedef BasicHttpClient<HttpMultiThreadPolicy, HttpFunctionCompletion, HttpStreamingBuffer> HttpClient;
+typedef HttpClient::Transaction HttpTransaction;
+
+#ifdef HTTPCLIENT_EXTERN_TEMPLATE
+// 標準のクライアントはライブラリ側で実体化してある(HttpClient.cpp)
+extern template class BasicHttpClient<HttpMultiThreadPolicy, HttpFunctionCompletion, HttpStreamingBuffer>;
+extern template class BasicHttpTransaction<HttpFunctionCompletion, HttpStreamingBuffer>;
+#endif
+
+#endif /* defined(__httpclient__HttpClient__) */
@@ -0,0 +1,664 @@
+/*
+ * Copyright (c) 2013, nilfs
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * * Neither the name of the <ORGANIZATION> nor the names of its contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __httpclient__HttpClientPolicy__
+#define __httpclient__HttpClientPolicy__
+
+#include <chrono>
+#include <vector>
+#include <deque>
+#include <queue>
+#include <unordered_map>
+#include <random>
+#include <algorithm>
+#include <cstdint>
+
+/**
+ *  HttpClientの耐障害ポリシー(流量制御、リトライ、ヘッジング、負荷分散)
+ *  curlにも実時間にも依存しないので、HttpClientとシミュレータで同じコードを動かす
+ */
+
+// ポリシーが扱う時刻。基準時刻からの経過時間で表すので、仮想時間でもそのまま動く
+typedef std::chrono::microseconds HttpPolicyDuration;
+
+typedef uint64_t HttpPolicyRequestId;
+typedef uint64_t HttpPolicyAttemptId;
+
+/**
+ *  1回の通信試行の結果
+ */
+enum HttpAttemptResult
+{
+    HTTP_ATTEMPT_OK,
+    HTTP_ATTEMPT_ERROR,     // 接続失敗やサーバーエラー。リトライ対象
+    HTTP_ATTEMPT_TIMEOUT,   // タイムアウト。リトライ対象
+    HTTP_ATTEMPT_FATAL,     // リトライしても無駄なエラー(4xxなど)
+    HTTP_ATTEMPT_REJECTED,  // 流量制御で受け付けなかった
+};
+
+/**
+ *  負荷分散の方式
+ */
+enum HttpLoadBalanceType
+{
+    HTTP_BALANCE_ROUND_ROBIN,
+    HTTP_BALANCE_RANDOM,
+    HTTP_BALANCE_LEAST_OUTSTANDING, // 2つ選んで処理中の少ない方(power of two choices)
+};
+
+/**
+ *  ポリシーの設定値
+ */
+class HttpPolicyConfig
+{
+public:
+    HttpPolicyConfig()
+    :m_MaxConcurrency(0)
+    ,m_MaxPending(0)
+    ,m_MaxAttempts(1)
+    ,m_RetryBaseBackoff(std::chrono::milliseconds(50))
+    ,m_RetryMaxBackoff(std::chrono::seconds(2))
+    ,m_RetryBudgetRatio(0.f)
+    ,m_HedgeDelay(0)
+    ,m_MaxHedges(0)
+    ,m_AttemptTimeout(0)
+    ,m_BalanceType(HTTP_BALANCE_ROUND_ROBIN)
+    {}
+
+public:
+    // 同時に処理するリクエスト数の上限。0なら無制限
+    void SetMaxConcurrency( int count ){ m_MaxConcurrency = count; }
+    // 上限を超えたときに待たせておくリクエスト数。これも超えたら拒否する
+    void SetMaxPending( int count ){ m_MaxPending = count; }
+    // 1リクエストあたりの最大試行回数(初回を含む)。1ならリトライしない
+    void SetMaxAttempts( int count ){ m_MaxAttempts = count; }
+    // リトライ間隔。指数的に伸ばしてフルジッタをかける
+    void SetRetryBackoff( HttpPolicyDuration base, HttpPolicyDuration max ){ m_RetryBaseBackoff = base; m_RetryMaxBackoff = max; }
+    // リクエスト数に対するリトライ+ヘッジの上限割合。0なら制限しない
+    void SetRetryBudgetRatio( float ratio ){ m_RetryBudgetRatio = ratio; }
+    // 応答がこの時間返ってこなければ別の接続先にも投げる。0ならヘッジしない
+    void SetHedging( HttpPolicyDuration delay, int maxHedges ){ m_HedgeDelay = delay; m_MaxHedges = maxHedges; }
+    // 1回の試行のタイムアウト。0なら無制限
+    void SetAttemptTimeout( HttpPolicyDuration timeout ){ m_AttemptTimeout = timeout; }
+    void SetBalanceType( HttpLoadBalanceType type ){ m_BalanceType = type; }
+
+    int GetMaxConcurrency() const { return m_MaxConcurrency; }
+    int GetMaxPending() const { return m_MaxPending; }
+    int GetMaxAttempts() const { return m_MaxAttempts; }
+    HttpPolicyDuration GetRetryBaseBackoff() const { return m_RetryBaseBackoff; }
+    HttpPolicyDuration GetRetryMaxBackoff() const { return m_RetryMaxBackoff; }
+    float GetRetryBudgetRatio() const { return m_RetryBudgetRatio; }
+    HttpPolicyDuration GetHedgeDelay() const { return m_HedgeDelay; }
+    int GetMaxHedges() const { return m_MaxHedges; }
+    HttpPolicyDuration GetAttemptTimeout() const { return m_AttemptTimeout; }
+    HttpLoadBalanceType GetBalanceType() const { return m_BalanceType; }
+
+private:
+    int m_MaxConcurrency;
+    int m_MaxPending;
+    int m_MaxAttempts;
+    HttpPolicyDuration m_RetryBaseBackoff;
+    HttpPolicyDuration m_RetryMaxBackoff;
+    float m_RetryBudgetRatio;
+    HttpPolicyDuration m_HedgeDelay;
+    int m_MaxHedges;
+    HttpPolicyDuration m_AttemptTimeout;
+    HttpLoadBalanceType m_BalanceType;
+};
+
+/**
+ *  同時処理数による受付制御
+ */
+class HttpAdmissionPolicy
+{
+public:
+    HttpAdmissionPolicy( int maxConcurrency, int maxPending )
+    :m_MaxConcurrency(maxConcurrency)
+    ,m_MaxPending(maxPending)
+    ,m_InFlight(0)
+    {}
+
+public:
+    // すぐに処理を始めてよいか
+    bool TryAcquire()
+    {
+        if( 0 < m_MaxConcurrency && m_MaxConcurrency <= m_InFlight )
+        {
+            return false;
+        }
+        ++m_InFlight;
+        return true;
+    }
+
+    void Release(){ --m_InFlight; }
+
+    // 待ち行列にまだ入れられるか
+    bool CanQueue( size_t pendingCount ) const
+    {
+        return 0 < m_MaxConcurrency && pendingCount < static_cast<size_t>(m_MaxPending);
+    }
+
+    int GetInFlight() const { return m_InFlight; }
+
+private:
+    int m_MaxConcurrency;
+    int m_MaxPending;
+    int m_InFlight;
+};
+
+/**
+ *  リトライ判定と待ち時間の計算
+ *  リトライとヘッジは共通の予算(トークンバケツ)から払うので、障害時の負荷増幅に上限がかかる
+ */
+class HttpRetryPolicy
+{
+public:
+    HttpRetryPolicy( const HttpPolicyConfig& config )
+    :m_MaxAttempts(config.GetMaxAttempts())
+    ,m_BaseBackoff(config.GetRetryBaseBackoff())
+    ,m_MaxBackoff(config.GetRetryMaxBackoff())
+    ,m_BudgetRatio(config.GetRetryBudgetRatio())
+    ,m_BudgetTokens(MIN_BUDGET_TOKENS)
+    {}
+
+public:
+    // 新規リクエストごとに予算を積む
+    void OnRequest()
+    {
+        if( 0.f < m_BudgetRatio )
+        {
+            const float tokens = m_BudgetTokens + m_BudgetRatio;
+            m_BudgetTokens = tokens < MAX_BUDGET_TOKENS ? tokens : MAX_BUDGET_TOKENS;
+        }
+    }
+
+    bool IsRetryable( HttpAttemptResult result, int attemptCount ) const
+    {
+        if( result != HTTP_ATTEMPT_ERROR && result != HTTP_ATTEMPT_TIMEOUT )
+        {
+            return false;
+        }
+        return attemptCount < m_MaxAttempts;
+    }
+
+    // 予算が残っていれば1回分消費する
+    bool ConsumeBudget()
+    {
+        if( m_BudgetRatio <= 0.f )
+        {
+            return true;
+        }
+        if( m_BudgetTokens < 1.f )
+        {
+            return false;
+        }
+        m_BudgetTokens -= 1.f;
+        return true;
+    }
+
+    template< class Random >
+    HttpPolicyDuration GetBackoff( int attemptCount, Random& random ) const
+    {
+        // base * 2^(n-1) を上限で切って、0からその値までの一様乱数にする
+        HttpPolicyDuration::rep ceil = m_BaseBackoff.count();
+        for( int i=1; i<attemptCount && ceil < m_MaxBackoff.count(); ++i )
+        {
+            ceil *= 2;
+        }
+        ceil = std::min( ceil, m_MaxBackoff.count() );
+        if( ceil <= 0 )
+        {
+            return HttpPolicyDuration(0);
+        }
+        std::uniform_int_distribution<HttpPolicyDuration::rep> dist( 0, ceil );
+        return HttpPolicyDuration( dist(random) );
+    }
+
+private:
+    static constexpr float MIN_BUDGET_TOKENS = 10.f;    // 起動直後でも最低限リトライできるように
+    static constexpr float MAX_BUDGET_TOKENS = 1000.f;
+
+    int m_MaxAttempts;
+    HttpPolicyDuration m_BaseBackoff;
+    HttpPolicyDuration m_MaxBackoff;
+    float m_BudgetRatio;
+    float m_BudgetTokens;
+};
+
+/**
+ *  接続先の選択
+ */
+class HttpLoadBalancer
+{
+public:
+    static const size_t INVALID_ENDPOINT = SIZE_MAX;
+
+public:
+    HttpLoadBalancer( HttpLoadBalanceType type, size_t endpointCount )
+    :m_Type(type)
+    ,m_Outstanding(std::max<size_t>(endpointCount, 1), 0)
+    ,m_Next(0)
+    {}
+
+public:
+    /**
+     *  接続先を選ぶ。可能ならexcludeは避ける(リトライやヘッジで同じ接続先に投げないため)
+     */
+    template< class Random >
+    size_t Pick( Random& random, size_t exclude=INVALID_ENDPOINT )
+    {
+        const size_t count = m_Outstanding.size();
+        if( count == 1 )
+        {
+            return 0;
+        }
+
+        size_t endpoint = 0;
+        switch( m_Type )
+        {
+            case HTTP_BALANCE_RANDOM:
+                endpoint = _PickRandom( random, exclude );
+                break;
+
+            case HTTP_BALANCE_LEAST_OUTSTANDING:
+            {
+                size_t a = _PickRandom( random, exclude );
+                size_t b = _PickRandom( random, exclude );
+                endpoint = m_Outstanding[b] < m_Outstanding[a] ? b : a;
+                break;
+            }
+
+            case HTTP_BALANCE_ROUND_ROBIN:
+            default:
+                endpoint = m_Next++ % count;
+                if( endpoint == exclude )
+                {
+                    endpoint = m_Next++ % count;
+                }
+                break;
+        }
+        return endpoint;
+    }
+
+    void OnAttemptStart( size_t endpoint ){ ++m_Outstanding[endpoint]; }
+    void OnAttemptFinish( size_t endpoint ){ --m_Outstanding[endpoint]; }
+
+    size_t GetEndpointCount() const { return m_Outstanding.size(); }
+
+private:
+    template< class Random >
+    size_t _PickRandom( Random& random, size_t exclude )
+    {
+        const size_t count = m_Outstanding.size();
+        if( exclude < count )
+        {
+            // excludeを除いた中から選ぶ
+            std::uniform_int_distribution<size_t> dist( 0, count - 2 );
+            size_t endpoint = dist(random);
+            return endpoint < exclude ? endpoint : endpoint + 1;
+        }
+        std::uniform_int_distribution<size_t> dist( 0, count - 1 );
+        return dist(random);
+    }
+
+private:
+    HttpLoadBalanceType m_Type;
+    std::vector<int> m_Outstanding;  // 接続先ごとの処理中の試行数
+    size_t m_Next;
+};
+
+/**
+ *  ポリシー全体の統計
+ */
+struct HttpPolicyStats
+{
+    uint64_t requests;      // 受け付けたリクエスト数
+    uint64_t rejected;      // 流量制御で拒否した数
+    uint64_t attempts;      // 実際に投げた試行数
+    uint64_t retries;
+    uint64_t hedges;
+    uint64_t succeeded;
+    uint64_t failed;
+    uint64_t budgetExhausted;   // 予算切れでリトライ、ヘッジを諦めた数
+
+    HttpPolicyStats()
+    :requests(0), rejected(0), attempts(0), retries(0), hedges(0), succeeded(0), failed(0), budgetExhausted(0)
+    {}
+};
+
+/**
+ *  リクエスト1つ分の試行をポリシーに従って管理する
+ *
+ *  Hostは実際の通信を行う側で、以下を実装する
+ *    void StartAttempt( HttpPolicyRequestId, HttpPolicyAttemptId, size_t endpoint );
+ *    void CancelAttempt( HttpPolicyAttemptId );
+ *    void CompleteRequest( HttpPolicyRequestId, HttpPolicyAttemptId winner, HttpAttemptResult );
+ *  HttpClientは実時間とcurlで、シミュレータは仮想時間と模擬サーバーで実装している
+ */
+template< class Host >
+class HttpPolicyController
+{
+public:
+    static const HttpPolicyAttemptId INVALID_ATTEMPT_ID = 0;
+
+public:
+    HttpPolicyController( Host& host, const HttpPolicyConfig& config, size_t endpointCount, uint32_t seed=5489u )
+    :m_Host(host)
+    ,m_Config(config)
+    ,m_Admission(config.GetMaxConcurrency(), config.GetMaxPending())
+    ,m_Retry(config)
+    ,m_Balancer(config.GetBalanceType(), endpointCount)
+    ,m_Random(seed)
+    ,m_MaxHedges(std::min(config.GetMaxHedges(), MAX_ATTEMPTS_IN_FLIGHT - 1))
+    ,m_TopAttemptId(INVALID_ATTEMPT_ID)
+    {}
+
+public:
+    /**
+     *  リクエストを受け付ける。拒否した場合はその場でCompleteRequestが呼ばれてfalseを返す
+     */
+    bool Submit( HttpPolicyRequestId id, HttpPolicyDuration now )
+    {
+        if( !m_Admission.TryAcquire() )
+        {
+            if( !m_Admission.CanQueue( m_Pending.size() ) )
+            {
+                ++m_Stats.rejected;
+                m_Host.CompleteRequest( id, INVALID_ATTEMPT_ID, HTTP_ATTEMPT_REJECTED );
+                return false;
+            }
+            m_Pending.push_back( id );
+            return true;
+        }
+
+        _Begin( id, now );
+        return true;
+    }
+
+    /**
+     *  試行が終わったことを通知する
+     */
+    void OnAttemptFinished( HttpPolicyAttemptId attemptId, HttpAttemptResult result, HttpPolicyDuration now )
+    {
+        auto attemptIt = m_Attempts.find( attemptId );
+        if( attemptIt == m_Attempts.end() )
+        {
+            // キャンセル済み
+            return;
+        }
+        const HttpPolicyRequestId id = attemptIt->second.requestId;
+        m_Balancer.OnAttemptFinish( attemptIt->second.endpoint );
+        m_Attempts.erase( attemptIt );
+
+        auto it = m_Requests.find( id );
+        if( it == m_Requests.end() )
+        {
+            return;
+        }
+        RequestState& state = it->second;
+        _RemoveInFlight( state, attemptId );
+
+        if( result == HTTP_ATTEMPT_OK )
+        {
+            _Finish( it, attemptId, result, now );
+            return;
+        }
+        if( 0 < state.attemptsInFlight )
+        {
+            // ヘッジした他の試行がまだ生きているのでそちらを待つ
+            return;
+        }
+        if( m_Retry.IsRetryable( result, state.attemptsStarted ) )
+        {
+            if( m_Retry.ConsumeBudget() )
+            {
+                state.lastResult = result;
+                _Schedule( id, state, now + m_Retry.GetBackoff( state.attemptsStarted, m_Random ), TIMER_RETRY );
+                return;
+            }
+            ++m_Stats.budgetExhausted;
+        }
+        _Finish( it, INVALID_ATTEMPT_ID, result, now );
+    }
+
+    /**
+     *  時間経過によるリトライとヘッジを処理する
+     */
+    void Update( HttpPolicyDuration now )
+    {
+        while( !m_Timers.empty() && m_Timers.top().time <= now )
+        {
+            const Timer timer = m_Timers.top();
+            m_Timers.pop();
+
+            auto it = m_Requests.find( timer.requestId );
+            if( it == m_Requests.end() || it->second.timerSerial != timer.serial )
+            {
+                // 終わったリクエストか、新しいタイマーで上書きされている
+                continue;
+            }
+            RequestState& state = it->second;
+            if( timer.type == TIMER_RETRY )
+            {
+                ++m_Stats.retries;
+                _StartAttempt( timer.requestId, state, now );
+            }
+            else if( state.hedges < m_MaxHedges )
+            {
+                if( m_Retry.ConsumeBudget() )
+                {
+                    ++m_Stats.hedges;
+                    ++state.hedges;
+                    _StartAttempt( timer.requestId, state, now );
+                }
+                else
+                {
+                    ++m_Stats.budgetExhausted;
+                }
+            }
+        }
+    }
+
+    /**
+     *  次にUpdateを呼ぶ必要のある時刻。タイマーがなければfalse
+     */
+    bool GetNextDeadline( HttpPolicyDuration& deadline ) const
+    {
+        if( m_Timers.empty() )
+        {
+            return false;
+        }
+        deadline = m_Timers.top().time;
+        return true;
+    }
+
+    const HttpPolicyStats& GetStats() const { return m_Stats; }
+    const HttpPolicyConfig& GetConfig() const { return m_Config; }
+    size_t GetActiveRequestCount() const { return m_Requests.size(); }
+
+private:
+    enum TimerType
+    {
+        TIMER_RETRY,
+        TIMER_HEDGE,
+    };
+
+    // 1リクエストで同時に飛ばす試行数の上限(初回+ヘッジ)
+    static const int MAX_ATTEMPTS_IN_FLIGHT = 4;
+
+    struct RequestState
+    {
+        HttpPolicyAttemptId inFlight[MAX_ATTEMPTS_IN_FLIGHT];
+        HttpPolicyDuration startTime;
+        int attemptsStarted;
+        int attemptsInFlight;
+        int hedges;
+        size_t lastEndpoint;
+        uint64_t timerSerial;       // 最新のタイマー以外を無視するための番号
+        HttpAttemptResult lastResult;
+    };
+
+    struct AttemptState
+    {
+        HttpPolicyRequestId requestId;
+        size_t endpoint;
+    };
+
+    struct Timer
+    {
+        HttpPolicyDuration time;
+        HttpPolicyRequestId requestId;
+        uint64_t serial;
+        TimerType type;
+
+        bool operator>( const Timer& rhs ) const { return rhs.time < time; }
+    };
+
+    typedef std::unordered_map<HttpPolicyRequestId, RequestState> RequestMap;
+
+private:
+    void _Begin( HttpPolicyRequestId id, HttpPolicyDuration now )
+    {
+        ++m_Stats.requests;
+        m_Retry.OnRequest();
+
+        RequestState& state = m_Requests[id];
+        state.startTime = now;
+        state.attemptsStarted = 0;
+        state.attemptsInFlight = 0;
+        state.hedges = 0;
+        state.lastEndpoint = HttpLoadBalancer::INVALID_ENDPOINT;
+        state.timerSerial = 0;
+        state.lastResult = HTTP_ATTEMPT_ERROR;
+        _StartAttempt( id, state, now );
+    }
+
+    void _StartAttempt( HttpPolicyRequestId id, RequestState& state, HttpPolicyDuration now )
+    {
+        const size_t endpoint = m_Balancer.Pick( m_Random, state.lastEndpoint );
+        const HttpPolicyAttemptId attemptId = ++m_TopAttemptId;
+
+        AttemptState& attempt = m_Attempts[attemptId];
+        attempt.requestId = id;
+        attempt.endpoint = endpoint;
+
+        state.inFlight[state.attemptsInFlight++] = attemptId;
+        state.attemptsStarted++;
+        state.lastEndpoint = endpoint;
+        ++m_Stats.attempts;
+        m_Balancer.OnAttemptStart( endpoint );
+
+        if( 0 < m_Config.GetHedgeDelay().count() && state.hedges < m_MaxHedges )
+        {
+            _Schedule( id, state, now + m_Config.GetHedgeDelay(), TIMER_HEDGE );
+        }
+
+        // Hostの中から再入されても状態が壊れないように、登録を済ませてから呼ぶ
+        m_Host.StartAttempt( id, attemptId, endpoint );
+    }
+
+    void _RemoveInFlight( RequestState& state, HttpPolicyAttemptId attemptId )
+    {
+        for( int i=0; i<state.attemptsInFlight; ++i )
+        {
+            if( state.inFlight[i] == attemptId )
+            {
+                state.inFlight[i] = state.inFlight[--state.attemptsInFlight];
+                break;
+            }
+        }
+    }
+
+    void _Schedule( HttpPolicyRequestId id, RequestState& state, HttpPolicyDuration time, TimerType type )
+    {
+        Timer timer;
+        timer.time = time;
+        timer.requestId = id;
+        timer.serial = ++state.timerSerial;
+        timer.type = type;
+        m_Timers.push( timer );
+    }
+
+    void _Finish( typename RequestMap::iterator it, HttpPolicyAttemptId winner, HttpAttemptResult result, HttpPolicyDuration now )
+    {
+        const HttpPolicyRequestId id = it->first;
+
+        // 負けたヘッジの試行を止める
+        const RequestState state = it->second;
+        m_Requests.erase( it );
+        for( int i=0; i<state.attemptsInFlight; ++i )
+        {
+            auto attemptIt = m_Attempts.find( state.inFlight[i] );
+            if( attemptIt != m_Attempts.end() )
+            {
+                m_Balancer.OnAttemptFinish( attemptIt->second.endpoint );
+                m_Attempts.erase( attemptIt );
+                m_Host.CancelAttempt( state.inFlight[i] );
+            }
+        }
+
+        if( result == HTTP_ATTEMPT_OK )
+        {
+            ++m_Stats.succeeded;
+        }
+        else
+        {
+            ++m_Stats.failed;
+        }
+        m_Admission.Release();
+        m_Host.CompleteRequest( id, winner, result );
+
+        // 空いた枠で待たせていたリクエストを始める
+        while( !m_Pending.empty() && m_Admission.TryAcquire() )
+        {
+            const HttpPolicyRequestId pending = m_Pending.front();
+            m_Pending.pop_front();
+            _Begin( pending, now );
+        }
+    }
+
+private:
+    Host& m_Host;
+    HttpPolicyConfig m_Config;
+    HttpAdmissionPolicy m_Admission;
+    HttpRetryPolicy m_Retry;
+    HttpLoadBalancer m_Balancer;
+    std::mt19937 m_Random;
+    int m_MaxHedges;
+
+    RequestMap m_Requests;
+    std::unordered_map<HttpPolicyAttemptId, AttemptState> m_Attempts;
+    std::deque<HttpPolicyRequestId> m_Pending;     // 同時処理数の空き待ち
+    std::priority_queue<Timer, std::vector<Timer>, std::greater<Timer> > m_Timers;
+    HttpPolicyAttemptId m_TopAttemptId;
+
+    HttpPolicyStats m_Stats;
+};
+
+#endif /* defined(__httpclient__HttpClientPolicy__) */
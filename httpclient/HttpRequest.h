@@ -0,0 +1,367 @@
+/*
+ * Copyright (c) 2013, nilfs
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * * Neither the name of the <ORGANIZATION> nor the names of its contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __httpclient__HttpRequest__
+#define __httpclient__HttpRequest__
+
+#include <vector>
+#include <cstring>
+#include <cstddef>
+
+#include "HttpUrl.h"
+
+/**
+ *  まとめて作るリクエスト用の領域
+ *  確保は先頭から切り出すだけで、個別には解放しない。バッチが全部終わったらResetでまとめて戻す
+ *  スレッドセーフではないので、リクエストを作るスレッドごとに持つこと
+ */
+class HttpRequestArena
+{
+public:
+    explicit HttpRequestArena( size_t blockSize=16*1024 )
+    :m_BlockSize(blockSize)
+    ,m_BlockIndex(0)
+    ,m_Offset(0)
+    {}
+
+    ~HttpRequestArena()
+    {
+        for( char* block : m_Blocks )
+        {
+            delete [] block;
+        }
+        _FreeLarge();
+    }
+
+private:
+    HttpRequestArena( const HttpRequestArena& ) = delete;
+    HttpRequestArena& operator=( const HttpRequestArena& ) = delete;
+
+public:
+    char* Allocate( size_t size )
+    {
+        if( m_BlockSize < size )
+        {
+            // ブロックに収まらない大きさは個別に確保して、Resetで解放する
+            char* large = new char[size];
+            m_Large.push_back( large );
+            return large;
+        }
+
+        if( m_Blocks.empty() || m_BlockSize < m_Offset + size )
+        {
+            if( !m_Blocks.empty() )
+            {
+                ++m_BlockIndex;
+            }
+            if( m_Blocks.size() <= m_BlockIndex )
+            {
+                m_Blocks.push_back( new char[m_BlockSize] );
+            }
+            m_Offset = 0;
+        }
+
+        char* ptr = m_Blocks[m_BlockIndex] + m_Offset;
+        m_Offset += size;
+        return ptr;
+    }
+
+    // 確保したブロックは残したまま先頭に戻す。この領域を使ったリクエストが全て終わってから呼ぶこと
+    void Reset()
+    {
+        m_BlockIndex = 0;
+        m_Offset = 0;
+        _FreeLarge();
+    }
+
+private:
+    void _FreeLarge()
+    {
+        for( char* large : m_Large )
+        {
+            delete [] large;
+        }
+        m_Large.clear();
+    }
+
+private:
+    std::vector<char*> m_Blocks;
+    std::vector<char*> m_Large;
+    size_t m_BlockSize;
+    size_t m_BlockIndex;
+    size_t m_Offset;
+};
+
+/**
+ *  短ければオブジェクト内に持つ文字列
+ *  溢れた分はアリーナがあればそこから、なければヒープから確保する
+ */
+template< size_t InlineSize >
+class HttpSmallString
+{
+public:
+    HttpSmallString()
+    :m_Data(m_Inline)
+    ,m_Size(0)
+    ,m_Capacity(InlineSize)
+    ,m_HeapOwned(false)
+    {
+        m_Inline[0] = '\0';
+    }
+
+    HttpSmallString( HttpSmallString&& rhs )
+    {
+        _MoveFrom( rhs );
+    }
+
+    ~HttpSmallString()
+    {
+        _Free();
+    }
+
+    HttpSmallString& operator=( HttpSmallString&& rhs )
+    {
+        if( this != &rhs )
+        {
+            _Free();
+            _MoveFrom( rhs );
+        }
+        return *this;
+    }
+
+private:
+    HttpSmallString( const HttpSmallString& ) = delete;
+    HttpSmallString& operator=( const HttpSmallString& ) = delete;
+
+public:
+    void Assign( const char* str, size_t size, HttpRequestArena* arena )
+    {
+        m_Size = 0;
+        Append( str, size, arena );
+    }
+
+    // 終端の'\0'も含めて追記する(ヘッダを'\0'区切りで並べるため)
+    void AppendWithTerminator( const char* str, size_t size, HttpRequestArena* arena )
+    {
+        Append( str, size, arena );
+        _Reserve( m_Size + 2, arena );
+        m_Data[++m_Size] = '\0';
+    }
+
+    void Append( const char* str, size_t size, HttpRequestArena* arena )
+    {
+        _Reserve( m_Size + size + 1, arena );
+        std::memcpy( m_Data + m_Size, str, size );
+        m_Size += size;
+        m_Data[m_Size] = '\0';
+    }
+
+    void Clear()
+    {
+        m_Size = 0;
+        m_Data[0] = '\0';
+    }
+
+    const char* c_str() const { return m_Data; }
+    size_t size() const { return m_Size; }
+    bool empty() const { return m_Size == 0; }
+
+private:
+    void _Reserve( size_t capacity, HttpRequestArena* arena )
+    {
+        if( capacity <= m_Capacity )
+        {
+            return;
+        }
+
+        size_t newCapacity = m_Capacity * 2;
+        if( newCapacity < capacity )
+        {
+            newCapacity = capacity;
+        }
+
+        char* data = arena ? arena->Allocate( newCapacity ) : new char[newCapacity];
+        std::memcpy( data, m_Data, m_Size + 1 );
+        _Free();
+        m_Data = data;
+        m_Capacity = newCapacity;
+        m_HeapOwned = ( arena == nullptr );
+    }
+
+    void _Free()
+    {
+        if( m_HeapOwned )
+        {
+            delete [] m_Data;
+        }
+        m_Data = m_Inline;
+        m_Capacity = InlineSize;
+        m_HeapOwned = false;
+    }
+
+    void _MoveFrom( HttpSmallString& rhs )
+    {
+        m_Size = rhs.m_Size;
+        if( rhs.m_Data == rhs.m_Inline )
+        {
+            std::memcpy( m_Inline, rhs.m_Inline, rhs.m_Size + 1 );
+            m_Data = m_Inline;
+            m_Capacity = InlineSize;
+            m_HeapOwned = false;
+        }
+        else
+        {
+            // 外に確保した領域はそのまま引き継ぐ
+            m_Data = rhs.m_Data;
+            m_Capacity = rhs.m_Capacity;
+            m_HeapOwned = rhs.m_HeapOwned;
+        }
+
+        rhs.m_Data = rhs.m_Inline;
+        rhs.m_Size = 0;
+        rhs.m_Capacity = InlineSize;
+        rhs.m_HeapOwned = false;
+        rhs.m_Inline[0] = '\0';
+    }
+
+private:
+    char* m_Data;
+    size_t m_Size;
+    size_t m_Capacity;
+    bool m_HeapOwned;   // new[]で確保した(アリーナから確保したものは解放しない)
+    char m_Inline[InlineSize];
+};
+
+/**
+ *  リクエストの内容
+ *  文字列は全てリクエスト自身が持つので、作った側は渡した後すぐに破棄してよい
+ *  コピーはできず、CreateRequestでトランザクションにムーブする
+ */
+class HttpRequest
+{
+public:
+    enum RequestMethodType
+    {
+        GET,
+        POST,
+    };
+
+public:
+    HttpRequest( const char* url, RequestMethodType method, HttpRequestArena* arena=nullptr )
+    :m_Arena(arena)
+    ,m_HeaderCount(0)
+    ,m_MethodType(method)
+    ,m_HasPostField(false)
+    ,m_Timeout(0.f)
+    {
+        m_Url.Assign( url, std::strlen(url), m_Arena );
+    }
+
+    // 解析済みのURLを使う
+    HttpRequest( HttpUrl&& url, RequestMethodType method )
+    :m_ParsedUrl(std::move(url))
+    ,m_Arena(nullptr)
+    ,m_HeaderCount(0)
+    ,m_MethodType(method)
+    ,m_HasPostField(false)
+    ,m_Timeout(0.f)
+    {}
+
+    HttpRequest( HttpRequest&& rhs )
+    :m_Url(std::move(rhs.m_Url))
+    ,m_ParsedUrl(std::move(rhs.m_ParsedUrl))
+    ,m_PostField(std::move(rhs.m_PostField))
+    ,m_Headers(std::move(rhs.m_Headers))
+    ,m_Arena(rhs.m_Arena)
+    ,m_HeaderCount(rhs.m_HeaderCount)
+    ,m_MethodType(rhs.m_MethodType)
+    ,m_HasPostField(rhs.m_HasPostField)
+    ,m_Timeout(rhs.m_Timeout)
+    {}
+
+    HttpRequest& operator=( HttpRequest&& rhs )
+    {
+        m_Url = std::move(rhs.m_Url);
+        m_ParsedUrl = std::move(rhs.m_ParsedUrl);
+        m_PostField = std::move(rhs.m_PostField);
+        m_Headers = std::move(rhs.m_Headers);
+        m_Arena = rhs.m_Arena;
+        m_HeaderCount = rhs.m_HeaderCount;
+        m_MethodType = rhs.m_MethodType;
+        m_HasPostField = rhs.m_HasPostField;
+        m_Timeout = rhs.m_Timeout;
+        return *this;
+    }
+
+private:
+    HttpRequest( const HttpRequest& ) = delete;
+    HttpRequest& operator=( const HttpRequest& ) = delete;
+
+public:
+    void SetPostField( const char* field ){ SetPostField( field, std::strlen(field) ); }
+    void SetPostField( const char* field, size_t size )
+    {
+        m_PostField.Assign( field, size, m_Arena );
+        m_HasPostField = true;
+    }
+    void SetTimeout( float timeout ){ m_Timeout = timeout; }
+
+    // "Name: value" の形式で追加する
+    void AddHeader( const char* header )
+    {
+        m_Headers.AppendWithTerminator( header, std::strlen(header), m_Arena );
+        ++m_HeaderCount;
+    }
+
+    const char* GetUrl() const { return m_ParsedUrl.IsValid() ? nullptr : m_Url.c_str(); }
+    const HttpUrl* GetParsedUrl() const { return m_ParsedUrl.IsValid() ? &m_ParsedUrl : nullptr; }
+    // 文字列のURLは解析し直さないので、解析済みのURLのときだけ有効なIDを返す
+    HttpOriginId GetOriginId() const { return m_ParsedUrl.GetOriginId(); }
+    const char* GetPostField() const { return m_HasPostField ? m_PostField.c_str() : nullptr; }
+    size_t GetPostFieldSize() const { return m_PostField.size(); }
+    RequestMethodType GetMethodType() const { return m_MethodType; }
+    float GetTimeout() const { return m_Timeout; }
+
+    // ヘッダを順に取り出す。'\0'区切りで並んでいる
+    size_t GetHeaderCount() const { return m_HeaderCount; }
+    const char* GetHeaders() const { return m_Headers.c_str(); }
+
+private:
+    HttpSmallString<128> m_Url;
+    HttpUrl m_ParsedUrl;
+    HttpSmallString<64> m_PostField;
+    HttpSmallString<128> m_Headers;
+    HttpRequestArena* m_Arena;
+    size_t m_HeaderCount;
+    RequestMethodType m_MethodType;
+    bool m_HasPostField;
+    float m_Timeout;
+};
+
+#endif /* defined(__httpclient__HttpRequest__) */
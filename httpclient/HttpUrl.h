@@ -0,0 +1,379 @@
+/*
+ * Copyright (c) 2013, nilfs
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * * Neither the name of the <ORGANIZATION> nor the names of its contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __httpclient__HttpUrl__
+#define __httpclient__HttpUrl__
+
+#include <curl/curl.h>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <mutex>
+#include <cstring>
+#include <cstdint>
+
+typedef uint16_t HttpOriginId;
+
+/**
+ *  パーセントエンコード
+ *  呼び出し側のバッファに追記するので、バッファを使い回せば確保は最初の数回だけになる
+ */
+class HttpUrlEncoder
+{
+public:
+    // RFC3986の非予約文字か
+    static bool IsUnreserved( unsigned char c )
+    {
+        return ( 'a' <= c && c <= 'z' ) || ( 'A' <= c && c <= 'Z' ) || ( '0' <= c && c <= '9' )
+            || c == '-' || c == '.' || c == '_' || c == '~';
+    }
+
+    static void Append( std::string& out, const char* str, size_t length )
+    {
+        static const char s_Hex[] = "0123456789ABCDEF";
+
+        out.reserve( out.size() + length * 3 );
+
+        // 変換不要な文字が続く間はまとめて追記する
+        size_t runBegin = 0;
+        for( size_t i=0; i<length; ++i )
+        {
+            const unsigned char c = static_cast<unsigned char>(str[i]);
+            if( IsUnreserved( c ) )
+            {
+                continue;
+            }
+            out.append( str + runBegin, i - runBegin );
+
+            const char escaped[3] = { '%', s_Hex[c >> 4], s_Hex[c & 0x0f] };
+            out.append( escaped, 3 );
+            runBegin = i + 1;
+        }
+        out.append( str + runBegin, length - runBegin );
+    }
+
+    static void Append( std::string& out, const char* str )
+    {
+        Append( out, str, std::strlen(str) );
+    }
+};
+
+/**
+ *  オリジン(スキーム、ホスト、ポート)を小さな整数IDにする
+ *  オリジンごとの情報はIDを添字にした配列で持てる
+ */
+class HttpOriginTable
+{
+public:
+    static const HttpOriginId INVALID_ORIGIN_ID = UINT16_MAX;
+
+public:
+    static HttpOriginTable& GetInstance()
+    {
+        static HttpOriginTable s_Instance;
+        return s_Instance;
+    }
+
+public:
+    // 登録済みなら同じIDを返す。登録できる数を超えたらINVALID_ORIGIN_ID
+    HttpOriginId Intern( const std::string& origin )
+    {
+        std::lock_guard<std::mutex> lock( m_Mutex );
+
+        auto it = m_Ids.find( origin );
+        if( it != m_Ids.end() )
+        {
+            return it->second;
+        }
+        if( INVALID_ORIGIN_ID <= m_Origins.size() )
+        {
+            return INVALID_ORIGIN_ID;
+        }
+
+        const HttpOriginId id = static_cast<HttpOriginId>( m_Origins.size() );
+        m_Origins.push_back( origin );
+        m_Ids[origin] = id;
+        return id;
+    }
+
+    std::string GetOrigin( HttpOriginId id )
+    {
+        std::lock_guard<std::mutex> lock( m_Mutex );
+        return id < m_Origins.size() ? m_Origins[id] : std::string();
+    }
+
+    size_t GetCount()
+    {
+        std::lock_guard<std::mutex> lock( m_Mutex );
+        return m_Origins.size();
+    }
+
+private:
+    HttpOriginTable(){}
+    HttpOriginTable( const HttpOriginTable& );
+    HttpOriginTable& operator=( const HttpOriginTable& );
+
+private:
+    std::mutex m_Mutex;
+    std::unordered_map<std::string, HttpOriginId> m_Ids;
+    std::vector<std::string> m_Origins;
+};
+
+/**
+ *  解析済みのURL
+ *  ベースURLを1度だけ解析して、パスとクエリを差し替えながら使い回す
+ *  curlにはCURLOPT_CURLUでそのまま渡すので、通信のたびに文字列を解析し直さない
+ */
+class HttpUrl
+{
+public:
+    // 空のURL。IsValidはfalseになる
+    HttpUrl()
+    :m_Handle(nullptr)
+    ,m_OriginId(HttpOriginTable::INVALID_ORIGIN_ID)
+    ,m_Valid(false)
+    ,m_PathDirty(false)
+    ,m_QueryDirty(false)
+    {}
+
+    explicit HttpUrl( const char* base )
+    :m_Handle(curl_url())
+    ,m_OriginId(HttpOriginTable::INVALID_ORIGIN_ID)
+    ,m_Valid(false)
+    ,m_PathDirty(false)
+    ,m_QueryDirty(false)
+    {
+        SetBase( base );
+    }
+
+    HttpUrl( const HttpUrl& url )
+    :m_Handle(nullptr)
+    ,m_Path(url.m_Path)
+    ,m_Query(url.m_Query)
+    ,m_OriginId(url.m_OriginId)
+    ,m_Valid(url.m_Valid)
+    ,m_PathDirty(false)
+    ,m_QueryDirty(false)
+    {
+        url._Flush();
+        // ムーブ済みのURLはハンドルを持たないので、コピーも空のままにする
+        m_Handle = url.m_Handle ? curl_url_dup( url.m_Handle ) : nullptr;
+    }
+
+    HttpUrl( HttpUrl&& url )
+    :m_Handle(url.m_Handle)
+    ,m_Path(std::move(url.m_Path))
+    ,m_Query(std::move(url.m_Query))
+    ,m_OriginId(url.m_OriginId)
+    ,m_Valid(url.m_Valid)
+    ,m_PathDirty(url.m_PathDirty)
+    ,m_QueryDirty(url.m_QueryDirty)
+    {
+        url.m_Handle = nullptr;
+        url.m_Valid = false;
+        url.m_OriginId = HttpOriginTable::INVALID_ORIGIN_ID;
+    }
+
+    ~HttpUrl()
+    {
+        curl_url_cleanup( m_Handle );
+    }
+
+    HttpUrl& operator=( HttpUrl&& url )
+    {
+        if( this != &url )
+        {
+            curl_url_cleanup( m_Handle );
+            m_Handle = url.m_Handle;
+            m_Path = std::move(url.m_Path);
+            m_Query = std::move(url.m_Query);
+            m_OriginId = url.m_OriginId;
+            m_Valid = url.m_Valid;
+            m_PathDirty = url.m_PathDirty;
+            m_QueryDirty = url.m_QueryDirty;
+
+            url.m_Handle = nullptr;
+            url.m_Valid = false;
+            url.m_OriginId = HttpOriginTable::INVALID_ORIGIN_ID;
+        }
+        return *this;
+    }
+
+private:
+    HttpUrl& operator=( const HttpUrl& );
+
+public:
+    /**
+     *  ベースURLを解析し直す。解析できなければfalse
+     */
+    bool SetBase( const char* base )
+    {
+        m_Valid = curl_url_set( m_Handle, CURLUPART_URL, base, 0 ) == CURLUE_OK;
+        m_OriginId = m_Valid ? _InternOrigin() : HttpOriginTable::INVALID_ORIGIN_ID;
+
+        // ベースURLのパスとクエリに続けて追加できるように取っておく
+        m_Path.clear();
+        m_Query.clear();
+        char* part = nullptr;
+        if( m_Valid && curl_url_get( m_Handle, CURLUPART_PATH, &part, 0 ) == CURLUE_OK )
+        {
+            m_Path.assign( part );
+            curl_free( part );
+        }
+        if( m_Valid && curl_url_get( m_Handle, CURLUPART_QUERY, &part, 0 ) == CURLUE_OK )
+        {
+            m_Query.assign( part );
+            curl_free( part );
+        }
+        m_PathDirty = false;
+        m_QueryDirty = false;
+        return m_Valid;
+    }
+
+    // エンコード済みのパスに差し替える
+    void SetPath( const char* path )
+    {
+        m_Path.assign( path );
+        m_PathDirty = true;
+    }
+
+    // パスの後ろに'/'とエンコードしたセグメントを追加する
+    void AppendPathSegment( const char* segment )
+    {
+        if( m_Path.empty() || m_Path[m_Path.size() - 1] != '/' )
+        {
+            m_Path.push_back( '/' );
+        }
+        HttpUrlEncoder::Append( m_Path, segment );
+        m_PathDirty = true;
+    }
+
+    void ClearQuery()
+    {
+        m_Query.clear();
+        m_QueryDirty = true;
+    }
+
+    // key=valueをエンコードしてクエリに追加する
+    void AppendQuery( const char* key, const char* value )
+    {
+        if( !m_Query.empty() )
+        {
+            m_Query.push_back( '&' );
+        }
+        HttpUrlEncoder::Append( m_Query, key );
+        m_Query.push_back( '=' );
+        HttpUrlEncoder::Append( m_Query, value );
+        m_QueryDirty = true;
+    }
+
+    bool IsValid() const { return m_Valid; }
+    HttpOriginId GetOriginId() const { return m_OriginId; }
+
+    // curlに渡すハンドル。パスとクエリの変更はここで反映する
+    CURLU* GetHandle() const
+    {
+        _Flush();
+        return m_Handle;
+    }
+
+    // パスとクエリだけを文字列にする(負荷分散で接続先を差し替えるとき用)
+    std::string GetPathAndQuery() const
+    {
+        std::string result;
+        char* part = nullptr;
+        _Flush();
+        if( curl_url_get( m_Handle, CURLUPART_PATH, &part, 0 ) == CURLUE_OK )
+        {
+            result.assign( part );
+            curl_free( part );
+        }
+        if( curl_url_get( m_Handle, CURLUPART_QUERY, &part, 0 ) == CURLUE_OK )
+        {
+            result.push_back( '?' );
+            result.append( part );
+            curl_free( part );
+        }
+        return result;
+    }
+
+private:
+    void _Flush() const
+    {
+        if( m_PathDirty )
+        {
+            curl_url_set( m_Handle, CURLUPART_PATH, m_Path.empty() ? "/" : m_Path.c_str(), 0 );
+            m_PathDirty = false;
+        }
+        if( m_QueryDirty )
+        {
+            curl_url_set( m_Handle, CURLUPART_QUERY, m_Query.empty() ? nullptr : m_Query.c_str(), 0 );
+            m_QueryDirty = false;
+        }
+    }
+
+    HttpOriginId _InternOrigin()
+    {
+        std::string origin;
+        char* part = nullptr;
+        if( curl_url_get( m_Handle, CURLUPART_SCHEME, &part, 0 ) == CURLUE_OK )
+        {
+            origin.append( part );
+            curl_free( part );
+        }
+        origin.append( "://" );
+        if( curl_url_get( m_Handle, CURLUPART_HOST, &part, 0 ) == CURLUE_OK )
+        {
+            // ホスト名は大文字小文字を区別しない
+            for( const char* c = part; *c; ++c )
+            {
+                origin.push_back( ( 'A' <= *c && *c <= 'Z' ) ? static_cast<char>(*c - 'A' + 'a') : *c );
+            }
+            curl_free( part );
+        }
+        if( curl_url_get( m_Handle, CURLUPART_PORT, &part, CURLU_DEFAULT_PORT ) == CURLUE_OK )
+        {
+            origin.push_back( ':' );
+            origin.append( part );
+            curl_free( part );
+        }
+        return HttpOriginTable::GetInstance().Intern( origin );
+    }
+
+private:
+    CURLU* m_Handle;
+    std::string m_Path;     // 使い回すエンコード用のバッファ
+    std::string m_Query;
+    HttpOriginId m_OriginId;
+    bool m_Valid;
+    mutable bool m_PathDirty;
+    mutable bool m_QueryDirty;
+};
+
+#endif /* defined(__httpclient__HttpUrl__) */
@@ -0,0 +1,636 @@
+/*
+ * Copyright (c) 2013, nilfs
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * * Neither the name of the <ORGANIZATION> nor the names of its contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __httpsimulator__HttpPolicySimulator__
+#define __httpsimulator__HttpPolicySimulator__
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <deque>
+#include <queue>
+#include <unordered_map>
+#include <random>
+#include <algorithm>
+#include <cmath>
+#include <chrono>
+
+#include "../httpclient/HttpClientPolicy.h"
+
+/**
+ *  仮想時間で動く離散イベントシミュレータ
+ *  HttpClientと同じHttpPolicyControllerを、模擬サーバー相手に動かしてポリシーの効果を測る
+ */
+
+/**
+ *  サーバーの応答時間の分布
+ */
+class HttpLatencyModel
+{
+public:
+    enum DistributionType
+    {
+        CONSTANT,
+        EXPONENTIAL,
+        LOGNORMAL,
+    };
+
+public:
+    static HttpLatencyModel Constant( HttpPolicyDuration latency ){ return HttpLatencyModel( CONSTANT, latency, 0.0 ); }
+    static HttpLatencyModel Exponential( HttpPolicyDuration mean ){ return HttpLatencyModel( EXPONENTIAL, mean, 0.0 ); }
+    // 中央値とばらつき(対数の標準偏差)で指定する
+    static HttpLatencyModel LogNormal( HttpPolicyDuration median, double sigma ){ return HttpLatencyModel( LOGNORMAL, median, sigma ); }
+
+public:
+    HttpLatencyModel()
+    :m_Type(CONSTANT)
+    ,m_Scale(0)
+    ,m_Sigma(0.0)
+    ,m_TailProbability(0.0)
+    ,m_TailMultiplier(1.0)
+    {}
+
+public:
+    // probabilityの確率で応答時間をmultiplier倍にする(GCやディスク待ちなどの裾野)
+    void SetTail( double probability, double multiplier ){ m_TailProbability = probability; m_TailMultiplier = multiplier; }
+
+    template< class Random >
+    HttpPolicyDuration Sample( Random& random ) const
+    {
+        double latency = static_cast<double>(m_Scale.count());
+        switch( m_Type )
+        {
+            case EXPONENTIAL:
+            {
+                std::exponential_distribution<double> dist( 1.0 / std::max( latency, 1.0 ) );
+                latency = dist(random);
+                break;
+            }
+            case LOGNORMAL:
+            {
+                std::lognormal_distribution<double> dist( std::log( std::max( latency, 1.0 ) ), m_Sigma );
+                latency = dist(random);
+                break;
+            }
+            case CONSTANT:
+            default:
+                break;
+        }
+
+        if( 0.0 < m_TailProbability )
+        {
+            std::uniform_real_distribution<double> dist( 0.0, 1.0 );
+            if( dist(random) < m_TailProbability )
+            {
+                latency *= m_TailMultiplier;
+            }
+        }
+        return HttpPolicyDuration( static_cast<HttpPolicyDuration::rep>(latency) );
+    }
+
+private:
+    HttpLatencyModel( DistributionType type, HttpPolicyDuration scale, double sigma )
+    :m_Type(type)
+    ,m_Scale(scale)
+    ,m_Sigma(sigma)
+    ,m_TailProbability(0.0)
+    ,m_TailMultiplier(1.0)
+    {}
+
+private:
+    DistributionType m_Type;
+    HttpPolicyDuration m_Scale;
+    double m_Sigma;
+    double m_TailProbability;
+    double m_TailMultiplier;
+};
+
+/**
+ *  模擬サーバー1台分の設定
+ */
+class HttpSimulatedBackend
+{
+public:
+    HttpSimulatedBackend( const HttpLatencyModel& latency )
+    :m_Latency(latency)
+    ,m_ErrorRate(0.0)
+    ,m_Capacity(0)
+    {}
+
+public:
+    // 処理したリクエストがエラーになる確率
+    void SetErrorRate( double rate ){ m_ErrorRate = rate; }
+    // 同時に処理できる数。超えた分はサーバー側で待たされる。0なら無制限
+    void SetCapacity( int capacity ){ m_Capacity = capacity; }
+    // この期間は接続を即座に拒否する
+    void AddOutage( HttpPolicyDuration begin, HttpPolicyDuration end ){ m_Outages.push_back( Window( begin, end, 0.0 ) ); }
+    // この期間は応答時間がmultiplier倍になる
+    void AddSlowdown( HttpPolicyDuration begin, HttpPolicyDuration end, double multiplier ){ m_Slowdowns.push_back( Window( begin, end, multiplier ) ); }
+
+    const HttpLatencyModel& GetLatency() const { return m_Latency; }
+    double GetErrorRate() const { return m_ErrorRate; }
+    int GetCapacity() const { return m_Capacity; }
+
+    bool IsDown( HttpPolicyDuration now ) const
+    {
+        for( const Window& window : m_Outages )
+        {
+            if( window.begin <= now && now < window.end )
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    double GetSlowdown( HttpPolicyDuration now ) const
+    {
+        double multiplier = 1.0;
+        for( const Window& window : m_Slowdowns )
+        {
+            if( window.begin <= now && now < window.end )
+            {
+                multiplier *= window.multiplier;
+            }
+        }
+        return multiplier;
+    }
+
+private:
+    struct Window
+    {
+        Window( HttpPolicyDuration b, HttpPolicyDuration e, double m ):begin(b), end(e), multiplier(m){}
+
+        HttpPolicyDuration begin;
+        HttpPolicyDuration end;
+        double multiplier;
+    };
+
+private:
+    HttpLatencyModel m_Latency;
+    double m_ErrorRate;
+    int m_Capacity;
+    std::vector<Window> m_Outages;
+    std::vector<Window> m_Slowdowns;
+};
+
+/**
+ *  流すトラフィックと接続先の構成
+ */
+class HttpSimulationScenario
+{
+public:
+    HttpSimulationScenario()
+    :m_Duration(std::chrono::seconds(60))
+    ,m_RequestRate(100.0)
+    ,m_Seed(1)
+    {}
+
+public:
+    void SetDuration( HttpPolicyDuration duration ){ m_Duration = duration; }
+    // 1秒あたりのリクエスト数。到着はポアソン過程にする
+    void SetRequestRate( double rate ){ m_RequestRate = rate; }
+    void SetSeed( uint32_t seed ){ m_Seed = seed; }
+    void AddBackend( const HttpSimulatedBackend& backend ){ m_Backends.push_back( backend ); }
+
+    HttpPolicyDuration GetDuration() const { return m_Duration; }
+    double GetRequestRate() const { return m_RequestRate; }
+    uint32_t GetSeed() const { return m_Seed; }
+    const std::vector<HttpSimulatedBackend>& GetBackends() const { return m_Backends; }
+
+private:
+    HttpPolicyDuration m_Duration;
+    double m_RequestRate;
+    uint32_t m_Seed;
+    std::vector<HttpSimulatedBackend> m_Backends;
+};
+
+/**
+ *  シミュレーション結果
+ */
+class HttpSimulationReport
+{
+public:
+    HttpSimulationReport()
+    :m_WallTime(0)
+    {}
+
+public:
+    void SetStats( const HttpPolicyStats& stats ){ m_Stats = stats; }
+    void SetWallTime( std::chrono::milliseconds wallTime ){ m_WallTime = wallTime; }
+    void SetBackendAttempts( const std::vector<uint64_t>& attempts ){ m_BackendAttempts = attempts; }
+    void SwapLatencies( std::vector<HttpPolicyDuration::rep>& latencies )
+    {
+        m_Latencies.swap( latencies );
+        std::sort( m_Latencies.begin(), m_Latencies.end() );
+    }
+
+    const HttpPolicyStats& GetStats() const { return m_Stats; }
+    std::chrono::milliseconds GetWallTime() const { return m_WallTime; }
+    const std::vector<uint64_t>& GetBackendAttempts() const { return m_BackendAttempts; }
+
+    // 成功率(拒否も失敗に数える)
+    double GetSuccessRate() const
+    {
+        const uint64_t total = m_Stats.requests + m_Stats.rejected;
+        return total ? static_cast<double>(m_Stats.succeeded) / total : 0.0;
+    }
+
+    // 負荷増幅率。1リクエストあたりにサーバーへ投げた試行数
+    double GetAmplification() const
+    {
+        return m_Stats.requests ? static_cast<double>(m_Stats.attempts) / m_Stats.requests : 0.0;
+    }
+
+    // 成功したリクエストの応答時間のパーセンタイル(0-100)
+    HttpPolicyDuration GetPercentile( double percentile ) const
+    {
+        if( m_Latencies.empty() )
+        {
+            return HttpPolicyDuration(0);
+        }
+        size_t index = static_cast<size_t>( percentile / 100.0 * ( m_Latencies.size() - 1 ) + 0.5 );
+        return HttpPolicyDuration( m_Latencies[ std::min( index, m_Latencies.size() - 1 ) ] );
+    }
+
+    static void PrintHeader( std::ostream& out )
+    {
+        out << std::left << std::setw(28) << "policy"
+            << std::right
+            << std::setw(10) << "success%"
+            << std::setw(8) << "amp"
+            << std::setw(10) << "p50(ms)"
+            << std::setw(10) << "p90(ms)"
+            << std::setw(10) << "p99(ms)"
+            << std::setw(11) << "p99.9(ms)"
+            << std::setw(10) << "rejected"
+            << std::setw(10) << "wall(ms)"
+            << std::endl;
+    }
+
+    void Print( std::ostream& out, const std::string& name ) const
+    {
+        out << std::left << std::setw(28) << name
+            << std::right << std::fixed
+            << std::setw(10) << std::setprecision(3) << GetSuccessRate() * 100.0
+            << std::setw(8) << std::setprecision(3) << GetAmplification()
+            << std::setw(10) << std::setprecision(1) << _ToMs( GetPercentile(50.0) )
+            << std::setw(10) << std::setprecision(1) << _ToMs( GetPercentile(90.0) )
+            << std::setw(10) << std::setprecision(1) << _ToMs( GetPercentile(99.0) )
+            << std::setw(11) << std::setprecision(1) << _ToMs( GetPercentile(99.9) )
+            << std::setw(10) << m_Stats.rejected
+            << std::setw(10) << m_WallTime.count()
+            << std::endl;
+    }
+
+private:
+    static double _ToMs( HttpPolicyDuration duration ){ return duration.count() / 1000.0; }
+
+private:
+    HttpPolicyStats m_Stats;
+    std::chrono::milliseconds m_WallTime;
+    std::vector<uint64_t> m_BackendAttempts;
+    std::vector<HttpPolicyDuration::rep> m_Latencies;
+};
+
+/**
+ *  シミュレータ本体
+ *  HttpPolicyControllerのHostとして、試行を模擬サーバーに流す
+ */
+class HttpPolicySimulator
+{
+    friend class HttpPolicyController<HttpPolicySimulator>;
+
+public:
+    HttpPolicySimulator( const HttpSimulationScenario& scenario, const HttpPolicyConfig& config )
+    :m_Scenario(scenario)
+    ,m_Config(config)
+    ,m_Controller(nullptr)
+    ,m_Random(scenario.GetSeed())
+    ,m_Now(0)
+    ,m_EventSerial(0)
+    {}
+
+public:
+    HttpSimulationReport Run()
+    {
+        const auto wallStart = std::chrono::steady_clock::now();
+
+        const std::vector<HttpSimulatedBackend>& backends = m_Scenario.GetBackends();
+        m_Servers.assign( backends.size(), Server() );
+        m_BackendAttempts.assign( backends.size(), 0 );
+        m_Now = HttpPolicyDuration(0);
+
+        HttpPolicyController<HttpPolicySimulator> controller( *this, m_Config, backends.size(), m_Scenario.GetSeed() );
+        m_Controller = &controller;
+
+        HttpPolicyRequestId topRequestId = 0;
+        _Push( _NextArrival(), EVENT_ARRIVAL, 0 );
+
+        while( true )
+        {
+            HttpPolicyDuration deadline;
+            const bool hasTimer = controller.GetNextDeadline( deadline );
+            if( m_Events.empty() && !hasTimer )
+            {
+                break;
+            }
+
+            // ポリシーのタイマーが先ならそちらを進める
+            if( hasTimer && ( m_Events.empty() || deadline < m_Events.top().time ) )
+            {
+                m_Now = deadline;
+                controller.Update( m_Now );
+                continue;
+            }
+
+            const Event event = m_Events.top();
+            m_Events.pop();
+            m_Now = event.time;
+
+            switch( event.type )
+            {
+                case EVENT_ARRIVAL:
+                {
+                    const HttpPolicyRequestId id = ++topRequestId;
+                    m_RequestStart[id] = m_Now;
+                    controller.Submit( id, m_Now );
+
+                    const HttpPolicyDuration next = m_Now + _NextArrival();
+                    if( next < m_Scenario.GetDuration() )
+                    {
+                        _Push( next, EVENT_ARRIVAL, 0 );
+                    }
+                    break;
+                }
+
+                case EVENT_SERVICE_DONE:
+                    _OnServiceDone( event.id );
+                    break;
+
+                case EVENT_CLIENT_TIMEOUT:
+                    _OnClientResult( event.id, HTTP_ATTEMPT_TIMEOUT );
+                    break;
+            }
+        }
+
+        m_Controller = nullptr;
+
+        HttpSimulationReport report;
+        report.SetStats( controller.GetStats() );
+        report.SetBackendAttempts( m_BackendAttempts );
+        report.SwapLatencies( m_Latencies );
+        report.SetWallTime( std::chrono::duration_cast<std::chrono::milliseconds>( std::chrono::steady_clock::now() - wallStart ) );
+        return report;
+    }
+
+private:
+    enum EventType
+    {
+        EVENT_ARRIVAL,
+        EVENT_SERVICE_DONE,     // サーバーが処理を終えた
+        EVENT_CLIENT_TIMEOUT,   // クライアント側で試行がタイムアウトした
+    };
+
+    struct Event
+    {
+        HttpPolicyDuration time;
+        uint64_t serial;    // 同時刻のイベントを発生順に処理するため
+        EventType type;
+        HttpPolicyAttemptId id;
+
+        bool operator>( const Event& rhs ) const
+        {
+            return rhs.time < time || ( time == rhs.time && rhs.serial < serial );
+        }
+    };
+
+    struct Attempt
+    {
+        size_t backend;
+        bool clientDone;    // クライアント側では結果が出た(成功、失敗、タイムアウト、キャンセル)
+        bool serverDone;    // サーバー側の処理が終わった
+        bool serverError;
+        bool inService;     // サーバーの処理枠を使っている
+    };
+
+    struct Server
+    {
+        Server():busy(0){}
+
+        int busy;
+        std::deque<HttpPolicyAttemptId> queue;
+    };
+
+private:
+    // 以下はHttpPolicyControllerから呼ばれる
+    void StartAttempt( HttpPolicyRequestId, HttpPolicyAttemptId attemptId, size_t endpoint )
+    {
+        Attempt& attempt = m_Attempts[attemptId];
+        attempt.backend = endpoint;
+        attempt.clientDone = false;
+        attempt.serverDone = false;
+        attempt.serverError = false;
+        attempt.inService = false;
+        ++m_BackendAttempts[endpoint];
+
+        const HttpPolicyDuration timeout = m_Config.GetAttemptTimeout();
+        if( 0 < timeout.count() )
+        {
+            _Push( m_Now + timeout, EVENT_CLIENT_TIMEOUT, attemptId );
+        }
+
+        const HttpSimulatedBackend& backend = m_Scenario.GetBackends()[endpoint];
+        if( backend.IsDown( m_Now ) )
+        {
+            // 接続拒否はすぐに返ってくる
+            attempt.serverError = true;
+            _Push( m_Now + HttpPolicyDuration(std::chrono::milliseconds(1)), EVENT_SERVICE_DONE, attemptId );
+            return;
+        }
+
+        Server& server = m_Servers[endpoint];
+        if( 0 < backend.GetCapacity() && backend.GetCapacity() <= server.busy )
+        {
+            server.queue.push_back( attemptId );
+            return;
+        }
+        _StartService( endpoint, attemptId );
+    }
+
+    void CancelAttempt( HttpPolicyAttemptId attemptId )
+    {
+        auto it = m_Attempts.find( attemptId );
+        if( it != m_Attempts.end() )
+        {
+            // サーバーで処理中のものは止められないので、クライアント側の結果だけ捨てる
+            it->second.clientDone = true;
+        }
+    }
+
+    void CompleteRequest( HttpPolicyRequestId requestId, HttpPolicyAttemptId, HttpAttemptResult result )
+    {
+        auto it = m_RequestStart.find( requestId );
+        if( it == m_RequestStart.end() )
+        {
+            return;
+        }
+        if( result == HTTP_ATTEMPT_OK )
+        {
+            m_Latencies.push_back( ( m_Now - it->second ).count() );
+        }
+        m_RequestStart.erase( it );
+    }
+
+private:
+    void _StartService( size_t endpoint, HttpPolicyAttemptId attemptId )
+    {
+        const HttpSimulatedBackend& backend = m_Scenario.GetBackends()[endpoint];
+        ++m_Servers[endpoint].busy;
+
+        std::uniform_real_distribution<double> dist( 0.0, 1.0 );
+        Attempt& attempt = m_Attempts[attemptId];
+        attempt.serverError = dist(m_Random) < backend.GetErrorRate();
+        attempt.inService = true;
+
+        HttpPolicyDuration latency = backend.GetLatency().Sample( m_Random );
+        const double slowdown = backend.GetSlowdown( m_Now );
+        if( slowdown != 1.0 )
+        {
+            latency = HttpPolicyDuration( static_cast<HttpPolicyDuration::rep>( latency.count() * slowdown ) );
+        }
+        _Push( m_Now + latency, EVENT_SERVICE_DONE, attemptId );
+    }
+
+    void _OnServiceDone( HttpPolicyAttemptId attemptId )
+    {
+        auto it = m_Attempts.find( attemptId );
+        if( it == m_Attempts.end() )
+        {
+            return;
+        }
+        Attempt& attempt = it->second;
+        const size_t endpoint = attempt.backend;
+        const bool inService = attempt.inService;
+        attempt.serverDone = true;
+
+        const HttpAttemptResult result = attempt.serverError ? HTTP_ATTEMPT_ERROR : HTTP_ATTEMPT_OK;
+        _OnClientResult( attemptId, result );
+
+        // 空いた枠でサーバー側の待ち行列を進める。クライアントが諦めたものは処理しない
+        Server& server = m_Servers[endpoint];
+        if( !inService )
+        {
+            return;
+        }
+        --server.busy;
+        while( !server.queue.empty() )
+        {
+            const HttpPolicyAttemptId next = server.queue.front();
+            server.queue.pop_front();
+
+            auto nextIt = m_Attempts.find( next );
+            if( nextIt == m_Attempts.end() )
+            {
+                continue;
+            }
+            if( nextIt->second.clientDone )
+            {
+                nextIt->second.serverDone = true;
+                _Erase( nextIt );
+                continue;
+            }
+            _StartService( endpoint, next );
+            break;
+        }
+    }
+
+    void _OnClientResult( HttpPolicyAttemptId attemptId, HttpAttemptResult result )
+    {
+        auto it = m_Attempts.find( attemptId );
+        if( it == m_Attempts.end() )
+        {
+            return;
+        }
+        if( !it->second.clientDone )
+        {
+            it->second.clientDone = true;
+            m_Controller->OnAttemptFinished( attemptId, result, m_Now );
+        }
+
+        it = m_Attempts.find( attemptId );
+        if( it != m_Attempts.end() )
+        {
+            _Erase( it );
+        }
+    }
+
+    void _Erase( std::unordered_map<HttpPolicyAttemptId, Attempt>::iterator it )
+    {
+        if( it->second.clientDone && it->second.serverDone )
+        {
+            m_Attempts.erase( it );
+        }
+    }
+
+    void _Push( HttpPolicyDuration time, EventType type, HttpPolicyAttemptId id )
+    {
+        Event event;
+        event.time = time;
+        event.serial = ++m_EventSerial;
+        event.type = type;
+        event.id = id;
+        m_Events.push( event );
+    }
+
+    HttpPolicyDuration _NextArrival()
+    {
+        std::exponential_distribution<double> dist( m_Scenario.GetRequestRate() );
+        return HttpPolicyDuration( static_cast<HttpPolicyDuration::rep>( dist(m_Random) * 1000.0 * 1000.0 ) );
+    }
+
+private:
+    const HttpSimulationScenario& m_Scenario;
+    HttpPolicyConfig m_Config;
+    HttpPolicyController<HttpPolicySimulator>* m_Controller;
+    std::mt19937 m_Random;
+
+    HttpPolicyDuration m_Now;   // 仮想時間
+    uint64_t m_EventSerial;
+    std::priority_queue<Event, std::vector<Event>, std::greater<Event> > m_Events;
+
+    std::vector<Server> m_Servers;
+    std::unordered_map<HttpPolicyAttemptId, Attempt> m_Attempts;
+    std::unordered_map<HttpPolicyRequestId, HttpPolicyDuration> m_RequestStart;
+    std::vector<uint64_t> m_BackendAttempts;
+    std::vector<HttpPolicyDuration::rep> m_Latencies;
+};
+
+#endif /* defined(__httpsimulator__HttpPolicySimulator__) */
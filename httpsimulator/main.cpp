@@ -0,0 +1,104 @@
+/*
+ * Copyright (c) 2013, nilfs
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * * Neither the name of the <ORGANIZATION> nor the names of its contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <iostream>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <chrono>
+
+#include "HttpPolicySimulator.h"
+
+int main(int argc, const char * argv[])
+{
+    // 引数: シミュレーションする秒数 1秒あたりのリクエスト数
+    const long seconds = 1 < argc ? std::atol(argv[1]) : 3600;
+    const double rate = 2 < argc ? std::atof(argv[2]) : 200.0;
+
+    // 3台構成。1台は時々エラーを返し、途中で5分間落ちる。別の1台は途中で遅くなる
+    HttpSimulationScenario scenario;
+    scenario.SetDuration( std::chrono::seconds(seconds) );
+    scenario.SetRequestRate( rate );
+
+    HttpLatencyModel latency = HttpLatencyModel::LogNormal( std::chrono::milliseconds(20), 0.5 );
+    latency.SetTail( 0.01, 10.0 );
+    {
+        HttpSimulatedBackend backend( latency );
+        backend.SetCapacity( 64 );
+        scenario.AddBackend( backend );
+    }
+    {
+        HttpSimulatedBackend backend( latency );
+        backend.SetCapacity( 64 );
+        backend.SetErrorRate( 0.05 );
+        backend.AddOutage( std::chrono::seconds(seconds / 3), std::chrono::seconds(seconds / 3 + 300) );
+        scenario.AddBackend( backend );
+    }
+    {
+        HttpSimulatedBackend backend( latency );
+        backend.SetCapacity( 64 );
+        backend.AddSlowdown( std::chrono::seconds(seconds / 2), std::chrono::seconds(seconds / 2 + 600), 8.0 );
+        scenario.AddBackend( backend );
+    }
+
+    // 比較するポリシーの組み合わせ
+    std::vector< std::pair<std::string, HttpPolicyConfig> > policies;
+    {
+        HttpPolicyConfig config;
+        config.SetAttemptTimeout( std::chrono::seconds(1) );
+        policies.push_back( std::make_pair( "no retry", config ) );
+
+        config.SetMaxAttempts( 3 );
+        policies.push_back( std::make_pair( "retry x3", config ) );
+
+        config.SetRetryBudgetRatio( 0.1f );
+        policies.push_back( std::make_pair( "retry x3 + budget 10%", config ) );
+
+        config.SetBalanceType( HTTP_BALANCE_LEAST_OUTSTANDING );
+        policies.push_back( std::make_pair( "retry + budget + p2c", config ) );
+
+        config.SetHedging( std::chrono::milliseconds(60), 1 );
+        policies.push_back( std::make_pair( "retry + hedge 60ms + p2c", config ) );
+
+        config.SetMaxConcurrency( 64 );
+        config.SetMaxPending( 256 );
+        policies.push_back( std::make_pair( "all + concurrency 64", config ) );
+    }
+
+    std::cout << seconds << "秒間、" << rate << "req/s をシミュレーション" << std::endl;
+    HttpSimulationReport::PrintHeader( std::cout );
+    for( auto& policy : policies )
+    {
+        HttpPolicySimulator simulator( scenario, policy.second );
+        const HttpSimulationReport report = simulator.Run();
+        report.Print( std::cout, policy.first );
+    }
+
+    return 0;
+}
@@ -0,0 +1,64 @@
+#!/bin/sh
+#
+# プロファイルを使った最適化(PGO)とLTOをかけたライブラリを作り、通常のリリースビルドと速さを比べる
+#
+#   scripts/pgo_build.sh [ビルドディレクトリ]
+#
+# 1. 通常のリリースビルド (比較用)
+# 2. 計測用のビルドでループバックとキューのベンチマークを動かしてプロファイルを取る
+# 3. プロファイルとLTOを使って最適化したビルド
+# 4. 1と3のベンチマークを比べる
+#
+# コンパイラはCXX環境変数で選ぶ。clangの場合はllvm-profdataが必要
+#
+set -e
+
+SOURCE_DIR=$(cd "$(dirname "$0")/.." && pwd)
+BUILD_ROOT=${1:-"$SOURCE_DIR/_pgo_build"}
+PROFILE_DIR="$BUILD_ROOT/pgo-data"
+JOBS=$(getconf _NPROCESSORS_ONLN 2>/dev/null || echo 2)
+
+# プロファイルを取るときと比べるときのベンチマークの引数
+LOOPBACK_ARGS=${LOOPBACK_ARGS:-"20000 32 1024"}
+QUEUE_ARGS=${QUEUE_ARGS:-"2000000 1024 4"}
+
+configure_and_build() {
+    dir=$1
+    shift
+    cmake -S "$SOURCE_DIR" -B "$dir" -DCMAKE_BUILD_TYPE=Release "$@" > /dev/null
+    cmake --build "$dir" -j"$JOBS" > /dev/null
+}
+
+run_benchmarks() {
+    dir=$1
+    "$dir/benchmark/HttpLoopbackBenchmark" $LOOPBACK_ARGS
+    "$dir/benchmark/RequestQueueBenchmark" $QUEUE_ARGS
+}
+
+echo "== release"
+configure_and_build "$BUILD_ROOT/release"
+
+echo "== instrumented"
+rm -rf "$PROFILE_DIR"
+mkdir -p "$PROFILE_DIR"
+configure_and_build "$BUILD_ROOT/instrumented" -DTOYBOX_PGO=GENERATE -DTOYBOX_PGO_DIR="$PROFILE_DIR"
+run_benchmarks "$BUILD_ROOT/instrumented" > /dev/null
+
+if ls "$PROFILE_DIR"/*.profraw > /dev/null 2>&1; then
+    llvm-profdata merge -output="$PROFILE_DIR/merged.profdata" "$PROFILE_DIR"/*.profraw
+fi
+
+echo "== pgo+lto"
+configure_and_build "$BUILD_ROOT/pgo" -DTOYBOX_PGO=USE -DTOYBOX_PGO_DIR="$PROFILE_DIR" -DTOYBOX_LTO=ON
+
+run_benchmarks "$BUILD_ROOT/release" > "$BUILD_ROOT/release.txt"
+run_benchmarks "$BUILD_ROOT/pgo" > "$BUILD_ROOT/pgo.txt"
+
+echo
+echo "ライブラリ: $BUILD_ROOT/pgo/httpclient, $BUILD_ROOT/pgo/RequestAndUpdate"
+echo
+# 値が大きいほど速い単位(req/s)で出力しているので、pgo/releaseが速度比になる
+awk 'NR == FNR { release[$1] = $2; next }
+     FNR == 1 { printf "%-28s %14s %14s %8s\n", "benchmark", "release", "pgo+lto", "speedup" }
+     ($1 in release) { printf "%-28s %14.1f %14.1f %7.2fx\n", $1, release[$1], $2, $2 / release[$1] }' \
+    "$BUILD_ROOT/release.txt" "$BUILD_ROOT/pgo.txt"
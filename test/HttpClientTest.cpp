@@ -0,0 +1,217 @@
+/*
+ * Copyright (c) 2013, nilfs
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * * Neither the name of the <ORGANIZATION> nor the names of its contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <algorithm>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <functional>
+#include <type_traits>
+#include <unistd.h>
+
+#include "HttpClient.h"
+#include "Test.h"
+
+namespace
+{
+
+typedef BasicHttpClient<HttpMultiThreadPolicy, HttpFunctionCompletion, HttpAccumulateBuffer> AccumulateHttpClient;
+
+// 1スレッドで使う軽いクライアント。ロック、std::function、std::mapのハンドル表を使わない
+struct LeanCallback
+{
+    int* calls;
+
+    template< class Transaction >
+    void operator()( const Transaction& transaction, const char* data, size_t dataSize ) const
+    {
+        if( transaction.IsOk() && dataSize == 4 && std::string( data, dataSize ) == "body" )
+        {
+            ++*calls;
+        }
+    }
+};
+
+typedef BasicHttpClient<HttpSingleThreadPolicy, HttpStaticCompletion<LeanCallback, false>, HttpAccumulateBuffer, HttpSlotHandleTable> LeanHttpClient;
+
+static_assert( std::is_empty<LeanHttpClient::Mutex>::value, "single thread policy must not carry a mutex" );
+static_assert( std::is_same<LeanHttpClient::RequestCompleteCallback, LeanCallback>::value, "static completion must call the functor directly" );
+static_assert( std::is_same<LeanHttpClient::HandleTable, HttpSlotHandleTable::Table<LeanHttpClient::Transaction, HttpSingleThreadPolicy> >::value, "slot table policy must replace the map" );
+static_assert( std::is_same<HttpClient::RequestCompleteCallback, std::function<void(const HttpTransaction&, const char*, size_t)> >::value, "default client keeps std::function" );
+static_assert( std::is_same<HttpClient::HandleTable, HttpMapHandleTable::Table<HttpTransaction, HttpMultiThreadPolicy> >::value, "default client keeps the map" );
+static_assert( sizeof(LeanHttpClient::Transaction) < sizeof(AccumulateHttpClient::Transaction), "static completion must be smaller than std::function" );
+
+// 通信しなくて済むように、ローカルのファイルをfile://で読む
+std::string CreateBodyFile()
+{
+    const char* name = "HttpClientTest.txt";
+    if( FILE* file = std::fopen( name, "w" ) )
+    {
+        std::fputs( "body", file );
+        std::fclose( file );
+    }
+    char cwd[4096] = {};
+    if( !getcwd( cwd, sizeof(cwd) ) )
+    {
+        return std::string();
+    }
+    return std::string( "file://" ) + cwd + "/" + name;
+}
+
+template< class Client, class Done >
+bool UpdateUntil( Client& client, Done done )
+{
+    for( int i=0; i<5000 && !done(); ++i )
+    {
+        client.Update();
+        std::this_thread::sleep_for( std::chrono::milliseconds(1) );
+    }
+    return done();
+}
+
+// count件を同時に投げて、それぞれのコールバックが1回ずつ呼ばれるか確かめる
+template< class Client >
+bool RunEach( Client& client, const std::string& url, int count )
+{
+    std::vector<int> calls( count, 0 );
+    for( int i=0; i<count; ++i )
+    {
+        client.CreateRequest( HttpRequest( url.c_str(), HttpRequest::GET ), [&calls, i]( const typename Client::Transaction&, const char*, size_t ){
+            ++calls[i];
+        } );
+    }
+    UpdateUntil( client, [&]{ return std::count( calls.begin(), calls.end(), 0 ) == 0; } );
+    client.Update();
+    return std::count( calls.begin(), calls.end(), 1 ) == count;
+}
+
+// 完了のコールバックの中で自分のハンドルを解放する。通知が終わるまで回収されず、1度だけ回収される
+template< class Client >
+void CheckReleaseSelf( Client& client, const std::string& url, bool autoRelease )
+{
+    const int COUNT = 8;
+    std::vector<HttpTransactionHandle> handles( COUNT );
+    std::vector<int> calls( COUNT, 0 );
+    std::vector<int> releaseResults( COUNT, 0 );
+    for( int i=0; i<COUNT; ++i )
+    {
+        handles[i] = client.CreateRequest( HttpRequest( url.c_str(), HttpRequest::GET ), [&, i]( const typename Client::Transaction& transaction, const char*, size_t ){
+            ++calls[i];
+            releaseResults[i] += client.ReleaseTransaction( handles[i] ) ? 1 : 0;
+            // 解放した後も、通知が終わるまではトランザクションを参照できる
+            TEST_CHECK( transaction.IsOk() );
+        }, autoRelease );
+    }
+    TEST_CHECK( UpdateUntil( client, [&]{ return std::count( calls.begin(), calls.end(), 0 ) == 0; } ) );
+    client.Update();
+
+    for( int i=0; i<COUNT; ++i )
+    {
+        TEST_CHECK( calls[i] == 1 );
+        TEST_CHECK( releaseResults[i] == 1 );
+        TEST_CHECK( !client.ReleaseTransaction( handles[i] ) );
+    }
+
+    // 同じトランザクションを2回回収していれば、後のリクエストどうしで取り合う
+    TEST_CHECK( RunEach( client, url, COUNT * 2 ) );
+}
+
+// 使い回す上限まで貯めてから解放すると、通知中のトランザクションを消してしまっていた
+void TestReleaseSelfWithFullPool()
+{
+    const std::string url = CreateBodyFile();
+    AccumulateHttpClient client;
+    TEST_CHECK( RunEach( client, url, 80 ) );
+    CheckReleaseSelf( client, url, false );
+    TEST_CHECK( RunEach( client, url, 80 ) );
+    CheckReleaseSelf( client, url, true );
+}
+
+// ポリシー経由でも、受信データを渡すのは通知中なので同じ
+void TestReleaseSelfWithPolicy()
+{
+    const std::string url = CreateBodyFile();
+    HttpClient client;
+    client.SetPolicy( HttpPolicyConfig() );
+    TEST_CHECK( RunEach( client, url, 80 ) );
+    CheckReleaseSelf( client, url, false );
+    CheckReleaseSelf( client, url, true );
+}
+
+// 添字を使い回しても、古いハンドルでは新しいトランザクションを引かない
+void TestSlotHandleTable()
+{
+    const std::string url = CreateBodyFile();
+    LeanHttpClient client;
+    int calls = 0;
+    LeanCallback callback = { &calls };
+
+    const HttpTransactionHandle first = client.CreateRequest( HttpRequest( url.c_str(), HttpRequest::GET ), callback );
+    TEST_CHECK( first.IsValid() );
+    TEST_CHECK( UpdateUntil( client, [&]{ return calls == 1; } ) );
+    TEST_CHECK( client.IsCompleted( first ) );
+    TEST_CHECK( client.ReleaseTransaction( first ) );
+    TEST_CHECK( !client.ReleaseTransaction( first ) );
+
+    // 空いた添字を使うので、添字は同じで世代だけが違う
+    const HttpTransactionHandle second = client.CreateRequest( HttpRequest( url.c_str(), HttpRequest::GET ), callback );
+    TEST_CHECK( second.IsValid() );
+    TEST_CHECK( second.GetHandleId() != first.GetHandleId() );
+    TEST_CHECK( ( second.GetHandleId() & 0xFFFFF ) == ( first.GetHandleId() & 0xFFFFF ) );
+    TEST_CHECK( !client.ReleaseTransaction( first ) );
+    TEST_CHECK( UpdateUntil( client, [&]{ return calls == 2; } ) );
+    TEST_CHECK( client.ReleaseTransaction( second ) );
+
+    // 同時にいくつも持てて、それぞれ1回ずつ通知される
+    std::vector<HttpTransactionHandle> handles( 100 );
+    for( HttpTransactionHandle& handle : handles )
+    {
+        handle = client.CreateRequest( HttpRequest( url.c_str(), HttpRequest::GET ), callback );
+    }
+    TEST_CHECK( UpdateUntil( client, [&]{ return calls == 102; } ) );
+    client.Update();
+    TEST_CHECK( calls == 102 );
+    for( const HttpTransactionHandle& handle : handles )
+    {
+        TEST_CHECK( client.ReleaseTransaction( handle ) );
+    }
+}
+
+}
+
+int main()
+{
+    TestReleaseSelfWithFullPool();
+    TestReleaseSelfWithPolicy();
+    TestSlotHandleTable();
+    std::remove( "HttpClientTest.txt" );
+    return TestResult();
+}
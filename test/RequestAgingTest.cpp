@@ -0,0 +1,116 @@
+/*
+ * Copyright (c) 2013, nilfs
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * * Neither the name of the <ORGANIZATION> nor the names of its contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <vector>
+
+#include "RequestUpdate.h"
+#include "Test.h"
+
+namespace
+{
+
+const int LOW = 100;
+
+/**
+ *  1回に1件ずつ処理しながら、毎回優先度の高いリクエストを足す
+ *  優先度の低いリクエストがagingUpdates回持ち越された後に処理されることを確かめる
+ */
+std::vector<int> RunStarvation( RequestUpdate<int>& update, size_t agingUpdates )
+{
+    std::vector<int> executed;
+    update.SetRequestAging( agingUpdates );
+    update.SetRequestExecuter( [&executed]( int value ){ executed.push_back( value ); } );
+
+    update.AddRequest( LOW );
+    for( int i=0; i<6; ++i )
+    {
+        update.AddRequest( int(i) );
+        update.Update( RequestUpdateBudget( 1 ) );
+    }
+    return executed;
+}
+
+size_t IndexOfLow( const std::vector<int>& executed )
+{
+    for( size_t i=0; i<executed.size(); ++i )
+    {
+        if( executed[i] == LOW )
+        {
+            return i;
+        }
+    }
+    return executed.size();
+}
+
+// ヒープでもバケツでも、持ち越した回数で数える
+void TestAgingMatchesBuckets()
+{
+    for( size_t aging=1; aging<=4; ++aging )
+    {
+        RequestUpdate<int> heap;
+        heap.SetRequestSortKey( []( const std::tuple<int>& param ){ return std::get<0>( param ); } );
+        const std::vector<int> heapOrder = RunStarvation( heap, aging );
+
+        RequestUpdate<int> buckets;
+        buckets.SetRequestPriority( []( const std::tuple<int>& param ){ return std::get<0>( param ) == LOW ? 1 : 0; }, 2 );
+        const std::vector<int> bucketOrder = RunStarvation( buckets, aging );
+
+        // 最初のUpdateで持ち越して、そこからaging回目のUpdateで処理する
+        TEST_CHECK( IndexOfLow( heapOrder ) == aging );
+        TEST_CHECK( IndexOfLow( bucketOrder ) == aging );
+        TEST_CHECK( heapOrder == bucketOrder );
+    }
+}
+
+// エージングしなければ後から来た優先度の高いリクエストに抜かれ続ける
+void TestNoAging()
+{
+    RequestUpdate<int> heap;
+    heap.SetRequestSortKey( []( const std::tuple<int>& param ){ return std::get<0>( param ); } );
+    const std::vector<int> executed = RunStarvation( heap, 0 );
+    TEST_CHECK( IndexOfLow( executed ) == executed.size() );
+}
+
+// 比較関数でも同じ
+void TestAgingWithPredicator()
+{
+    RequestUpdate<int> update;
+    update.SetRequestSortPredicator( []( const std::tuple<int>& lhs, const std::tuple<int>& rhs ){ return lhs < rhs; } );
+    TEST_CHECK( IndexOfLow( RunStarvation( update, 3 ) ) == 3 );
+}
+
+}
+
+int main()
+{
+    TestAgingMatchesBuckets();
+    TestNoAging();
+    TestAgingWithPredicator();
+    return TestResult();
+}
@@ -0,0 +1,209 @@
+/*
+ * Copyright (c) 2013, nilfs
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * * Neither the name of the <ORGANIZATION> nor the names of its contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <cstdint>
+#include <string>
+#include <tuple>
+
+#include "RequestArena.h"
+#include "RequestUpdate.h"
+#include "Test.h"
+
+namespace
+{
+
+typedef RequestUpdate<int, RequestArenaString> ArenaUpdate;
+
+std::string MakeName( int id )
+{
+    return "req" + std::to_string( id ) + std::string( 200, 'x' );
+}
+
+// 処理したときに、アリーナの文字列が追加したときのままか確かめる
+struct NameChecker
+{
+    int executed;
+    int broken;
+
+    void Check( int id, const RequestArenaString& name )
+    {
+        ++executed;
+        if( std::string( name.data, name.size ) != MakeName( id ) )
+        {
+            ++broken;
+        }
+    }
+};
+
+void AddNamed( ArenaUpdate& update, int id )
+{
+    const std::string name = MakeName( id );
+    update.AddRequest( id, update.GetRequestArena().CopyString( name.c_str(), name.size() ) );
+}
+
+// Resetは確保したブロックを残したまま先頭に戻し、縮める間隔ごとに使わなくなった分を解放する
+void TestArenaResetAndShrink()
+{
+    RequestArena arena( 1024 );
+    void* aligned = arena.Allocate( 10, 64 );
+    TEST_CHECK( reinterpret_cast<uintptr_t>( aligned ) % 64 == 0 );
+    const RequestArenaString str = arena.CopyString( "abc" );
+    TEST_CHECK( str.size == 3 && std::string( str.data ) == "abc" );
+    TEST_CHECK( 0 < arena.GetUsed() );
+
+    const size_t capacity = arena.GetCapacity();
+    arena.Reset();
+    TEST_CHECK( arena.GetUsed() == 0 );
+    TEST_CHECK( arena.GetCapacity() == capacity );
+    TEST_CHECK( arena.Allocate( 10, 64 ) == aligned );
+
+    // 一時的に大きく使う
+    arena.SetShrinkInterval( 2 );
+    for( int i=0; i<16; ++i )
+    {
+        arena.Allocate( 1000 );
+    }
+    const size_t burst = arena.GetCapacity();
+    TEST_CHECK( 16 * 1000 <= burst );
+    TEST_CHECK( 16 * 1000 <= arena.GetHighWater() );
+
+    // 大きく使った回を含む間隔では縮めない。次の間隔で、その間の最大使用量まで縮める
+    arena.Reset();
+    arena.Allocate( 100 );
+    arena.Reset();
+    TEST_CHECK( 16 * 1000 <= arena.GetCapacity() );
+    arena.Allocate( 100 );
+    arena.Reset();
+    arena.Allocate( 100 );
+    arena.Reset();
+    TEST_CHECK( arena.GetCapacity() < burst );
+    TEST_CHECK( 0 < arena.GetCapacity() );
+    TEST_CHECK( 16 * 1000 <= arena.GetHighWater() );
+}
+
+// 持ち越しが続いても、処理し終わったUpdateの領域から捨てるので伸び続けない
+void TestArenaUnderBacklog()
+{
+    ArenaUpdate update;
+    NameChecker checker = { 0, 0 };
+    update.SetRequestExecuter( [&]( int id, RequestArenaString name ){ checker.Check( id, name ); } );
+
+    const int PER_UPDATE = 50;
+    const int ROUNDS = 500;
+    int id = 0;
+    for( int i=0; i<PER_UPDATE * 2; ++i )
+    {
+        AddNamed( update, id++ );
+    }
+    for( int round=0; round<ROUNDS; ++round )
+    {
+        for( int i=0; i<PER_UPDATE; ++i )
+        {
+            AddNamed( update, id++ );
+        }
+        update.Update( PER_UPDATE );
+        TEST_CHECK( 0 < update.GetPendingCount() );
+        // 持ち越しがあっても、この後に追加する分の領域は空から始まる
+        TEST_CHECK( update.GetRequestArena().GetUsed() == 0 );
+    }
+    // 全部ためていれば500回分で5MBを超える
+    TEST_CHECK( update.GetRequestArenaCapacity() < 1024 * 1024 );
+
+    update.Update();
+    TEST_CHECK( checker.executed == id );
+    TEST_CHECK( checker.broken == 0 );
+    TEST_CHECK( update.GetPendingCount() == 0 );
+}
+
+// ずっと後回しにされる1件が残っていても、その領域だけを残して他は使い回す
+void TestArenaStarvedRequest()
+{
+    ArenaUpdate update;
+    NameChecker checker = { 0, 0 };
+    update.SetRequestExecuter( [&]( int id, RequestArenaString name ){ checker.Check( id, name ); } );
+    update.SetRequestSortKey( []( const std::tuple<int, RequestArenaString>& v ){ return std::get<0>( v ) == 0 ? 1 : 0; } );
+
+    AddNamed( update, 0 );
+    int id = 1;
+    for( int round=0; round<300; ++round )
+    {
+        for( int i=0; i<20; ++i )
+        {
+            AddNamed( update, id++ );
+        }
+        update.Update( 20 );
+        TEST_CHECK( update.GetPendingCount() == 1 );
+    }
+    TEST_CHECK( update.GetRequestArenaCapacity() < 1024 * 1024 );
+    TEST_CHECK( checker.executed == id - 1 );
+
+    update.Update();
+    TEST_CHECK( checker.executed == id );
+    TEST_CHECK( checker.broken == 0 );
+}
+
+// 優先度のバケツに持ち越した分も同じ。FIFOは先頭から、LIFOは末尾から処理する
+void TestArenaPriorityBuckets( RequestBucketOrder order )
+{
+    ArenaUpdate update;
+    NameChecker checker = { 0, 0 };
+    update.SetRequestExecuter( [&]( int id, RequestArenaString name ){ checker.Check( id, name ); } );
+    update.SetRequestPriority( []( const std::tuple<int, RequestArenaString>& v ){ return std::get<0>( v ) % 3; }, 3, order );
+
+    int id = 0;
+    for( int i=0; i<60; ++i )
+    {
+        AddNamed( update, id++ );
+    }
+    for( int round=0; round<300; ++round )
+    {
+        for( int i=0; i<30; ++i )
+        {
+            AddNamed( update, id++ );
+        }
+        update.Update( 30 );
+        TEST_CHECK( update.GetRequestArena().GetUsed() == 0 );
+    }
+    update.Update();
+    TEST_CHECK( checker.executed == id );
+    TEST_CHECK( checker.broken == 0 );
+    TEST_CHECK( update.GetRequestArenaCapacity() < 2 * 1024 * 1024 );
+}
+
+}
+
+int main()
+{
+    TestArenaResetAndShrink();
+    TestArenaUnderBacklog();
+    TestArenaStarvedRequest();
+    TestArenaPriorityBuckets( REQUEST_BUCKET_FIFO );
+    TestArenaPriorityBuckets( REQUEST_BUCKET_LIFO );
+    return TestResult();
+}
@@ -0,0 +1,178 @@
+/*
+ * Copyright (c) 2013, nilfs
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * * Neither the name of the <ORGANIZATION> nor the names of its contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <vector>
+
+#include "RequestUpdate.h"
+#include "Test.h"
+
+namespace
+{
+
+// 呼ばれるごとに、受け取った範囲を1つの配列にして残す
+struct BatchRecorder
+{
+    std::vector< std::vector<int> > batches;
+
+    void Set( RequestUpdate<int>& update, size_t chunkSize )
+    {
+        update.SetBatchExecuter( [this]( RequestSpan< const std::tuple<int> > span ){
+            std::vector<int> values;
+            for( const std::tuple<int>& param : span )
+            {
+                values.push_back( std::get<0>( param ) );
+            }
+            batches.push_back( values );
+        }, chunkSize );
+    }
+
+    std::vector<int> Flatten() const
+    {
+        std::vector<int> values;
+        for( const std::vector<int>& batch : batches )
+        {
+            values.insert( values.end(), batch.begin(), batch.end() );
+        }
+        return values;
+    }
+};
+
+const int VALUES[] = { 5, 3, 8, 1, 9, 2, 7 };
+const size_t VALUE_COUNT = sizeof(VALUES) / sizeof(VALUES[0]);
+
+void AddValues( RequestUpdate<int>& update )
+{
+    for( int value : VALUES )
+    {
+        update.AddRequest( value );
+    }
+}
+
+// 並べ替えなければ追加した順に1回で渡す
+void TestBatchWhole()
+{
+    BatchRecorder recorder;
+    RequestUpdate<int> update;
+    recorder.Set( update, 0 );
+
+    AddValues( update );
+    update.Update();
+    TEST_CHECK( recorder.batches.size() == 1 );
+    TEST_CHECK( recorder.Flatten() == std::vector<int>( VALUES, VALUES + VALUE_COUNT ) );
+
+    // 何もなければ呼ばない
+    update.Update();
+    TEST_CHECK( recorder.batches.size() == 1 );
+}
+
+// chunkSize件ずつに区切る
+void TestBatchChunks()
+{
+    BatchRecorder recorder;
+    RequestUpdate<int> update;
+    recorder.Set( update, 3 );
+
+    AddValues( update );
+    update.Update();
+    TEST_CHECK( recorder.batches.size() == 3 );
+    TEST_CHECK( recorder.batches[0].size() == 3 && recorder.batches[1].size() == 3 && recorder.batches[2].size() == 1 );
+    TEST_CHECK( recorder.Flatten() == std::vector<int>( VALUES, VALUES + VALUE_COUNT ) );
+}
+
+// キーでも比較関数でも、並べた順に渡す
+void TestBatchSorted()
+{
+    const int sorted[] = { 1, 2, 3, 5, 7, 8, 9 };
+
+    BatchRecorder byKey;
+    RequestUpdate<int> keyUpdate;
+    byKey.Set( keyUpdate, 4 );
+    keyUpdate.SetRequestSortKey( []( const std::tuple<int>& param ){ return std::get<0>( param ); } );
+    AddValues( keyUpdate );
+    keyUpdate.Update();
+    TEST_CHECK( byKey.batches.size() == 2 );
+    TEST_CHECK( byKey.Flatten() == std::vector<int>( sorted, sorted + VALUE_COUNT ) );
+
+    BatchRecorder byPredicator;
+    RequestUpdate<int> predicatorUpdate;
+    byPredicator.Set( predicatorUpdate, 0 );
+    predicatorUpdate.SetRequestSortPredicator( []( const std::tuple<int>& lhs, const std::tuple<int>& rhs ){ return lhs < rhs; } );
+    AddValues( predicatorUpdate );
+    predicatorUpdate.Update();
+    TEST_CHECK( byPredicator.batches.size() == 1 );
+    TEST_CHECK( byPredicator.Flatten() == std::vector<int>( sorted, sorted + VALUE_COUNT ) );
+}
+
+// 件数で区切ったら、その分だけ渡して残りは次のUpdateで渡す
+void TestBatchCarryOver()
+{
+    BatchRecorder recorder;
+    RequestUpdate<int> update;
+    recorder.Set( update, 0 );
+    update.SetRequestSortKey( []( const std::tuple<int>& param ){ return std::get<0>( param ); } );
+
+    AddValues( update );
+    TEST_CHECK( update.Update( 3 ) == 3 );
+    TEST_CHECK( recorder.batches.size() == 1 );
+    const int first[] = { 1, 2, 3 };
+    TEST_CHECK( recorder.batches[0] == std::vector<int>( first, first + 3 ) );
+
+    update.AddRequest( 0 );
+    TEST_CHECK( update.Update( RequestUpdateBudget() ) == 5 );
+    TEST_CHECK( recorder.batches.size() == 2 );
+    const int rest[] = { 0, 5, 7, 8, 9 };
+    TEST_CHECK( recorder.batches[1] == std::vector<int>( rest, rest + 5 ) );
+}
+
+// SetRequestExecuterに戻せば1件ずつ処理する
+void TestBatchReplaced()
+{
+    BatchRecorder recorder;
+    std::vector<int> executed;
+    RequestUpdate<int> update;
+    recorder.Set( update, 0 );
+    update.SetRequestExecuter( [&executed]( int value ){ executed.push_back( value ); } );
+
+    AddValues( update );
+    update.Update();
+    TEST_CHECK( recorder.batches.empty() );
+    TEST_CHECK( executed == std::vector<int>( VALUES, VALUES + VALUE_COUNT ) );
+}
+
+}
+
+int main()
+{
+    TestBatchWhole();
+    TestBatchChunks();
+    TestBatchSorted();
+    TestBatchCarryOver();
+    TestBatchReplaced();
+    return TestResult();
+}
@@ -0,0 +1,158 @@
+/*
+ * Copyright (c) 2013, nilfs
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * * Neither the name of the <ORGANIZATION> nor the names of its contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <algorithm>
+#include <set>
+#include <vector>
+
+#include "RequestUpdate.h"
+#include "Test.h"
+
+namespace
+{
+
+/**
+ *  毎回いくつか追加しながら件数を区切ってUpdateし、持ち越しと新しい分を合わせた中から小さい順にmaxCount件ずつ処理されるか確かめる
+ *  キーは全て違う値にして、同じキーの順番には頼らない
+ */
+void RunAgainstModel( RequestUpdate<int>& update )
+{
+    std::vector<int> executed;
+    update.SetRequestExecuter( [&executed]( int value ){ executed.push_back( value ); } );
+
+    std::set<int> model;
+    uint32_t state = 12345;
+    int next = 0;
+    for( int round=0; round<200; ++round )
+    {
+        state = state * 1664525u + 1013904223u;
+        const int addCount = static_cast<int>( state >> 28 );
+        for( int i=0; i<addCount; ++i )
+        {
+            // 1000で割った余りで並びをばらけさせ、商で値を一意にする
+            const int value = static_cast<int>( ( next * 7919 ) % 1000 ) * 1000 + next / 1000;
+            ++next;
+            update.AddRequest( value );
+            model.insert( value );
+        }
+
+        const size_t maxCount = ( state >> 24 ) % 6;
+        executed.clear();
+        TEST_CHECK( update.Update( maxCount ) == std::min( maxCount, model.size() ) );
+
+        std::vector<int> expected;
+        while( expected.size() < maxCount && !model.empty() )
+        {
+            expected.push_back( *model.begin() );
+            model.erase( model.begin() );
+        }
+        TEST_CHECK( executed == expected );
+        TEST_CHECK( update.GetPendingCount() == model.size() );
+    }
+
+    executed.clear();
+    update.Update();
+    TEST_CHECK( executed == std::vector<int>( model.begin(), model.end() ) );
+    TEST_CHECK( update.GetPendingCount() == 0 );
+}
+
+// キーで並べるとき
+void TestCarryOverByKey()
+{
+    RequestUpdate<int> update;
+    update.SetRequestSortKey( []( const std::tuple<int>& param ){ return std::get<0>( param ); } );
+    RunAgainstModel( update );
+}
+
+// 比較関数で並べるとき
+void TestCarryOverByPredicator()
+{
+    RequestUpdate<int> update;
+    update.SetRequestSortPredicator( []( const std::tuple<int>& lhs, const std::tuple<int>& rhs ){ return lhs < rhs; } );
+    RunAgainstModel( update );
+}
+
+// 並べ替えなければ、持ち越しても追加した順のまま処理する
+void TestCarryOverFifo()
+{
+    std::vector<int> executed;
+    RequestUpdate<int> update;
+    update.SetRequestExecuter( [&executed]( int value ){ executed.push_back( value ); } );
+
+    int next = 0;
+    for( int round=0; round<10; ++round )
+    {
+        for( int i=0; i<3; ++i )
+        {
+            update.AddRequest( next++ );
+        }
+        TEST_CHECK( update.Update( 2 ) == 2 );
+    }
+    TEST_CHECK( update.GetPendingCount() == 10 );
+    update.Update();
+
+    TEST_CHECK( executed.size() == 30 );
+    for( size_t i=0; i<executed.size(); ++i )
+    {
+        TEST_CHECK( executed[i] == static_cast<int>(i) );
+    }
+}
+
+// 安定な並べ方なら、同じキーは持ち越しをまたいでも追加した順のまま
+void TestCarryOverStableKey()
+{
+    std::vector<int> executed;
+    RequestUpdate<int, int> update;
+    update.SetRequestSortKey( []( const std::tuple<int, int>& param ){ return std::get<0>( param ); }, REQUEST_SORT_STABLE );
+    update.SetRequestExecuter( [&executed]( int, int id ){ executed.push_back( id ); } );
+
+    update.AddRequest( 1, 0 );
+    update.AddRequest( 0, 1 );
+    update.AddRequest( 1, 2 );
+    update.AddRequest( 1, 3 );
+    TEST_CHECK( update.Update( 2 ) == 2 );
+
+    update.AddRequest( 1, 4 );
+    update.AddRequest( 0, 5 );
+    update.Update();
+
+    const int expected[] = { 1, 0, 5, 2, 3, 4 };
+    TEST_CHECK( executed == std::vector<int>( expected, expected + 6 ) );
+}
+
+}
+
+int main()
+{
+    TestCarryOverByKey();
+    TestCarryOverByPredicator();
+    TestCarryOverFifo();
+    TestCarryOverStableKey();
+    return TestResult();
+}
@@ -0,0 +1,155 @@
+/*
+ * Copyright (c) 2013, nilfs
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * * Neither the name of the <ORGANIZATION> nor the names of its contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <utility>
+#include <vector>
+
+#include "RequestUpdate.h"
+#include "Test.h"
+
+namespace
+{
+
+typedef std::pair<int, int> Executed;
+
+// 1つ目の引数をまとめるキー、2つ目を値にする
+void SetRecorder( RequestUpdate<int, int>& update, std::vector<Executed>& executed )
+{
+    update.SetRequestExecuter( [&executed]( int key, int value ){ executed.push_back( Executed( key, value ) ); } );
+}
+
+int GetKey( const std::tuple<int, int>& param ){ return std::get<0>( param ); }
+
+void AddMixed( RequestUpdate<int, int>& update )
+{
+    update.AddRequest( 1, 10 );
+    update.AddRequest( 2, 20 );
+    update.AddRequest( 1, 11 );
+    update.AddRequest( 3, 30 );
+    update.AddRequest( 2, 21 );
+    update.AddRequest( 1, 12 );
+}
+
+// 最初に届いた位置に、最後に届いた値を置く
+void TestCoalesceLast()
+{
+    std::vector<Executed> executed;
+    RequestUpdate<int, int> update;
+    SetRecorder( update, executed );
+    update.SetRequestCoalesce( &GetKey );
+
+    AddMixed( update );
+    update.Update();
+
+    const Executed expected[] = { Executed( 1, 12 ), Executed( 2, 21 ), Executed( 3, 30 ) };
+    TEST_CHECK( executed == std::vector<Executed>( expected, expected + 3 ) );
+    TEST_CHECK( update.GetStats().coalescedCount == 3 );
+}
+
+// 最初に届いた値を残す
+void TestCoalesceFirst()
+{
+    std::vector<Executed> executed;
+    RequestUpdate<int, int> update;
+    SetRecorder( update, executed );
+    update.SetRequestCoalesce( &GetKey, REQUEST_COALESCE_FIRST );
+
+    AddMixed( update );
+    update.Update();
+
+    const Executed expected[] = { Executed( 1, 10 ), Executed( 2, 20 ), Executed( 3, 30 ) };
+    TEST_CHECK( executed == std::vector<Executed>( expected, expected + 3 ) );
+}
+
+// まとめる関数には届いた順に渡す
+void TestCoalesceReducer()
+{
+    std::vector<Executed> executed;
+    RequestUpdate<int, int> update;
+    SetRecorder( update, executed );
+    update.SetRequestCoalesce( &GetKey, []( std::tuple<int, int>& merged, std::tuple<int, int>&& incoming ){
+        std::get<1>( merged ) = std::get<1>( merged ) * 100 + std::get<1>( incoming );
+    } );
+
+    AddMixed( update );
+    update.Update();
+
+    const Executed expected[] = { Executed( 1, 101112 ), Executed( 2, 2021 ), Executed( 3, 30 ) };
+    TEST_CHECK( executed == std::vector<Executed>( expected, expected + 3 ) );
+}
+
+// まとめた後で並べ替える。前のUpdateから持ち越した分とはまとめない
+void TestCoalesceWithCarryOver()
+{
+    std::vector<Executed> executed;
+    RequestUpdate<int, int> update;
+    SetRecorder( update, executed );
+    update.SetRequestSortKey( []( const std::tuple<int, int>& param ){ return -std::get<1>( param ); } );
+    update.SetRequestCoalesce( &GetKey );
+
+    update.AddRequest( 1, 1 );
+    update.AddRequest( 2, 5 );
+    update.AddRequest( 1, 9 );
+    TEST_CHECK( update.Update( 1 ) == 1 );
+
+    update.AddRequest( 2, 7 );
+    update.AddRequest( 2, 3 );
+    update.Update();
+
+    const Executed expected[] = { Executed( 1, 9 ), Executed( 2, 5 ), Executed( 2, 3 ) };
+    TEST_CHECK( executed == std::vector<Executed>( expected, expected + 3 ) );
+    TEST_CHECK( update.GetStats().coalescedCount == 2 );
+}
+
+// やめればまとめない
+void TestClearCoalesce()
+{
+    std::vector<Executed> executed;
+    RequestUpdate<int, int> update;
+    SetRecorder( update, executed );
+    update.SetRequestCoalesce( &GetKey );
+    update.ClearRequestCoalesce();
+
+    AddMixed( update );
+    update.Update();
+    TEST_CHECK( executed.size() == 6 );
+    TEST_CHECK( update.GetStats().coalescedCount == 0 );
+}
+
+}
+
+int main()
+{
+    TestCoalesceLast();
+    TestCoalesceFirst();
+    TestCoalesceReducer();
+    TestCoalesceWithCarryOver();
+    TestClearCoalesce();
+    return TestResult();
+}
@@ -0,0 +1,146 @@
+/*
+ * Copyright (c) 2013, nilfs
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * * Neither the name of the <ORGANIZATION> nor the names of its contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "RequestColumnUpdate.h"
+#include "Test.h"
+
+namespace
+{
+
+bool IsAligned( const void* ptr )
+{
+    return reinterpret_cast<uintptr_t>( ptr ) % 64 == 0;
+}
+
+// 並べ替えなければ追加した順の列を渡す。列の先頭は64バイトに揃っている
+void TestColumnsInOrder()
+{
+    RequestColumnUpdate<int, float> update;
+    std::vector<int> ids;
+    std::vector<float> values;
+    int calls = 0;
+    bool aligned = true;
+    update.SetRequestExecuter( [&]( RequestSpan<const int> idSpan, RequestSpan<const float> valueSpan ){
+        ++calls;
+        aligned = aligned && IsAligned( idSpan.data() ) && IsAligned( valueSpan.data() );
+        TEST_CHECK( idSpan.size() == valueSpan.size() );
+        ids.insert( ids.end(), idSpan.begin(), idSpan.end() );
+        values.insert( values.end(), valueSpan.begin(), valueSpan.end() );
+    } );
+
+    for( int i=0; i<100; ++i )
+    {
+        update.AddRequest( i, i * 0.5f );
+    }
+    TEST_CHECK( update.Update() == 100 );
+    TEST_CHECK( calls == 1 );
+    TEST_CHECK( aligned );
+    for( int i=0; i<100; ++i )
+    {
+        TEST_CHECK( ids[i] == i && values[i] == i * 0.5f );
+    }
+
+    // 処理した列は次のUpdateまで読める
+    TEST_CHECK( update.GetColumn<0>().size() == 100 );
+    TEST_CHECK( update.GetColumn<1>()[10] == 5.0f );
+
+    TEST_CHECK( update.Update() == 0 );
+    TEST_CHECK( calls == 1 );
+}
+
+// 指定した列の値で並べ替え、他の列も同じ順に並ぶ。chunkSize件ずつに区切る
+void TestSortColumn()
+{
+    RequestColumnUpdate<int, float> update;
+    std::vector<int> ids;
+    std::vector<float> values;
+    std::vector<size_t> chunks;
+    update.SetRequestExecuter( [&]( RequestSpan<const int> idSpan, RequestSpan<const float> valueSpan ){
+        chunks.push_back( idSpan.size() );
+        ids.insert( ids.end(), idSpan.begin(), idSpan.end() );
+        values.insert( values.end(), valueSpan.begin(), valueSpan.end() );
+    }, 4 );
+    update.SetRequestSortColumn<1>();
+
+    const float source[] = { 3.0f, -1.0f, 2.5f, -7.0f, 0.0f, 10.0f };
+    for( int i=0; i<6; ++i )
+    {
+        update.AddRequest( i, source[i] );
+    }
+    update.Update();
+
+    const int expectedIds[] = { 3, 1, 4, 2, 0, 5 };
+    TEST_CHECK( ids == std::vector<int>( expectedIds, expectedIds + 6 ) );
+    for( size_t i=0; i<ids.size(); ++i )
+    {
+        TEST_CHECK( values[i] == source[ ids[i] ] );
+    }
+    TEST_CHECK( chunks.size() == 2 && chunks[0] == 4 && chunks[1] == 2 );
+
+    // 並べ替えをやめれば追加した順
+    ids.clear();
+    update.ClearRequestSort();
+    update.AddRequest( 1, 1.0f );
+    update.AddRequest( 0, 0.0f );
+    update.Update();
+    TEST_CHECK( ids.size() == 2 && ids[0] == 1 && ids[1] == 0 );
+}
+
+// ムーブしかできない型の列も作れる
+void TestMoveOnlyColumn()
+{
+    RequestColumnUpdate<int, std::unique_ptr<int>> update;
+    int sum = 0;
+    update.SetRequestExecuter( [&sum]( RequestSpan<const int> ids, RequestSpan<const std::unique_ptr<int>> values ){
+        for( size_t i=0; i<ids.size(); ++i )
+        {
+            sum += ids[i] * *values[i];
+        }
+    } );
+    update.SetRequestSortColumn<0>();
+
+    update.EmplaceRequest( 2, std::unique_ptr<int>( new int( 10 ) ) );
+    update.EmplaceRequest( 1, std::unique_ptr<int>( new int( 3 ) ) );
+    TEST_CHECK( update.Update() == 2 );
+    TEST_CHECK( sum == 23 );
+}
+
+}
+
+int main()
+{
+    TestColumnsInOrder();
+    TestSortColumn();
+    TestMoveOnlyColumn();
+    return TestResult();
+}
@@ -0,0 +1,134 @@
+/*
+ * Copyright (c) 2013, nilfs
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * * Neither the name of the <ORGANIZATION> nor the names of its contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <chrono>
+#include <sstream>
+#include <string>
+#include <thread>
+
+#include "RequestUpdate.h"
+#include "Test.h"
+
+#ifndef REQUEST_UPDATE_INSTRUMENT
+#error "RequestInstrumentTest must be built with REQUEST_UPDATE_INSTRUMENT"
+#endif
+
+namespace
+{
+
+// どの値もそのバケツの下限と次のバケツの下限の間に入り、誤差は1/8まで
+void TestHistogramBuckets()
+{
+    const uint64_t values[] = { 0, 1, 7, 8, 9, 15, 16, 17, 100, 1000, 123456789, ~0ULL >> 1 };
+    for( uint64_t value : values )
+    {
+        const size_t index = RequestHistogram::GetBucketIndex( value );
+        TEST_CHECK( index < RequestHistogram::BUCKET_COUNT );
+        TEST_CHECK( RequestHistogram::GetBucketLowerBound( index ) <= value );
+        TEST_CHECK( value < RequestHistogram::GetBucketLowerBound( index + 1 ) );
+        TEST_CHECK( value - RequestHistogram::GetBucketLowerBound( index ) <= value / 8 );
+    }
+
+    RequestHistogram histogram;
+    for( uint64_t value=1; value<=1000; ++value )
+    {
+        histogram.Record( value );
+    }
+    const RequestHistogramSummary summary = histogram.Summarize( 1.0 );
+    TEST_CHECK( summary.count == 1000 );
+    TEST_CHECK( summary.mean == 500.5 );
+    TEST_CHECK( summary.max == 1000.0 );
+    TEST_CHECK( 500 * 7 / 8 <= summary.p50 && summary.p50 <= 500 * 9 / 8 );
+    TEST_CHECK( 990 * 7 / 8 <= summary.p99 && summary.p99 <= 1000 );
+}
+
+// 追加した数、Updateの回数、取り出した数、待ち時間を数える。持ち越した分は取り出したUpdateで数える
+void TestSnapshotCounts()
+{
+    RequestUpdate<int> update;
+    update.SetRequestExecuter( []( int ){} );
+
+    for( int i=0; i<10; ++i )
+    {
+        update.AddRequest( i );
+    }
+    update.Update();
+    for( int i=0; i<5; ++i )
+    {
+        update.AddRequest( i );
+    }
+    update.Update( 2 );
+    update.Update();
+
+    const RequestInstrumentSnapshot snapshot = update.GetInstrumentSnapshot();
+    TEST_CHECK( snapshot.enabled );
+    TEST_CHECK( snapshot.updateCount == 3 );
+    TEST_CHECK( snapshot.requestCount == 15 );
+    TEST_CHECK( snapshot.enqueueTime.count == 15 );
+    TEST_CHECK( snapshot.latency.count == 15 );
+    TEST_CHECK( snapshot.queueDepth.count == 3 );
+    TEST_CHECK( snapshot.queueDepth.max == 10.0 );
+    TEST_CHECK( snapshot.sortTime.count == 3 );
+    TEST_CHECK( snapshot.executeTime.count == 3 );
+    TEST_CHECK( snapshot.updateTime.count == 3 );
+
+    std::ostringstream out;
+    snapshot.Print( out );
+    TEST_CHECK( out.str().find( "updates\t3\trequests\t15" ) != std::string::npos );
+
+    update.ResetInstrument();
+    const RequestInstrumentSnapshot reset = update.GetInstrumentSnapshot();
+    TEST_CHECK( reset.enabled );
+    TEST_CHECK( reset.updateCount == 0 && reset.requestCount == 0 && reset.latency.count == 0 );
+}
+
+// 時間はナノ秒に直して返す。処理に2ミリ秒かかったら、処理時間と待ち時間に表れる
+void TestSnapshotDurations()
+{
+    RequestUpdate<int> update;
+    update.SetRequestExecuter( []( int ){ std::this_thread::sleep_for( std::chrono::milliseconds(2) ); } );
+    update.AddRequest( 0 );
+    std::this_thread::sleep_for( std::chrono::milliseconds(2) );
+    update.Update();
+
+    const RequestInstrumentSnapshot snapshot = update.GetInstrumentSnapshot();
+    TEST_CHECK( 1.0e6 <= snapshot.executeTime.max );
+    TEST_CHECK( snapshot.executeTime.max <= snapshot.updateTime.max );
+    TEST_CHECK( 1.0e6 <= snapshot.latency.max );
+}
+
+}
+
+int main()
+{
+    TestHistogramBuckets();
+    TestSnapshotCounts();
+    TestSnapshotDurations();
+    return TestResult();
+}
@@ -0,0 +1,156 @@
+/*
+ * Copyright (c) 2013, nilfs
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * * Neither the name of the <ORGANIZATION> nor the names of its contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <memory>
+#include <vector>
+
+#include "RequestUpdate.h"
+#include "Test.h"
+
+namespace
+{
+
+// コピーされた回数を数える。ムーブがnoexceptでないとstd::vectorが伸びるときにコピーされる
+struct CopyCounter
+{
+    static int s_CopyCount;
+    int value;
+
+    explicit CopyCounter( int value ) : value(value) {}
+    CopyCounter( const CopyCounter& other ) : value(other.value) { ++s_CopyCount; }
+    CopyCounter( CopyCounter&& other ) noexcept : value(other.value) {}
+    CopyCounter& operator=( const CopyCounter& other ){ value = other.value; ++s_CopyCount; return *this; }
+    CopyCounter& operator=( CopyCounter&& other ) noexcept { value = other.value; return *this; }
+};
+
+int CopyCounter::s_CopyCount = 0;
+
+typedef RequestUpdate<int, CopyCounter> CountedUpdate;
+
+// 並べ方や持ち越しの指定ごとに、同じ手順で追加して処理する
+void RunCounted( CountedUpdate& update, std::vector<int>& executed )
+{
+    update.SetRequestExecuter( [&executed]( int, CopyCounter counter ){ executed.push_back( counter.value ); } );
+    for( int i=0; i<40; ++i )
+    {
+        update.EmplaceRequest( i % 4, CopyCounter( i ) );
+    }
+    update.AddCancellableRequest( 0, CopyCounter( 40 ) );
+    update.Update( 10 );
+    update.AddRequest( 1, CopyCounter( 41 ) );
+    update.Update();
+}
+
+int GetKey( const std::tuple<int, CopyCounter>& param ){ return std::get<0>( param ); }
+
+// 右辺値で追加すれば、並べ替え、持ち越し、バケツ、まとめる処理のどこでもコピーしない
+void TestNoCopies()
+{
+    for( int mode=0; mode<5; ++mode )
+    {
+        CopyCounter::s_CopyCount = 0;
+        std::vector<int> executed;
+        CountedUpdate update;
+        switch( mode )
+        {
+            case 1:
+                update.SetRequestSortKey( &GetKey );
+                break;
+            case 2:
+                update.SetRequestSortPredicator( []( const std::tuple<int, CopyCounter>& lhs, const std::tuple<int, CopyCounter>& rhs ){ return std::get<0>( lhs ) < std::get<0>( rhs ); } );
+                break;
+            case 3:
+                update.SetRequestPriority( &GetKey, 4 );
+                break;
+            case 4:
+                update.SetRequestCoalesce( []( const std::tuple<int, CopyCounter>& param ){ return std::get<1>( param ).value % 20; } );
+                break;
+            default:
+                break;
+        }
+        RunCounted( update, executed );
+        // まとめると1回目は20件になり、持ち越した分と後から来た1件はまとめない
+        TEST_CHECK( executed.size() == ( mode == 4 ? 21u : 42u ) );
+        TEST_CHECK( CopyCounter::s_CopyCount == 0 );
+    }
+}
+
+// 左辺値を渡したら、コピーは引数に受け取るときの1回だけ
+void TestLvalueCopiedOnce()
+{
+    CopyCounter::s_CopyCount = 0;
+    int executed = -1;
+    CountedUpdate update;
+    update.SetRequestSortKey( &GetKey );
+    update.SetRequestExecuter( [&executed]( int, CopyCounter counter ){ executed = counter.value; } );
+
+    const CopyCounter counter( 7 );
+    update.AddRequest( 0, counter );
+    update.Update();
+    TEST_CHECK( executed == 7 );
+    TEST_CHECK( CopyCounter::s_CopyCount == 1 );
+
+    CopyCounter::s_CopyCount = 0;
+    update.EmplaceRequest( 0, counter );
+    update.Update();
+    TEST_CHECK( CopyCounter::s_CopyCount == 1 );
+}
+
+// ムーブしかできない型も、持ち越しと取り消しを通ってエグゼキュータに届く
+void TestMoveOnly()
+{
+    typedef RequestUpdate<int, std::unique_ptr<int>> MoveOnlyUpdate;
+    MoveOnlyUpdate update;
+    int sum = 0;
+    update.SetRequestSortKey( []( const std::tuple<int, std::unique_ptr<int>>& param ){ return -std::get<0>( param ); } );
+    update.SetRequestExecuter( [&sum]( int, std::unique_ptr<int> value ){ sum += *value; } );
+
+    for( int i=0; i<10; ++i )
+    {
+        update.EmplaceRequest( i, std::unique_ptr<int>( new int( i ) ) );
+    }
+    const RequestTicket cancelled = update.AddCancellableRequest( 100, std::unique_ptr<int>( new int( 1000 ) ) );
+    TEST_CHECK( update.Cancel( cancelled ) );
+    update.AddRequest( 50, std::unique_ptr<int>( new int( 50 ) ) );
+
+    TEST_CHECK( update.Update( 3 ) == 3 );
+    TEST_CHECK( sum == 50 + 9 + 8 );
+    update.Update();
+    TEST_CHECK( sum == 50 + 45 );
+}
+
+}
+
+int main()
+{
+    TestNoCopies();
+    TestLvalueCopiedOnce();
+    TestMoveOnly();
+    return TestResult();
+}
@@ -0,0 +1,331 @@
+/*
+ * Copyright (c) 2013, nilfs
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * * Neither the name of the <ORGANIZATION> nor the names of its contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <algorithm>
+
+#include "RequestUpdate.h"
+#include "Test.h"
+
+namespace
+{
+
+// 上限に達したら追加せず、処理すればまた追加できる
+void TestReject()
+{
+    RequestUpdate<int> update;
+    std::vector<int> executed;
+    update.SetRequestCapacity( 3 );
+    update.SetRequestExecuter( [&executed]( int value ){ executed.push_back( value ); } );
+
+    TEST_CHECK( update.AddRequest( 1 ) && update.AddRequest( 2 ) && update.AddRequest( 3 ) );
+    TEST_CHECK( !update.AddRequest( 4 ) );
+    TEST_CHECK( !update.AddCancellableRequest( 5 ).IsValid() );
+
+    RequestOverloadStats stats = update.GetOverloadStats();
+    TEST_CHECK( stats.rejectedCount == 2 && stats.fullCount == 2 );
+    TEST_CHECK( stats.full && stats.waitingCount == 3 && stats.capacity == 3 );
+
+    update.Update();
+    TEST_CHECK( executed == std::vector<int>({ 1, 2, 3 }) );
+    stats = update.GetOverloadStats();
+    TEST_CHECK( !stats.full && stats.waitingCount == 0 );
+    TEST_CHECK( update.AddRequest( 6 ) );
+}
+
+// 待つ時間は呼び出しごとの期限で、起こされた後に他のスレッドに先を越されても延びない
+void TestBlockDeadline()
+{
+    typedef std::chrono::steady_clock Clock;
+    const int PRODUCERS = 8;
+    RequestUpdate<int> update;
+    update.SetRequestCapacity( 1, REQUEST_OVERLOAD_BLOCK, std::chrono::milliseconds(50) );
+    update.SetRequestExecuter( []( int ){} );
+    TEST_CHECK( update.AddRequest( 0 ) );
+
+    // 少しずつ空けて、待っているスレッドで取り合わせる
+    std::atomic<int> finished( 0 );
+    std::atomic<int> added( 0 );
+    std::atomic<long> maxWaitMs( 0 );
+    std::vector<std::thread> producers;
+    for( int p=0; p<PRODUCERS; ++p )
+    {
+        producers.push_back( std::thread( [&]{
+            const Clock::time_point start = Clock::now();
+            if( update.AddRequest( 1 ) )
+            {
+                ++added;
+            }
+            const long waited = static_cast<long>( std::chrono::duration_cast<std::chrono::milliseconds>( Clock::now() - start ).count() );
+            long current = maxWaitMs.load();
+            while( current < waited && !maxWaitMs.compare_exchange_weak( current, waited ) )
+            {
+            }
+            ++finished;
+        } ) );
+    }
+    while( finished.load() < PRODUCERS )
+    {
+        update.Update();
+        std::this_thread::sleep_for( std::chrono::milliseconds(20) );
+    }
+    for( std::thread& thread : producers )
+    {
+        thread.join();
+    }
+
+    const RequestOverloadStats stats = update.GetOverloadStats();
+    TEST_CHECK( maxWaitMs.load() < 50 + 100 );
+    TEST_CHECK( stats.blockedCount <= static_cast<uint64_t>( PRODUCERS ) );
+    TEST_CHECK( stats.rejectedCount + added.load() == static_cast<uint64_t>( PRODUCERS ) );
+}
+
+// 期限なしで待って、Updateで空いたら追加する
+void TestBlockUntilSpace()
+{
+    RequestUpdate<int> update;
+    std::atomic<int> executed( 0 );
+    update.SetRequestCapacity( 2, REQUEST_OVERLOAD_BLOCK );
+    update.SetRequestExecuter( [&executed]( int ){ ++executed; } );
+    update.AddRequest( 1 );
+    update.AddRequest( 2 );
+
+    std::atomic<bool> added( false );
+    std::thread producer( [&]{ added.store( update.AddRequest( 3 ) ); } );
+    while( update.GetOverloadStats().blockedCount == 0 )
+    {
+        std::this_thread::yield();
+    }
+    TEST_CHECK( !added.load() );
+    update.Update();
+    producer.join();
+    TEST_CHECK( added.load() );
+    update.Update();
+    TEST_CHECK( executed.load() == 3 );
+}
+
+// 複数のスレッドから待ちながら追加しても、数が合う
+void TestBlockContention()
+{
+    const int PRODUCERS = 4;
+    const int COUNT = 2000;
+    RequestUpdate<int> update;
+    std::atomic<int> executed( 0 );
+    update.SetRequestCapacity( 16, REQUEST_OVERLOAD_BLOCK );
+    update.SetRequestExecuter( [&executed]( int ){ ++executed; } );
+
+    std::vector<std::thread> producers;
+    for( int p=0; p<PRODUCERS; ++p )
+    {
+        producers.push_back( std::thread( [&update]{
+            for( int i=0; i<COUNT; ++i )
+            {
+                update.AddRequest( i );
+            }
+        } ) );
+    }
+    while( executed.load() < PRODUCERS * COUNT )
+    {
+        update.Update();
+        std::this_thread::yield();
+    }
+    for( std::thread& thread : producers )
+    {
+        thread.join();
+    }
+    const RequestOverloadStats stats = update.GetOverloadStats();
+    TEST_CHECK( stats.waitingCount == 0 && stats.rejectedCount == 0 );
+}
+
+
+// 時刻になったタイマーのリクエストは処理を待つ数に入る
+void TestTimerCounted()
+{
+    typedef std::chrono::steady_clock::time_point TimePoint;
+    TimePoint now = std::chrono::steady_clock::now();
+    RequestUpdate<int> update;
+    std::vector<int> executed;
+    update.SetRequestCapacity( 2, REQUEST_OVERLOAD_REJECT );
+    update.SetRequestTimerClock( [&now]{ return now; } );
+    update.SetRequestExecuter( [&executed]( int value ){ executed.push_back( value ); } );
+
+    // 登録するときは上限を確かめない
+    update.AddRequestAt( now + std::chrono::milliseconds(10), 10 );
+    update.AddRequestAt( now + std::chrono::milliseconds(10), 11 );
+    update.AddRequestAt( now + std::chrono::milliseconds(10), 12 );
+    TEST_CHECK( update.AddRequest( 1 ) && update.AddRequest( 2 ) );
+    TEST_CHECK( update.GetOverloadStats().waitingCount == 2 );
+
+    // 1件ずつ処理すると、残りは持ち越しとして数える
+    now += std::chrono::milliseconds(10);
+    update.Update( RequestUpdateBudget( 1 ) );
+    TEST_CHECK( executed.size() == 1 );
+    TEST_CHECK( update.GetOverloadStats().waitingCount == 4 );
+    TEST_CHECK( !update.AddRequest( 3 ) );
+
+    while( update.GetPendingCount() != 0 )
+    {
+        update.Update();
+    }
+    TEST_CHECK( executed.size() == 5 );
+    TEST_CHECK( update.GetOverloadStats().waitingCount == 0 );
+}
+
+
+// 古いものから捨てて、持ち越しと合わせて上限に収める
+void TestDropOldest()
+{
+    RequestUpdate<int> update;
+    std::vector<int> executed;
+    update.SetRequestCapacity( 4, REQUEST_OVERLOAD_DROP_OLDEST );
+    update.SetRequestExecuter( [&executed]( int value ){ executed.push_back( value ); } );
+
+    for( int i=0; i<6; ++i )
+    {
+        TEST_CHECK( update.AddRequest( int(i) ) );
+    }
+    update.Update( RequestUpdateBudget( 1 ) );
+    TEST_CHECK( executed == std::vector<int>({ 2 }) );
+    TEST_CHECK( update.GetPendingCount() == 3 );
+
+    // 持ち越しの3件と新しい3件から、古い2件を捨てる
+    const RequestTicket ticket = update.AddCancellableRequest( 6 );
+    update.AddRequest( 7 );
+    update.AddRequest( 8 );
+    update.Update();
+    // 券のあるリクエストも券のないリクエストと追加した順に並ぶ
+    TEST_CHECK( executed == std::vector<int>({ 2, 5, 6, 7, 8 }) );
+    TEST_CHECK( !update.Cancel( ticket ) );
+
+    const RequestOverloadStats stats = update.GetOverloadStats();
+    TEST_CHECK( stats.droppedCount == 4 && stats.rejectedCount == 0 && stats.waitingCount == 0 );
+}
+
+// 上限の2倍までは追加して、それ以上は追加しない
+void TestDropHardLimit()
+{
+    RequestUpdate<int> update;
+    update.SetRequestCapacity( 5, REQUEST_OVERLOAD_DROP_OLDEST );
+    update.SetRequestExecuter( []( int ){} );
+    int added = 0;
+    for( int i=0; i<20; ++i )
+    {
+        added += update.AddRequest( int(i) ) ? 1 : 0;
+    }
+    TEST_CHECK( added == 10 );
+    const RequestOverloadStats stats = update.GetOverloadStats();
+    TEST_CHECK( stats.rejectedCount == 10 && stats.fullCount == 15 );
+    update.Update();
+    TEST_CHECK( update.GetOverloadStats().droppedCount == 5 );
+}
+
+// キーの大きいものから捨てる
+void TestDropLowestByKey()
+{
+    RequestUpdate<int> update;
+    std::vector<int> executed;
+    update.SetRequestCapacity( 3, REQUEST_OVERLOAD_DROP_LOWEST );
+    update.SetRequestSortKey( []( const std::tuple<int>& param ){ return std::get<0>( param ); } );
+    update.SetRequestExecuter( [&executed]( int value ){ executed.push_back( value ); } );
+
+    update.AddRequest( 5 );
+    const RequestTicket ticket = update.AddCancellableRequest( 9 );
+    update.AddRequest( 1 );
+    update.AddRequest( 7 );
+    update.AddRequest( 2 );
+    TEST_CHECK( ticket.IsValid() );
+    update.Update();
+    TEST_CHECK( executed == std::vector<int>({ 1, 2, 5 }) );
+    TEST_CHECK( update.GetOverloadStats().droppedCount == 2 );
+}
+
+// 比較関数で後に並ぶものから捨てる
+void TestDropLowestByPredicator()
+{
+    RequestUpdate<int> update;
+    std::vector<int> executed;
+    update.SetRequestCapacity( 3, REQUEST_OVERLOAD_DROP_LOWEST );
+    update.SetRequestSortPredicator( []( const std::tuple<int>& lhs, const std::tuple<int>& rhs ){ return std::get<0>( rhs ) < std::get<0>( lhs ); } );
+    update.SetRequestExecuter( [&executed]( int value ){ executed.push_back( value ); } );
+
+    const int values[] = { 4, 8, 1, 6, 3, 9 };
+    for( int value : values )
+    {
+        update.AddRequest( value );
+    }
+    update.Update( RequestUpdateBudget( 1 ) );
+    TEST_CHECK( executed == std::vector<int>({ 9 }) );
+
+    // 持ち越しの8, 6と新しい分を合わせて3件に収める
+    update.AddRequest( 7 );
+    update.AddRequest( 0 );
+    update.Update();
+    TEST_CHECK( executed == std::vector<int>({ 9, 8, 7, 6 }) );
+}
+
+// 優先度のバケツでは優先度の低いバケツから捨てる
+void TestDropLowestByPriority()
+{
+    RequestUpdate<int> update;
+    std::vector<int> executed;
+    update.SetRequestCapacity( 3, REQUEST_OVERLOAD_DROP_LOWEST );
+    update.SetRequestPriority( []( const std::tuple<int>& param ){ return std::get<0>( param ) % 4; }, 4 );
+    update.SetRequestExecuter( [&executed]( int value ){ executed.push_back( value ); } );
+
+    const int values[] = { 3, 0, 2, 1, 7, 4 };
+    for( int value : values )
+    {
+        update.AddRequest( value );
+    }
+    update.Update();
+    std::sort( executed.begin(), executed.end() );
+    TEST_CHECK( executed == std::vector<int>({ 0, 1, 4 }) );
+    const RequestOverloadStats stats = update.GetOverloadStats();
+    TEST_CHECK( stats.droppedCount == 3 && stats.waitingCount == 0 );
+}
+
+}
+
+int main()
+{
+    TestReject();
+    TestBlockDeadline();
+    TestBlockUntilSpace();
+    TestBlockContention();
+    TestTimerCounted();
+    TestDropOldest();
+    TestDropHardLimit();
+    TestDropLowestByKey();
+    TestDropLowestByPredicator();
+    TestDropLowestByPriority();
+    return TestResult();
+}
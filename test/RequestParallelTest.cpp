@@ -0,0 +1,209 @@
+/*
+ * Copyright (c) 2013, nilfs
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * * Neither the name of the <ORGANIZATION> nor the names of its contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "RequestUpdate.h"
+#include "RequestWorkerPool.h"
+#include "Test.h"
+
+namespace
+{
+
+const int KEY_COUNT = 16;
+
+struct PoolCounter
+{
+    std::vector< std::atomic<int> > hits;
+    explicit PoolCounter( size_t count ) : hits( count ) {}
+
+    static void Hit( void* context, size_t index )
+    {
+        static_cast<PoolCounter*>( context )->hits[index].fetch_add( 1, std::memory_order_relaxed );
+    }
+};
+
+// 複数のスレッドから同時にRunしても、どの添字も1回ずつ呼ばれる
+void TestPoolConcurrentRun()
+{
+    RequestWorkerPool pool( 3 );
+    const int CALLERS = 3;
+    const int ROUNDS = 200;
+    std::vector<std::thread> callers;
+    std::atomic<int> mismatch( 0 );
+    for( int c=0; c<CALLERS; ++c )
+    {
+        callers.push_back( std::thread( [&, c]{
+            for( int round=0; round<ROUNDS; ++round )
+            {
+                const size_t count = 1 + ( round * 7 + c ) % 40;
+                PoolCounter counter( count );
+                pool.Run( &PoolCounter::Hit, &counter, count );
+                for( size_t i=0; i<count; ++i )
+                {
+                    mismatch += counter.hits[i].load() == 1 ? 0 : 1;
+                }
+            }
+        } ) );
+    }
+    for( std::thread& thread : callers )
+    {
+        thread.join();
+    }
+    TEST_CHECK( mismatch == 0 );
+}
+
+// ワーカーがいなくても呼んだスレッドで全部処理する
+void TestPoolWithoutWorkers()
+{
+    RequestWorkerPool pool( 0 );
+    TEST_CHECK( pool.GetWorkerCount() == 0 );
+    PoolCounter counter( 10 );
+    pool.Run( &PoolCounter::Hit, &counter, 10 );
+    for( size_t i=0; i<10; ++i )
+    {
+        TEST_CHECK( counter.hits[i].load() == 1 );
+    }
+}
+
+/**
+ *  1つ目の引数をレーンのキー、2つ目をキーごとの通し番号にする
+ *  同じキーは1つのレーンで順に処理されるので、キーごとの記録はロックせずに書ける
+ */
+struct KeyedRecorder
+{
+    std::vector< std::vector<int> > executed;
+    KeyedRecorder() : executed( KEY_COUNT ) {}
+
+    void Add( RequestUpdate<int, int>& update, int count )
+    {
+        std::vector<int> next( KEY_COUNT );
+        for( int i=0; i<count; ++i )
+        {
+            const int key = ( i * 5 ) % KEY_COUNT;
+            update.AddRequest( key, next[key]++ );
+        }
+    }
+
+    bool InOrder( int countPerKey ) const
+    {
+        for( const std::vector<int>& values : executed )
+        {
+            if( values.size() != static_cast<size_t>( countPerKey ) )
+            {
+                return false;
+            }
+            for( size_t i=0; i<values.size(); ++i )
+            {
+                if( values[i] != static_cast<int>(i) )
+                {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+};
+
+// 同じキーのリクエストは追加した順に処理され、全部が1回ずつ処理される
+void TestParallelKeyOrder()
+{
+    RequestWorkerPool pool( 3 );
+    KeyedRecorder recorder;
+    RequestUpdate<int, int> update;
+    update.SetRequestExecuter( [&recorder]( int key, int sequence ){ recorder.executed[key].push_back( sequence ); } );
+    update.SetRequestParallel( &pool, []( const std::tuple<int, int>& param ){ return std::get<0>( param ); } );
+
+    for( int round=0; round<20; ++round )
+    {
+        recorder.Add( update, KEY_COUNT * 50 );
+        update.Update();
+        TEST_CHECK( recorder.InOrder( 50 ) );
+        for( std::vector<int>& values : recorder.executed )
+        {
+            values.clear();
+        }
+    }
+}
+
+// 件数で区切って持ち越しても、同じキーは並んだ順に処理する
+void TestParallelCarryOver()
+{
+    RequestWorkerPool pool( 2 );
+    KeyedRecorder recorder;
+    RequestUpdate<int, int> update;
+    update.SetRequestExecuter( [&recorder]( int key, int sequence ){ recorder.executed[key].push_back( sequence ); } );
+    update.SetRequestSortKey( []( const std::tuple<int, int>& param ){ return std::get<1>( param ); } );
+    update.SetRequestParallel( &pool, []( const std::tuple<int, int>& param ){ return std::get<0>( param ); } );
+
+    recorder.Add( update, KEY_COUNT * 20 );
+    size_t executed = 0;
+    while( executed < static_cast<size_t>( KEY_COUNT * 20 ) )
+    {
+        const size_t count = update.Update( 37 );
+        TEST_CHECK( count != 0 );
+        executed += count;
+    }
+    TEST_CHECK( executed == static_cast<size_t>( KEY_COUNT * 20 ) );
+    TEST_CHECK( update.GetPendingCount() == 0 );
+    TEST_CHECK( recorder.InOrder( 20 ) );
+}
+
+// 並列をやめれば呼んだスレッドだけで処理する
+void TestClearParallel()
+{
+    RequestWorkerPool pool( 2 );
+    RequestUpdate<int, int> update;
+    update.SetRequestParallel( &pool, []( const std::tuple<int, int>& param ){ return std::get<0>( param ); } );
+    update.ClearRequestParallel();
+
+    const std::thread::id self = std::this_thread::get_id();
+    int otherThread = 0;
+    update.SetRequestExecuter( [&]( int, int ){ otherThread += std::this_thread::get_id() == self ? 0 : 1; } );
+    for( int i=0; i<100; ++i )
+    {
+        update.AddRequest( i, i );
+    }
+    update.Update();
+    TEST_CHECK( otherThread == 0 );
+}
+
+}
+
+int main()
+{
+    TestPoolConcurrentRun();
+    TestPoolWithoutWorkers();
+    TestParallelKeyOrder();
+    TestParallelCarryOver();
+    TestClearParallel();
+    return TestResult();
+}
@@ -0,0 +1,189 @@
+/*
+ * Copyright (c) 2013, nilfs
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * * Neither the name of the <ORGANIZATION> nor the names of its contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "RequestBoundedQueue.h"
+#include "RequestPipeline.h"
+#include "Test.h"
+
+namespace
+{
+
+// 埋まったら追加できず、閉じた後は残りだけ取り出せる
+void TestQueueClose()
+{
+    RequestBoundedQueue<int> queue( 4 );
+    for( int i=0; i<4; ++i )
+    {
+        TEST_CHECK( queue.TryPush( int(i) ) );
+    }
+    TEST_CHECK( !queue.TryPush( 4 ) );
+
+    int item = -1;
+    TEST_CHECK( queue.TryPop( item ) && item == 0 );
+    queue.Close();
+    TEST_CHECK( !queue.TryPush( 5 ) );
+    TEST_CHECK( !queue.Push( 6 ) );
+
+    for( int i=1; i<4; ++i )
+    {
+        TEST_CHECK( queue.Pop( item ) && item == i );
+    }
+    TEST_CHECK( !queue.Pop( item ) );
+
+    queue.Reopen();
+    TEST_CHECK( queue.TryPush( 7 ) );
+    TEST_CHECK( queue.Pop( item ) && item == 7 );
+}
+
+// 複数のスレッドで追加と取り出しをしても、全部が1回ずつ届く
+void TestQueueContention()
+{
+    const int PRODUCERS = 4;
+    const int COUNT = 20000;
+    RequestBoundedQueue<int> queue( 64 );
+    std::vector<std::atomic<int>> seen( PRODUCERS * COUNT );
+    for( std::atomic<int>& count : seen )
+    {
+        count.store( 0 );
+    }
+
+    std::vector<std::thread> consumers;
+    for( int i=0; i<2; ++i )
+    {
+        consumers.push_back( std::thread( [&]{
+            int item = 0;
+            while( queue.Pop( item ) )
+            {
+                seen[item].fetch_add( 1 );
+            }
+        } ) );
+    }
+    std::vector<std::thread> producers;
+    for( int p=0; p<PRODUCERS; ++p )
+    {
+        producers.push_back( std::thread( [&queue, p]{
+            for( int i=0; i<COUNT; ++i )
+            {
+                queue.Push( p * COUNT + i );
+            }
+        } ) );
+    }
+    for( std::thread& thread : producers )
+    {
+        thread.join();
+    }
+    queue.Close();
+    for( std::thread& thread : consumers )
+    {
+        thread.join();
+    }
+
+    int missing = 0;
+    for( std::atomic<int>& count : seen )
+    {
+        missing += count.load() == 1 ? 0 : 1;
+    }
+    TEST_CHECK( missing == 0 );
+}
+
+void BuildPipeline( RequestPipeline<int>& pipeline, std::atomic<long>& sum )
+{
+    pipeline.Begin()
+        .Then<int>( "double", []( int&& value, RequestPipelineOutput<int>& out ){ out.Push( value * 2 ); }, 2, 8 )
+        .Then<int>( "odd", []( int&& value, RequestPipelineOutput<int>& out ){ out.Push( value + 1 ); }, 1, 8 )
+        .Finally( "sum", [&sum]( int&& value ){ sum.fetch_add( value ); }, 1, 8 );
+}
+
+// Stopまでに追加したものは全て処理して、Stopの後は追加できない
+void TestPipelineStop()
+{
+    std::atomic<long> sum( 0 );
+    RequestPipeline<int> pipeline;
+    BuildPipeline( pipeline, sum );
+    TEST_CHECK( pipeline.Start() );
+    TEST_CHECK( !pipeline.Start() );
+
+    long expected = 0;
+    for( int i=0; i<1000; ++i )
+    {
+        TEST_CHECK( pipeline.Push( int(i) ) );
+        expected += i * 2 + 1;
+    }
+    pipeline.Stop();
+    TEST_CHECK( sum.load() == expected );
+
+    TEST_CHECK( !pipeline.Push( 1 ) );
+    TEST_CHECK( !pipeline.TryPush( 1 ) );
+    TEST_CHECK( sum.load() == expected );
+
+    // もう一度動かせる
+    TEST_CHECK( pipeline.Start() );
+    TEST_CHECK( pipeline.Push( 10 ) );
+    pipeline.Stop();
+    TEST_CHECK( sum.load() == expected + 21 );
+
+    std::vector<RequestPipelineStageStats> stats = pipeline.GetStats();
+    TEST_CHECK( stats.size() == 3 && stats[2].processed == 1001 );
+}
+
+// Finallyまでつないでいなければ動かさず、追加もできない
+void TestPipelineIncomplete()
+{
+    RequestPipeline<int> pipeline;
+    pipeline.Begin().Then<int>( "double", []( int&& value, RequestPipelineOutput<int>& out ){ out.Push( value * 2 ); } );
+    TEST_CHECK( !pipeline.Start() );
+    TEST_CHECK( !pipeline.Push( 1 ) );
+    TEST_CHECK( !pipeline.TryPush( 1 ) );
+}
+
+// 段を1つもつないでいなくても、追加はfalseを返すだけで落ちない
+void TestPipelineEmpty()
+{
+    RequestPipeline<int> pipeline;
+    TEST_CHECK( !pipeline.Push( 1 ) );
+    TEST_CHECK( !pipeline.TryPush( 1 ) );
+    TEST_CHECK( !pipeline.Start() );
+    pipeline.Stop();
+}
+
+}
+
+int main()
+{
+    TestQueueClose();
+    TestQueueContention();
+    TestPipelineStop();
+    TestPipelineIncomplete();
+    TestPipelineEmpty();
+    return TestResult();
+}
@@ -0,0 +1,135 @@
+/*
+ * Copyright (c) 2013, nilfs
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * * Neither the name of the <ORGANIZATION> nor the names of its contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <vector>
+
+#include "RequestUpdate.h"
+#include "Test.h"
+
+namespace
+{
+
+typedef RequestUpdate<int, int> PriorityUpdate;
+
+// 1つ目の引数を優先度、2つ目を処理した順番を見るための番号にする
+void SetPriority( PriorityUpdate& update, std::vector<int>& executed, size_t bucketCount, RequestBucketOrder order )
+{
+    update.SetRequestPriority( []( const std::tuple<int, int>& param ){ return std::get<0>( param ); }, bucketCount, order );
+    update.SetRequestExecuter( [&executed]( int, int id ){ executed.push_back( id ); } );
+}
+
+// 優先度の小さいバケツから、バケツの中は追加した順に処理する。範囲外の優先度は最後のバケツに入る
+void TestBucketFifo()
+{
+    std::vector<int> executed;
+    PriorityUpdate update;
+    SetPriority( update, executed, 3, REQUEST_BUCKET_FIFO );
+
+    update.AddRequest( 2, 1 );
+    update.AddRequest( 0, 2 );
+    update.AddRequest( 1, 3 );
+    update.AddRequest( 9, 4 );
+    update.AddRequest( 0, 5 );
+    update.AddRequest( 2, 6 );
+    update.Update();
+
+    const int expected[] = { 2, 5, 3, 1, 4, 6 };
+    TEST_CHECK( executed == std::vector<int>( expected, expected + 6 ) );
+    TEST_CHECK( update.GetPendingCount() == 0 );
+}
+
+// LIFOではバケツの中を後から追加したものから処理する
+void TestBucketLifo()
+{
+    std::vector<int> executed;
+    PriorityUpdate update;
+    SetPriority( update, executed, 2, REQUEST_BUCKET_LIFO );
+
+    update.AddRequest( 1, 1 );
+    update.AddRequest( 0, 2 );
+    update.AddRequest( 1, 3 );
+    update.AddRequest( 0, 4 );
+    update.Update();
+
+    const int expected[] = { 4, 2, 3, 1 };
+    TEST_CHECK( executed == std::vector<int>( expected, expected + 4 ) );
+}
+
+// 件数で区切ると残りはバケツに持ち越し、次のUpdateで後から来た優先度の高いものが先に処理される
+void TestBucketCarryOver()
+{
+    std::vector<int> executed;
+    PriorityUpdate update;
+    SetPriority( update, executed, 2, REQUEST_BUCKET_FIFO );
+
+    update.AddRequest( 1, 1 );
+    update.AddRequest( 1, 2 );
+    update.AddRequest( 1, 3 );
+    TEST_CHECK( update.Update( 1 ) == 1 );
+    TEST_CHECK( update.GetPendingCount() == 2 );
+
+    update.AddRequest( 0, 4 );
+    update.AddRequest( 1, 5 );
+    TEST_CHECK( update.Update( 2 ) == 2 );
+    TEST_CHECK( update.GetPendingCount() == 2 );
+
+    TEST_CHECK( update.Update( RequestUpdateBudget() ) == 2 );
+    const int expected[] = { 1, 4, 2, 3, 5 };
+    TEST_CHECK( executed == std::vector<int>( expected, expected + 5 ) );
+    TEST_CHECK( update.GetPendingCount() == 0 );
+}
+
+// LIFOで持ち越すと、次のUpdateでは新しく来た分から処理する
+void TestBucketLifoCarryOver()
+{
+    std::vector<int> executed;
+    PriorityUpdate update;
+    SetPriority( update, executed, 1, REQUEST_BUCKET_LIFO );
+
+    update.AddRequest( 0, 1 );
+    update.AddRequest( 0, 2 );
+    TEST_CHECK( update.Update( 1 ) == 1 );
+
+    update.AddRequest( 0, 3 );
+    update.Update();
+
+    const int expected[] = { 2, 3, 1 };
+    TEST_CHECK( executed == std::vector<int>( expected, expected + 3 ) );
+}
+
+}
+
+int main()
+{
+    TestBucketFifo();
+    TestBucketLifo();
+    TestBucketCarryOver();
+    TestBucketLifoCarryOver();
+    return TestResult();
+}
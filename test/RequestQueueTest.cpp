@@ -0,0 +1,271 @@
+/*
+ * Copyright (c) 2013, nilfs
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * * Neither the name of the <ORGANIZATION> nor the names of its contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <cstdint>
+
+#include "MpscRequestQueue.h"
+#include "SpscRequestQueue.h"
+#include "RequestUpdate.h"
+#include "Test.h"
+
+namespace
+{
+
+// 別のスレッドで取り出しても、追加した順に全部届く。リングを何度も育てる
+void TestSpscOrder()
+{
+    const int COUNT = 200000;
+    SpscRequestQueue<int> queue( 2 );
+    std::thread producer( [&queue]{
+        for( int i=0; i<COUNT; ++i )
+        {
+            queue.Push( i );
+        }
+    } );
+
+    std::vector<int> items;
+    int expected = 0;
+    bool ordered = true;
+    while( expected < COUNT )
+    {
+        items.clear();
+        queue.PopAll( items );
+        for( int item : items )
+        {
+            ordered = ordered && item == expected;
+            ++expected;
+        }
+    }
+    producer.join();
+    TEST_CHECK( ordered );
+    TEST_CHECK( expected == COUNT );
+    TEST_CHECK( queue.IsEmpty() );
+}
+
+// 取り出さなかった要素はデストラクタで破棄する
+void TestSpscDestroy()
+{
+    std::shared_ptr<int> shared = std::make_shared<int>( 0 );
+    {
+        SpscRequestQueue< std::shared_ptr<int> > queue( 4 );
+        for( int i=0; i<10; ++i )
+        {
+            queue.Push( shared );
+        }
+        std::vector< std::shared_ptr<int> > items;
+        queue.PopAll( items );
+        TEST_CHECK( items.size() == 10 );
+        for( int i=0; i<7; ++i )
+        {
+            queue.Push( shared );
+        }
+        TEST_CHECK( !queue.IsEmpty() );
+    }
+    TEST_CHECK( shared.use_count() == 1 );
+}
+
+// TryPushは埋まっていたら確保せずに失敗し、取り出せばまた入る
+void TestSpscTryPush()
+{
+    SpscRequestQueue<int> queue( 4 );
+    for( int i=0; i<4; ++i )
+    {
+        TEST_CHECK( queue.TryPush( i ) );
+    }
+    TEST_CHECK( !queue.TryPush( 4 ) );
+
+    std::vector<int> items;
+    queue.PopAll( items );
+    TEST_CHECK( items.size() == 4 && items[3] == 3 );
+    TEST_CHECK( queue.TryPush( 5 ) );
+    items.clear();
+    queue.PopAll( items );
+    TEST_CHECK( items.size() == 1 && items[0] == 5 );
+}
+
+// 大きさを固定したら、Pushは取り出されるまで待って、小さなリングのまま追加した順に全部届ける
+void TestSpscFixed()
+{
+    const int COUNT = 20000;
+    SpscRequestQueue<int> queue( 8, false );
+    std::thread producer( [&queue]{
+        for( int i=0; i<COUNT; ++i )
+        {
+            queue.Push( i );
+        }
+    } );
+
+    std::vector<int> items;
+    int expected = 0;
+    bool ordered = true;
+    size_t largest = 0;
+    while( expected < COUNT )
+    {
+        items.clear();
+        queue.PopAll( items );
+        largest = largest < items.size() ? items.size() : largest;
+        if( items.empty() )
+        {
+            // CPUが1つでも追加側に回す
+            std::this_thread::yield();
+        }
+        for( int item : items )
+        {
+            ordered = ordered && item == expected;
+            ++expected;
+        }
+    }
+    producer.join();
+    TEST_CHECK( ordered );
+    TEST_CHECK( largest <= 8 );
+}
+
+// 固定の大きさのキューを使うRequestUpdateも、別のスレッドから追加した分を順に全部処理する
+void TestSpscFixedPolicy()
+{
+    const int COUNT = 20000;
+    BasicRequestUpdate< RequestUpdateSpscFixed<16>, int > update;
+    int expected = 0;
+    bool ordered = true;
+    update.SetRequestExecuter( [&]( int value ){
+        ordered = ordered && value == expected;
+        ++expected;
+    } );
+
+    std::thread producer( [&update]{
+        for( int i=0; i<COUNT; ++i )
+        {
+            update.AddRequest( i );
+        }
+    } );
+    while( expected < COUNT )
+    {
+        if( update.Update( RequestUpdateBudget() ) == 0 )
+        {
+            std::this_thread::yield();
+        }
+    }
+    producer.join();
+    TEST_CHECK( ordered );
+    TEST_CHECK( expected == COUNT );
+}
+
+// ストライプより多いスレッドから追加しても、スレッドごとの順番と数が合う
+void TestMpscContention()
+{
+    const int PRODUCERS = 12;
+    const uint64_t COUNT = 50000;
+    MpscRequestQueue<uint64_t> queue;
+    std::atomic<int> finished( 0 );
+    std::vector<std::thread> producers;
+    for( int p=0; p<PRODUCERS; ++p )
+    {
+        producers.push_back( std::thread( [&queue, &finished, p]{
+            for( uint64_t i=0; i<COUNT; ++i )
+            {
+                queue.Push( ( uint64_t(p) << 32 ) | i );
+            }
+            ++finished;
+        } ) );
+    }
+
+    std::vector<uint64_t> next( PRODUCERS, 0 );
+    std::vector<uint64_t> items;
+    bool ordered = true;
+    uint64_t total = 0;
+    for(;;)
+    {
+        // 全員が終わったのを見てからもう1回取り出せば残りはない
+        const bool done = finished.load() == PRODUCERS;
+        items.clear();
+        queue.PopAll( items );
+        for( uint64_t item : items )
+        {
+            const size_t producer = static_cast<size_t>( item >> 32 );
+            ordered = ordered && producer < next.size() && ( item & 0xffffffffu ) == next[producer];
+            if( producer < next.size() )
+            {
+                ++next[producer];
+            }
+        }
+        total += items.size();
+        if( done )
+        {
+            break;
+        }
+    }
+    for( std::thread& thread : producers )
+    {
+        thread.join();
+    }
+
+    TEST_CHECK( ordered );
+    TEST_CHECK( total == PRODUCERS * COUNT );
+    TEST_CHECK( queue.IsEmpty() );
+}
+
+// ムーブしかできない型も通り、取り出さなかった要素はデストラクタで破棄する
+void TestMpscMoveOnly()
+{
+    std::shared_ptr<int> shared = std::make_shared<int>( 0 );
+    {
+        MpscRequestQueue< std::unique_ptr< std::shared_ptr<int> > > queue;
+        for( int i=0; i<1000; ++i )
+        {
+            queue.Push( std::unique_ptr< std::shared_ptr<int> >( new std::shared_ptr<int>( shared ) ) );
+        }
+        std::vector< std::unique_ptr< std::shared_ptr<int> > > items;
+        queue.PopAll( items );
+        TEST_CHECK( items.size() == 1000 );
+        for( int i=0; i<300; ++i )
+        {
+            queue.Push( std::unique_ptr< std::shared_ptr<int> >( new std::shared_ptr<int>( shared ) ) );
+        }
+        TEST_CHECK( !queue.IsEmpty() );
+    }
+    TEST_CHECK( shared.use_count() == 1 );
+}
+
+}
+
+int main()
+{
+    TestSpscOrder();
+    TestSpscDestroy();
+    TestSpscTryPush();
+    TestSpscFixed();
+    TestSpscFixedPolicy();
+    TestMpscContention();
+    TestMpscMoveOnly();
+    return TestResult();
+}
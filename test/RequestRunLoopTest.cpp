@@ -0,0 +1,169 @@
+/*
+ * Copyright (c) 2013, nilfs
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * * Neither the name of the <ORGANIZATION> nor the names of its contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#include "RequestRunLoop.h"
+#include "RequestUpdate.h"
+#include "Test.h"
+
+namespace
+{
+
+typedef std::chrono::steady_clock Clock;
+
+// 今の時刻に足すと溢れるtimeoutでも、すぐには戻らずNotifyされるまで寝る
+void TestParkMaxTimeout()
+{
+    RequestWakeup wakeup;
+    std::atomic<bool> returned( false );
+    Clock::duration slept = Clock::duration::zero();
+
+    wakeup.Prepare();
+    std::thread sleeper( [&]{
+        const Clock::time_point start = Clock::now();
+        wakeup.Park( Clock::duration::max() );
+        slept = Clock::now() - start;
+        returned = true;
+    } );
+
+    std::this_thread::sleep_for( std::chrono::milliseconds(50) );
+    TEST_CHECK( !returned );
+    wakeup.Notify();
+    sleeper.join();
+    TEST_CHECK( slept >= std::chrono::milliseconds(40) );
+    TEST_CHECK( wakeup.GetWakeCount() == 1 );
+}
+
+// 型の違う長いtimeoutでも溢れない
+void TestParkMaxTimeoutOtherUnits()
+{
+    RequestWakeup wakeup;
+    wakeup.Prepare();
+    std::thread sleeper( [&]{ wakeup.Park( std::chrono::hours::max() ); } );
+    std::this_thread::sleep_for( std::chrono::milliseconds(20) );
+    wakeup.Notify();
+    sleeper.join();
+    TEST_CHECK( wakeup.GetWakeCount() == 1 );
+
+    // 短いtimeoutはいつも通り過ぎたら戻る
+    const Clock::time_point start = Clock::now();
+    wakeup.Prepare();
+    wakeup.Park( std::chrono::milliseconds(10) );
+    TEST_CHECK( Clock::now() - start >= std::chrono::milliseconds(10) );
+    TEST_CHECK( wakeup.GetWakeCount() == 1 );
+}
+
+// parkTimeoutとspinDurationがDuration::max()でも、空回りせずに寝て、起こせば止まる
+void TestRunMaxDurations()
+{
+    RequestUpdate<int> update;
+    std::atomic<int> executed( 0 );
+    update.SetRequestExecuter( [&]( int ){ ++executed; } );
+
+    RequestStopSource stop;
+    std::thread consumer( [&]{
+        update.Run( stop.GetToken(), RequestRunOptions( RequestRunOptions::Duration::zero(), RequestRunOptions::Duration::max() ) );
+    } );
+
+    std::this_thread::sleep_for( std::chrono::milliseconds(50) );
+    update.AddRequest( 1 );
+    for( int i=0; i<1000 && executed.load() == 0; ++i )
+    {
+        std::this_thread::sleep_for( std::chrono::milliseconds(1) );
+    }
+    TEST_CHECK( executed == 1 );
+
+    stop.RequestStop();
+    update.WakeConsumer();
+    consumer.join();
+
+    // 溢れてすぐに戻っていれば、何千回も寝直している
+    TEST_CHECK( update.GetStats().parkCount <= 4 );
+
+    // spinDurationがDuration::max()でも、止めるように言われれば戻る
+    RequestStopSource spinStop;
+    std::thread spinner( [&]{
+        update.Run( spinStop.GetToken(), RequestRunOptions( RequestRunOptions::Duration::max() ) );
+    } );
+    std::this_thread::sleep_for( std::chrono::milliseconds(20) );
+    update.AddRequest( 2 );
+    for( int i=0; i<1000 && executed.load() == 1; ++i )
+    {
+        std::this_thread::sleep_for( std::chrono::milliseconds(1) );
+    }
+    spinStop.RequestStop();
+    spinner.join();
+    TEST_CHECK( executed == 2 );
+}
+
+// Runを始めるのと同時に追加しても、寝たまま見落とさない
+void TestRunStartRace()
+{
+    const int ROUNDS = 200;
+    int missed = 0;
+    for( int round=0; round<ROUNDS; ++round )
+    {
+        RequestUpdate<int> update;
+        std::atomic<int> executed( 0 );
+        update.SetRequestExecuter( [&]( int ){ ++executed; } );
+
+        RequestStopSource stop;
+        std::thread consumer( [&]{
+            update.Run( stop.GetToken(), RequestRunOptions( RequestRunOptions::Duration::zero(), RequestRunOptions::Duration::max() ) );
+        } );
+        update.AddRequest( round );
+
+        // 見落とすと、parkTimeoutが無限なので起こされるまで処理しない
+        const Clock::time_point deadline = Clock::now() + std::chrono::seconds(2);
+        while( executed.load() == 0 && Clock::now() < deadline )
+        {
+            std::this_thread::yield();
+        }
+        missed += executed.load() == 0 ? 1 : 0;
+
+        stop.RequestStop();
+        update.WakeConsumer();
+        consumer.join();
+    }
+    TEST_CHECK( missed == 0 );
+}
+
+}
+
+int main()
+{
+    TestParkMaxTimeout();
+    TestParkMaxTimeoutOtherUnits();
+    TestRunMaxDurations();
+    TestRunStartRace();
+    return TestResult();
+}
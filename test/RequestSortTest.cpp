@@ -0,0 +1,204 @@
+/*
+ * Copyright (c) 2013, nilfs
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * * Neither the name of the <ORGANIZATION> nor the names of its contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <cstdint>
+#include <limits>
+#include <vector>
+#include <algorithm>
+
+#include "RequestSort.h"
+#include "Test.h"
+
+namespace
+{
+
+template< typename Key >
+uint64_t Encode( Key key ){ return RequestSortKeyTraits<Key>::Encode( key ); }
+
+enum SignedOrder : int8_t
+{
+    ORDER_LOW = -5,
+    ORDER_MID = 0,
+    ORDER_HIGH = 7,
+};
+
+// 符号付き整数は負の数が前に来る
+void TestSignedEncode()
+{
+    TEST_CHECK( Encode<int32_t>( std::numeric_limits<int32_t>::min() ) < Encode<int32_t>( -1 ) );
+    TEST_CHECK( Encode<int32_t>( -1 ) < Encode<int32_t>( 0 ) );
+    TEST_CHECK( Encode<int32_t>( 0 ) < Encode<int32_t>( 1 ) );
+    TEST_CHECK( Encode<int32_t>( 1 ) < Encode<int32_t>( std::numeric_limits<int32_t>::max() ) );
+    TEST_CHECK( Encode<int64_t>( std::numeric_limits<int64_t>::min() ) < Encode<int64_t>( std::numeric_limits<int64_t>::max() ) );
+    TEST_CHECK( Encode<int8_t>( -128 ) < Encode<int8_t>( 127 ) );
+    TEST_CHECK( Encode<uint32_t>( 0 ) < Encode<uint32_t>( std::numeric_limits<uint32_t>::max() ) );
+}
+
+// -0と0は同じキー、NaNは符号にかかわらず最後に来る
+template< typename Float >
+void TestFloatEncode()
+{
+    const Float nan = std::numeric_limits<Float>::quiet_NaN();
+    const Float inf = std::numeric_limits<Float>::infinity();
+
+    TEST_CHECK( Encode<Float>( -0.0 ) == Encode<Float>( 0.0 ) );
+    TEST_CHECK( Encode<Float>( -inf ) < Encode<Float>( -1.5 ) );
+    TEST_CHECK( Encode<Float>( -1.5 ) < Encode<Float>( -std::numeric_limits<Float>::denorm_min() ) );
+    TEST_CHECK( Encode<Float>( -std::numeric_limits<Float>::denorm_min() ) < Encode<Float>( 0.0 ) );
+    TEST_CHECK( Encode<Float>( 0.0 ) < Encode<Float>( std::numeric_limits<Float>::denorm_min() ) );
+    TEST_CHECK( Encode<Float>( 1.5 ) < Encode<Float>( inf ) );
+    TEST_CHECK( Encode<Float>( inf ) < Encode<Float>( nan ) );
+    TEST_CHECK( Encode<Float>( inf ) < Encode<Float>( -nan ) );
+    TEST_CHECK( Encode<Float>( nan ) == Encode<Float>( -nan ) );
+}
+
+// 列挙型は元の整数型の順番で並ぶ
+void TestEnumEncode()
+{
+    TEST_CHECK( Encode( ORDER_LOW ) < Encode( ORDER_MID ) );
+    TEST_CHECK( Encode( ORDER_MID ) < Encode( ORDER_HIGH ) );
+    TEST_CHECK( Encode( ORDER_LOW ) == Encode<int8_t>( -5 ) );
+}
+
+std::vector<RequestSortEntry> MakeEntries( size_t size, uint32_t seed )
+{
+    std::vector<RequestSortEntry> entries;
+    uint32_t state = seed;
+    for( size_t i=0; i<size; ++i )
+    {
+        state = state * 1664525u + 1013904223u;
+        RequestSortEntry entry;
+        // 重複するキーと上位の桁だけが違うキーを混ぜる
+        entry.key = Encode<int32_t>( static_cast<int32_t>( state >> 8 ) % 64 - 32 ) + ( static_cast<uint64_t>( state & 3 ) << 40 );
+        entry.index = static_cast<uint32_t>(i);
+        entries.push_back( entry );
+    }
+    return entries;
+}
+
+bool SameKeys( const std::vector<RequestSortEntry>& lhs, const std::vector<RequestSortEntry>& rhs )
+{
+    if( lhs.size() != rhs.size() )
+    {
+        return false;
+    }
+    for( size_t i=0; i<lhs.size(); ++i )
+    {
+        if( lhs[i].key != rhs[i].key )
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool SameEntries( const std::vector<RequestSortEntry>& lhs, const std::vector<RequestSortEntry>& rhs )
+{
+    if( !SameKeys( lhs, rhs ) )
+    {
+        return false;
+    }
+    for( size_t i=0; i<lhs.size(); ++i )
+    {
+        if( lhs[i].index != rhs[i].index )
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// しきい値の前後で、どの並べ方でもキーの順番は同じ。安定な並べ方は添字の順番も保つ
+void TestEnginesAgree()
+{
+    const size_t sizes[] = { 2, 30, 200, RequestSorter::RADIX_THRESHOLD - 1, RequestSorter::RADIX_THRESHOLD, 300, 1000 };
+    RequestSorter sorter;
+    for( size_t size : sizes )
+    {
+        const std::vector<RequestSortEntry> source = MakeEntries( size, static_cast<uint32_t>(size) );
+        std::vector<RequestSortEntry> expected = source;
+        std::stable_sort( expected.begin(), expected.end(), []( const RequestSortEntry& lhs, const RequestSortEntry& rhs ){ return lhs.key < rhs.key; } );
+
+        std::vector<RequestSortEntry> radix = source;
+        sorter.Sort( radix, REQUEST_SORT_RADIX );
+        TEST_CHECK( SameEntries( radix, expected ) );
+
+        std::vector<RequestSortEntry> stable = source;
+        sorter.Sort( stable, REQUEST_SORT_STABLE );
+        TEST_CHECK( SameEntries( stable, expected ) );
+
+        std::vector<RequestSortEntry> pdq = source;
+        sorter.Sort( pdq, REQUEST_SORT_PDQ );
+        TEST_CHECK( SameKeys( pdq, expected ) );
+
+        std::vector<RequestSortEntry> automatic = source;
+        sorter.Sort( automatic, REQUEST_SORT_AUTO );
+        TEST_CHECK( SameKeys( automatic, expected ) );
+    }
+}
+
+// 浮動小数点数のキーも基数ソートと比較ソートで同じ順番になり、NaNは最後に集まる
+void TestFloatEnginesAgree()
+{
+    const double values[] = { 3.0, -0.0, std::numeric_limits<double>::quiet_NaN(), -2.5, 0.0, -std::numeric_limits<double>::quiet_NaN(), 1e300, -1e-300 };
+    const size_t count = sizeof(values) / sizeof(values[0]);
+    std::vector<RequestSortEntry> source;
+    for( size_t i=0; i<600; ++i )
+    {
+        RequestSortEntry entry;
+        entry.key = Encode( values[i % count] );
+        entry.index = static_cast<uint32_t>(i);
+        source.push_back( entry );
+    }
+
+    RequestSorter sorter;
+    std::vector<RequestSortEntry> radix = source;
+    sorter.Sort( radix, REQUEST_SORT_RADIX );
+    std::vector<RequestSortEntry> pdq = source;
+    sorter.Sort( pdq, REQUEST_SORT_PDQ );
+    TEST_CHECK( SameKeys( radix, pdq ) );
+
+    const uint64_t nanKey = Encode( std::numeric_limits<double>::quiet_NaN() );
+    TEST_CHECK( radix.front().key == Encode( -2.5 ) );
+    TEST_CHECK( radix[ radix.size() - 150 ].key == nanKey );
+    TEST_CHECK( radix.back().key == nanKey );
+}
+
+}
+
+int main()
+{
+    TestSignedEncode();
+    TestFloatEncode<float>();
+    TestFloatEncode<double>();
+    TestEnumEncode();
+    TestEnginesAgree();
+    TestFloatEnginesAgree();
+    return TestResult();
+}
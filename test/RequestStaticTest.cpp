@@ -0,0 +1,120 @@
+/*
+ * Copyright (c) 2013, nilfs
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * * Neither the name of the <ORGANIZATION> nor the names of its contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <memory>
+#include <vector>
+
+#include "RequestStaticUpdate.h"
+#include "Test.h"
+
+namespace
+{
+
+// 型として渡すエグゼキュータ。記録先だけを持つ
+struct Recorder
+{
+    std::vector<int>* executed;
+    void operator()( int value, float ) const { executed->push_back( value ); }
+};
+
+struct ByValue
+{
+    bool operator()( const std::tuple<int, float>& lhs, const std::tuple<int, float>& rhs ) const
+    {
+        return std::get<1>( lhs ) < std::get<1>( rhs );
+    }
+};
+
+// 比較関数の順に処理して、処理した数を返す
+void TestStaticSorted()
+{
+    std::vector<int> executed;
+    auto update = MakeRequestUpdate<int, float>(
+        [&executed]( int id, float ){ executed.push_back( id ); },
+        []( const std::tuple<int, float>& lhs, const std::tuple<int, float>& rhs ){ return std::get<1>( lhs ) < std::get<1>( rhs ); } );
+
+    update->AddRequest( 0, 3.0f );
+    update->AddRequest( 1, 1.0f );
+    update->AddRequest( 2, 2.0f );
+    TEST_CHECK( update->Update() == 3 );
+
+    const int expected[] = { 1, 2, 0 };
+    TEST_CHECK( executed == std::vector<int>( expected, expected + 3 ) );
+    TEST_CHECK( update->Update() == 0 );
+}
+
+// 比較関数を渡さなければ追加した順
+void TestStaticUnsorted()
+{
+    std::vector<int> executed;
+    auto update = MakeRequestUpdate<int, float>( Recorder{ &executed } );
+    for( int i=5; 0<=i; --i )
+    {
+        update->AddRequest( i, 0.0f );
+    }
+    TEST_CHECK( update->Update() == 6 );
+
+    const int expected[] = { 5, 4, 3, 2, 1, 0 };
+    TEST_CHECK( executed == std::vector<int>( expected, expected + 6 ) );
+}
+
+// スレッドの方針と関数の型を直接指定する。エグゼキュータには引数をムーブして渡す
+void TestStaticSingleThreadMoveOnly()
+{
+    int sum = 0;
+    auto executer = [&sum]( std::unique_ptr<int> value, int scale ){ sum += *value * scale; };
+    BasicStaticRequestUpdate< RequestUpdateSingleThread, decltype(executer), RequestNoSort, std::unique_ptr<int>, int > update( executer );
+
+    update.EmplaceRequest( std::unique_ptr<int>( new int( 4 ) ), 10 );
+    update.EmplaceRequest( std::unique_ptr<int>( new int( 2 ) ), 1 );
+    TEST_CHECK( update.Update() == 2 );
+    TEST_CHECK( sum == 42 );
+}
+
+// 比較関数の型も直接指定できる
+void TestStaticComparatorType()
+{
+    std::vector<int> executed;
+    BasicStaticRequestUpdate< RequestUpdateSingleThread, Recorder, ByValue, int, float > update( Recorder{ &executed } );
+    update.AddRequest( 0, 2.0f );
+    update.AddRequest( 1, -2.0f );
+    update.Update();
+    TEST_CHECK( executed.size() == 2 && executed[0] == 1 && executed[1] == 0 );
+}
+
+}
+
+int main()
+{
+    TestStaticSorted();
+    TestStaticUnsorted();
+    TestStaticSingleThreadMoveOnly();
+    TestStaticComparatorType();
+    return TestResult();
+}
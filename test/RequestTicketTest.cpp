@@ -0,0 +1,272 @@
+/*
+ * Copyright (c) 2013, nilfs
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * * Neither the name of the <ORGANIZATION> nor the names of its contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <mutex>
+
+#include "RequestTicket.h"
+#include "RequestUpdate.h"
+#include "Test.h"
+
+namespace
+{
+
+// 取り消しと処理を同時に試しても、どちらか片方だけが成功する。使い回した番号の古い券は取り消せない
+void TestCancelClaimRace()
+{
+    const int ROUNDS = 200;
+    const int COUNT = 256;
+    const int CANCELLERS = 3;
+    RequestTicketTable table;
+    int mismatch = 0;
+    int staleCancelled = 0;
+    std::vector<RequestTicket> previous;
+
+    for( int round=0; round<ROUNDS; ++round )
+    {
+        std::vector<RequestTicket> tickets;
+        for( int i=0; i<COUNT; ++i )
+        {
+            tickets.push_back( table.Acquire() );
+        }
+
+        std::atomic<int> cancelled( 0 );
+        std::vector<std::thread> cancellers;
+        for( int c=0; c<CANCELLERS; ++c )
+        {
+            cancellers.push_back( std::thread( [&, c]{
+                for( int i=c; i<COUNT; i+=CANCELLERS )
+                {
+                    cancelled += table.Cancel( tickets[i] ) ? 1 : 0;
+                }
+            } ) );
+        }
+        int claimed = 0;
+        for( const RequestTicket& ticket : tickets )
+        {
+            claimed += table.Claim( ticket ) ? 1 : 0;
+        }
+        for( std::thread& thread : cancellers )
+        {
+            thread.join();
+        }
+        mismatch += claimed + cancelled.load() == COUNT ? 0 : 1;
+
+        // 番号は使い回されているので、前の回の券を取り消しても今の券には効かない
+        for( const RequestTicket& ticket : previous )
+        {
+            staleCancelled += table.Cancel( ticket ) ? 1 : 0;
+        }
+        previous = tickets;
+    }
+    TEST_CHECK( mismatch == 0 );
+    TEST_CHECK( staleCancelled == 0 );
+}
+
+// 無効な券は取り消せず、処理すると決めたことになる
+void TestInvalidTicket()
+{
+    RequestTicketTable table;
+    const RequestTicket invalid;
+    TEST_CHECK( !invalid.IsValid() );
+    TEST_CHECK( !table.Cancel( invalid ) );
+    TEST_CHECK( table.Claim( invalid ) );
+}
+
+// 並べ替えないときは、券のあるリクエストも券のないリクエストと追加した順に処理する。取り消したものだけ抜ける
+void TestMixedOrder()
+{
+    RequestUpdate<int> update;
+    std::vector<int> executed;
+    update.SetRequestExecuter( [&executed]( int value ){ executed.push_back( value ); } );
+
+    std::vector<RequestTicket> tickets;
+    for( int i=0; i<8; ++i )
+    {
+        if( i % 2 == 0 )
+        {
+            update.AddRequest( i );
+        }
+        else
+        {
+            tickets.push_back( update.AddCancellableRequest( i ) );
+        }
+    }
+    TEST_CHECK( update.Cancel( tickets[1] ) );
+    update.Update();
+    TEST_CHECK( executed == std::vector<int>({ 0, 1, 2, 4, 5, 6, 7 }) );
+
+    // 持ち越しても順番は変わらず、持ち越した後でも取り消せる
+    executed.clear();
+    tickets.clear();
+    for( int i=0; i<8; ++i )
+    {
+        if( i % 3 == 0 )
+        {
+            tickets.push_back( update.AddCancellableRequest( i ) );
+        }
+        else
+        {
+            update.AddRequest( i );
+        }
+    }
+    update.Update( 2 );
+    TEST_CHECK( executed == std::vector<int>({ 0, 1 }) );
+    TEST_CHECK( update.Cancel( tickets[1] ) );
+    update.Update();
+    TEST_CHECK( executed == std::vector<int>({ 0, 1, 2, 4, 5, 6, 7 }) );
+}
+
+// 上限に収めるために今回の分を詰めても、券は同じリクエストに付いたまま
+void TestTrimKeepsTickets()
+{
+    RequestUpdate<int> update;
+    std::vector<int> executed;
+    update.SetRequestCapacity( 4, REQUEST_OVERLOAD_DROP_OLDEST );
+    update.SetRequestExecuter( [&executed]( int value ){ executed.push_back( value ); } );
+
+    const RequestTicket first = update.AddCancellableRequest( 0 );
+    update.AddRequest( 1 );
+    const RequestTicket second = update.AddCancellableRequest( 2 );
+    update.AddRequest( 3 );
+    update.AddRequest( 4 );
+    const RequestTicket last = update.AddCancellableRequest( 5 );
+    TEST_CHECK( update.Cancel( last ) );
+
+    // 取り消した5は取り出したときに捨て、上限を超えた1件は一番古い0を捨てる
+    update.Update( 1 );
+    TEST_CHECK( executed == std::vector<int>({ 1 }) );
+    TEST_CHECK( !update.Cancel( first ) );
+    TEST_CHECK( update.Cancel( second ) );
+    update.Update();
+    TEST_CHECK( executed == std::vector<int>({ 1, 3, 4 }) );
+}
+
+/**
+ *  追加しながら別のスレッドで取り消して、処理した数と取り消せた数の合計が追加した数に合う
+ *  setupで並べ方を変えて、取り出すときに使い切る場合と処理するときに使い切る場合を試す
+ */
+template< typename Setup >
+void RunCancelDuringUpdate( Setup setup, const RequestUpdateBudget& budget )
+{
+    const int PRODUCERS = 2;
+    const int COUNT = 5000;
+    RequestUpdate<int> update;
+    std::atomic<int> executed( 0 );
+    update.SetRequestExecuter( [&executed]( int ){ ++executed; } );
+    setup( update );
+
+    std::mutex ticketMutex;
+    std::vector<RequestTicket> tickets;
+    std::atomic<int> producing( PRODUCERS );
+    std::atomic<int> cancelled( 0 );
+    std::vector<std::thread> threads;
+    for( int p=0; p<PRODUCERS; ++p )
+    {
+        threads.push_back( std::thread( [&]{
+            for( int i=0; i<COUNT; ++i )
+            {
+                const RequestTicket ticket = update.AddCancellableRequest( i );
+                std::lock_guard<std::mutex> lock( ticketMutex );
+                tickets.push_back( ticket );
+            }
+            --producing;
+        } ) );
+    }
+    threads.push_back( std::thread( [&]{
+        size_t next = 0;
+        for(;;)
+        {
+            const bool done = producing.load() == 0;
+            RequestTicket ticket;
+            {
+                std::lock_guard<std::mutex> lock( ticketMutex );
+                if( tickets.size() <= next )
+                {
+                    if( done )
+                    {
+                        break;
+                    }
+                    continue;
+                }
+                ticket = tickets[next];
+                next += 2;
+            }
+            cancelled += update.Cancel( ticket ) ? 1 : 0;
+        }
+    } ) );
+
+    while( producing.load() != 0 )
+    {
+        update.Update( budget );
+    }
+    for( std::thread& thread : threads )
+    {
+        thread.join();
+    }
+    while( 0 < update.GetPendingCount() || executed.load() + cancelled.load() < PRODUCERS * COUNT )
+    {
+        const int before = executed.load();
+        update.Update();
+        if( before == executed.load() && update.GetPendingCount() == 0 )
+        {
+            break;
+        }
+    }
+
+    TEST_CHECK( executed.load() + cancelled.load() == PRODUCERS * COUNT );
+    TEST_CHECK( 0 < cancelled.load() || 0 < executed.load() );
+    TEST_CHECK( update.GetStats().cancelledCount <= static_cast<uint64_t>( cancelled.load() ) );
+}
+
+void TestCancelDuringUpdate()
+{
+    // 並べ替えないときは処理する直前に使い切る
+    RunCancelDuringUpdate( []( RequestUpdate<int>& ){}, RequestUpdateBudget() );
+    // 件数を絞って持ち越しからも取り消す
+    RunCancelDuringUpdate( []( RequestUpdate<int>& ){}, RequestUpdateBudget( 64 ) );
+    // 並べ替えるときは取り出すときに使い切る
+    RunCancelDuringUpdate( []( RequestUpdate<int>& update ){
+        update.SetRequestSortKey( []( const std::tuple<int>& param ){ return std::get<0>( param ); } );
+    }, RequestUpdateBudget( 64 ) );
+}
+
+}
+
+int main()
+{
+    TestCancelClaimRace();
+    TestInvalidTicket();
+    TestMixedOrder();
+    TestTrimKeepsTickets();
+    TestCancelDuringUpdate();
+    return TestResult();
+}
@@ -0,0 +1,232 @@
+/*
+ * Copyright (c) 2013, nilfs
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * * Neither the name of the <ORGANIZATION> nor the names of its contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <vector>
+#include <chrono>
+#include <algorithm>
+
+#include "RequestTimerWheel.h"
+#include "RequestUpdate.h"
+#include "Test.h"
+
+namespace
+{
+
+struct Collect
+{
+    std::vector<uint32_t> fired;
+
+    bool operator()( uint32_t payload, bool )
+    {
+        fired.push_back( payload );
+        return true;
+    }
+};
+
+// 決まった時刻に取り出す
+void TestWheelOneShot()
+{
+    RequestTimerWheel wheel;
+    Collect collect;
+    const uint64_t expires[] = { 1, 255, 256, 257, 65535, 65536, 70000, 16777216, 5000000000ull };
+    for( uint32_t i=0; i<sizeof(expires)/sizeof(expires[0]); ++i )
+    {
+        wheel.Schedule( expires[i], 0, i );
+    }
+
+    for( uint32_t i=0; i<sizeof(expires)/sizeof(expires[0]); ++i )
+    {
+        wheel.Advance( expires[i] - 1, collect );
+        TEST_CHECK( collect.fired.size() == i );
+        wheel.Advance( expires[i], collect );
+        TEST_CHECK( collect.fired.size() == i + 1 && collect.fired.back() == i );
+    }
+    TEST_CHECK( wheel.empty() );
+}
+
+// 何周期分も飛ばしても繰り返しのタイマーは1回だけ取り出す
+void TestWheelPeriodicCatchUp()
+{
+    RequestTimerWheel wheel;
+    Collect collect;
+    wheel.Schedule( 3, 3, 7 );
+
+    wheel.Advance( 100000, collect );
+    TEST_CHECK( collect.fired.size() == 1 );
+    TEST_CHECK( wheel.GetCurrent() == 100000 );
+
+    // 次は100000より後の最初の周期(3の倍数)
+    wheel.Advance( 100001, collect );
+    TEST_CHECK( collect.fired.size() == 1 );
+    wheel.Advance( 100002, collect );
+    TEST_CHECK( collect.fired.size() == 2 );
+    wheel.Advance( 100004, collect );
+    TEST_CHECK( collect.fired.size() == 2 );
+    wheel.Advance( 100005, collect );
+    TEST_CHECK( collect.fired.size() == 3 );
+
+    // 30時間分(1tick=1ms)飛ばしても1回
+    wheel.Advance( 100005 + 30ull * 60 * 60 * 1000, collect );
+    TEST_CHECK( collect.fired.size() == 4 );
+    TEST_CHECK( wheel.size() == 1 );
+}
+
+// 遠いタイマーまで飛ばしても、途中のタイマーを順に取り出す
+void TestWheelLongJump()
+{
+    RequestTimerWheel wheel;
+    Collect collect;
+    wheel.Schedule( 1000000, 0, 1 );
+    wheel.Schedule( 3000000000ull, 0, 3 );
+    wheel.Schedule( 2000000, 0, 2 );
+
+    wheel.Advance( 10000000000ull, collect );
+    TEST_CHECK( collect.fired.size() == 3 );
+    TEST_CHECK( collect.fired == std::vector<uint32_t>({ 1, 2, 3 }) );
+    TEST_CHECK( wheel.empty() );
+}
+
+// 時計を大きく進めても、繰り返しのリクエストはUpdate1回につき1回だけ処理する
+void TestUpdateEveryAfterClockJump()
+{
+    typedef std::chrono::steady_clock::time_point TimePoint;
+    TimePoint now = std::chrono::steady_clock::now();
+    int executed = 0;
+
+    RequestUpdate<int> update;
+    update.SetRequestTimerClock( [&now]{ return now; } );
+    update.SetRequestExecuter( [&executed]( int ){ ++executed; } );
+    update.AddRequestEvery( std::chrono::milliseconds(3), 0 );
+    update.Update();
+    TEST_CHECK( executed == 0 );
+
+    now += std::chrono::seconds(100);
+    update.Update();
+    TEST_CHECK( executed == 1 );
+
+    now += std::chrono::hours(30);
+    update.Update();
+    TEST_CHECK( executed == 2 );
+
+    update.Update();
+    TEST_CHECK( executed == 2 );
+
+    now += std::chrono::milliseconds(3);
+    update.Update();
+    TEST_CHECK( executed == 3 );
+}
+
+// 繰り返しのタイマーでfalseを返すと止まる
+void TestWheelStopPeriodic()
+{
+    struct StopAfter
+    {
+        int fired;
+
+        bool operator()( uint32_t, bool periodic )
+        {
+            ++fired;
+            return periodic && fired < 3;
+        }
+    };
+
+    RequestTimerWheel wheel;
+    StopAfter stop = { 0 };
+    wheel.Schedule( 2, 2, 1 );
+    for( uint64_t now=1; now<=20; ++now )
+    {
+        wheel.Advance( now, stop );
+    }
+    TEST_CHECK( stop.fired == 3 );
+    TEST_CHECK( wheel.empty() );
+}
+
+// AddRequestEveryの券で繰り返しを止める。止めた後は処理せず、他の繰り返しは続く
+void TestUpdateEveryCancel()
+{
+    typedef std::chrono::steady_clock::time_point TimePoint;
+    TimePoint now = std::chrono::steady_clock::now();
+    std::vector<int> executed( 3, 0 );
+
+    RequestUpdate<int> update;
+    update.SetRequestTimerClock( [&now]{ return now; } );
+    update.SetRequestExecuter( [&executed]( int i ){ ++executed[i]; } );
+    const RequestTicket first = update.AddRequestEvery( std::chrono::milliseconds(10), 0 );
+    const RequestTicket second = update.AddRequestEvery( std::chrono::milliseconds(10), 1 );
+    TEST_CHECK( first.IsValid() && second.IsValid() );
+    update.Update();
+
+    for( int i=0; i<3; ++i )
+    {
+        now += std::chrono::milliseconds(10);
+        update.Update();
+    }
+    TEST_CHECK( executed[0] == 3 && executed[1] == 3 );
+
+    TEST_CHECK( update.Cancel( first ) );
+    TEST_CHECK( !update.Cancel( first ) );
+    for( int i=0; i<3; ++i )
+    {
+        now += std::chrono::milliseconds(10);
+        update.Update();
+    }
+    TEST_CHECK( executed[0] == 3 );
+    TEST_CHECK( executed[1] == 6 );
+    TEST_CHECK( !update.Cancel( first ) );
+
+    // Updateで登録する前に止めれば1回も処理しない
+    const RequestTicket third = update.AddRequestEvery( std::chrono::milliseconds(10), 2 );
+    TEST_CHECK( update.Cancel( third ) );
+    for( int i=0; i<3; ++i )
+    {
+        now += std::chrono::milliseconds(10);
+        update.Update();
+    }
+    TEST_CHECK( executed[2] == 0 );
+    TEST_CHECK( executed[1] == 9 );
+    TEST_CHECK( update.GetStats().cancelledCount == 2 );
+
+    TEST_CHECK( update.Cancel( second ) );
+    now += std::chrono::milliseconds(10);
+    update.Update();
+    TEST_CHECK( executed[1] == 9 );
+}
+
+}
+
+int main()
+{
+    TestWheelOneShot();
+    TestWheelPeriodicCatchUp();
+    TestWheelLongJump();
+    TestUpdateEveryAfterClockJump();
+    TestWheelStopPeriodic();
+    TestUpdateEveryCancel();
+    return TestResult();
+}
@@ -0,0 +1,67 @@
+/*
+ * Copyright (c) 2013, nilfs
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * * Neither the name of the <ORGANIZATION> nor the names of its contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __test__Test__
+#define __test__Test__
+
+#include <iostream>
+
+/**
+ *  テストの共通処理
+ *  TEST_CHECKが失敗したら場所を出力して数えておき、最後にTestResultの値をmainから返す
+ */
+inline int& TestFailureCount()
+{
+    static int count = 0;
+    return count;
+}
+
+inline bool TestCheck( bool condition, const char* expression, const char* file, int line )
+{
+    if( !condition )
+    {
+        std::cerr << file << ":" << line << ": 失敗 " << expression << std::endl;
+        ++TestFailureCount();
+    }
+    return condition;
+}
+
+#define TEST_CHECK( condition ) TestCheck( (condition), #condition, __FILE__, __LINE__ )
+
+inline int TestResult()
+{
+    if( TestFailureCount() != 0 )
+    {
+        std::cerr << TestFailureCount() << "件失敗" << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
+#endif /* defined(__test__Test__) */